@@ -46,6 +46,124 @@ static int changed;
 static uintptr_t mutex;
 static int disable_saving;
 
+// The items are also indexed by a hash table of key slots, for O(1) lookups.
+// A slot is created for every key which was set or resolved by conf_key_get,
+// and is never freed before conf_free, so it can be used as a key handle.
+//
+// Each slot points to an immutable snapshot of its value, with the numeric
+// forms parsed in advance. Getters read the snapshots without taking the lock:
+// a reader announces itself in conf_readers, before loading the snapshot pointer.
+// Writers replace the pointer under the lock, and move the old snapshot to the retired list,
+// which is only freed when no reader is active.
+#define CONF_HASH_SIZE 4096
+
+typedef struct conf_value_s {
+    struct conf_value_s *next; // in the retired list
+    int64_t ival;
+    double fval;
+    char str[];
+} conf_value_t;
+
+struct ddb_conf_key_s {
+    char *key;
+    uint32_t hash;
+    struct ddb_conf_key_s *hash_next;
+    DB_conf_item_t *item; // NULL if not set, protected by the lock
+    conf_value_t *value; // NULL if not set, swapped atomically
+};
+
+typedef struct ddb_conf_key_s conf_slot_t;
+
+static conf_slot_t *conf_hash[CONF_HASH_SIZE];
+static int conf_readers;
+static conf_value_t *conf_retired;
+
+static uint32_t
+_conf_hash (const char *key) {
+    // case-insensitive FNV-1a, the keys are ASCII
+    uint32_t h = 2166136261u;
+    for (const uint8_t *p = (const uint8_t *)key; *p; p++) {
+        uint8_t c = *p;
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        h = (h ^ c) * 16777619u;
+    }
+    return h;
+}
+
+// lock-free, can be called without conf_lock
+static conf_slot_t *
+_conf_slot_find (const char *key, uint32_t h) {
+    conf_slot_t *slot = __atomic_load_n (&conf_hash[h % CONF_HASH_SIZE], __ATOMIC_ACQUIRE);
+    for (; slot; slot = slot->hash_next) {
+        if (slot->hash == h && !strcasecmp (slot->key, key)) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+// must be called with conf_lock held
+static conf_slot_t *
+_conf_slot_get (const char *key) {
+    uint32_t h = _conf_hash (key);
+    conf_slot_t *slot = _conf_slot_find (key, h);
+    if (slot) {
+        return slot;
+    }
+    slot = calloc (1, sizeof (conf_slot_t));
+    slot->key = strdup (key);
+    slot->hash = h;
+    slot->hash_next = conf_hash[h % CONF_HASH_SIZE];
+    // publish the fully initialized slot
+    __atomic_store_n (&conf_hash[h % CONF_HASH_SIZE], slot, __ATOMIC_RELEASE);
+    return slot;
+}
+
+static void
+_conf_free_retired (void) {
+    while (conf_retired) {
+        conf_value_t *next = conf_retired->next;
+        free (conf_retired);
+        conf_retired = next;
+    }
+}
+
+// must be called with conf_lock held
+static void
+_conf_slot_set_value (conf_slot_t *slot, const char *val) {
+    conf_value_t *v = NULL;
+    if (val) {
+        size_t l = strlen (val);
+        v = malloc (sizeof (conf_value_t) + l + 1);
+        v->next = NULL;
+        v->ival = atoll (val);
+        v->fval = atof (val);
+        memcpy (v->str, val, l + 1);
+    }
+    conf_value_t *old = __atomic_exchange_n (&slot->value, v, __ATOMIC_SEQ_CST);
+    if (old) {
+        old->next = conf_retired;
+        conf_retired = old;
+    }
+    // whoever started reading before the exchange, is done if there are no readers now
+    if (!__atomic_load_n (&conf_readers, __ATOMIC_SEQ_CST)) {
+        _conf_free_retired ();
+    }
+}
+
+static inline conf_value_t *
+_conf_read_begin (conf_slot_t *slot) {
+    __atomic_fetch_add (&conf_readers, 1, __ATOMIC_SEQ_CST);
+    return __atomic_load_n (&slot->value, __ATOMIC_SEQ_CST);
+}
+
+static inline void
+_conf_read_end (void) {
+    __atomic_fetch_sub (&conf_readers, 1, __ATOMIC_RELEASE);
+}
+
 void
 conf_init (void) {
     mutex = mutex_create ();
@@ -70,6 +188,17 @@ conf_free (void) {
         conf_item_free (it);
     }
     conf_items = NULL;
+    for (int i = 0; i < CONF_HASH_SIZE; i++) {
+        conf_slot_t *next = NULL;
+        for (conf_slot_t *slot = conf_hash[i]; slot; slot = next) {
+            next = slot->hash_next;
+            free (slot->value);
+            free (slot->key);
+            free (slot);
+        }
+        conf_hash[i] = NULL;
+    }
+    _conf_free_retired ();
     changed = 0;
     mutex_free (mutex);
     mutex = 0;
@@ -220,18 +349,17 @@ conf_item_free (DB_conf_item_t *it) {
 
 const char *
 conf_get_str_fast (const char *key, const char *def) {
-    for (DB_conf_item_t *it = conf_items; it; it = it->next) {
-        if (!strcasecmp (key, it->key)) {
-            return it->value;
-        }
+    conf_slot_t *slot = _conf_slot_find (key, _conf_hash (key));
+    if (slot && slot->item) {
+        return slot->item->value;
     }
     return def;
 }
 
 void
-conf_get_str (const char *key, const char *def, char *buffer, int buffer_size) {
-    conf_lock ();
-    const char *out = conf_get_str_fast (key, def);
+conf_key_get_str (ddb_conf_key_t *key, const char *def, char *buffer, int buffer_size) {
+    conf_value_t *v = key ? _conf_read_begin (key) : NULL;
+    const char *out = v ? v->str : def;
     if (out) {
         size_t n = strlen (out)+1;
         n = min (n, buffer_size);
@@ -241,34 +369,70 @@ conf_get_str (const char *key, const char *def, char *buffer, int buffer_size) {
     else {
         *buffer = 0;
     }
-    conf_unlock ();
+    if (key) {
+        _conf_read_end ();
+    }
 }
 
 float
-conf_get_float (const char *key, float def) {
-    conf_lock ();
-    const char *v = conf_get_str_fast (key, NULL);
-    float res = v ? atof (v) : def;
-    conf_unlock ();
+conf_key_get_float (ddb_conf_key_t *key, float def) {
+    if (!key) {
+        return def;
+    }
+    conf_value_t *v = _conf_read_begin (key);
+    float res = v ? v->fval : def;
+    _conf_read_end ();
     return res;
 }
 
 int
-conf_get_int (const char *key, int def) {
-    conf_lock ();
-    const char *v = conf_get_str_fast (key, NULL);
-    int res = v ? atoi (v) : def;
-    conf_unlock ();
+conf_key_get_int (ddb_conf_key_t *key, int def) {
+    if (!key) {
+        return def;
+    }
+    conf_value_t *v = _conf_read_begin (key);
+    int res = v ? (int)v->ival : def;
+    _conf_read_end ();
     return res;
 }
 
 int64_t
-conf_get_int64 (const char *key, int64_t def) {
+conf_key_get_int64 (ddb_conf_key_t *key, int64_t def) {
+    if (!key) {
+        return def;
+    }
+    conf_value_t *v = _conf_read_begin (key);
+    int64_t res = v ? v->ival : def;
+    _conf_read_end ();
+    return res;
+}
+
+ddb_conf_key_t *
+conf_key_get (const char *key) {
     conf_lock ();
-    const char *v = conf_get_str_fast (key, NULL);
-    int64_t res = v ? atoll (v) : def;
+    conf_slot_t *slot = _conf_slot_get (key);
     conf_unlock ();
-    return res;
+    return slot;
+}
+
+void
+conf_get_str (const char *key, const char *def, char *buffer, int buffer_size) {
+    conf_key_get_str (_conf_slot_find (key, _conf_hash (key)), def, buffer, buffer_size);
+}
+
+float
+conf_get_float (const char *key, float def) {
+    return conf_key_get_float (_conf_slot_find (key, _conf_hash (key)), def);
+}
+
+int
+conf_get_int (const char *key, int def) {
+    return conf_key_get_int (_conf_slot_find (key, _conf_hash (key)), def);
+}
+
+int64_t
+conf_get_int64 (const char *key, int64_t def) {
+    return conf_key_get_int64 (_conf_slot_find (key, _conf_hash (key)), def);
 }
 
 DB_conf_item_t *
@@ -285,29 +449,31 @@ conf_find (const char *group, DB_conf_item_t *prev) {
 void
 conf_set_str (const char *key, const char *val) {
     conf_lock ();
-    DB_conf_item_t *prev = NULL;
-    for (DB_conf_item_t *it = conf_items; it; it = it->next) {
-        int cmp = strcasecmp (key, it->key);
-        if (!cmp) {
-            if (!strcmp (it->value, val)) {
-                conf_unlock ();
-                return;
-            }
-            free (it->value);
-            it->value = strdup (val);
+    conf_slot_t *slot = _conf_slot_find (key, _conf_hash (key));
+    if (slot && slot->item) {
+        DB_conf_item_t *it = slot->item;
+        if (!strcmp (it->value, val)) {
             conf_unlock ();
-            changed = 1;
             return;
         }
-        else if (cmp < 0) {
-            break;
-        }
-        prev = it;
+        free (it->value);
+        it->value = strdup (val);
+        _conf_slot_set_value (slot, val);
+        conf_unlock ();
+        changed = 1;
+        return;
     }
     if (!val) {
         conf_unlock ();
         return;
     }
+    DB_conf_item_t *prev = NULL;
+    for (DB_conf_item_t *it = conf_items; it; it = it->next) {
+        if (strcasecmp (key, it->key) < 0) {
+            break;
+        }
+        prev = it;
+    }
     DB_conf_item_t *it = malloc (sizeof (DB_conf_item_t));
     memset (it, 0, sizeof (DB_conf_item_t));
     it->key = strdup (key);
@@ -322,6 +488,9 @@ conf_set_str (const char *key, const char *val) {
         it->next = conf_items;
         conf_items = it;
     }
+    slot = _conf_slot_get (key);
+    slot->item = it;
+    _conf_slot_set_value (slot, val);
     conf_unlock ();
 }
 
@@ -370,6 +539,11 @@ conf_remove_items (const char *key) {
     DB_conf_item_t *next = NULL;
     while (it) {
         next = it->next;
+        conf_slot_t *slot = _conf_slot_find (it->key, _conf_hash (it->key));
+        if (slot) {
+            slot->item = NULL;
+            _conf_slot_set_value (slot, NULL);
+        }
         conf_item_free (it);
         it = next;
         if (!it || strncasecmp (key, it->key, l)) {
@@ -93,4 +93,21 @@ conf_item_free (DB_conf_item_t *it);
 void
 conf_enable_saving (int enable);
 
+// Resolve the key to a handle, which stays valid until exit, whether the key is set or not.
+// Reading through the handle skips the key lookup, and never blocks.
+ddb_conf_key_t *
+conf_key_get (const char *key);
+
+void
+conf_key_get_str (ddb_conf_key_t *key, const char *def, char *buffer, int buffer_size);
+
+float
+conf_key_get_float (ddb_conf_key_t *key, float def);
+
+int
+conf_key_get_int (ddb_conf_key_t *key, int def);
+
+int64_t
+conf_key_get_int64 (ddb_conf_key_t *key, int64_t def);
+
 #endif // __CONF_H
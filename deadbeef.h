@@ -71,6 +71,7 @@ extern "C" {
 // that there's a better replacement in the newer deadbeef versions.
 
 // api version history:
+// 1.11 -- deadbeef-1.8.1
 // 1.10 -- deadbeef-1.8.0
 // 1.9 -- deadbeef-0.7.2
 // 1.8 -- deadbeef-0.7.0
@@ -95,7 +96,7 @@ extern "C" {
 // 0.1 -- deadbeef-0.2.0
 
 #define DB_API_VERSION_MAJOR 1
-#define DB_API_VERSION_MINOR 10
+#define DB_API_VERSION_MINOR 11
 
 #if defined(__clang__)
 
@@ -668,6 +669,57 @@ enum {
 
 #endif
 
+// since 1.11
+#if (DDB_API_LEVEL >= 11)
+// playlist lock usage counters, see pl_get_lock_stats
+typedef struct {
+    int _size; // must be set to sizeof(ddb_lock_stats_t)
+    uint64_t exclusive; // number of times pl_lock was acquired (not counting recursion)
+    uint64_t exclusive_contended; // how many of these had to wait for another thread
+    uint64_t exclusive_wait_ns; // total time spent waiting
+    uint64_t shared; // same for pl_lock_shared
+    uint64_t shared_contended;
+    uint64_t shared_wait_ns;
+} ddb_lock_stats_t;
+
+// metadata string cache counters, see metacache_get_stats
+typedef struct {
+    int _size; // must be set to sizeof(ddb_metacache_stats_t)
+    int n_strings; // number of unique strings currently stored
+    int n_inserts; // total number of add/get requests
+    int n_buckets; // number of non-empty hash buckets
+    int hash_size; // total number of hash buckets
+    size_t n_bytes; // memory used by the string storage
+} ddb_metacache_stats_t;
+
+// opaque handle of a configuration key, see conf_key_get
+typedef struct ddb_conf_key_s ddb_conf_key_t;
+
+// streamer buffering counters, see streamer_get_stats
+typedef struct {
+    int _size; // must be set to sizeof(ddb_streamer_stats_t)
+    int blocks_total; // number of decoded data blocks in the pool (streamer.block_count)
+    int block_size; // size of each block in bytes
+    int blocks_in_flight; // blocks holding decoded data, which wasn't handed to the output yet
+    int output_buffered; // bytes of processed audio, waiting to be read by the output plugin
+    uint64_t underruns; // number of times the output plugin had to be fed silence during playback, because no data was ready
+    uint64_t direct_blocks; // number of blocks processed directly into the output buffer
+    uint64_t staged_blocks; // number of blocks which had to be staged in an intermediate buffer
+} ddb_streamer_stats_t;
+
+// main message queue counters, see messagepump_get_stats
+typedef struct {
+    int _size; // must be set to sizeof(ddb_messagepump_stats_t)
+    int depth; // number of messages waiting to be delivered
+    int max_depth; // the highest depth seen so far
+    int capacity; // number of allocated messages, the pool grows when all of them are in use
+    uint64_t pushed; // total number of messages sent
+    uint64_t delivered; // total number of messages delivered to the plugins
+    uint64_t merged; // number of messages dropped, because an identical one was already waiting to be delivered
+    uint64_t dropped; // number of messages lost, because the pool couldn't grow
+} ddb_messagepump_stats_t;
+#endif
+
 // forward decl for plugin struct
 struct DB_plugin_s;
 
@@ -1450,6 +1502,61 @@ typedef struct {
     // this should be called by plugins to prevent running cuesheet code at a wrong time.
     int (*plt_is_loading_cue) (ddb_playlist_t *plt);
 #endif
+
+    // since 1.11
+#if (DDB_API_LEVEL >= 11)
+    ////// Shared playlist locking //////
+
+    // Same as pl_lock/pl_unlock, but allows multiple readers at the same time.
+    // Use it for read-only access, e.g. around pl_find_meta calls.
+    // Nothing must be modified while holding the shared lock.
+    // Can be nested inside of pl_lock, but must be released before it.
+    // pl_lock can't be taken while holding the shared lock, directly or via functions
+    // which modify anything (e.g. plt_unref), take pl_lock from the start in such cases.
+    void (*pl_lock_shared) (void);
+
+    void (*pl_unlock_shared) (void);
+
+    // Get the playlist lock usage counters.
+    // stats->_size must be set to sizeof(ddb_lock_stats_t)
+    void (*pl_get_lock_stats) (ddb_lock_stats_t *stats);
+
+    // Get the metadata string cache counters.
+    // stats->_size must be set to sizeof(ddb_metacache_stats_t)
+    void (*metacache_get_stats) (ddb_metacache_stats_t *stats);
+
+    // Evaluate a compiled title formatting script for many tracks at once,
+    // taking the playlist lock only once.
+    // The output strings are stored one after another in the arena buffer,
+    // each at most outlen bytes long, including the terminating zero,
+    // and results[i] is set to point to the output of tracks[i].
+    // ctx->it is ignored. If DDB_TF_CONTEXT_HAS_INDEX is set, ctx->idx is the index of tracks[0],
+    // and is incremented for each following track.
+    // Returns the number of evaluated tracks, which is less than count if the arena got full.
+    // In that case, call it again for the remaining tracks.
+    // Returns -1 on error.
+    int (*tf_eval_batch) (ddb_tf_context_t *ctx, const char *code, ddb_playItem_t **tracks, int count, char *arena, size_t arena_size, int outlen, const char **results);
+
+    // Get the streamer buffering counters.
+    // stats->_size must be set to sizeof(ddb_streamer_stats_t)
+    void (*streamer_get_stats) (ddb_streamer_stats_t *stats);
+
+    // Resolve a configuration key to a handle, which stays valid until exit,
+    // and can be read from any thread without locking, and without looking up the key.
+    // The key doesn't need to exist, the getters return the default value until it's set.
+    // conf_get_str/int/int64/float are lock-free as well, but need to look up the key on every call.
+    ddb_conf_key_t *(*conf_key_get) (const char *key);
+    void (*conf_key_get_str) (ddb_conf_key_t *key, const char *def, char *buffer, int buffer_size);
+    float (*conf_key_get_float) (ddb_conf_key_t *key, float def);
+    int (*conf_key_get_int) (ddb_conf_key_t *key, int def);
+    int64_t (*conf_key_get_int64) (ddb_conf_key_t *key, int64_t def);
+
+    // Get the main message queue counters.
+    // Repeated notifications, such as DB_EV_PLAYLISTCHANGED with the same arguments,
+    // or DB_EV_TRACKINFOCHANGED for the same track, are merged while waiting in the queue.
+    // stats->_size must be set to sizeof(ddb_messagepump_stats_t)
+    void (*messagepump_get_stats) (ddb_messagepump_stats_t *stats);
+#endif
 } DB_functions_t;
 
 // NOTE: an item placement must be selected like this
@@ -1541,6 +1648,13 @@ enum {
 
     // Tells the system that the plugin supports replaygain, and streamer should not do it.
     DDB_PLUGIN_FLAG_REPLAYGAIN = 2,
+
+#if (DDB_API_LEVEL >= 11)
+    // since 1.11
+    // Tells the system that the decoder's insert can be called from several threads at the same time.
+    // Folders are added with worker threads, which call the insert of other decoders one at a time.
+    DDB_PLUGIN_FLAG_INSERT_THREADSAFE = 4,
+#endif
 };
 #endif
 
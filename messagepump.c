@@ -32,39 +32,98 @@
 #include "threading.h"
 #include "playlist.h"
 
+// The queue is a lock-free intrusive MPSC list: any thread can push,
+// while messagepump_pop must only be called from the thread running the main loop.
+// Messages are allocated from a pool, which grows in chunks, each twice the size of the previous one,
+// and the free list is a stack of pool indexes, tagged against ABA.
+// Popped messages are moved to a consumer-side list, where redundant events are merged.
+
+enum {
+    MSG_COALESCE = 1, // the message is in the pending table
+};
+
 typedef struct message_s {
     uint32_t id;
-    uintptr_t ctx;
     uint32_t p1;
     uint32_t p2;
+    uint32_t hash;
+    uint32_t flags;
+    uint32_t idx; // position in the pool
+    uint32_t free_next; // idx+1 of the next free message, or 0
+    uintptr_t ctx;
+    uintptr_t key; // what the message is about, for coalescing
     struct message_s *next;
 } message_t;
 
-enum { MAX_MESSAGES = 100 };
-static message_t pool[MAX_MESSAGES];
-static message_t *mfree;
-static message_t *mqueue;
+enum {
+    CHUNK_MIN_SHIFT = 7, // the first chunk holds 128 messages
+    MAX_CHUNKS = 16, // 8M messages in total
+    MAX_DRAIN = 4096, // max messages moved to the pending list per pop
+};
+
+static message_t *chunks[MAX_CHUNKS];
+static int nchunks;
+static uint64_t mfree; // (tag << 32) | (idx + 1) of the top free message
+
+// producers append at mqhead, the consumer takes from mqtail
+static message_t stub;
+static message_t *mqhead;
 static message_t *mqtail;
+
+// consumer-only: messages taken from the queue, in order, and a hash of coalescable ones among them
+static message_t *pending_head;
+static message_t *pending_tail;
+static message_t **pending_table;
+static uint32_t pending_table_size;
+static uint32_t pending_table_count;
+
 static uintptr_t mutex;
 static uintptr_t cond;
 
+// counters
+static int capacity;
+static int depth;
+static int max_depth;
+static uint64_t stats_pushed;
+static uint64_t stats_delivered;
+static uint64_t stats_merged;
+static uint64_t stats_dropped;
+
 static void
 messagepump_reset (void);
 
+static int
+_pool_grow (void);
+
 int
 messagepump_init (void) {
     messagepump_reset ();
     mutex = mutex_create ();
     cond = cond_create ();
+    _pool_grow ();
     return 0;
 }
 
+static message_t *
+_queue_pop (void);
+
 void
 messagepump_free () {
     mutex_lock (mutex);
 
     // this helps catching any ref leaks caused by messages sent at exit
-    for (message_t *m = mqueue; m; m = m->next) {
+    message_t *m;
+    while ((m = _queue_pop ())) {
+        m->next = NULL;
+        if (pending_tail) {
+            pending_tail->next = m;
+        }
+        else {
+            pending_head = m;
+        }
+        pending_tail = m;
+    }
+    for (m = pending_head; m; m = m->next) {
         switch (m->id) {
         case DB_EV_SONGCHANGED:
         case DB_EV_SONGSTARTED:
@@ -76,6 +135,10 @@ messagepump_free () {
         }
     }
 
+    for (int i = 0; i < nchunks; i++) {
+        free (chunks[i]);
+    }
+    free (pending_table);
     messagepump_reset ();
     mutex_unlock (mutex);
     mutex_free (mutex);
@@ -84,42 +147,281 @@ messagepump_free () {
 
 static void
 messagepump_reset (void) {
-    mqueue = NULL;
-    mfree = NULL;
-    mqtail = NULL;
-    memset (pool, 0, sizeof (pool));
-    for (int i = 0; i < MAX_MESSAGES; i++) {
-        pool[i].next = mfree;
-        mfree = &pool[i];
+    memset (chunks, 0, sizeof (chunks));
+    nchunks = 0;
+    mfree = 0;
+    memset (&stub, 0, sizeof (stub));
+    mqhead = &stub;
+    mqtail = &stub;
+    pending_head = NULL;
+    pending_tail = NULL;
+    pending_table = NULL;
+    pending_table_size = 0;
+    pending_table_count = 0;
+    capacity = 0;
+    depth = 0;
+    max_depth = 0;
+    stats_pushed = 0;
+    stats_delivered = 0;
+    stats_merged = 0;
+    stats_dropped = 0;
+}
+
+static message_t *
+_pool_get (uint32_t idx) {
+    int c = 31 - __builtin_clz ((idx >> CHUNK_MIN_SHIFT) + 1);
+    return &chunks[c][idx - (((1u << c) - 1) << CHUNK_MIN_SHIFT)];
+}
+
+// push the chain first..last to the free list
+static void
+_pool_release (message_t *first, message_t *last) {
+    uint64_t head = __atomic_load_n (&mfree, __ATOMIC_RELAXED);
+    uint64_t newhead;
+    do {
+        __atomic_store_n (&last->free_next, (uint32_t)head, __ATOMIC_RELAXED);
+        newhead = (((head >> 32) + 1) << 32) | (first->idx + 1);
+    } while (!__atomic_compare_exchange_n (&mfree, &head, newhead, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static int
+_pool_grow (void) {
+    int res = 0;
+    mutex_lock (mutex);
+    // another thread might have grown the pool, or messages got released, while we were waiting
+    if ((uint32_t)__atomic_load_n (&mfree, __ATOMIC_ACQUIRE) == 0) {
+        message_t *chunk = NULL;
+        uint32_t count = 1u << (CHUNK_MIN_SHIFT + nchunks);
+        if (nchunks < MAX_CHUNKS) {
+            chunk = calloc (count, sizeof (message_t));
+        }
+        if (!chunk) {
+            res = -1;
+        }
+        else {
+            uint32_t base = ((1u << nchunks) - 1) << CHUNK_MIN_SHIFT;
+            for (uint32_t i = 0; i < count; i++) {
+                chunk[i].idx = base + i;
+                chunk[i].free_next = base + i + 2;
+            }
+            chunks[nchunks++] = chunk;
+            __atomic_store_n (&capacity, capacity + count, __ATOMIC_RELAXED);
+            _pool_release (&chunk[0], &chunk[count-1]);
+        }
+    }
+    mutex_unlock (mutex);
+    return res;
+}
+
+static message_t *
+_message_alloc (void) {
+    uint64_t head = __atomic_load_n (&mfree, __ATOMIC_ACQUIRE);
+    for (;;) {
+        if ((uint32_t)head == 0) {
+            if (_pool_grow () < 0) {
+                return NULL;
+            }
+            head = __atomic_load_n (&mfree, __ATOMIC_ACQUIRE);
+            continue;
+        }
+        message_t *msg = _pool_get ((uint32_t)head - 1);
+        // may read a stale value, if msg was taken meanwhile, but then the tag won't match
+        uint32_t next = __atomic_load_n (&msg->free_next, __ATOMIC_RELAXED);
+        uint64_t newhead = (((head >> 32) + 1) << 32) | next;
+        if (__atomic_compare_exchange_n (&mfree, &head, newhead, 1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+            return msg;
+        }
+    }
+}
+
+static void
+_queue_push (message_t *msg) {
+    __atomic_store_n (&msg->next, NULL, __ATOMIC_RELAXED);
+    message_t *prev = __atomic_exchange_n (&mqhead, msg, __ATOMIC_ACQ_REL);
+    __atomic_store_n (&prev->next, msg, __ATOMIC_RELEASE);
+}
+
+// returns NULL when the queue is empty, or when a producer is in the middle of pushing
+static message_t *
+_queue_pop (void) {
+    message_t *tail = mqtail;
+    message_t *next = __atomic_load_n (&tail->next, __ATOMIC_ACQUIRE);
+    if (tail == &stub) {
+        if (!next) {
+            return NULL;
+        }
+        mqtail = tail = next;
+        next = __atomic_load_n (&tail->next, __ATOMIC_ACQUIRE);
+    }
+    if (next) {
+        mqtail = next;
+        return tail;
+    }
+    if (tail != __atomic_load_n (&mqhead, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    _queue_push (&stub);
+    next = __atomic_load_n (&tail->next, __ATOMIC_ACQUIRE);
+    if (next) {
+        mqtail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+// Events, which only tell the listeners to re-read some state.
+// A second copy of such event, arriving while the first one is still waiting to be delivered, carries no information.
+static int
+_is_coalescable (uint32_t id) {
+    switch (id) {
+    case DB_EV_CONFIGCHANGED:
+    case DB_EV_PLAYLISTCHANGED:
+    case DB_EV_VOLUMECHANGED:
+    case DB_EV_PLAYLISTSWITCHED:
+    case DB_EV_ACTIONSCHANGED:
+    case DB_EV_DSPCHAINCHANGED:
+    case DB_EV_TRACKINFOCHANGED:
+        return 1;
+    }
+    return 0;
+}
+
+static int
+_pending_equal (message_t *a, message_t *b) {
+    return a->id == b->id && a->key == b->key && a->p1 == b->p1 && a->p2 == b->p2;
+}
+
+static message_t *
+_pending_find (message_t *msg) {
+    if (!pending_table) {
+        return NULL;
+    }
+    uint32_t mask = pending_table_size - 1;
+    for (uint32_t i = msg->hash & mask; pending_table[i]; i = (i + 1) & mask) {
+        if (_pending_equal (pending_table[i], msg)) {
+            return pending_table[i];
+        }
+    }
+    return NULL;
+}
+
+static void
+_pending_table_put (message_t **table, uint32_t size, message_t *msg) {
+    uint32_t i = msg->hash & (size - 1);
+    while (table[i]) {
+        i = (i + 1) & (size - 1);
+    }
+    table[i] = msg;
+}
+
+static int
+_pending_insert (message_t *msg) {
+    if ((pending_table_count + 1) * 2 > pending_table_size) {
+        uint32_t size = pending_table_size ? pending_table_size * 2 : 64;
+        message_t **table = calloc (size, sizeof (message_t *));
+        if (!table) {
+            return -1;
+        }
+        for (uint32_t i = 0; i < pending_table_size; i++) {
+            if (pending_table[i]) {
+                _pending_table_put (table, size, pending_table[i]);
+            }
+        }
+        free (pending_table);
+        pending_table = table;
+        pending_table_size = size;
+    }
+    _pending_table_put (pending_table, pending_table_size, msg);
+    pending_table_count++;
+    msg->flags |= MSG_COALESCE;
+    return 0;
+}
+
+static void
+_pending_remove (message_t *msg) {
+    uint32_t mask = pending_table_size - 1;
+    uint32_t i = msg->hash & mask;
+    while (pending_table[i] != msg) {
+        i = (i + 1) & mask;
+    }
+    // linear probing: shift back the following entries of the cluster, which would become unreachable
+    uint32_t j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (!pending_table[j]) {
+            break;
+        }
+        uint32_t k = pending_table[j]->hash & mask;
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) {
+            continue;
+        }
+        pending_table[i] = pending_table[j];
+        i = j;
+    }
+    pending_table[i] = NULL;
+    pending_table_count--;
+    msg->flags &= ~MSG_COALESCE;
+}
+
+// move the messages from the queue to the pending list, dropping the duplicates
+static void
+_drain (void) {
+    message_t *msg;
+    for (int n = 0; n < MAX_DRAIN && (msg = _queue_pop ()); n++) {
+        if (_is_coalescable (msg->id)) {
+            message_t *dup = _pending_find (msg);
+            if (dup) {
+                if (msg->id >= DB_EV_FIRST && msg->ctx) {
+                    messagepump_event_free ((ddb_event_t *)msg->ctx);
+                }
+                __atomic_fetch_sub (&depth, 1, __ATOMIC_RELAXED);
+                __atomic_store_n (&stats_merged, stats_merged + 1, __ATOMIC_RELAXED);
+                _pool_release (msg, msg);
+                continue;
+            }
+            _pending_insert (msg);
+        }
+        msg->next = NULL;
+        if (pending_tail) {
+            pending_tail->next = msg;
+        }
+        else {
+            pending_head = msg;
+        }
+        pending_tail = msg;
     }
 }
 
 int
 messagepump_push (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
-    if (!mfree) {
+    message_t *msg = _message_alloc ();
+    if (!msg) {
         //fprintf (stderr, "WARNING: message queue is full! message ignored (%d %p %d %d)\n", id, (void*)ctx, p1, p2);
+        __atomic_fetch_add (&stats_dropped, 1, __ATOMIC_RELAXED);
         if (id >= DB_EV_FIRST && ctx) {
             messagepump_event_free ((ddb_event_t *)ctx);
         }
         return -1;
     }
-    mutex_lock (mutex);
-    message_t *msg = mfree;
-    mfree = mfree->next;
-    if (mqtail) {
-        mqtail->next = msg;
-    }
-    mqtail = msg;
-    if (!mqueue) {
-        mqueue = msg;
-    }
 
-    msg->next = NULL;
     msg->id = id;
     msg->ctx = ctx;
     msg->p1 = p1;
     msg->p2 = p2;
-    mutex_unlock (mutex);
+    msg->flags = 0;
+    msg->key = ctx;
+    if (id == DB_EV_TRACKINFOCHANGED && ctx) {
+        msg->key = (uintptr_t)((ddb_event_track_t *)ctx)->track;
+    }
+    uint64_t h = ((uint64_t)msg->key * 0x9e3779b97f4a7c15ull) ^ ((uint64_t)id << 40) ^ ((uint64_t)p1 << 20) ^ p2;
+    msg->hash = (uint32_t)((h * 0xff51afd7ed558ccdull) >> 32);
+
+    int d = __atomic_add_fetch (&depth, 1, __ATOMIC_RELAXED);
+    int m = __atomic_load_n (&max_depth, __ATOMIC_RELAXED);
+    while (d > m && !__atomic_compare_exchange_n (&max_depth, &m, d, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    __atomic_fetch_add (&stats_pushed, 1, __ATOMIC_RELAXED);
+
+    _queue_push (msg);
     cond_signal (cond);
     return 0;
 }
@@ -132,29 +434,50 @@ messagepump_wait (void) {
 
 int
 messagepump_pop (uint32_t *id, uintptr_t *ctx, uint32_t *p1, uint32_t *p2) {
-    mutex_lock (mutex);
-    if (!mqueue) {
-        mutex_unlock (mutex);
+    _drain ();
+    message_t *msg = pending_head;
+    if (!msg) {
         return -1;
     }
-    *id = mqueue->id;
-    *ctx = mqueue->ctx;
-    *p1 = mqueue->p1;
-    *p2 = mqueue->p2;
-    message_t *next = mqueue->next;
-    mqueue->next = mfree;
-    mfree = mqueue;
-    mqueue = next;
-    if (!mqueue) {
-        mqtail = NULL;
+    pending_head = msg->next;
+    if (!pending_head) {
+        pending_tail = NULL;
     }
-    mutex_unlock (mutex);
+    if (msg->flags & MSG_COALESCE) {
+        _pending_remove (msg);
+    }
+    *id = msg->id;
+    *ctx = msg->ctx;
+    *p1 = msg->p1;
+    *p2 = msg->p2;
+    __atomic_fetch_sub (&depth, 1, __ATOMIC_RELAXED);
+    __atomic_store_n (&stats_delivered, stats_delivered + 1, __ATOMIC_RELAXED);
+    _pool_release (msg, msg);
     return 0;
 }
 
 int
 messagepump_hasmessages (void) {
-    return mqueue ? 1 : 0;
+    return __atomic_load_n (&depth, __ATOMIC_RELAXED) > 0 ? 1 : 0;
+}
+
+void
+messagepump_get_stats (ddb_messagepump_stats_t *stats) {
+    int size = stats->_size;
+    if (size > sizeof (ddb_messagepump_stats_t)) {
+        size = sizeof (ddb_messagepump_stats_t);
+    }
+    ddb_messagepump_stats_t s = {
+        ._size = size,
+        .depth = __atomic_load_n (&depth, __ATOMIC_RELAXED),
+        .max_depth = __atomic_load_n (&max_depth, __ATOMIC_RELAXED),
+        .capacity = __atomic_load_n (&capacity, __ATOMIC_RELAXED),
+        .pushed = __atomic_load_n (&stats_pushed, __ATOMIC_RELAXED),
+        .delivered = __atomic_load_n (&stats_delivered, __ATOMIC_RELAXED),
+        .merged = __atomic_load_n (&stats_merged, __ATOMIC_RELAXED),
+        .dropped = __atomic_load_n (&stats_dropped, __ATOMIC_RELAXED),
+    };
+    memcpy (stats, &s, size);
 }
 
 ddb_event_t *
@@ -40,4 +40,6 @@ ddb_event_t *messagepump_event_alloc (uint32_t id);
 void messagepump_event_free (ddb_event_t *ev);
 int messagepump_push_event (ddb_event_t *ev, uint32_t p1, uint32_t p2);
 
+void messagepump_get_stats (ddb_messagepump_stats_t *stats);
+
 #endif // __MESSAGEPUMP_H
@@ -26,48 +26,176 @@
 */
 #include <string.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include "metacache.h"
 
+// NOTE: the refcount and cmpidx fields must immediately precede str,
+// since metacache_ref/unref and playlist search access them via the string pointer
 typedef struct metacache_str_s {
     struct metacache_str_s *next;
-    size_t value_length;
+    uint32_t hash;
+    uint32_t value_length;
     uint32_t refcount;
     char cmpidx; // positive means "equals", negative means "notequals"
     char str[1];
 } metacache_str_t;
 
-typedef struct {
-//    uint32_t hash;
-    metacache_str_t *chain;
-} metacache_hash_t;
+#define INITIAL_HASH_SIZE 4096
+#define MAX_LOAD_FACTOR 2 // average chain length which triggers growing the table
 
-#define HASH_SIZE 4096
+static metacache_str_t **hash;
+static uint32_t hash_size;
 
-static metacache_hash_t hash[HASH_SIZE];
+// string storage:
+// small entries are carved from large arena blocks, and recycled via per-size free lists;
+// large entries are malloc'ed individually
+#define ARENA_BLOCK_SIZE 0x10000
+#define ARENA_ALIGN 8
+#define ARENA_MAX_ENTRY 512
+#define ARENA_NUM_CLASSES (ARENA_MAX_ENTRY/ARENA_ALIGN)
+
+typedef struct arena_block_s {
+    struct arena_block_s *next;
+} arena_block_t;
+
+static arena_block_t *arena_blocks;
+static char *arena_ptr;
+static char *arena_end;
+static metacache_str_t *arena_free[ARENA_NUM_CLASSES];
+
+static int n_strings = 0;
+static int n_inserts = 0;
+static int n_buckets = 0;
+static size_t n_bytes = 0;
+
+static size_t
+metacache_entry_size (size_t len) {
+    return (offsetof (metacache_str_t, str) + len + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN-1);
+}
+
+static metacache_str_t *
+metacache_entry_alloc (size_t len) {
+    size_t size = metacache_entry_size (len);
+    n_bytes += size;
+    if (size > ARENA_MAX_ENTRY) {
+        return malloc (size);
+    }
+
+    int cls = (int)(size / ARENA_ALIGN) - 1;
+    metacache_str_t *data = arena_free[cls];
+    if (data) {
+        arena_free[cls] = data->next;
+        return data;
+    }
+
+    if (arena_ptr + size > arena_end) {
+        arena_block_t *block = malloc (ARENA_BLOCK_SIZE);
+        block->next = arena_blocks;
+        arena_blocks = block;
+        arena_ptr = (char *)block + ((sizeof (arena_block_t) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN-1));
+        arena_end = (char *)block + ARENA_BLOCK_SIZE;
+    }
+    data = (metacache_str_t *)arena_ptr;
+    arena_ptr += size;
+    return data;
+}
+
+static void
+metacache_entry_free (metacache_str_t *data) {
+    size_t size = metacache_entry_size (data->value_length);
+    n_bytes -= size;
+    if (size > ARENA_MAX_ENTRY) {
+        free (data);
+        return;
+    }
+    int cls = (int)(size / ARENA_ALIGN) - 1;
+    data->next = arena_free[cls];
+    arena_free[cls] = data;
+}
+
+// MurmurHash3 x86_32, by Austin Appleby (public domain)
+static inline uint32_t
+rotl32 (uint32_t x, int r) {
+    return (x << r) | (x >> (32 - r));
+}
 
 static uint32_t
-metacache_get_hash_sdbm (const char *str, size_t len) {
-    uint32_t hash = 0;
-    int c;
+metacache_get_hash (const char *str, size_t len) {
+    const uint8_t *data = (const uint8_t *)str;
+    const size_t nblocks = len / 4;
+    const uint32_t c1 = 0xcc9e2d51;
+    const uint32_t c2 = 0x1b873593;
+    uint32_t h = 0x9747b28c;
 
-    const char *end = str+len;
+    for (size_t i = 0; i < nblocks; i++) {
+        uint32_t k;
+        memcpy (&k, data + i*4, 4);
+        k *= c1;
+        k = rotl32 (k, 15);
+        k *= c2;
+        h ^= k;
+        h = rotl32 (h, 13);
+        h = h * 5 + 0xe6546b64;
+    }
 
-    while (str < end) {
-        c = *str++;
-        hash = c + (hash << 6) + (hash << 16) - hash;
+    const uint8_t *tail = data + nblocks*4;
+    uint32_t k = 0;
+    switch (len & 3) {
+    case 3:
+        k ^= tail[2] << 16;
+        // fallthrough
+    case 2:
+        k ^= tail[1] << 8;
+        // fallthrough
+    case 1:
+        k ^= tail[0];
+        k *= c1;
+        k = rotl32 (k, 15);
+        k *= c2;
+        h ^= k;
     }
 
-    return hash;
+    h ^= (uint32_t)len;
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+static void
+metacache_resize (uint32_t new_size) {
+    metacache_str_t **new_hash = calloc (new_size, sizeof (metacache_str_t *));
+    n_buckets = 0;
+    for (uint32_t i = 0; i < hash_size; i++) {
+        metacache_str_t *chain = hash[i];
+        while (chain) {
+            metacache_str_t *next = chain->next;
+            metacache_str_t **bucket = &new_hash[chain->hash & (new_size-1)];
+            if (!*bucket) {
+                n_buckets++;
+            }
+            chain->next = *bucket;
+            *bucket = chain;
+            chain = next;
+        }
+    }
+    free (hash);
+    hash = new_hash;
+    hash_size = new_size;
 }
 
 static metacache_str_t *
 metacache_find_in_bucket (uint32_t h, const char *value, size_t len) {
-    metacache_hash_t *bucket = &hash[h];
-    metacache_str_t *chain = bucket->chain;
+    if (!hash) {
+        return NULL;
+    }
+    metacache_str_t *chain = hash[h & (hash_size-1)];
     while (chain) {
-        if (chain->value_length == len && !memcmp (chain->str, value, len)) {
+        if (chain->hash == h && chain->value_length == len && !memcmp (chain->str, value, len)) {
             return chain;
         }
         chain = chain->next;
@@ -75,31 +203,35 @@ metacache_find_in_bucket (uint32_t h, const char *value, size_t len) {
     return NULL;
 }
 
-static int n_strings = 0;
-static int n_inserts = 0;
-static int n_buckets = 0;
-
 const char *
 metacache_add_value (const char *value, size_t len) {
     //    printf ("n_strings=%d, n_inserts=%d, n_buckets=%d\n", n_strings, n_inserts, n_buckets);
-    uint32_t h = metacache_get_hash_sdbm (value, len);
-    metacache_str_t *data = metacache_find_in_bucket (h & (HASH_SIZE-1), value, len);
+    uint32_t h = metacache_get_hash (value, len);
+    metacache_str_t *data = metacache_find_in_bucket (h, value, len);
     n_inserts++;
     if (data) {
         data->refcount++;
         return data->str;
     }
-    metacache_hash_t *bucket = &hash[h & (HASH_SIZE-1)];
-    if (!bucket->chain) {
+    if (!hash) {
+        hash_size = INITIAL_HASH_SIZE;
+        hash = calloc (hash_size, sizeof (metacache_str_t *));
+    }
+    else if (n_strings >= hash_size * MAX_LOAD_FACTOR) {
+        metacache_resize (hash_size * 2);
+    }
+    metacache_str_t **bucket = &hash[h & (hash_size-1)];
+    if (!*bucket) {
         n_buckets++;
     }
-    data = malloc (sizeof (metacache_str_t) + len);
-    memset (data, 0, sizeof (metacache_str_t) + len);
+    data = metacache_entry_alloc (len);
+    data->hash = h;
+    data->value_length = (uint32_t)len;
     data->refcount = 1;
+    data->cmpidx = 0;
     memcpy (data->str, value, len);
-    data->value_length = len;
-    data->next = bucket->chain;
-    bucket->chain = data;
+    data->next = *bucket;
+    *bucket = data;
     n_strings++;
     return data->str;
 }
@@ -111,21 +243,28 @@ metacache_add_string (const char *str) {
 
 void
 metacache_remove_value (const char *value, size_t valuesize) {
-    uint32_t h = metacache_get_hash_sdbm (value, valuesize);
-    metacache_hash_t *bucket = &hash[h & (HASH_SIZE-1)];
-    metacache_str_t *chain = bucket->chain;
+    if (!hash) {
+        return;
+    }
+    uint32_t h = metacache_get_hash (value, valuesize);
+    metacache_str_t **bucket = &hash[h & (hash_size-1)];
+    metacache_str_t *chain = *bucket;
     metacache_str_t *prev = NULL;
     while (chain) {
-        if (chain->value_length == valuesize && !memcmp (chain->str, value, valuesize)) {
+        if (chain->hash == h && chain->value_length == valuesize && !memcmp (chain->str, value, valuesize)) {
             chain->refcount--;
             if (chain->refcount == 0) {
                 if (prev) {
                     prev->next = chain->next;
                 }
                 else {
-                    bucket->chain = chain->next;
+                    *bucket = chain->next;
+                    if (!*bucket) {
+                        n_buckets--;
+                    }
                 }
-                free (chain);
+                n_strings--;
+                metacache_entry_free (chain);
             }
             break;
         }
@@ -158,8 +297,8 @@ metacache_get_string (const char *str) {
 
 const char *
 metacache_get_value (const char *value, size_t len) {
-    uint32_t h = metacache_get_hash_sdbm (value, len);
-    metacache_str_t *data = metacache_find_in_bucket (h & (HASH_SIZE-1), value, len);
+    uint32_t h = metacache_get_hash (value, len);
+    metacache_str_t *data = metacache_find_in_bucket (h, value, len);
     n_inserts++;
     if (data) {
         data->refcount++;
@@ -168,3 +307,20 @@ metacache_get_value (const char *value, size_t len) {
 
     return NULL;
 }
+
+void
+metacache_get_stats (ddb_metacache_stats_t *stats) {
+    int size = stats->_size;
+    if (size > sizeof (ddb_metacache_stats_t)) {
+        size = sizeof (ddb_metacache_stats_t);
+    }
+    ddb_metacache_stats_t s = {
+        ._size = size,
+        .n_strings = n_strings,
+        .n_inserts = n_inserts,
+        .n_buckets = n_buckets,
+        .hash_size = hash_size,
+        .n_bytes = n_bytes,
+    };
+    memcpy (stats, &s, size);
+}
@@ -27,6 +27,8 @@
 #ifndef __METACACHE_H
 #define __METACACHE_H
 
+#include "deadbeef.h"
+
 // Adds a new NULL-terminated string, or finds an existing one
 const char *
 metacache_add_string (const char *str);
@@ -59,4 +61,8 @@ metacache_ref (const char *str);
 void
 metacache_unref (const char *str);
 
+// Fills the stats structure, stats->_size must be set
+void
+metacache_get_stats (ddb_metacache_stats_t *stats);
+
 #endif
@@ -25,6 +25,51 @@
 #include "deadbeef.h"
 #include "premix.h"
 
+#define NUM_FRAMES 1003
+
+// converts the same input with the scalar kernels and with the given kernel set,
+// returns the index of the first differing byte, or -1 if the outputs are the same
+static int
+convert_scalar_and_simd (const ddb_waveformat_t *inputfmt, const ddb_waveformat_t *outputfmt, int simd) {
+    static char input[NUM_FRAMES * 2 * 4];
+    static char scalar_output[NUM_FRAMES * 2 * 4];
+    static char simd_output[NUM_FRAMES * 2 * 4];
+
+    int inputsize = NUM_FRAMES * inputfmt->channels * inputfmt->bps / 8;
+    srand (inputfmt->bps + inputfmt->is_float * 100 + inputfmt->channels * 1000);
+    if (inputfmt->is_float) {
+        // include some out of range samples
+        float *samples = (float *)input;
+        for (int i = 0; i < inputsize / 4; i++) {
+            samples[i] = rand () / (float)RAND_MAX * 2.4f - 1.2f;
+        }
+    }
+    else {
+        for (int i = 0; i < inputsize; i++) {
+            input[i] = rand ();
+        }
+    }
+
+    memset (scalar_output, 0, sizeof (scalar_output));
+    memset (simd_output, 0, sizeof (simd_output));
+
+    pcm_simd_set (PCM_SIMD_NONE);
+    int scalar_size = pcm_convert (inputfmt, input, outputfmt, scalar_output, inputsize);
+    pcm_simd_set (simd);
+    int simd_size = pcm_convert (inputfmt, input, outputfmt, simd_output, inputsize);
+    pcm_simd_set (pcm_simd_detect ());
+
+    if (scalar_size != simd_size || simd_size != NUM_FRAMES * outputfmt->channels * outputfmt->bps / 8) {
+        return 0;
+    }
+    for (int i = 0; i < simd_size; i++) {
+        if (scalar_output[i] != simd_output[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
 @interface FormatConversion : XCTestCase
 
 @end
@@ -93,4 +138,52 @@
     XCTAssert(outsamples[3] == 0x4000, @"sample3 is %d", outsamples[3]);
 }
 
+// NUM_FRAMES is odd, so that the tails which don't fill a whole vector are checked too
+- (void)compareScalarAndSimdWithInputBps:(int)bps isFloat:(int)isFloat {
+    static const int outputformats[][2] = { {8, 0}, {16, 0}, {24, 0}, {32, 0}, {32, 1} };
+    for (int simd = PCM_SIMD_SSE2; simd <= PCM_SIMD_NEON; simd++) {
+        if (pcm_simd_set (simd)) {
+            continue;
+        }
+        for (int channels = 1; channels <= 2; channels++) {
+            for (int i = 0; i < (int)(sizeof (outputformats) / sizeof (outputformats[0])); i++) {
+                ddb_waveformat_t inputfmt = {
+                    .bps = bps,
+                    .is_float = isFloat,
+                    .channels = channels,
+                    .samplerate = 44100,
+                    .channelmask = channels == 1 ? DDB_SPEAKER_FRONT_LEFT : DDB_SPEAKER_FRONT_LEFT|DDB_SPEAKER_FRONT_RIGHT
+                };
+                ddb_waveformat_t outputfmt = inputfmt;
+                outputfmt.bps = outputformats[i][0];
+                outputfmt.is_float = outputformats[i][1];
+
+                int res = convert_scalar_and_simd (&inputfmt, &outputfmt, simd);
+                XCTAssert(res == -1, @"%s: %d%s -> %d%s with %d channels differs at byte %d", pcm_simd_name (simd), bps, isFloat ? " float" : "", outputfmt.bps, outputfmt.is_float ? " float" : "", channels, res);
+            }
+        }
+    }
+    pcm_simd_set (pcm_simd_detect ());
+}
+
+- (void)testConvertFrom8Bit_SimdSameAsScalar {
+    [self compareScalarAndSimdWithInputBps:8 isFloat:0];
+}
+
+- (void)testConvertFrom16Bit_SimdSameAsScalar {
+    [self compareScalarAndSimdWithInputBps:16 isFloat:0];
+}
+
+- (void)testConvertFrom24Bit_SimdSameAsScalar {
+    [self compareScalarAndSimdWithInputBps:24 isFloat:0];
+}
+
+- (void)testConvertFrom32Bit_SimdSameAsScalar {
+    [self compareScalarAndSimdWithInputBps:32 isFloat:0];
+}
+
+- (void)testConvertFromFloat_SimdSameAsScalar {
+    [self compareScalarAndSimdWithInputBps:32 isFloat:1];
+}
+
 @end
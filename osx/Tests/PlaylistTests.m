@@ -7,9 +7,57 @@
 //
 
 #import <XCTest/XCTest.h>
+#include <unistd.h>
 #include "deadbeef.h"
 #include "../../common.h"
 #include "playlist.h"
+#include "pltmeta.h"
+#include "sort.h"
+
+// checks plt_get_item_for_idx and plt_get_item_idx against a walk over the list
+static int
+check_index (playlist_t *plt) {
+    int idx = 0;
+    for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN], idx++) {
+        playItem_t *found = plt_get_item_for_idx (plt, idx, PL_MAIN);
+        if (found) {
+            pl_item_unref (found);
+        }
+        if (found != it || plt_get_item_idx (plt, it, PL_MAIN) != idx) {
+            return 0;
+        }
+    }
+    if (idx != plt->count[PL_MAIN]) {
+        return 0;
+    }
+    playItem_t *past_end = plt_get_item_for_idx (plt, idx, PL_MAIN);
+    if (past_end) {
+        pl_item_unref (past_end);
+        return 0;
+    }
+    return 1;
+}
+
+static playlist_t *
+create_playlist (int count) {
+    playlist_t *plt = plt_alloc ("test");
+    for (int i = 0; i < count; i++) {
+        playItem_t *it = pl_item_alloc ();
+        char title[20];
+        // titles don't go in the insertion order, to make the sort move the items
+        snprintf (title, sizeof (title), "%03d", (i * 37) % count);
+        pl_add_meta (it, "title", title);
+        plt_insert_item (plt, plt->tail[PL_MAIN], it);
+        pl_item_unref (it);
+    }
+    return plt;
+}
+
+static int
+write_string (FILE *fp, const char *s) {
+    uint16_t l = (uint16_t)strlen (s);
+    return fwrite (&l, 2, 1, fp) == 1 && fwrite (s, 1, l, fp) == l;
+}
 
 @interface PlaylistTest : XCTestCase
 
@@ -59,4 +107,206 @@
     plt_unref (plt);
 }
 
+- (void)test_SaveAndLoadPlaylist_MetadataAndFlagsAreTheSame {
+    const char *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"roundtrip.dbpl"].UTF8String;
+    playlist_t *plt = plt_alloc ("test");
+    for (int i = 0; i < 3; i++) {
+        playItem_t *it = pl_item_alloc_init ("/music/file.flac", "stdflac");
+        char title[20];
+        snprintf (title, sizeof (title), "Title %d", i);
+        pl_add_meta (it, "title", title);
+        const char genre[] = "Rock\0Pop";
+        pl_add_meta_full (it, "genre", genre, sizeof (genre));
+        pl_add_meta (it, ":FILETYPE", "FLAC");
+        if (i == 1) {
+            pl_item_set_startsample (it, 44100);
+            pl_item_set_endsample (it, 5000000000LL);
+            pl_set_item_flags (it, pl_get_item_flags (it) | DDB_IS_SUBTRACK);
+        }
+        plt_insert_item (plt, plt->tail[PL_MAIN], it);
+        plt_set_item_duration (plt, it, 100.5f + i);
+        pl_item_unref (it);
+    }
+    plt_add_meta (plt, "name", "value");
+
+    XCTAssertTrue(plt_save (plt, NULL, NULL, path, NULL, NULL, NULL) == 0);
+
+    FILE *fp = fopen (path, "rb");
+    char magic[5] = { 0 };
+    fread (magic, 1, 5, fp);
+    fclose (fp);
+    XCTAssertTrue(!memcmp (magic, "DBPL", 4) && magic[4] == 2);
+
+    playlist_t *loaded = plt_alloc ("loaded");
+    plt_load (loaded, NULL, path, NULL, NULL, NULL);
+    unlink (path);
+
+    XCTAssertTrue(loaded->count[PL_MAIN] == plt->count[PL_MAIN]);
+    playItem_t *b = loaded->head[PL_MAIN];
+    for (playItem_t *a = plt->head[PL_MAIN]; a && b; a = a->next[PL_MAIN], b = b->next[PL_MAIN]) {
+        XCTAssertTrue(pl_get_item_flags (a) == pl_get_item_flags (b));
+        XCTAssertTrue(pl_item_get_startsample (a) == pl_item_get_startsample (b));
+        XCTAssertTrue(pl_item_get_endsample (a) == pl_item_get_endsample (b));
+        XCTAssertTrue(pl_get_item_duration (a) == pl_get_item_duration (b));
+        DB_metaInfo_t *mb = pl_get_metadata_head (b);
+        for (DB_metaInfo_t *ma = pl_get_metadata_head (a); ma; ma = ma->next, mb = mb->next) {
+            XCTAssertTrue(mb != NULL);
+            if (!mb) {
+                break;
+            }
+            XCTAssertTrue(!strcmp (ma->key, mb->key), @"Expected key %s, got %s", ma->key, mb->key);
+            XCTAssertTrue(ma->valuesize == mb->valuesize && !memcmp (ma->value, mb->value, ma->valuesize), @"Key %s has a different value", ma->key);
+        }
+        XCTAssertTrue(mb == NULL);
+    }
+    const char *name = plt_find_meta (loaded, "name");
+    XCTAssertTrue(name && !strcmp (name, "value"));
+
+    plt_unref (loaded);
+    plt_unref (plt);
+}
+
+- (void)test_LoadPlaylistInFormat1_3_LoadsTracksAndMetadata {
+    const char *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"format_1_3.dbpl"].UTF8String;
+    FILE *fp = fopen (path, "wb");
+    uint8_t ver[2] = { 1, 3 };
+    uint32_t count = 2;
+    fwrite ("DBPL", 1, 4, fp);
+    fwrite (ver, 1, 2, fp);
+    fwrite (&count, 4, 1, fp);
+    for (int i = 0; i < 2; i++) {
+        int32_t startsample = i ? 44100 : 0;
+        int32_t endsample = i ? 88200 : 0;
+        float duration = 1.5f + i;
+        uint32_t flags = i ? DDB_IS_SUBTRACK : 0;
+        int16_t nm = 3;
+        fwrite (&startsample, 4, 1, fp);
+        fwrite (&endsample, 4, 1, fp);
+        fwrite (&duration, 4, 1, fp);
+        fwrite (&flags, 4, 1, fp);
+        fwrite (&nm, 2, 1, fp);
+        write_string (fp, "title");
+        write_string (fp, i ? "Second" : "First");
+        write_string (fp, ":URI");
+        write_string (fp, "/music/file.flac");
+        write_string (fp, ":DECODER");
+        write_string (fp, "stdflac");
+    }
+    int16_t nm = 1;
+    fwrite (&nm, 2, 1, fp);
+    write_string (fp, "name");
+    write_string (fp, "value");
+    fclose (fp);
+
+    playlist_t *plt = plt_alloc ("test");
+    plt_load (plt, NULL, path, NULL, NULL, NULL);
+    unlink (path);
+
+    XCTAssertTrue(plt->count[PL_MAIN] == 2);
+    playItem_t *first = plt->head[PL_MAIN];
+    playItem_t *second = plt->tail[PL_MAIN];
+    XCTAssertTrue(!strcmp (pl_find_meta_raw (first, "title"), "First"));
+    XCTAssertTrue(!strcmp (pl_find_meta_raw (second, "title"), "Second"));
+    XCTAssertTrue(!strcmp (pl_find_meta_raw (second, ":URI"), "/music/file.flac"));
+    XCTAssertTrue(!strcmp (pl_find_meta_raw (second, ":DECODER"), "stdflac"));
+    XCTAssertTrue(!(pl_get_item_flags (first) & DDB_IS_SUBTRACK));
+    XCTAssertTrue(pl_get_item_flags (second) & DDB_IS_SUBTRACK);
+    XCTAssertTrue(pl_item_get_startsample (second) == 44100);
+    XCTAssertTrue(pl_item_get_endsample (second) == 88200);
+    XCTAssertTrue(pl_get_item_duration (second) == 2.5f);
+    const char *name = plt_find_meta (plt, "name");
+    XCTAssertTrue(name && !strcmp (name, "value"));
+
+    plt_unref (plt);
+}
+
+- (void)test_InsertItems_IndexMatchesList {
+    playlist_t *plt = create_playlist (100);
+    XCTAssertTrue(check_index (plt));
+
+    playItem_t *head = pl_item_alloc ();
+    plt_insert_item (plt, NULL, head);
+    pl_item_unref (head);
+    XCTAssertTrue(check_index (plt));
+
+    playItem_t *after = plt_get_item_for_idx (plt, 50, PL_MAIN);
+    playItem_t *middle = pl_item_alloc ();
+    plt_insert_item (plt, after, middle);
+    pl_item_unref (middle);
+    pl_item_unref (after);
+    XCTAssertTrue(check_index (plt));
+    XCTAssertTrue(plt_get_item_idx (plt, middle, PL_MAIN) == 51);
+
+    playItem_t *tail = pl_item_alloc ();
+    plt_insert_item (plt, plt->tail[PL_MAIN], tail);
+    pl_item_unref (tail);
+    XCTAssertTrue(check_index (plt));
+    XCTAssertTrue(plt_get_item_idx (plt, tail, PL_MAIN) == 102);
+
+    plt_unref (plt);
+}
+
+- (void)test_RemoveItems_IndexMatchesList {
+    playlist_t *plt = create_playlist (100);
+
+    plt_remove_item (plt, plt->head[PL_MAIN]);
+    XCTAssertTrue(check_index (plt));
+
+    playItem_t *middle = plt_get_item_for_idx (plt, 40, PL_MAIN);
+    plt_remove_item (plt, middle);
+    pl_item_unref (middle);
+    XCTAssertTrue(check_index (plt));
+
+    plt_remove_item (plt, plt->tail[PL_MAIN]);
+    XCTAssertTrue(check_index (plt));
+    XCTAssertTrue(plt->count[PL_MAIN] == 97);
+
+    while (plt->head[PL_MAIN]) {
+        plt_remove_item (plt, plt->head[PL_MAIN]);
+    }
+    XCTAssertTrue(check_index (plt));
+
+    plt_unref (plt);
+}
+
+- (void)test_MoveItems_IndexMatchesList {
+    playlist_t *plt = create_playlist (100);
+
+    // move every third item before the item at index 10
+    uint32_t indexes[34];
+    int count = 0;
+    for (int i = 0; i < 100; i += 3) {
+        indexes[count++] = i;
+    }
+    playItem_t *drop_before = plt_get_item_for_idx (plt, 10, PL_MAIN);
+    plt_move_items (plt, PL_MAIN, plt, drop_before, indexes, count);
+    pl_item_unref (drop_before);
+    XCTAssertTrue(check_index (plt));
+    XCTAssertTrue(plt->count[PL_MAIN] == 100);
+
+    // and to the end
+    plt_move_items (plt, PL_MAIN, plt, NULL, indexes, count);
+    XCTAssertTrue(check_index (plt));
+
+    plt_unref (plt);
+}
+
+- (void)test_SortItems_IndexMatchesList {
+    playlist_t *plt = create_playlist (100);
+
+    plt_sort_v2 (plt, PL_MAIN, -1, "%title%", DDB_SORT_ASCENDING);
+    XCTAssertTrue(check_index (plt));
+    playItem_t *first = plt_get_item_for_idx (plt, 0, PL_MAIN);
+    XCTAssertTrue(!strcmp (pl_find_meta_raw (first, "title"), "000"));
+    pl_item_unref (first);
+
+    plt_sort_v2 (plt, PL_MAIN, -1, "%title%", DDB_SORT_DESCENDING);
+    XCTAssertTrue(check_index (plt));
+
+    plt_sort_random (plt, PL_MAIN);
+    XCTAssertTrue(check_index (plt));
+
+    plt_unref (plt);
+}
+
 @end
@@ -1721,4 +1721,131 @@ static DB_output_t fake_out = {
     XCTAssert(!strcmp (buffer, "ЁЁЁЁЁАБВГД"), @"The actual output is: %s", buffer);
 }
 
+- (void)test_ConstantAdd_IsFoldedAndSameAsUnfolded {
+    pl_add_meta (it, "one", "1");
+    pl_add_meta (it, "two", "2");
+    char *folded = tf_compile("$add(1,2)");
+    char *unfolded = tf_compile("$add(%one%,%two%)");
+    XCTAssert(folded[4] == 0 && folded[5] == 7, @"The constant call was not folded");
+    char unfolded_buffer[1000];
+    tf_eval (&ctx, folded, buffer, sizeof (buffer));
+    tf_eval (&ctx, unfolded, unfolded_buffer, sizeof (unfolded_buffer));
+    tf_free (folded);
+    tf_free (unfolded);
+    XCTAssert(!strcmp (buffer, "3"), @"The actual output is: %s", buffer);
+    XCTAssert(!strcmp (buffer, unfolded_buffer), @"The folded output is: %s, the unfolded output is: %s", buffer, unfolded_buffer);
+}
+
+- (void)test_ConstantIfTrue_IsFoldedAndSameAsUnfolded {
+    pl_add_meta (it, "one", "1");
+    pl_add_meta (it, "two", "2");
+    char *folded = tf_compile("$if($greater(2,1),yes,no)");
+    char *unfolded = tf_compile("$if($greater(%two%,%one%),yes,no)");
+    XCTAssert(folded[4] == 0 && folded[5] == 7, @"The constant call was not folded");
+    char unfolded_buffer[1000];
+    tf_eval (&ctx, folded, buffer, sizeof (buffer));
+    tf_eval (&ctx, unfolded, unfolded_buffer, sizeof (unfolded_buffer));
+    tf_free (folded);
+    tf_free (unfolded);
+    XCTAssert(!strcmp (buffer, "yes"), @"The actual output is: %s", buffer);
+    XCTAssert(!strcmp (buffer, unfolded_buffer), @"The folded output is: %s, the unfolded output is: %s", buffer, unfolded_buffer);
+}
+
+- (void)test_ConstantIfFalse_IsFoldedAndSameAsUnfolded {
+    pl_add_meta (it, "one", "1");
+    pl_add_meta (it, "two", "2");
+    char *folded = tf_compile("$if($greater(1,2),yes,no)");
+    char *unfolded = tf_compile("$if($greater(%one%,%two%),yes,no)");
+    XCTAssert(folded[4] == 0 && folded[5] == 7, @"The constant call was not folded");
+    char unfolded_buffer[1000];
+    tf_eval (&ctx, folded, buffer, sizeof (buffer));
+    tf_eval (&ctx, unfolded, unfolded_buffer, sizeof (unfolded_buffer));
+    tf_free (folded);
+    tf_free (unfolded);
+    XCTAssert(!strcmp (buffer, "no"), @"The actual output is: %s", buffer);
+    XCTAssert(!strcmp (buffer, unfolded_buffer), @"The folded output is: %s, the unfolded output is: %s", buffer, unfolded_buffer);
+}
+
+- (void)test_ConstantInIf2_IsFoldedAndSameAsUnfolded {
+    pl_add_meta (it, "one", "1");
+    pl_add_meta (it, "two", "2");
+    char *folded = tf_compile("$if2($add(1,2),x)");
+    char *unfolded = tf_compile("$if2($add(%one%,%two%),x)");
+    char unfolded_buffer[1000];
+    tf_eval (&ctx, folded, buffer, sizeof (buffer));
+    tf_eval (&ctx, unfolded, unfolded_buffer, sizeof (unfolded_buffer));
+    tf_free (folded);
+    tf_free (unfolded);
+    XCTAssert(!strcmp (buffer, "3"), @"The actual output is: %s", buffer);
+    XCTAssert(!strcmp (buffer, unfolded_buffer), @"The folded output is: %s, the unfolded output is: %s", buffer, unfolded_buffer);
+}
+
+- (void)test_TitleCompiledBeforeKeyIsAdded_FindsTitleByKeyId {
+    char *bc = tf_compile("%title%");
+    pl_add_meta (it, "Title", "Hello");
+    tf_eval (&ctx, bc, buffer, sizeof (buffer));
+    tf_free (bc);
+    XCTAssert(!strcmp (buffer, "Hello"), @"The actual output is: %s", buffer);
+}
+
+- (void)test_UnknownFieldCompiledBeforeKeyIsAdded_FindsFieldByKeyId {
+    char *bc = tf_compile("%some_new_key%");
+    pl_add_meta (it, "SOME_NEW_KEY", "value");
+    tf_eval (&ctx, bc, buffer, sizeof (buffer));
+    tf_free (bc);
+    XCTAssert(!strcmp (buffer, "value"), @"The actual output is: %s", buffer);
+}
+
+- (void)test_EvalBatchWithNullTracksAndIndex_SameAsEvalPerTrack {
+    playlist_t *plt = plt_alloc ("test");
+    for (int i = 0; i < 10; i++) {
+        playItem_t *track = pl_item_alloc_init ("testfile.flac", "stdflac");
+        char title[20];
+        snprintf (title, sizeof (title), "Title %d", i);
+        pl_add_meta (track, "title", title);
+        if (i % 3) {
+            pl_add_meta (track, "artist", "Artist");
+        }
+        plt_insert_item (plt, plt->tail[PL_MAIN], track);
+        pl_item_unref (track);
+    }
+
+    // every fourth entry is NULL
+    ddb_playItem_t *tracks[13];
+    int count = 0;
+    playItem_t *track = plt->head[PL_MAIN];
+    for (int i = 0; i < 13; i++) {
+        if (i % 4 == 3) {
+            tracks[count++] = NULL;
+        }
+        else {
+            tracks[count++] = (ddb_playItem_t *)track;
+            track = track->next[PL_MAIN];
+        }
+    }
+
+    char *bc = tf_compile("%list_index%: [%artist% - ]%title%");
+    ctx.plt = (ddb_playlist_t *)plt;
+    ctx.flags |= DDB_TF_CONTEXT_HAS_INDEX;
+    ctx.idx = 5;
+
+    char arena[13 * 100];
+    const char *results[13];
+    int n = tf_eval_batch (&ctx, bc, tracks, count, arena, sizeof (arena), 100, results);
+    XCTAssert(n == count, @"The batch evaluated %d tracks out of %d", n, count);
+    XCTAssert(ctx.idx == 5, @"The context index was not restored: %d", ctx.idx);
+
+    for (int i = 0; i < n; i++) {
+        ctx.it = tracks[i];
+        ctx.idx = 5 + i;
+        tf_eval (&ctx, bc, buffer, 100);
+        XCTAssert(!strcmp (buffer, results[i]), @"Track %d: the batch output is: %s, the tf_eval output is: %s", i, results[i], buffer);
+    }
+
+    tf_free (bc);
+    ctx.it = NULL;
+    ctx.plt = NULL;
+    plt_free (plt);
+}
+
 @end
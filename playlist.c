@@ -66,6 +66,8 @@
 #include "strdupa.h"
 #include "tf.h"
 #include "playqueue.h"
+#include "plindex.h"
+#include "plfile.h"
 
 #include "cueutil.h"
 
@@ -91,12 +93,10 @@
 //    removed legacy data used for compat with 0.4.4
 //    note: ddb-0.5.0 should keep using 1.2 playlist format
 //    1.3 support is designed for transition to ddb-0.6.0
+// 1.x->2.0 changelog:
+//    binary format with a string table and fixed size records, see plfile.h
+//    1.x playlists are still loaded, but only 2.x is written
 #define PLAYLIST_MAJOR_VER 1
-#define PLAYLIST_MINOR_VER 2
-
-#if (PLAYLIST_MINOR_VER<2)
-#error writing playlists in format <1.2 is not supported
-#endif
 
 #define min(x,y) ((x)<(y)?(x):(y))
 
@@ -106,11 +106,24 @@ static playlist_t *playlist = NULL; // current playlist
 static int plt_loading = 0; // disable sending event about playlist switch, config regen, etc
 
 #if !DISABLE_LOCKING
-static uintptr_t mutex;
+// pl_lock is a recursive reader-writer lock:
+// pl_lock/pl_unlock take it exclusively, pl_lock_shared/pl_unlock_shared allow concurrent readers.
+// A shared section may be opened inside of an exclusive one, and must be closed before it.
+// The shared lock can't be upgraded, so calling pl_lock while holding pl_lock_shared is a bug:
+// code which may need to modify anything must take pl_lock from the start.
+static uintptr_t rwlock;
+
+static __thread int pl_lock_depth; // recursion count of pl_lock in this thread
+static __thread int pl_lock_shared_depth; // recursion count of pl_lock_shared in this thread
+static __thread int pl_lock_shared_held; // whether the outermost pl_lock_shared acquired the rwlock
+
+static ddb_lock_stats_t lock_stats;
 #endif
 
 #define LOCK {pl_lock();}
 #define UNLOCK {pl_unlock();}
+#define SHARED_LOCK {pl_lock_shared();}
+#define SHARED_UNLOCK {pl_unlock_shared();}
 
 // used at startup to prevent crashes
 static playlist_t dummy_playlist = {
@@ -178,7 +191,7 @@ pl_init (void) {
     }
     playlist = &dummy_playlist;
 #if !DISABLE_LOCKING
-    mutex = mutex_create ();
+    rwlock = rwlock_create ();
 #endif
     return 0;
 }
@@ -203,9 +216,9 @@ pl_free (void) {
     plt_loading = 0;
     UNLOCK;
 #if !DISABLE_LOCKING
-    if (mutex) {
-        mutex_free (mutex);
-        mutex = 0;
+    if (rwlock) {
+        rwlock_free (rwlock);
+        rwlock = 0;
     }
 #endif
     playlist = NULL;
@@ -219,10 +232,32 @@ static pthread_t tids[1000];
 static int ntids = 0;
 pthread_t pl_lock_tid = 0;
 #endif
+#if !DISABLE_LOCKING
+static uint64_t
+_lock_time_ns (void) {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
+
 void
 pl_lock (void) {
 #if !DISABLE_LOCKING
-    mutex_lock (mutex);
+    if (pl_lock_depth > 0) {
+        pl_lock_depth++;
+        return;
+    }
+    // would deadlock waiting for the own read lock
+    assert (pl_lock_shared_depth == 0 && "pl_lock called inside of pl_lock_shared");
+    if (rwlock_trywrlock (rwlock) != 0) {
+        uint64_t t = _lock_time_ns ();
+        rwlock_wrlock (rwlock);
+        __sync_fetch_and_add (&lock_stats.exclusive_contended, 1);
+        __sync_fetch_and_add (&lock_stats.exclusive_wait_ns, _lock_time_ns () - t);
+    }
+    pl_lock_depth = 1;
+    __sync_fetch_and_add (&lock_stats.exclusive, 1);
 #if DETECT_PL_LOCK_RC
     pl_lock_tid = pthread_self ();
     tids[ntids++] = pl_lock_tid;
@@ -238,6 +273,10 @@ pl_lock (void) {
 void
 pl_unlock (void) {
 #if !DISABLE_LOCKING
+    assert (pl_lock_depth > 0);
+    if (--pl_lock_depth > 0) {
+        return;
+    }
 #if DETECT_PL_LOCK_RC
     if (ntids > 0) {
         ntids--;
@@ -249,7 +288,9 @@ pl_unlock (void) {
         pl_lock_tid = 0;
     }
 #endif
-    mutex_unlock (mutex);
+    // a shared section opened inside of this one would be left unprotected
+    assert (pl_lock_shared_depth == 0 && "pl_unlock called inside of pl_lock_shared");
+    rwlock_unlock (rwlock);
 #if DEBUG_LOCKING
     pl_lock_cnt--;
     printf ("pcnt: %d\n", pl_lock_cnt);
@@ -257,6 +298,57 @@ pl_unlock (void) {
 #endif
 }
 
+void
+pl_lock_shared (void) {
+#if !DISABLE_LOCKING
+    if (pl_lock_shared_depth++ > 0 || pl_lock_depth > 0) {
+        // already protected by this thread
+        return;
+    }
+    if (rwlock_tryrdlock (rwlock) != 0) {
+        uint64_t t = _lock_time_ns ();
+        rwlock_rdlock (rwlock);
+        __sync_fetch_and_add (&lock_stats.shared_contended, 1);
+        __sync_fetch_and_add (&lock_stats.shared_wait_ns, _lock_time_ns () - t);
+    }
+    pl_lock_shared_held = 1;
+    __sync_fetch_and_add (&lock_stats.shared, 1);
+#endif
+}
+
+void
+pl_unlock_shared (void) {
+#if !DISABLE_LOCKING
+    assert (pl_lock_shared_depth > 0);
+    if (--pl_lock_shared_depth > 0) {
+        return;
+    }
+    if (pl_lock_shared_held) {
+        pl_lock_shared_held = 0;
+        rwlock_unlock (rwlock);
+    }
+#endif
+}
+
+void
+pl_get_lock_stats (ddb_lock_stats_t *stats) {
+#if !DISABLE_LOCKING
+    int size = stats->_size;
+    if (size > sizeof (ddb_lock_stats_t)) {
+        size = sizeof (ddb_lock_stats_t);
+    }
+    memcpy (stats, &lock_stats, size);
+    stats->_size = size;
+#endif
+}
+
+void
+pl_reset_lock_stats (void) {
+#if !DISABLE_LOCKING
+    memset (&lock_stats, 0, sizeof (lock_stats));
+#endif
+}
+
 static void
 pl_item_free (playItem_t *it);
 
@@ -608,15 +700,15 @@ plt_get_idx_of (playlist_t *plt) {
 
 int
 plt_get_title (playlist_t *p, char *buffer, int bufsize) {
-    LOCK;
+    SHARED_LOCK;
     if (!buffer) {
         int l = (int)strlen (p->title);
-        UNLOCK;
+        SHARED_UNLOCK;
         return l;
     }
     strncpy (buffer, p->title, bufsize);
     buffer[bufsize-1] = 0;
-    UNLOCK;
+    SHARED_UNLOCK;
     return 0;
 }
 
@@ -643,9 +735,9 @@ plt_modified (playlist_t *plt) {
 
 int
 plt_get_modification_idx (playlist_t *plt) {
-    pl_lock ();
+    pl_lock_shared ();
     int idx = plt->modification_idx;
-    pl_unlock ();
+    pl_unlock_shared ();
     return idx;
 }
 
@@ -859,6 +951,114 @@ fileadd_filter_test (ddb_file_found_data_t *data) {
     return 0;
 }
 
+static const char *
+_file_basename (const char *fname) {
+    const char *fn = strrchr (fname, '/');
+    return fn ? fn + 1 : fname;
+}
+
+static int
+_decoder_matches_ext (DB_decoder_t *dec, const char *ext, int e) {
+    return !strcasecmp (dec->exts[e], ext) || !strcmp (dec->exts[e], "*");
+}
+
+static int
+_decoder_matches_prefix (DB_decoder_t *dec, const char *fn, int e) {
+    size_t l = strlen (dec->prefixes[e]);
+    return !strncasecmp (dec->prefixes[e], fn, l) && fn[l] == '.';
+}
+
+// returns 1 if any decoder can try to load the file, judging by the name
+static int
+_decoders_match (const char *fname, const char *ext) {
+    const char *fn = _file_basename (fname);
+    DB_decoder_t **decoders = plug_get_decoder_list ();
+    for (int i = 0; decoders[i]; i++) {
+        if (!decoders[i]->insert) {
+            continue;
+        }
+        for (int e = 0; decoders[i]->exts && decoders[i]->exts[e]; e++) {
+            if (_decoder_matches_ext (decoders[i], ext, e)) {
+                return 1;
+            }
+        }
+        for (int e = 0; decoders[i]->prefixes && decoders[i]->prefixes[e]; e++) {
+            if (_decoder_matches_prefix (decoders[i], fn, e)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// call the decoder's insert; when serialize_mutex is set, it's held during the call,
+// unless the decoder can be called from several threads at the same time
+static playItem_t *
+_decoder_insert (DB_decoder_t *dec, playlist_t *playlist, playItem_t *after, const char *fname, uintptr_t serialize_mutex) {
+    if (dec->plugin.flags & DDB_PLUGIN_FLAG_INSERT_THREADSAFE) {
+        serialize_mutex = 0;
+    }
+    if (serialize_mutex) {
+        mutex_lock (serialize_mutex);
+    }
+    playItem_t *inserted = (playItem_t *)dec->insert ((ddb_playlist_t *)playlist, DB_PLAYITEM (after), fname);
+    if (serialize_mutex) {
+        mutex_unlock (serialize_mutex);
+    }
+    return inserted;
+}
+
+// try the matching decoders in order, until one of them loads the file;
+// returns the last track inserted by the decoder, or NULL
+static playItem_t *
+_decoders_insert (playlist_t *playlist, playItem_t *after, const char *fname, const char *ext, uintptr_t serialize_mutex) {
+    const char *fn = _file_basename (fname);
+    DB_decoder_t **decoders = plug_get_decoder_list ();
+    for (int i = 0; decoders[i]; i++) {
+        if (!decoders[i]->insert) {
+            continue;
+        }
+        for (int e = 0; decoders[i]->exts && decoders[i]->exts[e]; e++) {
+            if (_decoder_matches_ext (decoders[i], ext, e)) {
+                playItem_t *inserted = _decoder_insert (decoders[i], playlist, after, fname, serialize_mutex);
+                if (inserted) {
+                    return inserted;
+                }
+            }
+        }
+        for (int e = 0; decoders[i]->prefixes && decoders[i]->prefixes[e]; e++) {
+            if (_decoder_matches_prefix (decoders[i], fn, e)) {
+                playItem_t *inserted = _decoder_insert (decoders[i], playlist, after, fname, serialize_mutex);
+                if (inserted) {
+                    return inserted;
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+// report the added file to the caller's callback and the file add listeners
+static void
+_file_added (int visibility, playlist_t *playlist, playItem_t *inserted, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
+    if (cb && cb (inserted, user_data) < 0 && pabort) {
+        *pabort = 1;
+    }
+    if (file_add_listeners) {
+        ddb_fileadd_data_t d;
+        memset (&d, 0, sizeof (d));
+        d.visibility = visibility;
+        d.plt = (ddb_playlist_t *)playlist;
+        d.track = (ddb_playItem_t *)inserted;
+        for (ddb_fileadd_listener_t *l = file_add_listeners; l; l = l->next) {
+            if (l->callback (&d, l->user_data) < 0 && pabort) {
+                *pabort = 1;
+                break;
+            }
+        }
+    }
+}
+
 static playItem_t *
 plt_insert_file_int (int visibility, playlist_t *playlist, playItem_t *after, const char *fname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
     if (!fname || !(*fname)) {
@@ -880,14 +1080,6 @@ plt_insert_file_int (int visibility, playlist_t *playlist, playItem_t *after, co
         }
     }
 
-    const char *fn = strrchr (fname, '/');
-    if (!fn) {
-        fn = fname;
-    }
-    else {
-        fn++;
-    }
-
     // add all possible streams as special-case:
     // set decoder to NULL, and filetype to "content"
     // streamer is responsible to determine content type on 1st access and
@@ -969,95 +1161,24 @@ plt_insert_file_int (int visibility, playlist_t *playlist, playItem_t *after, co
         return inserted;
     }
 
-    int filter_done = 0;
-    int file_recognized = 0;
-
-    DB_decoder_t **decoders = plug_get_decoder_list ();
-    // match by decoder
-    for (int i = 0; decoders[i]; i++) {
-        if (decoders[i]->exts && decoders[i]->insert) {
-            const char **exts = decoders[i]->exts;
-            for (int e = 0; exts[e]; e++) {
-                if (!strcasecmp (exts[e], eol) || !strcmp (exts[e], "*")) {
-                    if (!filter_done) {
-                        ddb_file_found_data_t dt;
-                        dt.filename = fname;
-                        dt.plt = (ddb_playlist_t *)playlist;
-                        dt.is_dir = 0;
-                        if (fileadd_filter_test (&dt) < 0) {
-                            return NULL;
-                        }
-                        filter_done = 1;
-                    }
-
-                    file_recognized = 1;
-
-                    playItem_t *inserted = (playItem_t *)decoders[i]->insert ((ddb_playlist_t *)playlist, DB_PLAYITEM (after), fname);
-                    if (inserted != NULL) {
-                        if (cb && cb (inserted, user_data) < 0) {
-                            *pabort = 1;
-                        }
-                        if (file_add_listeners) {
-                            ddb_fileadd_data_t d;
-                            memset (&d, 0, sizeof (d));
-                            d.visibility = visibility;
-                            d.plt = (ddb_playlist_t *)playlist;
-                            d.track = (ddb_playItem_t *)inserted;
-                            for (ddb_fileadd_listener_t *l = file_add_listeners; l; l = l->next) {
-                                if (pabort && l->callback (&d, l->user_data) < 0) {
-                                    *pabort = 1;
-                                    break;
-                                }
-                            }
-                        }
-                        return inserted;
-                    }
-                }
-            }
-        }
-        if (decoders[i]->prefixes && decoders[i]->insert) {
-            const char **prefixes = decoders[i]->prefixes;
-            for (int e = 0; prefixes[e]; e++) {
-                if (!strncasecmp (prefixes[e], fn, strlen(prefixes[e])) && *(fn + strlen (prefixes[e])) == '.') {
-                    if (!filter_done) {
-                        ddb_file_found_data_t dt;
-                        dt.filename = fname;
-                        dt.plt = (ddb_playlist_t *)playlist;
-                        dt.is_dir = 0;
-                        if (fileadd_filter_test (&dt) < 0) {
-                            return NULL;
-                        }
-                        filter_done = 1;
-                    }
+    if (!_decoders_match (fname, eol)) {
+        return NULL;
+    }
 
-                    file_recognized = 1;
-                    playItem_t *inserted = (playItem_t *)decoders[i]->insert ((ddb_playlist_t *)playlist, DB_PLAYITEM (after), fname);
-                    if (inserted != NULL) {
-                        if (cb && cb (inserted, user_data) < 0) {
-                            *pabort = 1;
-                        }
-                        if (file_add_listeners) {
-                            ddb_fileadd_data_t d;
-                            memset (&d, 0, sizeof (d));
-                            d.visibility = visibility;
-                            d.plt = (ddb_playlist_t *)playlist;
-                            d.track = (ddb_playItem_t *)inserted;
-                            for (ddb_fileadd_listener_t *l = file_add_listeners; l; l = l->next) {
-                                if (l->callback (&d, l->user_data) < 0) {
-                                    *pabort = 1;
-                                    break;
-                                }
-                            }
-                        }
-                        return inserted;
-                    }
-                }
-            }
-        }
+    ddb_file_found_data_t dt;
+    dt.filename = fname;
+    dt.plt = (ddb_playlist_t *)playlist;
+    dt.is_dir = 0;
+    if (fileadd_filter_test (&dt) < 0) {
+        return NULL;
     }
-    if (file_recognized) {
-        trace_err ("ERROR: could not load: %s\n", fname);
+
+    playItem_t *inserted = _decoders_insert (playlist, after, fname, eol, 0);
+    if (inserted != NULL) {
+        _file_added (visibility, playlist, inserted, pabort, cb, user_data);
+        return inserted;
     }
+    trace_err ("ERROR: could not load: %s\n", fname);
     return NULL;
 }
 
@@ -1116,6 +1237,249 @@ _get_fullname_and_dir (char *fullname, int sz, char *dir, int dirsz, DB_vfs_t *v
     }
 }
 
+// Parallel folder import.
+// The calling thread walks the folders in the usual order, and hands the files over to a pool of worker threads,
+// which run the decoders' insert in parallel, each file into its own scratch playlist.
+// Only the decoders with DDB_PLUGIN_FLAG_INSERT_THREADSAFE run concurrently, the others take turns on insert_mutex.
+// The calling thread then moves the tracks to the target playlist in the original order, in batches,
+// and calls the callbacks. Anything which must be inserted in place (cuesheets, archives) waits until
+// all preceding files were committed.
+
+#define MAX_INSERT_THREADS 16
+#define INSERT_JOBS_PER_THREAD 16
+
+typedef struct plt_insert_job_s {
+    char *fname;
+    playlist_t scratch; // the decoder inserts the tracks here
+    playItem_t *inserted; // the last track inserted by the decoder
+    int done;
+    struct plt_insert_job_s *next; // submission order
+    struct plt_insert_job_s *next_queued;
+} plt_insert_job_t;
+
+typedef struct plt_insert_pool_s {
+    uintptr_t mutex;
+    uintptr_t insert_mutex; // serializes the decoders which are not thread-safe
+    uintptr_t cond; // a job was queued, or the pool is terminating
+    uintptr_t cond_done; // a job was done
+    plt_insert_job_t *queue; // jobs waiting for a worker
+    plt_insert_job_t *queue_tail;
+    int terminate;
+
+    // owned by the calling thread
+    plt_insert_job_t *jobs; // uncommitted jobs, in submission order
+    plt_insert_job_t *jobs_tail;
+    int njobs;
+    playItem_t *after; // where the next committed track goes
+    int nthreads;
+    intptr_t tids[MAX_INSERT_THREADS];
+} plt_insert_pool_t;
+
+static void
+_insert_pool_worker (void *ctx) {
+    plt_insert_pool_t *pool = ctx;
+    mutex_lock (pool->mutex);
+    for (;;) {
+        while (!pool->queue && !pool->terminate) {
+            cond_wait_locked (pool->cond, pool->mutex);
+        }
+        if (pool->terminate) {
+            break;
+        }
+        plt_insert_job_t *job = pool->queue;
+        pool->queue = job->next_queued;
+        if (!pool->queue) {
+            pool->queue_tail = NULL;
+        }
+        mutex_unlock (pool->mutex);
+
+        const char *ext = strrchr (job->fname, '.') + 1;
+        playItem_t *inserted = _decoders_insert (&job->scratch, NULL, job->fname, ext, pool->insert_mutex);
+
+        mutex_lock (pool->mutex);
+        job->inserted = inserted;
+        job->done = 1;
+        cond_signal (pool->cond_done);
+    }
+    mutex_unlock (pool->mutex);
+}
+
+static plt_insert_pool_t *
+_insert_pool_alloc (int nthreads, playItem_t *after) {
+    plt_insert_pool_t *pool = calloc (1, sizeof (plt_insert_pool_t));
+    pool->mutex = mutex_create ();
+    pool->insert_mutex = mutex_create ();
+    pool->cond = cond_create ();
+    pool->cond_done = cond_create ();
+    pool->after = after;
+    for (int i = 0; i < nthreads; i++) {
+        intptr_t tid = thread_start (_insert_pool_worker, pool);
+        if (!tid) {
+            break;
+        }
+        pool->tids[pool->nthreads++] = tid;
+    }
+    return pool;
+}
+
+static void
+_insert_job_free (plt_insert_job_t *job) {
+    // drop the scratch playlist's references
+    playItem_t *next = NULL;
+    for (playItem_t *it = job->scratch.head[PL_MAIN]; it; it = next) {
+        next = it->next[PL_MAIN];
+        pl_item_unref (it);
+    }
+    free (job->fname);
+    free (job);
+}
+
+// Move the finished jobs' tracks to the playlist, in submission order.
+// With wait_all set, blocks until all jobs are committed, otherwise until the number of jobs in flight is under the limit.
+static void
+_insert_pool_commit (plt_insert_pool_t *pool, int visibility, playlist_t *playlist, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data, int wait_all) {
+    int limit = wait_all ? 0 : pool->nthreads * INSERT_JOBS_PER_THREAD;
+    for (;;) {
+        mutex_lock (pool->mutex);
+        plt_insert_job_t *batch = pool->jobs;
+        plt_insert_job_t *batch_tail = NULL;
+        int n = 0;
+        for (plt_insert_job_t *job = pool->jobs; job && job->done; job = job->next) {
+            batch_tail = job;
+            n++;
+        }
+        if (!n) {
+            if (pool->njobs <= limit) {
+                mutex_unlock (pool->mutex);
+                return;
+            }
+            cond_wait_locked (pool->cond_done, pool->mutex);
+            mutex_unlock (pool->mutex);
+            continue;
+        }
+        pool->jobs = batch_tail->next;
+        if (!pool->jobs) {
+            pool->jobs_tail = NULL;
+        }
+        batch_tail->next = NULL;
+        pool->njobs -= n;
+        mutex_unlock (pool->mutex);
+
+        // each file's tracks are added right before it's reported, so nothing is left over after an abort;
+        // the tracks of the jobs which were not committed are released with them
+        for (plt_insert_job_t *job = batch; job; job = job->next) {
+            if (pabort && *pabort) {
+                break;
+            }
+            if (!job->inserted) {
+                trace_err ("ERROR: could not load: %s\n", job->fname);
+                continue;
+            }
+            pl_lock ();
+            playItem_t *next = NULL;
+            for (playItem_t *it = job->scratch.head[PL_MAIN]; it; it = next) {
+                next = it->next[PL_MAIN];
+                pool->after = plt_insert_item (playlist, pool->after, it);
+                pl_item_unref (it);
+            }
+            job->scratch.head[PL_MAIN] = NULL;
+            pl_unlock ();
+            _file_added (visibility, playlist, job->inserted, pabort, cb, user_data);
+        }
+
+        plt_insert_job_t *next = NULL;
+        for (plt_insert_job_t *job = batch; job; job = next) {
+            next = job->next;
+            _insert_job_free (job);
+        }
+    }
+}
+
+// Returns 1 if the file was either queued or rejected, or 0 if it needs to be inserted in place.
+static int
+_insert_pool_submit (plt_insert_pool_t *pool, int visibility, playlist_t *playlist, const char *fname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
+    // anything but plain files known to the decoders goes through plt_insert_file_int
+    if (fname[0] != '/') {
+        return 0;
+    }
+    if (!playlist->ignore_archives) {
+        DB_vfs_t **vfsplugs = plug_get_vfs_list ();
+        for (int i = 0; vfsplugs[i]; i++) {
+            if (vfsplugs[i]->is_container && vfsplugs[i]->is_container (fname)) {
+                return 0;
+            }
+        }
+    }
+    const char *ext = strrchr (fname, '.');
+    if (!ext) {
+        return 1;
+    }
+    ext++;
+    if (!strcasecmp (ext, "cue")) {
+        return 0;
+    }
+    if (!_decoders_match (fname, ext)) {
+        return 1;
+    }
+
+    ddb_file_found_data_t dt;
+    dt.filename = fname;
+    dt.plt = (ddb_playlist_t *)playlist;
+    dt.is_dir = 0;
+    if (fileadd_filter_test (&dt) < 0) {
+        return 1;
+    }
+
+    plt_insert_job_t *job = calloc (1, sizeof (plt_insert_job_t));
+    job->fname = strdup (fname);
+
+    mutex_lock (pool->mutex);
+    if (pool->jobs_tail) {
+        pool->jobs_tail->next = job;
+    }
+    else {
+        pool->jobs = job;
+    }
+    pool->jobs_tail = job;
+    pool->njobs++;
+    if (pool->queue_tail) {
+        pool->queue_tail->next_queued = job;
+    }
+    else {
+        pool->queue = job;
+    }
+    pool->queue_tail = job;
+    cond_signal (pool->cond);
+    mutex_unlock (pool->mutex);
+
+    _insert_pool_commit (pool, visibility, playlist, pabort, cb, user_data, 0);
+    return 1;
+}
+
+// Stops the workers, and drops the jobs which were not committed.
+static void
+_insert_pool_free (plt_insert_pool_t *pool) {
+    mutex_lock (pool->mutex);
+    pool->terminate = 1;
+    pool->queue = pool->queue_tail = NULL;
+    cond_broadcast (pool->cond);
+    mutex_unlock (pool->mutex);
+    for (int i = 0; i < pool->nthreads; i++) {
+        thread_join (pool->tids[i]);
+    }
+
+    plt_insert_job_t *next = NULL;
+    for (plt_insert_job_t *job = pool->jobs; job; job = next) {
+        next = job->next;
+        _insert_job_free (job);
+    }
+    cond_free (pool->cond);
+    cond_free (pool->cond_done);
+    mutex_free (pool->insert_mutex);
+    mutex_free (pool->mutex);
+    free (pool);
+}
+
 static playItem_t *
 plt_insert_dir_int (int visibility, playlist_t *playlist, DB_vfs_t *vfs, playItem_t *after, const char *dirname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
     if (!strncmp (dirname, "file://", 7)) {
@@ -1177,16 +1541,26 @@ plt_insert_dir_int (int visibility, playlist_t *playlist, DB_vfs_t *vfs, playIte
     char fullname[PATH_MAX];
     char fulldir[PATH_MAX];
 
+    // with the worker threads, in-place inserts need all the previous files committed
+    plt_insert_pool_t *pool = vfs ? NULL : playlist->insert_pool;
+
     // try loading cuesheets first
     for (int c = 0; c < ncuefiles; c++) {
         int i = cuefiles[c];
         _get_fullname_and_dir (fullname, sizeof (fullname), fulldir, sizeof(fulldir), vfs, dirname, namelist[i]->d_name);
 
+        if (pool) {
+            _insert_pool_commit (pool, visibility, playlist, pabort, cb, user_data, 1);
+            after = pool->after;
+        }
         playItem_t *inserted = plt_load_cue_file (playlist, after, fullname, fulldir, namelist, n);
         namelist[i]->d_name[0] = 0;
 
         if (inserted) {
             after = inserted;
+            if (pool) {
+                pool->after = inserted;
+            }
         }
         if (pabort && *pabort) {
             break;
@@ -1203,11 +1577,21 @@ plt_insert_dir_int (int visibility, playlist_t *playlist, DB_vfs_t *vfs, playIte
             }
             _get_fullname_and_dir (fullname, sizeof (fullname), NULL, 0, vfs, dirname, namelist[i]->d_name);
             playItem_t *inserted = NULL;
-            if (!vfs) {
+            // regular files can't be scanned as folders
+            if (!vfs && namelist[i]->d_type != DT_REG) {
                 inserted = plt_insert_dir_int (visibility, playlist, vfs, after, fullname, pabort, cb, user_data);
             }
-            if (!inserted) {
-                inserted = plt_insert_file_int (visibility, playlist, after, fullname, pabort, cb, user_data);
+            if (!inserted && namelist[i]->d_type != DT_DIR) {
+                if (!pool || !_insert_pool_submit (pool, visibility, playlist, fullname, pabort, cb, user_data)) {
+                    if (pool) {
+                        _insert_pool_commit (pool, visibility, playlist, pabort, cb, user_data, 1);
+                        after = pool->after;
+                    }
+                    inserted = plt_insert_file_int (visibility, playlist, after, fullname, pabort, cb, user_data);
+                    if (pool && inserted) {
+                        pool->after = inserted;
+                    }
+                }
             }
 
             if (inserted) {
@@ -1229,6 +1613,37 @@ plt_insert_dir_int (int visibility, playlist_t *playlist, DB_vfs_t *vfs, playIte
     return after;
 }
 
+// insert a folder from the filesystem, reading the files in parallel, if add_folders_threads > 1
+static playItem_t *
+plt_insert_dir_parallel (int visibility, playlist_t *playlist, playItem_t *after, const char *dirname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
+    int nthreads = conf_get_int ("add_folders_threads", 4);
+    if (nthreads > MAX_INSERT_THREADS) {
+        nthreads = MAX_INSERT_THREADS;
+    }
+    if (nthreads <= 1 || playlist->insert_pool) {
+        return plt_insert_dir_int (visibility, playlist, NULL, after, dirname, pabort, cb, user_data);
+    }
+
+    plt_insert_pool_t *pool = _insert_pool_alloc (nthreads, after);
+    if (!pool->nthreads) {
+        _insert_pool_free (pool);
+        return plt_insert_dir_int (visibility, playlist, NULL, after, dirname, pabort, cb, user_data);
+    }
+    playlist->insert_pool = pool;
+    playItem_t *ret = plt_insert_dir_int (visibility, playlist, NULL, after, dirname, pabort, cb, user_data);
+    if (!pabort || !*pabort) {
+        _insert_pool_commit (pool, visibility, playlist, pabort, cb, user_data, 1);
+    }
+    playlist->insert_pool = NULL;
+
+    // the tracks inserted by the workers are only known after the last commit
+    if (ret || pool->after != after) {
+        ret = pool->after;
+    }
+    _insert_pool_free (pool);
+    return ret;
+}
+
 playItem_t *
 plt_insert_dir (playlist_t *playlist, playItem_t *after, const char *dirname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
     int prev_sl = playlist->follow_symlinks;
@@ -1237,7 +1652,7 @@ plt_insert_dir (playlist_t *playlist, playItem_t *after, const char *dirname, in
     int prev = playlist->ignore_archives;
     playlist->ignore_archives = conf_get_int ("ignore_archives", 1);
 
-    playItem_t *ret = plt_insert_dir_int (0, playlist, NULL, after, dirname, pabort, cb, user_data);
+    playItem_t *ret = plt_insert_dir_parallel (0, playlist, after, dirname, pabort, cb, user_data);
 
     playlist->follow_symlinks = prev_sl;
     playlist->ignore_archives = prev;
@@ -1297,6 +1712,7 @@ plt_remove_item (playlist_t *playlist, playItem_t *it) {
     for (int iter = PL_MAIN; iter <= PL_SEARCH; iter++) {
         if (it->prev[iter] || it->next[iter] || playlist->head[iter] == it || playlist->tail[iter] == it) {
             playlist->count[iter]--;
+            plt_index_remove (playlist, iter, it);
         }
 
         playItem_t *next = it->next[iter];
@@ -1349,14 +1765,14 @@ plt_get_item_count (playlist_t *plt, int iter) {
 
 int
 pl_getcount (int iter) {
-    LOCK;
+    SHARED_LOCK;
     if (!playlist) {
-        UNLOCK;
+        SHARED_UNLOCK;
         return 0;
     }
 
     int cnt = playlist->count[iter];
-    UNLOCK;
+    SHARED_UNLOCK;
     return cnt;
 }
 
@@ -1374,35 +1790,28 @@ plt_getselcount (playlist_t *playlist) {
 
 int
 pl_getselcount (void) {
-    LOCK;
+    SHARED_LOCK;
     int cnt = plt_getselcount (playlist);
-    UNLOCK;
+    SHARED_UNLOCK;
     return cnt;
 }
 
 playItem_t *
 plt_get_item_for_idx (playlist_t *playlist, int idx, int iter) {
-    LOCK;
-    playItem_t *it = playlist->head[iter];
-    while (idx--) {
-        if (!it) {
-            UNLOCK;
-            return NULL;
-        }
-        it = it->next[iter];
-    }
+    SHARED_LOCK;
+    playItem_t *it = plt_index_get (playlist, iter, idx);
     if (it) {
         pl_item_ref (it);
     }
-    UNLOCK;
+    SHARED_UNLOCK;
     return it;
 }
 
 playItem_t *
 pl_get_for_idx_and_iter (int idx, int iter) {
-    LOCK;
+    SHARED_LOCK;
     playItem_t *it = plt_get_item_for_idx (playlist, idx, iter);
-    UNLOCK;
+    SHARED_UNLOCK;
     return it;
 }
 
@@ -1413,18 +1822,9 @@ pl_get_for_idx (int idx) {
 
 int
 plt_get_item_idx (playlist_t *playlist, playItem_t *it, int iter) {
-    LOCK;
-    playItem_t *c = playlist->head[iter];
-    int idx = 0;
-    while (c && c != it) {
-        c = c->next[iter];
-        idx++;
-    }
-    if (!c) {
-        UNLOCK;
-        return -1;
-    }
-    UNLOCK;
+    SHARED_LOCK;
+    int idx = plt_index_find (playlist, iter, it);
+    SHARED_UNLOCK;
     return idx;
 }
 
@@ -1435,9 +1835,9 @@ pl_get_idx_of (playItem_t *it) {
 
 int
 pl_get_idx_of_iter (playItem_t *it, int iter) {
-    LOCK;
+    SHARED_LOCK;
     int idx = plt_get_item_idx (playlist, it, iter);
-    UNLOCK;
+    SHARED_UNLOCK;
     return idx;
 }
 
@@ -1470,6 +1870,7 @@ plt_insert_item (playlist_t *playlist, playItem_t *after, playItem_t *it) {
     it->in_playlist = 1;
 
     playlist->count[PL_MAIN]++;
+    plt_index_insert (playlist, PL_MAIN, after, it);
 
     // shuffle
     playItem_t *prev = it->prev[PL_MAIN];
@@ -1553,25 +1954,19 @@ pl_item_alloc_init (const char *fname, const char *decoder_id) {
     return it;
 }
 
+// refcounting is atomic, so that it doesn't require the exclusive lock,
+// and can be done by the threads holding the shared one
 void
 pl_item_ref (playItem_t *it) {
-    LOCK;
-    it->_refc++;
+    __sync_fetch_and_add (&it->_refc, 1);
     //fprintf (stderr, "\033[0;34m+it %p: refc=%d: %s\033[37;0m\n", it, it->_refc, pl_find_meta_raw (it, ":URI"));
-    UNLOCK;
 }
 
 static void
 pl_item_free (playItem_t *it) {
     LOCK;
     if (it) {
-        while (it->meta) {
-            pl_meta_free_values (it->meta);
-            DB_metaInfo_t *m = it->meta;
-            it->meta = m->next;
-            free (m);
-        }
-
+        pl_item_free_meta (it);
         free (it);
     }
     UNLOCK;
@@ -1579,17 +1974,15 @@ pl_item_free (playItem_t *it) {
 
 void
 pl_item_unref (playItem_t *it) {
-    LOCK;
-    it->_refc--;
-    //trace ("\033[0;31m-it %p: refc=%d: %s\033[37;0m\n", it, it->_refc, pl_find_meta_raw (it, ":URI"));
-    if (it->_refc < 0) {
+    int refc = __sync_sub_and_fetch (&it->_refc, 1);
+    //trace ("\033[0;31m-it %p: refc=%d: %s\033[37;0m\n", it, refc, pl_find_meta_raw (it, ":URI"));
+    if (refc < 0) {
         trace ("\033[0;31mplaylist: bad refcount on item %p\033[37;0m\n", it);
     }
-    if (it->_refc <= 0) {
+    if (refc == 0) {
         //printf ("\033[0;31mdeleted %s\033[37;0m\n", pl_find_meta_raw (it, ":URI"));
         pl_item_free (it);
     }
-    UNLOCK;
 }
 
 int
@@ -1668,191 +2061,9 @@ plt_save (playlist_t *plt, playItem_t *first, playItem_t *last, const char *fnam
         }
     }
 
-    char tempfile[PATH_MAX];
-    snprintf (tempfile, sizeof (tempfile), "%s.tmp", fname);
-    const char magic[] = "DBPL";
-    uint8_t majorver = PLAYLIST_MAJOR_VER;
-    uint8_t minorver = PLAYLIST_MINOR_VER;
-    FILE *fp = fopen (tempfile, "w+b");
-    if (!fp) {
-        UNLOCK;
-        return -1;
-    }
-    if (fwrite (magic, 1, 4, fp) != 4) {
-        goto save_fail;
-    }
-    if (fwrite (&majorver, 1, 1, fp) != 1) {
-        goto save_fail;
-    }
-    if (fwrite (&minorver, 1, 1, fp) != 1) {
-        goto save_fail;
-    }
-    uint32_t cnt = plt->count[PL_MAIN];
-    if (fwrite (&cnt, 1, 4, fp) != 4) {
-        goto save_fail;
-    }
-    for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
-        uint16_t l;
-        uint8_t ll;
-        if (cb) {
-            cb(it, user_data);
-        }
-#if (PLAYLIST_MINOR_VER==2)
-        const char *fname = pl_find_meta_raw (it, ":URI");
-        l = strlen (fname);
-        if (fwrite (&l, 1, 2, fp) != 2) {
-            goto save_fail;
-        }
-        if (fwrite (fname, 1, l, fp) != l) {
-            goto save_fail;
-        }
-        const char *decoder_id = pl_find_meta_raw (it, ":DECODER");
-        if (decoder_id) {
-            ll = strlen (decoder_id);
-            if (fwrite (&ll, 1, 1, fp) != 1) {
-                goto save_fail;
-            }
-            if (fwrite (decoder_id, 1, ll, fp) != ll) {
-                goto save_fail;
-            }
-        }
-        else
-        {
-            ll = 0;
-            if (fwrite (&ll, 1, 1, fp) != 1) {
-                goto save_fail;
-            }
-        }
-        l = pl_find_meta_int (it, ":TRACKNUM", 0);
-        if (fwrite (&l, 1, 2, fp) != 2) {
-            goto save_fail;
-        }
-#endif
-        if (fwrite (&it->startsample, 1, 4, fp) != 4) {
-            goto save_fail;
-        }
-        if (fwrite (&it->endsample, 1, 4, fp) != 4) {
-            goto save_fail;
-        }
-        if (fwrite (&it->_duration, 1, 4, fp) != 4) {
-            goto save_fail;
-        }
-#if (PLAYLIST_MINOR_VER==2)
-        const char *filetype = pl_find_meta_raw (it, ":FILETYPE");
-        if (!filetype) {
-            filetype = "";
-        }
-        uint8_t ft = strlen (filetype);
-        if (fwrite (&ft, 1, 1, fp) != 1) {
-            goto save_fail;
-        }
-        if (ft) {
-            if (fwrite (filetype, 1, ft, fp) != ft) {
-                goto save_fail;
-            }
-        }
-        float rg_albumgain = pl_get_item_replaygain (it, DDB_REPLAYGAIN_ALBUMGAIN);
-        float rg_albumpeak = pl_get_item_replaygain (it, DDB_REPLAYGAIN_ALBUMPEAK);
-        float rg_trackgain = pl_get_item_replaygain (it, DDB_REPLAYGAIN_TRACKGAIN);
-        float rg_trackpeak = pl_get_item_replaygain (it, DDB_REPLAYGAIN_TRACKPEAK);
-        if (fwrite (&rg_albumgain, 1, 4, fp) != 4) {
-            goto save_fail;
-        }
-        if (fwrite (&rg_albumpeak, 1, 4, fp) != 4) {
-            goto save_fail;
-        }
-        if (fwrite (&rg_trackgain, 1, 4, fp) != 4) {
-            goto save_fail;
-        }
-        if (fwrite (&rg_trackpeak, 1, 4, fp) != 4) {
-            goto save_fail;
-        }
-#endif
-        if (fwrite (&it->_flags, 1, 4, fp) != 4) {
-            goto save_fail;
-        }
-
-        int16_t nm = 0;
-        DB_metaInfo_t *m;
-        for (m = it->meta; m; m = m->next) {
-            if (m->key[0] == '_' || m->key[0] == '!') {
-                continue; // skip reserved names
-            }
-            nm++;
-        }
-        if (fwrite (&nm, 1, 2, fp) != 2) {
-            goto save_fail;
-        }
-        for (m = it->meta; m; m = m->next) {
-            if (m->key[0] == '_' || m->key[0] == '!') {
-                continue; // skip reserved names
-            }
-
-            l = strlen (m->key);
-            if (fwrite (&l, 1, 2, fp) != 2) {
-                goto save_fail;
-            }
-            if (l) {
-                if (fwrite (m->key, 1, l, fp) != l) {
-                    goto save_fail;
-                }
-            }
-            l = m->valuesize-1;
-            if (fwrite (&l, 1, 2, fp) != 2) {
-                goto save_fail;
-            }
-            if (l) {
-                if (fwrite (m->value, 1, l, fp) != l) {
-                    goto save_fail;
-                }
-            }
-        }
-    }
-
-    // write playlist metadata
-    int16_t nm = 0;
-    DB_metaInfo_t *m;
-    for (m = plt->meta; m; m = m->next) {
-        nm++;
-    }
-    if (fwrite (&nm, 1, 2, fp) != 2) {
-        goto save_fail;
-    }
-
-    for (m = plt->meta; m; m = m->next) {
-        uint16_t l;
-        l = strlen (m->key);
-        if (fwrite (&l, 1, 2, fp) != 2) {
-            goto save_fail;
-        }
-        if (l) {
-            if (fwrite (m->key, 1, l, fp) != l) {
-                goto save_fail;
-            }
-        }
-        l = strlen (m->value);
-        if (fwrite (&l, 1, 2, fp) != 2) {
-            goto save_fail;
-        }
-        if (l) {
-            if (fwrite (m->value, 1, l, fp) != l) {
-                goto save_fail;
-            }
-        }
-    }
-
+    int res = plfile_save (plt, fname, cb, user_data);
     UNLOCK;
-    fclose (fp);
-    if (rename (tempfile, fname) != 0) {
-        fprintf (stderr, "playlist rename %s -> %s failed: %s\n", tempfile, fname, strerror (errno));
-        return -1;
-    }
-    return 0;
-save_fail:
-    UNLOCK;
-    fclose (fp);
-    unlink (tempfile);
-    return -1;
+    return res;
 }
 
 int
@@ -1978,6 +2189,10 @@ plt_load_int (int visibility, playlist_t *plt, playItem_t *after, const char *fn
     if (fread (&majorver, 1, 1, fp) != 1) {
         goto load_fail;
     }
+    if (majorver == DBPL_MAJOR_VER) {
+        fclose (fp);
+        return plfile_load (plt, fname);
+    }
     if (majorver != PLAYLIST_MAJOR_VER) {
         trace ("bad majorver=%d\n", majorver);
         goto load_fail;
@@ -2429,7 +2644,7 @@ pl_get_item_replaygain (playItem_t *it, int idx) {
 
 int
 pl_format_item_queue (playItem_t *it, char *s, int size) {
-    LOCK;
+    SHARED_LOCK;
     *s = 0;
     int initsize = size;
     const char *val = pl_find_meta_raw (it, "_playing");
@@ -2479,7 +2694,7 @@ pl_format_item_queue (playItem_t *it, char *s, int size) {
     int pq_cnt = playqueue_getcount ();
 
     if (!pq_cnt) {
-        UNLOCK;
+        SHARED_UNLOCK;
         return 0;
     }
 
@@ -2513,7 +2728,7 @@ pl_format_item_queue (playItem_t *it, char *s, int size) {
         s += len;
         size -= len;
     }
-    UNLOCK;
+    SHARED_UNLOCK;
     return initsize-size;
 }
 
@@ -3027,9 +3242,9 @@ plt_get_totaltime (playlist_t *playlist) {
 
 float
 pl_get_totaltime (void) {
-    LOCK;
+    SHARED_LOCK;
     float t = plt_get_totaltime (playlist);
-    UNLOCK;
+    SHARED_UNLOCK;
     return t;
 }
 
@@ -3089,9 +3304,9 @@ plt_get_first (playlist_t *playlist, int iter) {
 
 playItem_t *
 pl_get_first (int iter) {
-    LOCK;
+    SHARED_LOCK;
     playItem_t *it = plt_get_first (playlist, iter);
-    UNLOCK;
+    SHARED_UNLOCK;
     return it;
 }
 
@@ -3106,9 +3321,9 @@ plt_get_last (playlist_t *playlist, int iter) {
 
 playItem_t *
 pl_get_last (int iter) {
-    LOCK;
+    SHARED_LOCK;
     playItem_t *it = plt_get_last (playlist, iter);
-    UNLOCK;
+    SHARED_UNLOCK;
     return it;
 }
 
@@ -3140,9 +3355,9 @@ plt_get_cursor (playlist_t *playlist, int iter) {
 
 int
 pl_get_cursor (int iter) {
-    LOCK;
+    SHARED_LOCK;
     int c = plt_get_cursor (playlist, iter);
-    UNLOCK;
+    SHARED_UNLOCK;
     return c;
 }
 
@@ -3227,10 +3442,7 @@ plt_copy_items (playlist_t *to, int iter, playlist_t *from, playItem_t *before,
 
     playItem_t **items = malloc (cnt * sizeof(playItem_t *));
     for (int i = 0; i < cnt; i++) {
-        playItem_t *it = from->head[iter];
-        for (int idx = 0; it && idx < indices[i]; idx++) {
-            it = it->next[iter];
-        }
+        playItem_t *it = plt_index_get (from, iter, indices[i]);
         items[i] = it;
         if (!it) {
             trace ("plt_copy_items: warning: item %d not found in source plt_to\n", indices[i]);
@@ -3254,6 +3466,7 @@ plt_copy_items (playlist_t *to, int iter, playlist_t *from, playItem_t *before,
 static void
 plt_search_reset_int (playlist_t *playlist, int clear_selection) {
     LOCK;
+    plt_index_clear (playlist, PL_SEARCH);
     while (playlist->head[PL_SEARCH]) {
         playItem_t *next = playlist->head[PL_SEARCH]->next[PL_SEARCH];
         if (clear_selection) {
@@ -3275,6 +3488,7 @@ plt_search_reset (playlist_t *playlist) {
 
 static void
 _plsearch_append (playlist_t *plt, playItem_t *it, int select_results) {
+    plt_index_insert (plt, PL_SEARCH, plt->tail[PL_SEARCH], it);
     it->next[PL_SEARCH] = NULL;
     it->prev[PL_SEARCH] = plt->tail[PL_SEARCH];
     if (plt->tail[PL_SEARCH]) {
@@ -3663,7 +3877,7 @@ plt_add_dir2 (int visibility, playlist_t *plt, const char *dirname, int (*callba
     plt->ignore_archives = conf_get_int ("ignore_archives", 1);
 
     int abort = 0;
-    playItem_t *it = plt_insert_dir_int (visibility, plt, NULL, plt->tail[PL_MAIN], dirname, &abort, callback, user_data);
+    playItem_t *it = plt_insert_dir_parallel (visibility, plt, plt->tail[PL_MAIN], dirname, &abort, callback, user_data);
 
     plt->ignore_archives = prev;
     plt->follow_symlinks = prev_sl;
@@ -3685,7 +3899,7 @@ plt_insert_dir2 (int visibility, playlist_t *plt, playItem_t *after, const char
     plt->follow_symlinks = conf_get_int ("add_folders_follow_symlinks", 0);
     plt->ignore_archives = conf_get_int ("ignore_archives", 1);
 
-    playItem_t *ret = plt_insert_dir_int (visibility, plt, NULL, after, dirname, pabort, callback, user_data);
+    playItem_t *ret = plt_insert_dir_parallel (visibility, plt, after, dirname, pabort, callback, user_data);
 
     plt->follow_symlinks = prev_sl;
     plt->ignore_archives = 0;
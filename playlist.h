@@ -34,6 +34,18 @@
 
 #define PL_MAX_ITERATORS 2
 
+struct playItem_s;
+
+// node of the per-iterator order-statistic tree (implicit treap),
+// which mirrors the linked list order, and is used for O(log n) idx<->item lookups
+typedef struct {
+    struct playItem_s *parent;
+    struct playItem_s *left;
+    struct playItem_s *right;
+    uint32_t size; // number of items in this subtree, including this one
+    uint32_t prio;
+} pl_index_node_t;
+
 // predefined properties stored in metadata for storage unification:
 // :URI - full pathname
 // :DECODER - decoder id
@@ -53,7 +65,9 @@ typedef struct playItem_s {
     int _refc;
     struct playItem_s *next[PL_MAX_ITERATORS]; // next item in linked list
     struct playItem_s *prev[PL_MAX_ITERATORS]; // prev item in linked list
+    pl_index_node_t _index[PL_MAX_ITERATORS]; // position in playlist_t::index_root
     struct DB_metaInfo_s *meta; // linked list storing metainfo
+    struct pl_meta_index_s *_meta_index; // key lookup table for meta, see plmeta.c
     unsigned selected : 1;
     unsigned played : 1; // mark as played in shuffle mode
     unsigned in_playlist : 1; // 1 if item is in playlist
@@ -71,6 +85,7 @@ typedef struct playlist_s {
     int last_save_modification_idx;
     playItem_t *head[PL_MAX_ITERATORS]; // head of linked list
     playItem_t *tail[PL_MAX_ITERATORS]; // tail of linked list
+    playItem_t *index_root[PL_MAX_ITERATORS]; // root of the index tree, see plindex.h
     int current_row[PL_MAX_ITERATORS]; // current row (cursor)
     int scroll;
     struct DB_metaInfo_s *meta; // linked list storing metainfo
@@ -81,6 +96,8 @@ typedef struct playlist_s {
     int cue_samplerate;
 
     int search_cmpidx;
+
+    struct plt_insert_pool_s *insert_pool; // set while a folder is being added with worker threads
     
     unsigned fast_mode : 1;
     unsigned files_adding : 1;
@@ -103,6 +120,18 @@ pl_lock (void);
 void
 pl_unlock (void);
 
+void
+pl_lock_shared (void);
+
+void
+pl_unlock_shared (void);
+
+void
+pl_get_lock_stats (ddb_lock_stats_t *stats);
+
+void
+pl_reset_lock_stats (void);
+
 //void
 //plt_lock (void);
 //
@@ -567,12 +596,30 @@ pl_configchanged (void);
 DB_metaInfo_t *
 pl_meta_for_key (playItem_t *it, const char *key);
 
+// returns the id of the key, registering it if necessary;
+// ids are case-insensitive, and stay valid for the lifetime of the process
+uint32_t
+pl_meta_key_id (const char *key);
+
+// same as pl_meta_for_key, but with a key id from pl_meta_key_id
+DB_metaInfo_t *
+pl_meta_for_key_id (playItem_t *it, uint32_t key_id);
+
 void
 pl_meta_free_values (DB_metaInfo_t *meta);
 
 void
 pl_add_meta_copy (playItem_t *it, DB_metaInfo_t *meta);
 
+// add a key/value pair, where both key and value are metacache strings;
+// a reference is taken on each, and the value is stored as-is
+void
+pl_add_meta_interned (playItem_t *it, const char *key, const char *value, int valuesize);
+
+// release all metadata of the item, including properties
+void
+pl_item_free_meta (playItem_t *it);
+
 int
 register_fileadd_filter (int (*callback)(ddb_file_found_data_t *data, void *user_data), void *user_data);
 
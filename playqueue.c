@@ -122,14 +122,14 @@ playqueue_remove (playItem_t *it) {
 
 int
 playqueue_test (playItem_t *it) {
-    pl_lock ();
+    pl_lock_shared ();
     for (int i = 0; i < playqueue_count; i++) {
         if (playqueue[i] == it) {
-            pl_unlock ();
+            pl_unlock_shared ();
             return i;
         }
     }
-    pl_unlock ();
+    pl_unlock_shared ();
     return -1;
 }
 
@@ -153,10 +153,10 @@ playqueue_getcount (void) {
 
 playItem_t *
 playqueue_get_item (int i) {
-    pl_lock ();
+    pl_lock_shared ();
     playItem_t *it = playqueue[i];
     pl_item_ref (it);
-    pl_unlock ();
+    pl_unlock_shared ();
     return it;
 }
 
@@ -0,0 +1,391 @@
+/*
+  This file is part of Deadbeef Player source code
+  http://deadbeef.sourceforge.net
+
+  binary playlist file format
+
+  Copyright (C) 2009-2018 Alexey Yakovenko
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+
+  Alexey Yakovenko waker@users.sourceforge.net
+*/
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "plfile.h"
+#include "pltmeta.h"
+#include "metacache.h"
+
+//#define trace(...) { fprintf(stderr, __VA_ARGS__); }
+#define trace(fmt,...)
+
+#define LOCK {pl_lock();}
+#define UNLOCK {pl_unlock();}
+
+// string table builder, keys and values are metacache strings,
+// so that the identical ones are deduplicated by pointer
+typedef struct {
+    const char **ptrs; // open addressing set of strings
+    uint32_t *ids;
+    uint32_t hash_size;
+    dbpl_string_t *strings;
+    const char **data;
+    uint32_t n_strings;
+    uint32_t strings_size;
+    uint64_t strdata_size;
+} strtab_t;
+
+static uint32_t
+_ptr_hash (const char *p) {
+    uintptr_t v = (uintptr_t)p;
+    v ^= v >> 17;
+    v *= 0xed5ad4bb;
+    v ^= v >> 11;
+    return (uint32_t)v;
+}
+
+static void
+_strtab_grow (strtab_t *st) {
+    uint32_t size = st->hash_size ? st->hash_size * 2 : 4096;
+    const char **ptrs = calloc (size, sizeof (const char *));
+    uint32_t *ids = malloc (size * sizeof (uint32_t));
+    for (uint32_t i = 0; i < st->hash_size; i++) {
+        if (st->ptrs[i]) {
+            uint32_t h = _ptr_hash (st->ptrs[i]) & (size - 1);
+            while (ptrs[h]) {
+                h = (h + 1) & (size - 1);
+            }
+            ptrs[h] = st->ptrs[i];
+            ids[h] = st->ids[i];
+        }
+    }
+    free (st->ptrs);
+    free (st->ids);
+    st->ptrs = ptrs;
+    st->ids = ids;
+    st->hash_size = size;
+}
+
+static int
+_strtab_add (strtab_t *st, const char *str, uint32_t size, uint32_t *id) {
+    if ((st->n_strings + 1) * 2 > st->hash_size) {
+        _strtab_grow (st);
+    }
+    uint32_t mask = st->hash_size - 1;
+    uint32_t h = _ptr_hash (str) & mask;
+    while (st->ptrs[h]) {
+        if (st->ptrs[h] == str) {
+            *id = st->ids[h];
+            return 0;
+        }
+        h = (h + 1) & mask;
+    }
+    if (st->strdata_size + size > UINT32_MAX) {
+        return -1;
+    }
+    if (st->n_strings == st->strings_size) {
+        st->strings_size = st->strings_size ? st->strings_size * 2 : 1024;
+        st->strings = realloc (st->strings, st->strings_size * sizeof (dbpl_string_t));
+        st->data = realloc (st->data, st->strings_size * sizeof (const char *));
+    }
+    st->ptrs[h] = str;
+    st->ids[h] = st->n_strings;
+    st->strings[st->n_strings].offset = (uint32_t)st->strdata_size;
+    st->strings[st->n_strings].size = size;
+    st->data[st->n_strings] = str;
+    st->strdata_size += size;
+    *id = st->n_strings++;
+    return 0;
+}
+
+static void
+_strtab_free (strtab_t *st) {
+    free (st->ptrs);
+    free (st->ids);
+    free (st->strings);
+    free (st->data);
+}
+
+static int
+_add_meta_record (strtab_t *st, dbpl_meta_t **meta, uint32_t *n_meta, uint32_t *meta_size, const char *key, const char *value, uint32_t valuesize) {
+    if (*n_meta == *meta_size) {
+        *meta_size = *meta_size ? *meta_size * 2 : 4096;
+        *meta = realloc (*meta, *meta_size * sizeof (dbpl_meta_t));
+    }
+    dbpl_meta_t *m = &(*meta)[*n_meta];
+    if (_strtab_add (st, key, (uint32_t)strlen (key) + 1, &m->key) < 0
+        || _strtab_add (st, value, valuesize, &m->value) < 0) {
+        return -1;
+    }
+    (*n_meta)++;
+    return 0;
+}
+
+int
+plfile_save (playlist_t *plt, const char *fname, int (*cb)(playItem_t *it, void *data), void *user_data) {
+    int res = -1;
+    strtab_t st;
+    memset (&st, 0, sizeof (st));
+    dbpl_meta_t *meta = NULL;
+    uint32_t n_meta = 0;
+    uint32_t meta_size = 0;
+    FILE *fp = NULL;
+
+    LOCK;
+    dbpl_header_t hdr;
+    memset (&hdr, 0, sizeof (hdr));
+    memcpy (hdr.magic, "DBPL", 4);
+    hdr.majorver = DBPL_MAJOR_VER;
+    hdr.minorver = DBPL_MINOR_VER;
+    hdr.n_tracks = plt->count[PL_MAIN];
+
+    dbpl_track_t *tracks = calloc (hdr.n_tracks ? hdr.n_tracks : 1, sizeof (dbpl_track_t));
+    uint32_t i = 0;
+    for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN], i++) {
+        if (cb) {
+            cb (it, user_data);
+        }
+        dbpl_track_t *t = &tracks[i];
+        t->startsample64 = it->startsample64;
+        t->endsample64 = it->endsample64;
+        t->startsample = it->startsample;
+        t->endsample = it->endsample;
+        t->duration = it->_duration;
+        t->flags = it->_flags;
+        t->bits = (it->has_startsample64 ? DBPL_TRACK_HAS_STARTSAMPLE64 : 0)
+            | (it->has_endsample64 ? DBPL_TRACK_HAS_ENDSAMPLE64 : 0);
+        t->meta_start = n_meta;
+        for (DB_metaInfo_t *m = it->meta; m; m = m->next) {
+            if (m->key[0] == '_' || m->key[0] == '!') {
+                continue; // skip reserved names
+            }
+            if (!m->value) {
+                continue;
+            }
+            if (_add_meta_record (&st, &meta, &n_meta, &meta_size, m->key, m->value, m->valuesize) < 0) {
+                goto out;
+            }
+        }
+        t->meta_count = n_meta - t->meta_start;
+    }
+    hdr.n_meta = n_meta;
+
+    for (DB_metaInfo_t *m = plt->meta; m; m = m->next) {
+        if (_add_meta_record (&st, &meta, &n_meta, &meta_size, m->key, m->value, (uint32_t)strlen (m->value) + 1) < 0) {
+            goto out;
+        }
+    }
+    hdr.n_plt_meta = n_meta - hdr.n_meta;
+    hdr.n_strings = st.n_strings;
+
+    hdr.tracks_offset = sizeof (dbpl_header_t);
+    hdr.meta_offset = hdr.tracks_offset + (uint64_t)hdr.n_tracks * sizeof (dbpl_track_t);
+    hdr.strings_offset = hdr.meta_offset + (uint64_t)n_meta * sizeof (dbpl_meta_t);
+    hdr.strdata_offset = hdr.strings_offset + (uint64_t)st.n_strings * sizeof (dbpl_string_t);
+    hdr.strdata_size = st.strdata_size;
+
+    char tempfile[PATH_MAX];
+    snprintf (tempfile, sizeof (tempfile), "%s.tmp", fname);
+    fp = fopen (tempfile, "w+b");
+    if (!fp) {
+        goto out;
+    }
+    if (fwrite (&hdr, sizeof (hdr), 1, fp) != 1
+        || fwrite (tracks, sizeof (dbpl_track_t), hdr.n_tracks, fp) != hdr.n_tracks
+        || fwrite (meta, sizeof (dbpl_meta_t), n_meta, fp) != n_meta
+        || fwrite (st.strings, sizeof (dbpl_string_t), st.n_strings, fp) != st.n_strings) {
+        goto write_fail;
+    }
+    for (i = 0; i < st.n_strings; i++) {
+        if (fwrite (st.data[i], 1, st.strings[i].size, fp) != st.strings[i].size) {
+            goto write_fail;
+        }
+    }
+    if (fclose (fp)) {
+        fp = NULL;
+        goto write_fail;
+    }
+    fp = NULL;
+    if (rename (tempfile, fname) != 0) {
+        fprintf (stderr, "playlist rename %s -> %s failed: %s\n", tempfile, fname, strerror (errno));
+        goto out;
+    }
+    res = 0;
+    goto out;
+
+write_fail:
+    if (fp) {
+        fclose (fp);
+        fp = NULL;
+    }
+    unlink (tempfile);
+out:
+    UNLOCK;
+    free (tracks);
+    free (meta);
+    _strtab_free (&st);
+    return res;
+}
+
+// check that a string table entry is within the string data, and zero-terminated
+static int
+_string_valid (const dbpl_header_t *hdr, const dbpl_string_t *s, const char *strdata) {
+    if (s->size == 0 || (uint64_t)s->offset + s->size > hdr->strdata_size) {
+        return 0;
+    }
+    return strdata[s->offset + s->size - 1] == 0;
+}
+
+static int
+_header_valid (const dbpl_header_t *hdr, uint64_t filesize) {
+    if (memcmp (hdr->magic, "DBPL", 4) || hdr->majorver != DBPL_MAJOR_VER) {
+        return 0;
+    }
+    uint64_t n_meta = (uint64_t)hdr->n_meta + hdr->n_plt_meta;
+    return hdr->tracks_offset >= sizeof (dbpl_header_t)
+        && hdr->tracks_offset + (uint64_t)hdr->n_tracks * sizeof (dbpl_track_t) <= hdr->meta_offset
+        && hdr->meta_offset + n_meta * sizeof (dbpl_meta_t) <= hdr->strings_offset
+        && hdr->strings_offset + (uint64_t)hdr->n_strings * sizeof (dbpl_string_t) <= hdr->strdata_offset
+        && hdr->strdata_offset + hdr->strdata_size <= filesize
+        && (hdr->tracks_offset % sizeof (int64_t)) == 0
+        && (hdr->meta_offset % sizeof (uint32_t)) == 0
+        && (hdr->strings_offset % sizeof (uint32_t)) == 0;
+}
+
+playItem_t *
+plfile_load (playlist_t *plt, const char *fname) {
+    int fd = open (fname, O_RDONLY);
+    if (fd < 0) {
+        trace ("plfile_load: failed to open %s\n", fname);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat (fd, &st) || st.st_size < (off_t)sizeof (dbpl_header_t)) {
+        close (fd);
+        return NULL;
+    }
+    size_t filesize = st.st_size;
+    const uint8_t *map = mmap (NULL, filesize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED) {
+        fprintf (stderr, "playlist load fail (%s): %s\n", fname, strerror (errno));
+        return NULL;
+    }
+
+    playItem_t *last_added = NULL;
+    const char **interned = NULL;
+
+    const dbpl_header_t *hdr = (const dbpl_header_t *)map;
+    if (!_header_valid (hdr, filesize)) {
+        goto load_fail;
+    }
+
+    const dbpl_track_t *tracks = (const dbpl_track_t *)(map + hdr->tracks_offset);
+    const dbpl_meta_t *meta = (const dbpl_meta_t *)(map + hdr->meta_offset);
+    const dbpl_string_t *strings = (const dbpl_string_t *)(map + hdr->strings_offset);
+    const char *strdata = (const char *)(map + hdr->strdata_offset);
+
+    // validate everything upfront, so that a broken file doesn't produce half-loaded tracks
+    for (uint32_t i = 0; i < hdr->n_strings; i++) {
+        if (!_string_valid (hdr, &strings[i], strdata)) {
+            goto load_fail;
+        }
+    }
+    uint32_t n_meta = hdr->n_meta + hdr->n_plt_meta;
+    for (uint32_t i = 0; i < n_meta; i++) {
+        if (meta[i].key >= hdr->n_strings || meta[i].value >= hdr->n_strings) {
+            goto load_fail;
+        }
+    }
+    for (uint32_t i = 0; i < hdr->n_tracks; i++) {
+        if ((uint64_t)tracks[i].meta_start + tracks[i].meta_count > hdr->n_meta) {
+            goto load_fail;
+        }
+    }
+
+    // strings are interned into metacache on first use, and only once per file,
+    // instead of once per occurrence
+    interned = calloc (hdr->n_strings ? hdr->n_strings : 1, sizeof (const char *));
+
+    LOCK;
+    for (uint32_t i = 0; i < hdr->n_tracks; i++) {
+        const dbpl_track_t *t = &tracks[i];
+        playItem_t *it = pl_item_alloc ();
+        it->startsample64 = t->startsample64;
+        it->endsample64 = t->endsample64;
+        it->startsample = t->startsample;
+        it->endsample = t->endsample;
+        it->has_startsample64 = (t->bits & DBPL_TRACK_HAS_STARTSAMPLE64) ? 1 : 0;
+        it->has_endsample64 = (t->bits & DBPL_TRACK_HAS_ENDSAMPLE64) ? 1 : 0;
+        it->_duration = t->duration;
+        // :TAGS and the other derived properties are stored in the metadata,
+        // so the flags are restored as is, without pl_set_item_flags
+        it->_flags = t->flags;
+
+        for (uint32_t m = t->meta_start; m < t->meta_start + t->meta_count; m++) {
+            uint32_t k = meta[m].key;
+            uint32_t v = meta[m].value;
+            if (!interned[k]) {
+                interned[k] = metacache_add_value (strdata + strings[k].offset, strings[k].size);
+            }
+            if (!interned[v]) {
+                interned[v] = metacache_add_value (strdata + strings[v].offset, strings[v].size);
+            }
+            pl_add_meta_interned (it, interned[k], interned[v], strings[v].size);
+        }
+
+        plt_insert_item (plt, plt->tail[PL_MAIN], it);
+        if (last_added) {
+            pl_item_unref (last_added);
+        }
+        last_added = it;
+    }
+
+    for (uint32_t m = hdr->n_meta; m < n_meta; m++) {
+        plt_add_meta (plt, strdata + strings[meta[m].key].offset, strdata + strings[meta[m].value].offset);
+    }
+
+    // drop the references held by the string table
+    for (uint32_t i = 0; i < hdr->n_strings; i++) {
+        if (interned[i]) {
+            metacache_remove_value (interned[i], strings[i].size);
+        }
+    }
+    UNLOCK;
+
+    free (interned);
+    munmap ((void *)map, filesize);
+    if (last_added) {
+        pl_item_unref (last_added);
+    }
+    return last_added;
+
+load_fail:
+    fprintf (stderr, "playlist load fail (%s)!\n", fname);
+    munmap ((void *)map, filesize);
+    return NULL;
+}
@@ -0,0 +1,99 @@
+/*
+  This file is part of Deadbeef Player source code
+  http://deadbeef.sourceforge.net
+
+  binary playlist file format
+
+  Copyright (C) 2009-2018 Alexey Yakovenko
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+
+  Alexey Yakovenko waker@users.sourceforge.net
+*/
+
+#ifndef __PLFILE_H
+#define __PLFILE_H
+
+#include "playlist.h"
+
+// DBPL 2.x is a binary playlist format, designed to be mmapped and read without parsing:
+//
+//   header
+//   track records          dbpl_track_t[n_tracks]
+//   metadata records       dbpl_meta_t[n_meta + n_plt_meta], tracks' first, then playlist's
+//   string table           dbpl_string_t[n_strings]
+//   string data            zero-terminated strings, multivalue ones contain inner zeros
+//
+// Each distinct key and value is stored once, and referenced by its index in the string table.
+// All integers are in host byte order, like in the 1.x format.
+
+#define DBPL_MAJOR_VER 2
+#define DBPL_MINOR_VER 0
+
+typedef struct {
+    char magic[4]; // "DBPL"
+    uint8_t majorver;
+    uint8_t minorver;
+    uint16_t reserved;
+    uint32_t n_tracks;
+    uint32_t n_meta;
+    uint32_t n_plt_meta;
+    uint32_t n_strings;
+    uint64_t tracks_offset;
+    uint64_t meta_offset;
+    uint64_t strings_offset;
+    uint64_t strdata_offset;
+    uint64_t strdata_size;
+} dbpl_header_t;
+
+#define DBPL_TRACK_HAS_STARTSAMPLE64 (1<<0)
+#define DBPL_TRACK_HAS_ENDSAMPLE64 (1<<1)
+
+typedef struct {
+    int64_t startsample64;
+    int64_t endsample64;
+    int32_t startsample;
+    int32_t endsample;
+    float duration;
+    uint32_t flags; // DDB_IS_SUBTRACK, etc
+    uint32_t bits; // DBPL_TRACK_*
+    uint32_t meta_start; // first dbpl_meta_t record of the track
+    uint32_t meta_count;
+    uint32_t reserved;
+} dbpl_track_t;
+
+typedef struct {
+    uint32_t key; // string index
+    uint32_t value; // string index
+} dbpl_meta_t;
+
+typedef struct {
+    uint32_t offset; // relative to strdata_offset
+    uint32_t size; // including the terminating zero
+} dbpl_string_t;
+
+// writes the playlist into fname, returns 0 on success, -1 on error;
+// must be called with pl_lock held
+int
+plfile_save (playlist_t *plt, const char *fname, int (*cb)(playItem_t *it, void *data), void *user_data);
+
+// appends tracks from fname to the end of the playlist, and loads playlist metadata;
+// returns the last added item (without reference), or NULL
+playItem_t *
+plfile_load (playlist_t *plt, const char *fname);
+
+#endif // __PLFILE_H
@@ -0,0 +1,258 @@
+/*
+  This file is part of Deadbeef Player source code
+  http://deadbeef.sourceforge.net
+
+  playlist index management
+
+  Copyright (C) 2009-2018 Alexey Yakovenko
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+
+  Alexey Yakovenko waker@users.sourceforge.net
+*/
+#include <stdlib.h>
+#include <string.h>
+#include "plindex.h"
+
+#define NODE(it) ((it)->_index[iter])
+
+static inline uint32_t
+_size (playItem_t *it, int iter) {
+    return it ? NODE(it).size : 0;
+}
+
+static inline void
+_update_size (playItem_t *it, int iter) {
+    NODE(it).size = 1 + _size (NODE(it).left, iter) + _size (NODE(it).right, iter);
+}
+
+static uint32_t
+_random_prio (void) {
+    return ((uint32_t)rand () << 16) ^ (uint32_t)rand ();
+}
+
+// rotate `it` one level up, replacing its parent
+static void
+_rotate_up (playlist_t *plt, int iter, playItem_t *it) {
+    playItem_t *p = NODE(it).parent;
+    playItem_t *g = NODE(p).parent;
+
+    if (NODE(p).left == it) {
+        NODE(p).left = NODE(it).right;
+        if (NODE(it).right) {
+            NODE(NODE(it).right).parent = p;
+        }
+        NODE(it).right = p;
+    }
+    else {
+        NODE(p).right = NODE(it).left;
+        if (NODE(it).left) {
+            NODE(NODE(it).left).parent = p;
+        }
+        NODE(it).left = p;
+    }
+    NODE(p).parent = it;
+    NODE(it).parent = g;
+
+    if (!g) {
+        plt->index_root[iter] = it;
+    }
+    else if (NODE(g).left == p) {
+        NODE(g).left = it;
+    }
+    else {
+        NODE(g).right = it;
+    }
+
+    _update_size (p, iter);
+    _update_size (it, iter);
+}
+
+void
+plt_index_insert (playlist_t *plt, int iter, playItem_t *after, playItem_t *it) {
+    memset (&NODE(it), 0, sizeof (pl_index_node_t));
+    NODE(it).size = 1;
+    NODE(it).prio = _random_prio ();
+
+    playItem_t *root = plt->index_root[iter];
+    if (!root) {
+        plt->index_root[iter] = it;
+        return;
+    }
+
+    // the new node becomes the leftmost node of the subtree following `after`
+    playItem_t *p;
+    int left;
+    if (!after) {
+        p = root;
+        left = 1;
+    }
+    else if (!NODE(after).right) {
+        p = after;
+        left = 0;
+    }
+    else {
+        p = NODE(after).right;
+        left = 1;
+    }
+    if (left) {
+        while (NODE(p).left) {
+            p = NODE(p).left;
+        }
+        NODE(p).left = it;
+    }
+    else {
+        NODE(p).right = it;
+    }
+    NODE(it).parent = p;
+
+    for (playItem_t *n = p; n; n = NODE(n).parent) {
+        NODE(n).size++;
+    }
+
+    while (NODE(it).parent && NODE(NODE(it).parent).prio < NODE(it).prio) {
+        _rotate_up (plt, iter, it);
+    }
+}
+
+void
+plt_index_remove (playlist_t *plt, int iter, playItem_t *it) {
+    // sink the node down to a leaf, preserving the heap order of the children
+    while (NODE(it).left || NODE(it).right) {
+        playItem_t *l = NODE(it).left;
+        playItem_t *r = NODE(it).right;
+        playItem_t *c;
+        if (!l) {
+            c = r;
+        }
+        else if (!r) {
+            c = l;
+        }
+        else {
+            c = NODE(l).prio > NODE(r).prio ? l : r;
+        }
+        _rotate_up (plt, iter, c);
+    }
+
+    playItem_t *p = NODE(it).parent;
+    if (!p) {
+        if (plt->index_root[iter] == it) {
+            plt->index_root[iter] = NULL;
+        }
+    }
+    else {
+        if (NODE(p).left == it) {
+            NODE(p).left = NULL;
+        }
+        else {
+            NODE(p).right = NULL;
+        }
+        for (playItem_t *n = p; n; n = NODE(n).parent) {
+            NODE(n).size--;
+        }
+    }
+    memset (&NODE(it), 0, sizeof (pl_index_node_t));
+}
+
+// build a perfectly balanced subtree from `count` list items starting at *cursor,
+// priorities are assigned by height, so that the heap order holds
+static playItem_t *
+_build (int iter, playItem_t **cursor, int count, uint32_t *height) {
+    if (count <= 0) {
+        *height = 0;
+        return NULL;
+    }
+    uint32_t lh, rh;
+    int nleft = count / 2;
+    playItem_t *left = _build (iter, cursor, nleft, &lh);
+    playItem_t *it = *cursor;
+    *cursor = it->next[iter];
+    playItem_t *right = _build (iter, cursor, count - nleft - 1, &rh);
+
+    *height = (lh > rh ? lh : rh) + 1;
+
+    NODE(it).parent = NULL;
+    NODE(it).left = left;
+    NODE(it).right = right;
+    NODE(it).size = count;
+    NODE(it).prio = (*height << 26) | (_random_prio () & 0x3ffffff);
+    if (left) {
+        NODE(left).parent = it;
+    }
+    if (right) {
+        NODE(right).parent = it;
+    }
+    return it;
+}
+
+void
+plt_index_rebuild (playlist_t *plt, int iter) {
+    playItem_t *cursor = plt->head[iter];
+    uint32_t height;
+    plt->index_root[iter] = _build (iter, &cursor, plt->count[iter], &height);
+}
+
+void
+plt_index_clear (playlist_t *plt, int iter) {
+    for (playItem_t *it = plt->head[iter]; it; it = it->next[iter]) {
+        memset (&NODE(it), 0, sizeof (pl_index_node_t));
+    }
+    plt->index_root[iter] = NULL;
+}
+
+playItem_t *
+plt_index_get (playlist_t *plt, int iter, int idx) {
+    if (idx < 0) {
+        return NULL;
+    }
+    playItem_t *n = plt->index_root[iter];
+    while (n) {
+        int ls = (int)_size (NODE(n).left, iter);
+        if (idx < ls) {
+            n = NODE(n).left;
+        }
+        else if (idx == ls) {
+            return n;
+        }
+        else {
+            idx -= ls + 1;
+            n = NODE(n).right;
+        }
+    }
+    return NULL;
+}
+
+int
+plt_index_find (playlist_t *plt, int iter, playItem_t *it) {
+    if (!it || !NODE(it).size) {
+        return -1;
+    }
+    int idx = _size (NODE(it).left, iter);
+    playItem_t *n = it;
+    while (NODE(n).parent) {
+        playItem_t *p = NODE(n).parent;
+        if (NODE(p).right == n) {
+            idx += _size (NODE(p).left, iter) + 1;
+        }
+        n = p;
+    }
+    // the item may belong to a different playlist
+    if (n != plt->index_root[iter]) {
+        return -1;
+    }
+    return idx;
+}
@@ -0,0 +1,60 @@
+/*
+  This file is part of Deadbeef Player source code
+  http://deadbeef.sourceforge.net
+
+  playlist index management
+
+  Copyright (C) 2009-2018 Alexey Yakovenko
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+
+  Alexey Yakovenko waker@users.sourceforge.net
+*/
+
+#ifndef __PLINDEX_H
+#define __PLINDEX_H
+
+#include "playlist.h"
+
+// The index is an implicit treap per playlist iterator, keyed by position.
+// It must be kept in sync with the next/prev linked lists by whoever relinks them,
+// and all functions must be called with pl_lock held.
+
+// link `it` into the index right after `after` (NULL means at the head)
+void
+plt_index_insert (playlist_t *plt, int iter, playItem_t *after, playItem_t *it);
+
+void
+plt_index_remove (playlist_t *plt, int iter, playItem_t *it);
+
+// rebuild the index from the linked list, in O(n); used after the list was reordered in bulk
+void
+plt_index_rebuild (playlist_t *plt, int iter);
+
+// drop the index, and reset the nodes of all items in the linked list
+void
+plt_index_clear (playlist_t *plt, int iter);
+
+// returns the item at idx, or NULL; doesn't add reference
+playItem_t *
+plt_index_get (playlist_t *plt, int iter, int idx);
+
+// returns the index of the item, or -1 if it's not in the list
+int
+plt_index_find (playlist_t *plt, int iter, playItem_t *it);
+
+#endif // __PLINDEX_H
@@ -27,6 +27,7 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include "playlist.h"
 #include "deadbeef.h"
 #include "metacache.h"
@@ -34,18 +35,288 @@
 #define LOCK {pl_lock();}
 #define UNLOCK {pl_unlock();}
 
+// Metadata of a track is still kept as a DB_metaInfo_t linked list, since
+// plugins walk it directly, but lookups don't go through the list:
+// every key is interned in a global registry, which maps it (case-insensitively)
+// to a small integer id, and each track keeps a sorted array of key ids and nodes.
+// Finding a key is then a single hash lookup, and a binary search over a few ints.
+
+typedef struct {
+    const char *key; // metacache string, never released
+    uint32_t hash;
+    uint32_t id;
+    uint32_t override_id; // for ":KEY", the id of "!KEY" once it's been seen
+} pl_meta_key_t;
+
+typedef struct pl_meta_key_table_s {
+    uint32_t size;
+    // previous, smaller tables are never freed, since readers may still be probing them
+    struct pl_meta_key_table_s *retired;
+    pl_meta_key_t *slots[];
+} pl_meta_key_table_t;
+
+static pl_meta_key_table_t * volatile _key_table;
+static uint32_t _key_count;
+
+// per-track index: header, followed by `size` key ids in ascending order,
+// followed by the node pointers in the same order;
+// it grows in small steps, so it stays close to the number of keys of the track
+struct pl_meta_index_s {
+    uint32_t count;
+    uint32_t size;
+};
+
+#define INDEX_KEYS(idx) ((uint32_t *)((idx) + 1))
+#define INDEX_NODES(idx) ((DB_metaInfo_t **)(INDEX_KEYS(idx) + (((idx)->size + 1) & ~1)))
+
+#define META_INDEX_GROW_STEP 8
+
+// nodes are allocated in blocks, instead of individual mallocs;
+// all pool and registry modifications happen with pl_lock held
+#define META_NODE_BLOCK_SIZE 1024
+
+static DB_metaInfo_t *_node_freelist;
+
+static uint32_t
+_key_hash (const char *key) {
+    // FNV-1a over ascii-lowercased bytes, to match strcasecmp
+    uint32_t h = 2166136261u;
+    for (const uint8_t *p = (const uint8_t *)key; *p; p++) {
+        uint8_t c = *p;
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        h = (h ^ c) * 16777619u;
+    }
+    return h;
+}
+
+static pl_meta_key_t *
+_key_find (const char *key, uint32_t hash) {
+    pl_meta_key_table_t *t = _key_table;
+    if (!t) {
+        return NULL;
+    }
+    uint32_t mask = t->size - 1;
+    for (uint32_t i = hash & mask; ; i = (i + 1) & mask) {
+        pl_meta_key_t *k = t->slots[i];
+        if (!k) {
+            return NULL;
+        }
+        if (k->hash == hash && !strcasecmp (k->key, key)) {
+            return k;
+        }
+    }
+}
+
+static void
+_key_table_insert (pl_meta_key_table_t *t, pl_meta_key_t *k) {
+    uint32_t mask = t->size - 1;
+    uint32_t i = k->hash & mask;
+    while (t->slots[i]) {
+        i = (i + 1) & mask;
+    }
+    // make sure the entry is complete before it becomes visible to lockless readers
+    __sync_synchronize ();
+    t->slots[i] = k;
+}
+
+static void
+_key_table_grow (void) {
+    pl_meta_key_table_t *old = _key_table;
+    uint32_t size = old ? old->size * 2 : 256;
+    pl_meta_key_table_t *t = calloc (1, sizeof (pl_meta_key_table_t) + size * sizeof (pl_meta_key_t *));
+    t->size = size;
+    t->retired = old;
+    if (old) {
+        for (uint32_t i = 0; i < old->size; i++) {
+            if (old->slots[i]) {
+                _key_table_insert (t, old->slots[i]);
+            }
+        }
+    }
+    __sync_synchronize ();
+    _key_table = t;
+}
+
+static pl_meta_key_t *
+_key_register (const char *key) {
+    uint32_t hash = _key_hash (key);
+    pl_meta_key_t *k = _key_find (key, hash);
+    if (k) {
+        return k;
+    }
+
+    if (!_key_table || (_key_count + 1) * 2 > _key_table->size) {
+        _key_table_grow ();
+    }
+
+    k = calloc (1, sizeof (pl_meta_key_t));
+    k->key = metacache_add_string (key);
+    k->hash = hash;
+    k->id = ++_key_count;
+    _key_table_insert (_key_table, k);
+
+    // link ":KEY" with its "!KEY" override
+    if (key[0] == ':' || key[0] == '!') {
+        size_t l = strlen (key);
+        char *other = malloc (l + 1);
+        memcpy (other, key, l + 1);
+        if (key[0] == '!') {
+            other[0] = ':';
+            _key_register (other)->override_id = k->id;
+        }
+        else {
+            other[0] = '!';
+            pl_meta_key_t *o = _key_find (other, _key_hash (other));
+            if (o) {
+                k->override_id = o->id;
+            }
+        }
+        free (other);
+    }
+    return k;
+}
+
+// returns the position of the id, or where it would be inserted
+static uint32_t
+_index_lower_bound (struct pl_meta_index_s *idx, uint32_t id) {
+    uint32_t *keys = INDEX_KEYS(idx);
+    uint32_t lo = 0;
+    uint32_t hi = idx->count;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (keys[mid] < id) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static DB_metaInfo_t *
+_index_find (playItem_t *it, uint32_t id) {
+    struct pl_meta_index_s *idx = it->_meta_index;
+    if (!idx) {
+        return NULL;
+    }
+    uint32_t i = _index_lower_bound (idx, id);
+    if (i < idx->count && INDEX_KEYS(idx)[i] == id) {
+        return INDEX_NODES(idx)[i];
+    }
+    return NULL;
+}
+
+static size_t
+_index_alloc_size (uint32_t size) {
+    // the key ids are padded to keep the node pointers aligned
+    return sizeof (struct pl_meta_index_s) + ((size + 1) & ~1) * sizeof (uint32_t) + size * sizeof (DB_metaInfo_t *);
+}
+
+static void
+_index_add (playItem_t *it, uint32_t id, DB_metaInfo_t *m) {
+    struct pl_meta_index_s *idx = it->_meta_index;
+    if (!idx || idx->count == idx->size) {
+        uint32_t size = (idx ? idx->size : 0) + META_INDEX_GROW_STEP;
+        struct pl_meta_index_s *n = malloc (_index_alloc_size (size));
+        n->size = size;
+        n->count = 0;
+        if (idx) {
+            n->count = idx->count;
+            memcpy (INDEX_KEYS(n), INDEX_KEYS(idx), idx->count * sizeof (uint32_t));
+            memcpy (INDEX_NODES(n), INDEX_NODES(idx), idx->count * sizeof (DB_metaInfo_t *));
+            free (idx);
+        }
+        idx = it->_meta_index = n;
+    }
+    uint32_t i = _index_lower_bound (idx, id);
+    uint32_t tail = idx->count - i;
+    memmove (INDEX_KEYS(idx) + i + 1, INDEX_KEYS(idx) + i, tail * sizeof (uint32_t));
+    memmove (INDEX_NODES(idx) + i + 1, INDEX_NODES(idx) + i, tail * sizeof (DB_metaInfo_t *));
+    INDEX_KEYS(idx)[i] = id;
+    INDEX_NODES(idx)[i] = m;
+    idx->count++;
+}
+
+static void
+_index_remove (playItem_t *it, DB_metaInfo_t *m) {
+    struct pl_meta_index_s *idx = it->_meta_index;
+    if (!idx) {
+        return;
+    }
+    pl_meta_key_t *k = _key_find (m->key, _key_hash (m->key));
+    if (!k) {
+        return;
+    }
+    uint32_t i = _index_lower_bound (idx, k->id);
+    if (i < idx->count && INDEX_NODES(idx)[i] == m) {
+        idx->count--;
+        uint32_t tail = idx->count - i;
+        memmove (INDEX_KEYS(idx) + i, INDEX_KEYS(idx) + i + 1, tail * sizeof (uint32_t));
+        memmove (INDEX_NODES(idx) + i, INDEX_NODES(idx) + i + 1, tail * sizeof (DB_metaInfo_t *));
+    }
+}
+
+static DB_metaInfo_t *
+_node_alloc (void) {
+    if (!_node_freelist) {
+        DB_metaInfo_t *block = malloc (META_NODE_BLOCK_SIZE * sizeof (DB_metaInfo_t));
+        for (int i = 0; i < META_NODE_BLOCK_SIZE - 1; i++) {
+            block[i].next = &block[i+1];
+        }
+        block[META_NODE_BLOCK_SIZE-1].next = NULL;
+        _node_freelist = block;
+    }
+    DB_metaInfo_t *m = _node_freelist;
+    _node_freelist = m->next;
+    memset (m, 0, sizeof (DB_metaInfo_t));
+    return m;
+}
+
+static void
+_node_free (DB_metaInfo_t *m) {
+    m->next = _node_freelist;
+    _node_freelist = m;
+}
+
+// unlink and release a node, prev is the node before it in the list
+static void
+_meta_unlink (playItem_t *it, DB_metaInfo_t *prev, DB_metaInfo_t *m) {
+    if (prev) {
+        prev->next = m->next;
+    }
+    else {
+        it->meta = m->next;
+    }
+    _index_remove (it, m);
+    metacache_remove_string (m->key);
+    pl_meta_free_values (m);
+    _node_free (m);
+}
 
 DB_metaInfo_t *
 pl_meta_for_key (playItem_t *it, const char *key) {
     pl_ensure_lock ();
-    DB_metaInfo_t *m = it->meta;
-    while (m) {
-        if (!strcasecmp (key, m->key)) {
-            return m;
-        }
-        m = m->next;
+    if (!it->_meta_index) {
+        return NULL;
     }
-    return NULL;
+    pl_meta_key_t *k = _key_find (key, _key_hash (key));
+    return k ? _index_find (it, k->id) : NULL;
+}
+
+uint32_t
+pl_meta_key_id (const char *key) {
+    pl_lock ();
+    uint32_t id = _key_register (key)->id;
+    pl_unlock ();
+    return id;
+}
+
+DB_metaInfo_t *
+pl_meta_for_key_id (playItem_t *it, uint32_t key_id) {
+    return _index_find (it, key_id);
 }
 
 void
@@ -55,20 +326,37 @@ pl_meta_free_values (DB_metaInfo_t *meta) {
     meta->valuesize = 0;
 }
 
-DB_metaInfo_t *
-pl_add_empty_meta_for_key (playItem_t *it, const char *key) {
+void
+pl_item_free_meta (playItem_t *it) {
+    LOCK;
+    while (it->meta) {
+        DB_metaInfo_t *m = it->meta;
+        it->meta = m->next;
+        metacache_remove_string (m->key);
+        pl_meta_free_values (m);
+        _node_free (m);
+    }
+    free (it->_meta_index);
+    it->_meta_index = NULL;
+    UNLOCK;
+}
+
+static DB_metaInfo_t *
+_add_empty_meta (playItem_t *it, const char *key, int key_interned) {
+    pl_meta_key_t *k = _key_register (key);
+
     // check if it's already set
+    if (_index_find (it, k->id)) {
+        return NULL;
+    }
+
     DB_metaInfo_t *normaltail = NULL;
     DB_metaInfo_t *propstart = NULL;
     DB_metaInfo_t *tail = NULL;
     DB_metaInfo_t *m = it->meta;
     while (m) {
-        if (!strcasecmp (key, m->key)) {
-            // duplicate key
-            return NULL;
-        }
         // find end of normal metadata
-        if (!normaltail && (!m->next || m->key[0] == ':' || m->key[0] == '_' || m->key[0] == '!')) {
+        if (!propstart && (m->key[0] == ':' || m->key[0] == '_' || m->key[0] == '!')) {
             normaltail = tail;
             propstart = m;
             if (key[0] != ':' && key[0] != '_' && key[0] != '!') {
@@ -79,9 +367,19 @@ pl_add_empty_meta_for_key (playItem_t *it, const char *key) {
         tail = m;
         m = m->next;
     }
+    if (!propstart) {
+        // no properties, the normal metadata ends at the tail
+        normaltail = tail;
+    }
     // add
-    m = calloc (1, sizeof (DB_metaInfo_t));
-    m->key = metacache_add_string (key);
+    m = _node_alloc ();
+    if (key_interned) {
+        metacache_ref (key);
+        m->key = key;
+    }
+    else {
+        m->key = metacache_add_string (key);
+    }
 
     if (key[0] == ':' || key[0] == '_' || key[0] == '!') {
         if (tail) {
@@ -101,9 +399,28 @@ pl_add_empty_meta_for_key (playItem_t *it, const char *key) {
         }
     }
 
+    _index_add (it, k->id, m);
+
     return m;
 }
 
+DB_metaInfo_t *
+pl_add_empty_meta_for_key (playItem_t *it, const char *key) {
+    return _add_empty_meta (it, key, 0);
+}
+
+void
+pl_add_meta_interned (playItem_t *it, const char *key, const char *value, int valuesize) {
+    pl_lock ();
+    DB_metaInfo_t *m = _add_empty_meta (it, key, 1);
+    if (m) {
+        metacache_ref (value);
+        m->value = value;
+        m->valuesize = valuesize;
+    }
+    pl_unlock ();
+}
+
 static char *
 _strip_empty (const char *value, int size, int *outsize) {
     char *data = malloc (size);
@@ -156,12 +473,12 @@ pl_add_meta_full (playItem_t *it, const char *key, const char *value, int values
         return;
     }
 
+    pl_lock ();
     DB_metaInfo_t *meta = pl_add_empty_meta_for_key (it, key);
-    if (!meta) {
-        return;
+    if (meta) {
+        _meta_set_value (meta, value, valuesize);
     }
-
-    _meta_set_value (meta, value, valuesize);
+    pl_unlock ();
 }
 
 void
@@ -294,18 +611,11 @@ void
 pl_delete_meta (playItem_t *it, const char *key) {
     pl_lock ();
     DB_metaInfo_t *prev = NULL;
+    DB_metaInfo_t *meta = pl_meta_for_key (it, key);
     DB_metaInfo_t *m = it->meta;
-    while (m) {
-        if (!strcasecmp (key, m->key)) {
-            if (prev) {
-                prev->next = m->next;
-            }
-            else {
-                it->meta = m->next;
-            }
-            metacache_remove_string (m->key);
-            pl_meta_free_values(m);
-            free (m);
+    while (meta && m) {
+        if (m == meta) {
+            _meta_unlink (it, prev, m);
             break;
         }
         prev = m;
@@ -317,26 +627,25 @@ pl_delete_meta (playItem_t *it, const char *key) {
 const char *
 pl_find_meta (playItem_t *it, const char *key) {
     pl_ensure_lock ();
-    DB_metaInfo_t *m = it->meta;
-
-    if (key && key[0] == ':') {
-        // try to find an override
-        while (m) {
-            if (m->key[0] == '!' && !strcasecmp (key+1, m->key+1)) {
-                return m->value;
-            }
-            m = m->next;
-        }
+    if (!it->_meta_index) {
+        return NULL;
+    }
+    pl_meta_key_t *k = _key_find (key, _key_hash (key));
+    if (!k) {
+        // never seen on any track
+        return NULL;
     }
 
-    m = it->meta;
-    while (m) {
-        if (!strcasecmp (key, m->key)) {
+    DB_metaInfo_t *m;
+    if (k->override_id) {
+        m = _index_find (it, k->override_id);
+        if (m) {
             return m->value;
         }
-        m = m->next;
     }
-    return NULL;
+
+    m = _index_find (it, k->id);
+    return m ? m->value : NULL;
 }
 
 const char *
@@ -347,28 +656,28 @@ pl_find_meta_raw (playItem_t *it, const char *key) {
 
 int
 pl_find_meta_int (playItem_t *it, const char *key, int def) {
-    pl_lock ();
+    pl_lock_shared ();
     const char *val = pl_find_meta (it, key);
     int res = val ? atoi (val) : def;
-    pl_unlock ();
+    pl_unlock_shared ();
     return res;
 }
 
 int64_t
 pl_find_meta_int64 (playItem_t *it, const char *key, int64_t def) {
-    pl_lock ();
+    pl_lock_shared ();
     const char *val = pl_find_meta (it, key);
     int64_t res = val ? atoll (val) : def;
-    pl_unlock ();
+    pl_unlock_shared ();
     return res;
 }
 
 float
 pl_find_meta_float (playItem_t *it, const char *key, float def) {
-    pl_lock ();
+    pl_lock_shared ();
     const char *val = pl_find_meta (it, key);
     float res = val ? atof (val) : def;
-    pl_unlock ();
+    pl_unlock_shared ();
     return res;
 }
 
@@ -384,15 +693,7 @@ pl_delete_metadata (playItem_t *it, DB_metaInfo_t *meta) {
     DB_metaInfo_t *m = it->meta;
     while (m) {
         if (m == meta) {
-            if (prev) {
-                prev->next = m->next;
-            }
-            else {
-                it->meta = m->next;
-            }
-            metacache_remove_string (m->key);
-            pl_meta_free_values(m);
-            free (m);
+            _meta_unlink (it, prev, m);
             break;
         }
         prev = m;
@@ -412,15 +713,7 @@ pl_delete_all_meta (playItem_t *it) {
             prev = m;
         }
         else {
-            if (prev) {
-                prev->next = next;
-            }
-            else {
-                it->meta = next;
-            }
-            metacache_remove_string (m->key);
-            pl_meta_free_values (m);
-            free (m);
+            _meta_unlink (it, prev, m);
         }
         m = next;
     }
@@ -433,46 +726,46 @@ pl_delete_all_meta (playItem_t *it) {
 int
 pl_get_meta (playItem_t *it, const char *key, char *val, int size) {
     *val = 0;
-    pl_lock ();
+    pl_lock_shared ();
     const char *v = pl_find_meta (it, key);
     if (!v) {
-        pl_unlock ();
+        pl_unlock_shared ();
         return 0;
     }
     strncpy (val, v, size);
-    pl_unlock ();
+    pl_unlock_shared ();
     return 1;
 }
 
 int
 pl_get_meta_raw (playItem_t *it, const char *key, char *val, int size) {
     *val = 0;
-    pl_lock ();
+    pl_lock_shared ();
     const char *v = pl_find_meta_raw (it, key);
     if (!v) {
-        pl_unlock ();
+        pl_unlock_shared ();
         return 0;
     }
     strncpy (val, v, size);
-    pl_unlock ();
+    pl_unlock_shared ();
     return 1;
 }
 
 int
 pl_meta_exists (playItem_t *it, const char *key) {
-    pl_lock ();
+    pl_lock_shared ();
     const char *v = pl_find_meta (it, key);
-    pl_unlock ();
+    pl_unlock_shared ();
     return v ? 1 : 0;
 }
 
 void
 pl_add_meta_copy (playItem_t *it, DB_metaInfo_t *meta) {
+    pl_lock ();
     DB_metaInfo_t *m = pl_add_empty_meta_for_key(it, meta->key);
-    if (!m) {
-        return; // dupe
+    if (m) {
+        m->value = metacache_add_value (meta->value, meta->valuesize);
+        m->valuesize = meta->valuesize;
     }
-
-    m->value = metacache_add_value (meta->value, meta->valuesize);
-    m->valuesize = meta->valuesize;
+    pl_unlock ();
 }
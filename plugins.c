@@ -498,6 +498,20 @@ static DB_functions_t deadbeef_api = {
 
     .plt_is_loading_cue = (int (*)(ddb_playlist_t *))plt_is_loading_cue,
 
+    // ******* new 1.11 APIs ********
+    .pl_lock_shared = pl_lock_shared,
+    .pl_unlock_shared = pl_unlock_shared,
+    .pl_get_lock_stats = pl_get_lock_stats,
+    .metacache_get_stats = metacache_get_stats,
+    .tf_eval_batch = tf_eval_batch,
+    .streamer_get_stats = streamer_get_stats,
+    .conf_key_get = conf_key_get,
+    .conf_key_get_str = conf_key_get_str,
+    .conf_key_get_float = conf_key_get_float,
+    .conf_key_get_int = conf_key_get_int,
+    .conf_key_get_int64 = conf_key_get_int64,
+    .messagepump_get_stats = messagepump_get_stats,
+
 };
 
 DB_functions_t *deadbeef = &deadbeef_api;
@@ -61,6 +61,7 @@
 #include "cache.h"
 #include "artwork.h"
 #include "mp4ff.h"
+#include "../../shared/imgresample.h"
 
 //#define trace(...) { fprintf (stderr, __VA_ARGS__); }
 #define trace(...)
@@ -131,51 +132,6 @@ scale_dimensions (int scaled_size, int width, int height, unsigned int *scaled_w
 }
 
 #ifndef USE_IMLIB2
-#ifdef USE_BICUBIC
-static float cerp (float p0, float p1, float p2, float p3, float d, float d2, float d3)
-{
-    /* Cubic Hermite spline (a = -0.5, Catmull-Rom) */
-    return p1 - (p0*d3 - 3*p1*d3 + 3*p2*d3 - p3*d3 - 2*p0*d2 + 5*p1*d2 - 4*p2*d2 + p3*d2 + p0*d - p2*d)/2;
-}
-
-static int_fast16_t bcerp (const png_byte *row0, const png_byte *row1, const png_byte *row2, const png_byte *row3,
-                      const uint_fast32_t x0, const uint_fast32_t x1, const uint_fast32_t x2, const uint_fast32_t x3, const uint_fast8_t component,
-                      float dx, float dx2, float dx3, float dy, float dy2, float dy3) {
-    const uint_fast32_t index0 = x0 + component;
-    const uint_fast32_t index1 = x1 + component;
-    const uint_fast32_t index2 = x2 + component;
-    const uint_fast32_t index3 = x3 + component;
-    float p0 = cerp (row0[index0], row1[index0], row2[index0], row3[index0], dy, dy2, dy3);
-    float p1 = cerp (row0[index1], row1[index1], row2[index1], row3[index1], dy, dy2, dy3);
-    float p2 = cerp (row0[index2], row1[index2], row2[index2], row3[index2], dy, dy2, dy3);
-    float p3 = cerp (row0[index3], row1[index3], row2[index3], row3[index3], dy, dy2, dy3);
-    return cerp (p0, p1, p2, p3, dx, dx2, dx3) + 0.5;
-}
-#endif
-static uint_fast32_t blerp_pixel (const png_byte *row, const png_byte *next_row, const uint_fast32_t x_index, const uint_fast32_t next_x_index,
-                                 const uint_fast32_t weight, const uint_fast32_t weightx, const uint_fast32_t weighty, const uint_fast32_t weightxy)
-{
-    return row[x_index]*weight + row[next_x_index]*weightx + next_row[x_index]*weighty + next_row[next_x_index]*weightxy;
-}
-
-static uint_fast32_t *
-calculate_quick_dividers (float scaling_ratio)
-{
-    /* Replace slow divisions by expected numbers with faster multiply/shift combo */
-    const uint16_t max_sample_size = scaling_ratio + 1;
-    uint_fast32_t *dividers = malloc ((max_sample_size * max_sample_size + 1) * sizeof (uint_fast32_t));
-    if (dividers) {
-        for (uint16_t y = max_sample_size; y; y--) {
-            for (uint16_t x = y; x; x--) {
-                const uint32_t num_pixels = x * y;
-                /* Accurate to 1/256 for up to 256 pixels and always for powers of 2 */
-                dividers[num_pixels] = num_pixels <= 256 || !(num_pixels & (num_pixels - 1)) ? 256*256/num_pixels : 0;
-            }
-        }
-    }
-    return dividers;
-}
-
 typedef struct {
     struct jpeg_error_mgr pub;	/* "public" fields */
     jmp_buf setjmp_buffer;	/* for return to caller */
@@ -193,6 +149,17 @@ my_error_exit (j_common_ptr cinfo)
   longjmp (myerr->setjmp_buffer, 1);
 }
 
+/* The largest DCT-domain downscale (1/8 to 1/1) which still leaves at least the target size,
+   so the decoder skips most of the work, and the resampler only does the final step */
+static unsigned int
+jpeg_prescale_denom (unsigned int width, unsigned int height, unsigned int scaled_width, unsigned int scaled_height)
+{
+    unsigned int denom = 8;
+    while (denom > 1 && ((width + denom - 1) / denom < scaled_width || (height + denom - 1) / denom < scaled_height)) {
+        denom /= 2;
+    }
+    return denom;
+}
 
 static int
 jpeg_resize (const char *fname, const char *outname, int scaled_size) {
@@ -200,8 +167,8 @@ jpeg_resize (const char *fname, const char *outname, int scaled_size) {
     FILE *fp = NULL, *out = NULL;
     struct jpeg_decompress_struct cinfo;
     struct jpeg_compress_struct cinfo_out;
-    void *sample_rows_buffer = NULL;
-    uint_fast32_t *quick_dividers = NULL;
+    JSAMPLE * volatile scanline = NULL;
+    img_resampler_t * volatile resampler = NULL;
     my_error_mgr_t jerr;
 
     cinfo.mem = cinfo_out.mem = NULL;
@@ -211,11 +178,11 @@ jpeg_resize (const char *fname, const char *outname, int scaled_size) {
         trace ("failed to scale %s as jpeg\n", outname);
         jpeg_destroy_decompress (&cinfo);
         jpeg_destroy_compress (&cinfo_out);
-        if (sample_rows_buffer) {
-            free (sample_rows_buffer);
+        if (scanline) {
+            free (scanline);
         }
-        if (quick_dividers) {
-            free (quick_dividers);
+        if (resampler) {
+            img_resampler_free (resampler);
         }
         if (fp) {
             fclose (fp);
@@ -243,18 +210,27 @@ jpeg_resize (const char *fname, const char *outname, int scaled_size) {
     jpeg_stdio_dest (&cinfo_out, out);
 
     jpeg_read_header (&cinfo, TRUE);
-    jpeg_start_decompress (&cinfo);
 
-    const unsigned int num_components = cinfo.output_components;
     const unsigned int width = cinfo.image_width;
     const unsigned int height = cinfo.image_height;
     unsigned int scaled_width, scaled_height;
     float scaling_ratio = scale_dimensions (scaled_size, width, height, &scaled_width, &scaled_height);
-    if (scaling_ratio >= 65535 || scaled_width < 1 || scaled_width > 32767 || scaled_height < 1 || scaled_width > 32767) {
+    if (scaling_ratio >= 65535 || scaled_width < 1 || scaled_width > 32767 || scaled_height < 1 || scaled_height > 32767) {
         trace ("scaling ratio (%g) or scaled image dimensions (%ux%u) are invalid\n", scaling_ratio, scaled_width, scaled_height);
         my_error_exit ((j_common_ptr)&cinfo);
     }
 
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = jpeg_prescale_denom (width, height, scaled_width, scaled_height);
+    jpeg_start_decompress (&cinfo);
+
+    const unsigned int num_components = cinfo.output_components;
+    resampler = img_resampler_new (cinfo.output_width, cinfo.output_height, scaled_width, scaled_height, num_components, 0);
+    scanline = malloc (cinfo.output_width * num_components * sizeof (JSAMPLE));
+    if (!resampler || !scanline) {
+        my_error_exit ((j_common_ptr)&cinfo);
+    }
+
     cinfo_out.image_width      = scaled_width;
     cinfo_out.image_height     = scaled_height;
     cinfo_out.input_components = num_components;
@@ -263,174 +239,25 @@ jpeg_resize (const char *fname, const char *outname, int scaled_size) {
     jpeg_set_quality (&cinfo_out, 95, TRUE);
     jpeg_start_compress (&cinfo_out, TRUE);
 
-    const uint_fast32_t row_components = width * num_components;
-    const uint_fast32_t scaled_row_components = scaled_width * num_components;
-    JSAMPLE out_line[scaled_row_components];
-    JSAMPROW out_row = out_line;
-
-    if (scaling_ratio > 2) {
-        /* Simple (unweighted) area sampling for large downscales */
-        quick_dividers = calculate_quick_dividers (scaling_ratio);
-        const uint16_t max_sample_height = scaling_ratio + 1;
-        sample_rows_buffer = malloc (max_sample_height * row_components * sizeof (JSAMPLE));
-        if (!sample_rows_buffer || !quick_dividers) {
-            my_error_exit ((j_common_ptr)&cinfo);
-        }
-        JSAMPROW rows[max_sample_height];
-        for (uint16_t row_index = 0; row_index < max_sample_height; row_index++) {
-            rows[row_index] = sample_rows_buffer + row_index*row_components;
-        }
-
-        /* Loop through all (down-)scaled pixels */
-        float y_interp = 0.5;
-        for (uint_fast16_t scaled_y = 0; scaled_y < scaled_height; scaled_y++) {
-            const uint_fast32_t y = y_interp;
-            const uint_fast32_t y_limit = y_interp += scaling_ratio;
-            const uint_fast16_t num_y_pixels = (y_limit < height ? y_limit : height) - y;
-
-            for (uint_fast16_t row_index = 0; row_index < num_y_pixels; row_index++) {
-                jpeg_read_scanlines (&cinfo, &rows[row_index], 1);
-            }
-
-            float x_interp = 0.5;
-            for (uint_fast32_t scaled_x = 0; scaled_x < scaled_row_components; scaled_x+=num_components) {
-                const uint_fast32_t x = x_interp;
-                x_interp += scaling_ratio;
-                const uint_fast32_t x_limit = x_interp < width ? x_interp : width;
-                const uint_fast32_t x_index = x * num_components;
-                const uint_fast32_t x_limit_index = x_limit * num_components;
-
-                /* Sum all values where the scaled pixel overlaps at least half a pixel in each direction */
-                const uint_fast32_t num_pixels = num_y_pixels * (x_limit - x);
-                const uint_fast32_t quick_divider = quick_dividers[num_pixels];
-                for (uint_fast8_t component=0; component<num_components; component++) {
-                    uint_fast32_t value = 0;
-                    for (uint_fast32_t pixel_index = x_index+component; pixel_index < x_limit_index; pixel_index+=num_components) {
-                        for (uint_fast16_t row_index = 0; row_index < num_y_pixels; row_index++) {
-                            value += rows[row_index][pixel_index];
-                        }
-                    }
-                    out_row[scaled_x+component] = quick_divider ? value * quick_divider >> 16 : value / num_pixels;
-                }
-            }
-
-            jpeg_write_scanlines (&cinfo_out, &out_row, 1);
-        }
-
-        free (sample_rows_buffer);
-        free (quick_dividers);
-    }
-    else {
-#ifndef USE_BICUBIC
-        /* Bilinear interpolation for upscales and modest downscales */
-        JSAMPLE scanline[row_components];
-        JSAMPLE next_scanline[row_components];
-        JSAMPROW row = scanline;
-        JSAMPROW next_row = next_scanline;
-        float downscale_offset = scaling_ratio < 1 ? 0 : (scaling_ratio - 1) / 2;
-        float y_interp = downscale_offset;
-        for (uint_fast16_t scaled_y = 0; scaled_y < scaled_height; scaled_y++, y_interp+=scaling_ratio) {
-            const uint_fast32_t y = y_interp;
-            const uint_fast16_t y_diff = (uint_fast32_t)(y_interp*256) - (y<<8);
-            const uint_fast16_t y_remn = 256 - y_diff;
-
-            if (cinfo.output_scanline < y+2) {
-                while (cinfo.output_scanline < y+1) {
-                    jpeg_read_scanlines (&cinfo, &next_row, 1);
-                }
-                memcpy (row, next_row, row_components*sizeof (JSAMPLE));
-                if (y+2 < height) {
-                    jpeg_read_scanlines (&cinfo, &next_row, 1);
-                }
-            }
-
-            float x_interp = downscale_offset;
-            for (uint_fast32_t scaled_x = 0; scaled_x < scaled_row_components; scaled_x+=num_components, x_interp+=scaling_ratio) {
-                const uint_fast32_t x = x_interp;
-                const uint_fast32_t x_index = x * num_components;
-                const uint_fast32_t next_x_index = x+1 < width ? x_index+num_components : x_index;
-
-                const uint_fast16_t x_diff = (uint_fast32_t)(x_interp*256) - (x<<8);
-                const uint_fast16_t x_remn = 256 - x_diff;
-                const uint_fast32_t weight = x_remn * y_remn;
-                const uint_fast32_t weightx = x_diff * y_remn;
-                const uint_fast32_t weighty = x_remn * y_diff;
-                const uint_fast32_t weightxy = x_diff * y_diff;
-
-                for (uint_fast8_t component=0; component<num_components; component++) {
-                    out_line[scaled_x + component] = blerp_pixel (row, next_row, x_index+component, next_x_index+component, weight, weightx, weighty, weightxy) >> 16;
-                }
-            }
-
-            jpeg_write_scanlines (&cinfo_out, &out_row, 1);
-        }
-#else
-        /* Bicubic interpolation to improve the scaled image quality */
-        JSAMPLE scanline0[row_components];
-        JSAMPLE scanline1[row_components];
-        JSAMPLE scanline2[row_components];
-        JSAMPLE scanline3[row_components];
-        JSAMPROW row0 = scanline0;
-        JSAMPROW row1 = scanline1;
-        JSAMPROW row2 = scanline2;
-        JSAMPROW row3 = scanline3;
-        jpeg_read_scanlines (&cinfo, &row1, 1);
-        memcpy (row2, row1, row_components*sizeof (JSAMPLE));
-
-        float downscale_offset = scaling_ratio < 1 ? 0 : (scaling_ratio - 1) / 2;
-        float y_interp = downscale_offset;
-        for (uint_fast16_t scaled_y = 0; scaled_y < scaled_height; scaled_y++, y_interp+=scaling_ratio) {
-            const uint_fast32_t y = y_interp;
-            float dy = y_interp - (int_fast32_t)y_interp;
-            float dy2 = dy * dy;
-            float dy3 = dy2 * dy;
-
-            if (cinfo.output_scanline < y+3) {
-                while (cinfo.output_scanline < y) {
-                    jpeg_read_scanlines (&cinfo, &row1, 1);
-                }
-                memcpy (row0, row1, row_components*sizeof (JSAMPLE));
-                if (cinfo.output_scanline < y+1) {
-                    jpeg_read_scanlines (&cinfo, &row2, 1);
-                }
-                memcpy (row1, row2, row_components*sizeof (JSAMPLE));
-                if (y+2 < height && cinfo.output_scanline < y+2) {
-                    jpeg_read_scanlines (&cinfo, &row3, 1);
-                }
-                memcpy (row2, row3, row_components*sizeof (JSAMPLE));
-                if (y+3 < height) {
-                    jpeg_read_scanlines (&cinfo, &row3, 1);
-                }
-            }
-
-            float x_interp = downscale_offset;
-            for (uint_fast32_t scaled_x = 0; scaled_x < scaled_row_components; scaled_x+=num_components, x_interp+=scaling_ratio) {
-                const uint_fast32_t x = x_interp;
-                const uint_fast32_t x1 = x * num_components;
-                const uint_fast32_t x0 = x > 0 ? x1-num_components : x1;
-                const uint_fast32_t x2 = x+1 < width ? x1+num_components : x1;
-                const uint_fast32_t x3 = x+2 < width ? x2+num_components : x2;
-
-                float dx = x_interp - (int_fast32_t)x_interp;
-                float dx2 = dx * dx;
-                float dx3 = dx2 * dx;
-
-                for (uint_fast8_t component=0; component<num_components; component++) {
-                    const int_fast16_t pixel = bcerp (row0, row1, row2, row3, x0, x1, x2, x3, component, dx, dx2, dx3, dy, dy2, dy3);
-                    out_row[scaled_x + component] = pixel < 0 ? 0 : pixel > 255 ? 255 : pixel;
-                }
-            }
-
+    JSAMPROW row = scanline;
+    while (cinfo.output_scanline < cinfo.output_height) {
+        jpeg_read_scanlines (&cinfo, &row, 1);
+        img_resampler_push_row (resampler, row);
+        JSAMPROW out_row;
+        while ((out_row = (JSAMPROW)img_resampler_pull_row (resampler))) {
             jpeg_write_scanlines (&cinfo_out, &out_row, 1);
         }
-#endif
     }
 
     jpeg_finish_compress (&cinfo_out);
+    jpeg_finish_decompress (&cinfo);
 
     jpeg_destroy_compress (&cinfo_out);
     jpeg_destroy_decompress (&cinfo);
 
+    img_resampler_free (resampler);
+    free (scanline);
+
     fclose (fp);
     fclose (out);
 
@@ -446,8 +273,7 @@ png_resize (const char *fname, const char *outname, int scaled_size) {
     int err = -1;
     FILE *fp = NULL;
     FILE *out = NULL;
-    png_byte *out_row = NULL;
-    uint_fast32_t *quick_dividers = NULL;
+    img_resampler_t *resampler = NULL;
 
     fp = fopen (fname, "rb");
     if (!fp) {
@@ -481,11 +307,19 @@ png_resize (const char *fname, const char *outname, int scaled_size) {
 
     unsigned int scaled_width, scaled_height;
     float scaling_ratio = scale_dimensions (scaled_size, width, height, &scaled_width, &scaled_height);
-    if (scaling_ratio >= 65535 || scaled_width < 1 || scaled_width > 32767 || scaled_height < 1 || scaled_width > 32767) {
+    if (scaling_ratio >= 65535 || scaled_width < 1 || scaled_width > 32767 || scaled_height < 1 || scaled_height > 32767) {
         trace ("scaling ratio (%g) or scaled image dimensions (%ux%u) are invalid\n", scaling_ratio, scaled_width, scaled_height);
         goto error;
     }
 
+    const uint8_t has_alpha = color_type & PNG_COLOR_MASK_ALPHA;
+    const uint8_t num_values = color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_GRAY_ALPHA ? 1 : 3;
+    const uint8_t num_components = num_values + (has_alpha ? 1 : 0);
+    resampler = img_resampler_new (width, height, scaled_width, scaled_height, num_components, has_alpha);
+    if (!resampler) {
+        goto error;
+    }
+
     out = fopen (outname, "w+b");
     if (!out) {
         trace ("failed to open %s for writing\n", outname);
@@ -516,249 +350,12 @@ png_resize (const char *fname, const char *outname, int scaled_size) {
     png_write_info (new_png_ptr, new_info_ptr);
     png_set_packing (new_png_ptr);
 
-    const uint8_t has_alpha = color_type & PNG_COLOR_MASK_ALPHA;
-    const uint8_t num_values = color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_GRAY_ALPHA ? 1 : 3;
-    const uint8_t num_components = num_values + (has_alpha ? 1 : 0);
-    const uint_fast32_t scaled_row_components = scaled_width * num_components;
-    out_row = malloc (scaled_row_components * sizeof (png_byte));
-    if (!out_row) {
-        goto error;
-    }
-
-    if (scaling_ratio > 2) {
-        /* Simple (unweighted) area sampling for large downscales */
-        quick_dividers = calculate_quick_dividers (scaling_ratio);
-        if (!quick_dividers) {
-            goto error;
+    for (png_uint_32 y = 0; y < height; y++) {
+        img_resampler_push_row (resampler, row_pointers[y]);
+        const png_byte *out_row;
+        while ((out_row = img_resampler_pull_row (resampler))) {
+            png_write_row (new_png_ptr, (png_bytep)out_row);
         }
-
-        /* Loop through all (down-)scaled pixels */
-        float y_interp = 0.5;
-        for (uint_fast16_t scaled_y = 0; scaled_y < scaled_height; scaled_y++) {
-            const uint_fast32_t y = y_interp;
-            const uint_fast32_t y_limit = y_interp += scaling_ratio;
-            const uint_fast16_t num_y_pixels = (y_limit < height ? y_limit : height) - y;
-            png_byte *rows[num_y_pixels];
-            for (uint_fast16_t row_index = 0; row_index < num_y_pixels; row_index++) {
-                rows[row_index] = row_pointers[y+row_index];
-            }
-
-            float x_interp = 0.5;
-            for (uint_fast32_t scaled_x = 0; scaled_x < scaled_row_components; scaled_x+=num_components) {
-                const uint_fast32_t x = x_interp;
-                x_interp += scaling_ratio;
-                const uint_fast32_t x_limit = x_interp < width ? x_interp : width;
-                const uint_fast32_t x_index = x * num_components;
-                const uint_fast32_t x_limit_index = x_limit * num_components;
-                const uint_fast32_t num_pixels = num_y_pixels * (x_limit - x);
-
-                /* Sum all values where the scaled pixel overlaps at least half an original pixel in each direction */
-                const uint_fast32_t quick_divider = quick_dividers[num_pixels];
-                if (has_alpha) {
-                    /* Alpha weight possible transparent pixels */
-                    uint_fast32_t greyred_value = 0;
-                    uint_fast32_t green_value = 0;
-                    uint_fast32_t blue_value = 0;
-                    uint_fast32_t alpha_value = 0;
-                    for (uint_fast16_t row_index = 0; row_index < num_y_pixels; row_index++) {
-                        const png_byte *start = rows[row_index] + x_index;
-                        png_byte *ptr = rows[row_index] + x_limit_index;
-                        do {
-                            const png_byte alpha = *--ptr;
-                            alpha_value += alpha;
-                            if (num_values == 3) {
-                                blue_value += *--ptr * alpha;
-                                green_value += *--ptr * alpha;
-                            }
-                            greyred_value += *--ptr * alpha;
-                        } while (ptr > start);
-                    }
-                    if (alpha_value < num_pixels) {
-                        for (uint_fast8_t component = 0; component < num_components; component++) {
-                            out_row[scaled_x+component] = 0;
-                        }
-                    }
-                    else {
-                        out_row[scaled_x+num_values] = alpha_value > 254*num_pixels ? 255 : quick_divider ? alpha_value*quick_divider>>16 : alpha_value/num_pixels;
-                        if (quick_divider && out_row[scaled_x+num_values] == 255) {
-                            out_row[scaled_x] = greyred_value * quick_divider >> 24;
-                            if (num_values == 3) {
-                                out_row[scaled_x+1] = green_value * quick_divider >> 24;
-                                out_row[scaled_x+2] = blue_value * quick_divider >> 24;
-                            }
-                        }
-                        else {
-                            out_row[scaled_x] = greyred_value / alpha_value;
-                            if (num_values == 3) {
-                                out_row[scaled_x+1] = green_value / alpha_value;
-                                out_row[scaled_x+2] = blue_value / alpha_value;
-                            }
-                        }
-                    }
-                }
-                else if (num_values == 3) {
-                    /* For opaque RGB pixels, use a simple average on each colour component */
-                    uint_fast32_t red_value = 0;
-                    uint_fast32_t green_value = 0;
-                    uint_fast32_t blue_value = 0;
-                    for (uint_fast16_t row_index = 0; row_index < num_y_pixels; row_index++) {
-                        const png_byte *start = rows[row_index] + x_index;
-                        png_byte *ptr = rows[row_index] + x_limit_index;
-                        do {
-                            blue_value += *--ptr;
-                            green_value += *--ptr;
-                            red_value += *--ptr;
-                        } while (ptr > start);
-
-                    }
-                    out_row[scaled_x] = quick_divider ? red_value * quick_divider >> 16 : red_value / num_pixels;
-                    out_row[scaled_x+1] = quick_divider ? green_value * quick_divider >> 16 : green_value / num_pixels;
-                    out_row[scaled_x+2] = quick_divider ? blue_value * quick_divider >> 16 : blue_value / num_pixels;
-                }
-                else {
-                    /* For opaque grey pixels, use a simple average of the values */
-                    uint_fast32_t grey_value = 0;
-                    for (uint_fast16_t row_index = 0; row_index < num_y_pixels; row_index++) {
-                        for (uint_fast32_t pixel_index = x_index; pixel_index < x_limit_index; pixel_index++) {
-                            grey_value += rows[row_index][pixel_index];
-                        }
-                    }
-                    out_row[scaled_x] = quick_divider ? grey_value * quick_divider >> 16 : grey_value / num_pixels;
-                }
-            }
-
-            png_write_row (new_png_ptr, out_row);
-        }
-    }
-    else {
-#ifndef USE_BICUBIC
-        /* Bilinear interpolation for upscales and modest downscales */
-        float downscale_offset = scaling_ratio < 1 ? 0 : (scaling_ratio - 1) / 2;
-        uint_fast32_t scaled_alpha = 255 << 16;
-        float y_interp = downscale_offset;
-        for (uint_fast16_t scaled_y = 0; scaled_y < scaled_height; scaled_y++, y_interp+=scaling_ratio) {
-            const uint_fast32_t y = y_interp;
-            const png_byte *row = row_pointers[y];
-            const png_byte *next_row = y+1 < height ? row_pointers[y+1] : row;
-
-            const uint_fast16_t y_diff = (uint_fast32_t)(y_interp*256) - (y<<8);
-            const uint_fast16_t y_remn = 256 - y_diff;
-
-            float x_interp = downscale_offset;
-            for (uint_fast32_t scaled_x = 0; scaled_x < scaled_row_components; scaled_x+=num_components, x_interp+=scaling_ratio) {
-                const uint_fast32_t x = x_interp;
-                const uint_fast32_t x_index = x * num_components;
-                const uint_fast32_t next_x_index = x < width ? x_index+num_components : x_index;
-
-                const uint_fast16_t x_diff = (uint_fast32_t)(x_interp*256) - (x<<8);
-                const uint_fast16_t x_remn = 256 - x_diff;
-                const uint_fast32_t weight = x_remn * y_remn;
-                const uint_fast32_t weightx = x_diff * y_remn;
-                const uint_fast32_t weighty = x_remn * y_diff;
-                const uint_fast32_t weightxy = x_diff * y_diff;
-
-                uint_fast32_t alpha, alphax, alphay, alphaxy;
-                if (has_alpha) {
-                    /* Interpolate alpha channel and weight pixels by their alpha */
-                    alpha = weight * row[x_index + num_values];
-                    alphax = weightx * row[next_x_index + num_values];
-                    alphay = weighty * next_row[x_index + num_values];
-                    alphaxy = weightxy * next_row[next_x_index + num_values];
-                    scaled_alpha = alpha + alphax + alphay + alphaxy;
-                    out_row[scaled_x + num_values] = scaled_alpha >> 16;
-                }
-
-                if (scaled_alpha == 255 << 16) {
-                    /* Simplified calculation for fully opaque pixels */
-                    for (uint_fast8_t component=0; component<num_values; component++) {
-                        out_row[scaled_x + component] = blerp_pixel (row, next_row, x_index+component, next_x_index+component, weight, weightx, weighty, weightxy) >> 16;
-                    }
-                }
-                else if (scaled_alpha == 0) {
-                    /* For speed, don't preserve the values of fully transparent pixels */
-                    for (uint_fast8_t component=0; component<num_values; component++) {
-                        out_row[scaled_x + component] = 0;
-                    }
-                }
-                else {
-                    /* Alpha-weight partially transparent pixels to avoid background colour bleeding */
-                    for (uint_fast8_t component=0; component<num_values; component++) {
-                        out_row[scaled_x + component] = blerp_pixel (row, next_row, x_index+component, next_x_index+component, alpha, alphax, alphay, alphaxy) / scaled_alpha;
-                    }
-                }
-            }
-
-            png_write_row (new_png_ptr, out_row);
-        }
-#else
-        /* Bicubic interpolation to improve the scaled image quality */
-        if (has_alpha) {
-            for (uint_fast16_t y = 0; y < height; y++) {
-                png_byte *row = row_pointers[y];
-                for (uint_fast16_t x_index = 0; x_index < width*4; x_index+=4) {
-                    const png_byte alpha = row[x_index + 3];
-                    if (alpha < 255) {
-                        for (uint_fast8_t component=0; component<3; component++) {
-                            row[x_index + component] = row[x_index + component]*alpha >> 8;
-                        }
-                    }
-                }
-            }
-        }
-
-        float downscale_offset = scaling_ratio < 1 ? 0 : (scaling_ratio - 1) / 2;
-        int_fast16_t scaled_alpha = 255;
-        float y_interp = downscale_offset;
-        for (uint_fast16_t scaled_y = 0; scaled_y < scaled_height; scaled_y++, y_interp+=scaling_ratio) {
-            const uint_fast32_t y = y_interp;
-            const png_byte *row1 = row_pointers[y];
-            const png_byte *row0 = y > 0 ? row_pointers[y-1] : row1;
-            const png_byte *row2 = y+1 < height ? row_pointers[y+1] : row1;
-            const png_byte *row3 = y+2 < height ? row_pointers[y+2] : row2;
-
-            float dy = y_interp - (int_fast32_t)y_interp;
-            float dy2 = dy * dy;
-            float dy3 = dy2 * dy;
-
-            float x_interp = downscale_offset;
-            for (uint_fast32_t scaled_x = 0; scaled_x < scaled_row_components; scaled_x+=num_components, x_interp+=scaling_ratio) {
-                const uint_fast32_t x = x_interp;
-                const uint_fast32_t x1 = x * num_components;
-                const uint_fast32_t x0 = x > 0 ? x1-num_components : x1;
-                const uint_fast32_t x2 = x+1 < width ? x1+num_components : x1;
-                const uint_fast32_t x3 = x+2 < width ? x2+num_components : x2;
-
-                float dx = x_interp - (int_fast32_t)x_interp;
-                float dx2 = dx * dx;
-                float dx3 = dx2 * dx;
-
-                if (has_alpha) {
-                    scaled_alpha = bcerp (row0, row1, row2, row3, x0, x1, x2, x3, 3, dx, dx2, dx3, dy, dy2, dy3);
-                    out_row[scaled_x + 3] = scaled_alpha < 0 ? 0 : scaled_alpha > 255 ? 255 : scaled_alpha;
-                }
-
-                if (scaled_alpha == 255) {
-                    for (uint_fast8_t component=0; component<3; component++) {
-                        const int_fast16_t pixel = bcerp (row0, row1, row2, row3, x0, x1, x2, x3, component, dx, dx2, dx3, dy, dy2, dy3);
-                        out_row[scaled_x + component] = pixel < 0 ? 0 : pixel > 255 ? 255 : pixel;
-                    }
-                }
-                else if (scaled_alpha == 0) {
-                    for (uint_fast8_t component=0; component<3; component++) {
-                        out_row[scaled_x + component] = 0;
-                    }
-                }
-                else {
-                    for (uint_fast8_t component=0; component<3; component++) {
-                        const int_fast16_t pixel = (bcerp (row0, row1, row2, row3, x0, x1, x2, x3, component, dx, dx2, dx3, dy, dy2, dy3)<<8) / scaled_alpha;
-                        out_row[scaled_x + component] = pixel < 0 ? 0 : pixel > 255 ? 255 : pixel;
-                    }
-                }
-            }
-
-            png_write_row (new_png_ptr, out_row);
-        }
-#endif
     }
 
     png_write_end (new_png_ptr, new_info_ptr);
@@ -777,11 +374,8 @@ error:
     if (new_png_ptr) {
         png_destroy_write_struct (&new_png_ptr, &new_info_ptr);
     }
-    if (out_row) {
-        free (out_row);
-    }
-    if (quick_dividers) {
-        free (quick_dividers);
+    if (resampler) {
+        img_resampler_free (resampler);
     }
 
     return err;
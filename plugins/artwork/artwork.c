@@ -65,10 +65,12 @@
 #include "albumartorg.h"
 #include "wos.h"
 #include "cache.h"
+#include "memcache.h"
 #ifdef USE_MP4FF
 #include "mp4ff.h"
 #endif
 #include "../../strdupa.h"
+#include "../../shared/imgresample.h"
 
 #define trace(...) { deadbeef->log_detailed (&plugin.plugin.plugin, 0, __VA_ARGS__); }
 
@@ -88,12 +90,26 @@ typedef struct cover_query_s {
     struct cover_query_s *next;
 } cover_query_t;
 
-static cover_query_t *queue;
-static cover_query_t *queue_tail;
+#define FETCHER_THREADS 4
+
+// when more queries are waiting, the oldest ones are cancelled
+#define MAX_PENDING_QUERIES 256
+
+#define MEMCACHE_SIZE (32*1024*1024)
+
+// how long the queries which found nothing are remembered,
+// unless the track or its folder changes
+#define MISSING_ARTWORK_RECHECK_INTERVAL (60*60)
+static int memcache_generation; // changed when the settings affecting the results change
+
+static cover_query_t *queue; // waiting queries, the most recent first
+static int queue_count;
+static cover_query_t *running; // queries being processed, which can still get more callbacks
 static int terminate;
-static intptr_t tid;
+static intptr_t tids[FETCHER_THREADS];
 static uintptr_t queue_mutex;
 static uintptr_t queue_cond;
+static uintptr_t web_mutex; // web services are queried by one thread at a time
 
 #ifdef ANDROID
 #define DEFAULT_DISABLE_CACHE 1
@@ -152,56 +168,6 @@ scale_dimensions (int scaled_size, int width, int height, unsigned int *scaled_w
 #endif
 
 #ifndef USE_IMLIB2
-#ifdef USE_BICUBIC
-static float cerp (float p0, float p1, float p2, float p3, float d, float d2, float d3)
-{
-    /* Cubic Hermite spline (a = -0.5, Catmull-Rom) */
-    return p1 - (p0*d3 - 3*p1*d3 + 3*p2*d3 - p3*d3 - 2*p0*d2 + 5*p1*d2 - 4*p2*d2 + p3*d2 + p0*d - p2*d)/2;
-}
-
-static int_fast16_t bcerp (const png_byte *row0, const png_byte *row1, const png_byte *row2, const png_byte *row3,
-                      const uint_fast32_t x0, const uint_fast32_t x1, const uint_fast32_t x2, const uint_fast32_t x3, const uint_fast8_t component,
-                      float dx, float dx2, float dx3, float dy, float dy2, float dy3) {
-    const uint_fast32_t index0 = x0 + component;
-    const uint_fast32_t index1 = x1 + component;
-    const uint_fast32_t index2 = x2 + component;
-    const uint_fast32_t index3 = x3 + component;
-    float p0 = cerp (row0[index0], row1[index0], row2[index0], row3[index0], dy, dy2, dy3);
-    float p1 = cerp (row0[index1], row1[index1], row2[index1], row3[index1], dy, dy2, dy3);
-    float p2 = cerp (row0[index2], row1[index2], row2[index2], row3[index2], dy, dy2, dy3);
-    float p3 = cerp (row0[index3], row1[index3], row2[index3], row3[index3], dy, dy2, dy3);
-    return cerp (p0, p1, p2, p3, dx, dx2, dx3) + 0.5;
-}
-#endif
-
-#ifdef USE_LIBPNG
-static uint_fast32_t blerp_pixel (const png_byte *row, const png_byte *next_row, const uint_fast32_t x_index, const uint_fast32_t next_x_index,
-                                 const uint_fast32_t weight, const uint_fast32_t weightx, const uint_fast32_t weighty, const uint_fast32_t weightxy)
-{
-    return row[x_index]*weight + row[next_x_index]*weightx + next_row[x_index]*weighty + next_row[next_x_index]*weightxy;
-}
-#endif
-
-#if defined(USE_LIBPNG) || defined(USE_LIBJPEG)
-static uint_fast32_t *
-calculate_quick_dividers (float scaling_ratio)
-{
-    /* Replace slow divisions by expected numbers with faster multiply/shift combo */
-    const uint16_t max_sample_size = scaling_ratio + 1;
-    uint_fast32_t *dividers = malloc ((max_sample_size * max_sample_size + 1) * sizeof (uint_fast32_t));
-    if (dividers) {
-        for (uint16_t y = max_sample_size; y; y--) {
-            for (uint16_t x = y; x; x--) {
-                const uint32_t num_pixels = x * y;
-                /* Accurate to 1/256 for up to 256 pixels and always for powers of 2 */
-                dividers[num_pixels] = num_pixels <= 256 || !(num_pixels & (num_pixels - 1)) ? 256*256/num_pixels : 0;
-            }
-        }
-    }
-    return dividers;
-}
-#endif
-
 #ifdef USE_LIBJPEG
 typedef struct {
     struct jpeg_error_mgr pub;	/* "public" fields */
@@ -220,6 +186,17 @@ my_error_exit (j_common_ptr cinfo)
   longjmp (myerr->setjmp_buffer, 1);
 }
 
+/* The largest DCT-domain downscale (1/8 to 1/1) which still leaves at least the target size,
+   so the decoder skips most of the work, and the resampler only does the final step */
+static unsigned int
+jpeg_prescale_denom (unsigned int width, unsigned int height, unsigned int scaled_width, unsigned int scaled_height)
+{
+    unsigned int denom = 8;
+    while (denom > 1 && ((width + denom - 1) / denom < scaled_width || (height + denom - 1) / denom < scaled_height)) {
+        denom /= 2;
+    }
+    return denom;
+}
 
 static int
 jpeg_resize (const char *fname, const char *outname, int scaled_size) {
@@ -227,8 +204,8 @@ jpeg_resize (const char *fname, const char *outname, int scaled_size) {
     FILE *fp = NULL, *out = NULL;
     struct jpeg_decompress_struct cinfo;
     struct jpeg_compress_struct cinfo_out;
-    void *sample_rows_buffer = NULL;
-    uint_fast32_t *quick_dividers = NULL;
+    JSAMPLE * volatile scanline = NULL;
+    img_resampler_t * volatile resampler = NULL;
     my_error_mgr_t jerr;
 
     cinfo.mem = cinfo_out.mem = NULL;
@@ -238,11 +215,11 @@ jpeg_resize (const char *fname, const char *outname, int scaled_size) {
         trace ("failed to scale %s as jpeg\n", outname);
         jpeg_destroy_decompress (&cinfo);
         jpeg_destroy_compress (&cinfo_out);
-        if (sample_rows_buffer) {
-            free (sample_rows_buffer);
+        if (scanline) {
+            free (scanline);
         }
-        if (quick_dividers) {
-            free (quick_dividers);
+        if (resampler) {
+            img_resampler_free (resampler);
         }
         if (fp) {
             fclose (fp);
@@ -270,18 +247,27 @@ jpeg_resize (const char *fname, const char *outname, int scaled_size) {
     jpeg_stdio_dest (&cinfo_out, out);
 
     jpeg_read_header (&cinfo, TRUE);
-    jpeg_start_decompress (&cinfo);
 
-    const unsigned int num_components = cinfo.output_components;
     const unsigned int width = cinfo.image_width;
     const unsigned int height = cinfo.image_height;
     unsigned int scaled_width, scaled_height;
     float scaling_ratio = scale_dimensions (scaled_size, width, height, &scaled_width, &scaled_height);
-    if (scaling_ratio >= 65535 || scaled_width < 1 || scaled_width > 32767 || scaled_height < 1 || scaled_width > 32767) {
+    if (scaling_ratio >= 65535 || scaled_width < 1 || scaled_width > 32767 || scaled_height < 1 || scaled_height > 32767) {
         trace ("scaling ratio (%g) or scaled image dimensions (%ux%u) are invalid\n", scaling_ratio, scaled_width, scaled_height);
         my_error_exit ((j_common_ptr)&cinfo);
     }
 
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = jpeg_prescale_denom (width, height, scaled_width, scaled_height);
+    jpeg_start_decompress (&cinfo);
+
+    const unsigned int num_components = cinfo.output_components;
+    resampler = img_resampler_new (cinfo.output_width, cinfo.output_height, scaled_width, scaled_height, num_components, 0);
+    scanline = malloc (cinfo.output_width * num_components * sizeof (JSAMPLE));
+    if (!resampler || !scanline) {
+        my_error_exit ((j_common_ptr)&cinfo);
+    }
+
     cinfo_out.image_width      = scaled_width;
     cinfo_out.image_height     = scaled_height;
     cinfo_out.input_components = num_components;
@@ -290,174 +276,25 @@ jpeg_resize (const char *fname, const char *outname, int scaled_size) {
     jpeg_set_quality (&cinfo_out, 95, TRUE);
     jpeg_start_compress (&cinfo_out, TRUE);
 
-    const uint_fast32_t row_components = width * num_components;
-    const uint_fast32_t scaled_row_components = scaled_width * num_components;
-    JSAMPLE out_line[scaled_row_components];
-    JSAMPROW out_row = out_line;
-
-    if (scaling_ratio > 2) {
-        /* Simple (unweighted) area sampling for large downscales */
-        quick_dividers = calculate_quick_dividers (scaling_ratio);
-        const uint16_t max_sample_height = scaling_ratio + 1;
-        sample_rows_buffer = malloc (max_sample_height * row_components * sizeof (JSAMPLE));
-        if (!sample_rows_buffer || !quick_dividers) {
-            my_error_exit ((j_common_ptr)&cinfo);
-        }
-        JSAMPROW rows[max_sample_height];
-        for (uint16_t row_index = 0; row_index < max_sample_height; row_index++) {
-            rows[row_index] = sample_rows_buffer + row_index*row_components;
-        }
-
-        /* Loop through all (down-)scaled pixels */
-        float y_interp = 0.5;
-        for (uint_fast16_t scaled_y = 0; scaled_y < scaled_height; scaled_y++) {
-            const uint_fast32_t y = y_interp;
-            const uint_fast32_t y_limit = y_interp += scaling_ratio;
-            const uint_fast16_t num_y_pixels = (y_limit < height ? y_limit : height) - y;
-
-            for (uint_fast16_t row_index = 0; row_index < num_y_pixels; row_index++) {
-                jpeg_read_scanlines (&cinfo, &rows[row_index], 1);
-            }
-
-            float x_interp = 0.5;
-            for (uint_fast32_t scaled_x = 0; scaled_x < scaled_row_components; scaled_x+=num_components) {
-                const uint_fast32_t x = x_interp;
-                x_interp += scaling_ratio;
-                const uint_fast32_t x_limit = x_interp < width ? x_interp : width;
-                const uint_fast32_t x_index = x * num_components;
-                const uint_fast32_t x_limit_index = x_limit * num_components;
-
-                /* Sum all values where the scaled pixel overlaps at least half a pixel in each direction */
-                const uint_fast32_t num_pixels = num_y_pixels * (x_limit - x);
-                const uint_fast32_t quick_divider = quick_dividers[num_pixels];
-                for (uint_fast8_t component=0; component<num_components; component++) {
-                    uint_fast32_t value = 0;
-                    for (uint_fast32_t pixel_index = x_index+component; pixel_index < x_limit_index; pixel_index+=num_components) {
-                        for (uint_fast16_t row_index = 0; row_index < num_y_pixels; row_index++) {
-                            value += rows[row_index][pixel_index];
-                        }
-                    }
-                    out_row[scaled_x+component] = quick_divider ? value * quick_divider >> 16 : value / num_pixels;
-                }
-            }
-
+    JSAMPROW row = scanline;
+    while (cinfo.output_scanline < cinfo.output_height) {
+        jpeg_read_scanlines (&cinfo, &row, 1);
+        img_resampler_push_row (resampler, row);
+        JSAMPROW out_row;
+        while ((out_row = (JSAMPROW)img_resampler_pull_row (resampler))) {
             jpeg_write_scanlines (&cinfo_out, &out_row, 1);
         }
-
-        free (sample_rows_buffer);
-        free (quick_dividers);
-    }
-    else {
-#ifndef USE_BICUBIC
-        /* Bilinear interpolation for upscales and modest downscales */
-        JSAMPLE scanline[row_components];
-        JSAMPLE next_scanline[row_components];
-        JSAMPROW row = scanline;
-        JSAMPROW next_row = next_scanline;
-        float downscale_offset = scaling_ratio < 1 ? 0 : (scaling_ratio - 1) / 2;
-        float y_interp = downscale_offset;
-        for (uint_fast16_t scaled_y = 0; scaled_y < scaled_height; scaled_y++, y_interp+=scaling_ratio) {
-            const uint_fast32_t y = y_interp;
-            const uint_fast16_t y_diff = (uint_fast32_t)(y_interp*256) - (y<<8);
-            const uint_fast16_t y_remn = 256 - y_diff;
-
-            if (cinfo.output_scanline < y+2) {
-                while (cinfo.output_scanline < y+1) {
-                    jpeg_read_scanlines (&cinfo, &next_row, 1);
-                }
-                memcpy (row, next_row, row_components*sizeof (JSAMPLE));
-                if (y+2 < height) {
-                    jpeg_read_scanlines (&cinfo, &next_row, 1);
-                }
-            }
-
-            float x_interp = downscale_offset;
-            for (uint_fast32_t scaled_x = 0; scaled_x < scaled_row_components; scaled_x+=num_components, x_interp+=scaling_ratio) {
-                const uint_fast32_t x = x_interp;
-                const uint_fast32_t x_index = x * num_components;
-                const uint_fast32_t next_x_index = x+1 < width ? x_index+num_components : x_index;
-
-                const uint_fast16_t x_diff = (uint_fast32_t)(x_interp*256) - (x<<8);
-                const uint_fast16_t x_remn = 256 - x_diff;
-                const uint_fast32_t weight = x_remn * y_remn;
-                const uint_fast32_t weightx = x_diff * y_remn;
-                const uint_fast32_t weighty = x_remn * y_diff;
-                const uint_fast32_t weightxy = x_diff * y_diff;
-
-                for (uint_fast8_t component=0; component<num_components; component++) {
-                    out_line[scaled_x + component] = blerp_pixel (row, next_row, x_index+component, next_x_index+component, weight, weightx, weighty, weightxy) >> 16;
-                }
-            }
-
-            jpeg_write_scanlines (&cinfo_out, &out_row, 1);
-        }
-#else
-        /* Bicubic interpolation to improve the scaled image quality */
-        JSAMPLE scanline0[row_components];
-        JSAMPLE scanline1[row_components];
-        JSAMPLE scanline2[row_components];
-        JSAMPLE scanline3[row_components];
-        JSAMPROW row0 = scanline0;
-        JSAMPROW row1 = scanline1;
-        JSAMPROW row2 = scanline2;
-        JSAMPROW row3 = scanline3;
-        jpeg_read_scanlines (&cinfo, &row1, 1);
-        memcpy (row2, row1, row_components*sizeof (JSAMPLE));
-
-        float downscale_offset = scaling_ratio < 1 ? 0 : (scaling_ratio - 1) / 2;
-        float y_interp = downscale_offset;
-        for (uint_fast16_t scaled_y = 0; scaled_y < scaled_height; scaled_y++, y_interp+=scaling_ratio) {
-            const uint_fast32_t y = y_interp;
-            float dy = y_interp - (int_fast32_t)y_interp;
-            float dy2 = dy * dy;
-            float dy3 = dy2 * dy;
-
-            if (cinfo.output_scanline < y+3) {
-                while (cinfo.output_scanline < y) {
-                    jpeg_read_scanlines (&cinfo, &row1, 1);
-                }
-                memcpy (row0, row1, row_components*sizeof (JSAMPLE));
-                if (cinfo.output_scanline < y+1) {
-                    jpeg_read_scanlines (&cinfo, &row2, 1);
-                }
-                memcpy (row1, row2, row_components*sizeof (JSAMPLE));
-                if (y+2 < height && cinfo.output_scanline < y+2) {
-                    jpeg_read_scanlines (&cinfo, &row3, 1);
-                }
-                memcpy (row2, row3, row_components*sizeof (JSAMPLE));
-                if (y+3 < height) {
-                    jpeg_read_scanlines (&cinfo, &row3, 1);
-                }
-            }
-
-            float x_interp = downscale_offset;
-            for (uint_fast32_t scaled_x = 0; scaled_x < scaled_row_components; scaled_x+=num_components, x_interp+=scaling_ratio) {
-                const uint_fast32_t x = x_interp;
-                const uint_fast32_t x1 = x * num_components;
-                const uint_fast32_t x0 = x > 0 ? x1-num_components : x1;
-                const uint_fast32_t x2 = x+1 < width ? x1+num_components : x1;
-                const uint_fast32_t x3 = x+2 < width ? x2+num_components : x2;
-
-                float dx = x_interp - (int_fast32_t)x_interp;
-                float dx2 = dx * dx;
-                float dx3 = dx2 * dx;
-
-                for (uint_fast8_t component=0; component<num_components; component++) {
-                    const int_fast16_t pixel = bcerp (row0, row1, row2, row3, x0, x1, x2, x3, component, dx, dx2, dx3, dy, dy2, dy3);
-                    out_row[scaled_x + component] = pixel < 0 ? 0 : pixel > 255 ? 255 : pixel;
-                }
-            }
-
-            jpeg_write_scanlines (&cinfo_out, &out_row, 1);
-        }
-#endif
     }
 
     jpeg_finish_compress (&cinfo_out);
+    jpeg_finish_decompress (&cinfo);
 
     jpeg_destroy_compress (&cinfo_out);
     jpeg_destroy_decompress (&cinfo);
 
+    img_resampler_free (resampler);
+    free (scanline);
+
     fclose (fp);
     fclose (out);
 
@@ -475,8 +312,7 @@ png_resize (const char *fname, const char *outname, int scaled_size) {
     int err = -1;
     FILE *fp = NULL;
     FILE *out = NULL;
-    png_byte *out_row = NULL;
-    uint_fast32_t *quick_dividers = NULL;
+    img_resampler_t *resampler = NULL;
 
     fp = fopen (fname, "rb");
     if (!fp) {
@@ -510,11 +346,19 @@ png_resize (const char *fname, const char *outname, int scaled_size) {
 
     unsigned int scaled_width, scaled_height;
     float scaling_ratio = scale_dimensions (scaled_size, width, height, &scaled_width, &scaled_height);
-    if (scaling_ratio >= 65535 || scaled_width < 1 || scaled_width > 32767 || scaled_height < 1 || scaled_width > 32767) {
+    if (scaling_ratio >= 65535 || scaled_width < 1 || scaled_width > 32767 || scaled_height < 1 || scaled_height > 32767) {
         trace ("scaling ratio (%g) or scaled image dimensions (%ux%u) are invalid\n", scaling_ratio, scaled_width, scaled_height);
         goto error;
     }
 
+    const uint8_t has_alpha = color_type & PNG_COLOR_MASK_ALPHA;
+    const uint8_t num_values = color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_GRAY_ALPHA ? 1 : 3;
+    const uint8_t num_components = num_values + (has_alpha ? 1 : 0);
+    resampler = img_resampler_new (width, height, scaled_width, scaled_height, num_components, has_alpha);
+    if (!resampler) {
+        goto error;
+    }
+
     out = fopen (outname, "w+b");
     if (!out) {
         trace ("failed to open %s for writing\n", outname);
@@ -545,249 +389,12 @@ png_resize (const char *fname, const char *outname, int scaled_size) {
     png_write_info (new_png_ptr, new_info_ptr);
     png_set_packing (new_png_ptr);
 
-    const uint8_t has_alpha = color_type & PNG_COLOR_MASK_ALPHA;
-    const uint8_t num_values = color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_GRAY_ALPHA ? 1 : 3;
-    const uint8_t num_components = num_values + (has_alpha ? 1 : 0);
-    const uint_fast32_t scaled_row_components = scaled_width * num_components;
-    out_row = malloc (scaled_row_components * sizeof (png_byte));
-    if (!out_row) {
-        goto error;
-    }
-
-    if (scaling_ratio > 2) {
-        /* Simple (unweighted) area sampling for large downscales */
-        quick_dividers = calculate_quick_dividers (scaling_ratio);
-        if (!quick_dividers) {
-            goto error;
-        }
-
-        /* Loop through all (down-)scaled pixels */
-        float y_interp = 0.5;
-        for (uint_fast16_t scaled_y = 0; scaled_y < scaled_height; scaled_y++) {
-            const uint_fast32_t y = y_interp;
-            const uint_fast32_t y_limit = y_interp += scaling_ratio;
-            const uint_fast16_t num_y_pixels = (y_limit < height ? y_limit : height) - y;
-            png_byte *rows[num_y_pixels];
-            for (uint_fast16_t row_index = 0; row_index < num_y_pixels; row_index++) {
-                rows[row_index] = row_pointers[y+row_index];
-            }
-
-            float x_interp = 0.5;
-            for (uint_fast32_t scaled_x = 0; scaled_x < scaled_row_components; scaled_x+=num_components) {
-                const uint_fast32_t x = x_interp;
-                x_interp += scaling_ratio;
-                const uint_fast32_t x_limit = x_interp < width ? x_interp : width;
-                const uint_fast32_t x_index = x * num_components;
-                const uint_fast32_t x_limit_index = x_limit * num_components;
-                const uint_fast32_t num_pixels = num_y_pixels * (x_limit - x);
-
-                /* Sum all values where the scaled pixel overlaps at least half an original pixel in each direction */
-                const uint_fast32_t quick_divider = quick_dividers[num_pixels];
-                if (has_alpha) {
-                    /* Alpha weight possible transparent pixels */
-                    uint_fast32_t greyred_value = 0;
-                    uint_fast32_t green_value = 0;
-                    uint_fast32_t blue_value = 0;
-                    uint_fast32_t alpha_value = 0;
-                    for (uint_fast16_t row_index = 0; row_index < num_y_pixels; row_index++) {
-                        const png_byte *start = rows[row_index] + x_index;
-                        png_byte *ptr = rows[row_index] + x_limit_index;
-                        do {
-                            const png_byte alpha = *--ptr;
-                            alpha_value += alpha;
-                            if (num_values == 3) {
-                                blue_value += *--ptr * alpha;
-                                green_value += *--ptr * alpha;
-                            }
-                            greyred_value += *--ptr * alpha;
-                        } while (ptr > start);
-                    }
-                    if (alpha_value < num_pixels) {
-                        for (uint_fast8_t component = 0; component < num_components; component++) {
-                            out_row[scaled_x+component] = 0;
-                        }
-                    }
-                    else {
-                        out_row[scaled_x+num_values] = alpha_value > 254*num_pixels ? 255 : quick_divider ? alpha_value*quick_divider>>16 : alpha_value/num_pixels;
-                        if (quick_divider && out_row[scaled_x+num_values] == 255) {
-                            out_row[scaled_x] = greyred_value * quick_divider >> 24;
-                            if (num_values == 3) {
-                                out_row[scaled_x+1] = green_value * quick_divider >> 24;
-                                out_row[scaled_x+2] = blue_value * quick_divider >> 24;
-                            }
-                        }
-                        else {
-                            out_row[scaled_x] = greyred_value / alpha_value;
-                            if (num_values == 3) {
-                                out_row[scaled_x+1] = green_value / alpha_value;
-                                out_row[scaled_x+2] = blue_value / alpha_value;
-                            }
-                        }
-                    }
-                }
-                else if (num_values == 3) {
-                    /* For opaque RGB pixels, use a simple average on each colour component */
-                    uint_fast32_t red_value = 0;
-                    uint_fast32_t green_value = 0;
-                    uint_fast32_t blue_value = 0;
-                    for (uint_fast16_t row_index = 0; row_index < num_y_pixels; row_index++) {
-                        const png_byte *start = rows[row_index] + x_index;
-                        png_byte *ptr = rows[row_index] + x_limit_index;
-                        do {
-                            blue_value += *--ptr;
-                            green_value += *--ptr;
-                            red_value += *--ptr;
-                        } while (ptr > start);
-
-                    }
-                    out_row[scaled_x] = quick_divider ? red_value * quick_divider >> 16 : red_value / num_pixels;
-                    out_row[scaled_x+1] = quick_divider ? green_value * quick_divider >> 16 : green_value / num_pixels;
-                    out_row[scaled_x+2] = quick_divider ? blue_value * quick_divider >> 16 : blue_value / num_pixels;
-                }
-                else {
-                    /* For opaque grey pixels, use a simple average of the values */
-                    uint_fast32_t grey_value = 0;
-                    for (uint_fast16_t row_index = 0; row_index < num_y_pixels; row_index++) {
-                        for (uint_fast32_t pixel_index = x_index; pixel_index < x_limit_index; pixel_index++) {
-                            grey_value += rows[row_index][pixel_index];
-                        }
-                    }
-                    out_row[scaled_x] = quick_divider ? grey_value * quick_divider >> 16 : grey_value / num_pixels;
-                }
-            }
-
-            png_write_row (new_png_ptr, out_row);
-        }
-    }
-    else {
-#ifndef USE_BICUBIC
-        /* Bilinear interpolation for upscales and modest downscales */
-        float downscale_offset = scaling_ratio < 1 ? 0 : (scaling_ratio - 1) / 2;
-        uint_fast32_t scaled_alpha = 255 << 16;
-        float y_interp = downscale_offset;
-        for (uint_fast16_t scaled_y = 0; scaled_y < scaled_height; scaled_y++, y_interp+=scaling_ratio) {
-            const uint_fast32_t y = y_interp;
-            const png_byte *row = row_pointers[y];
-            const png_byte *next_row = y+1 < height ? row_pointers[y+1] : row;
-
-            const uint_fast16_t y_diff = (uint_fast32_t)(y_interp*256) - (y<<8);
-            const uint_fast16_t y_remn = 256 - y_diff;
-
-            float x_interp = downscale_offset;
-            for (uint_fast32_t scaled_x = 0; scaled_x < scaled_row_components; scaled_x+=num_components, x_interp+=scaling_ratio) {
-                const uint_fast32_t x = x_interp;
-                const uint_fast32_t x_index = x * num_components;
-                const uint_fast32_t next_x_index = x < width ? x_index+num_components : x_index;
-
-                const uint_fast16_t x_diff = (uint_fast32_t)(x_interp*256) - (x<<8);
-                const uint_fast16_t x_remn = 256 - x_diff;
-                const uint_fast32_t weight = x_remn * y_remn;
-                const uint_fast32_t weightx = x_diff * y_remn;
-                const uint_fast32_t weighty = x_remn * y_diff;
-                const uint_fast32_t weightxy = x_diff * y_diff;
-
-                uint_fast32_t alpha = 0, alphax = 0, alphay = 0, alphaxy = 0;
-                if (has_alpha) {
-                    /* Interpolate alpha channel and weight pixels by their alpha */
-                    alpha = weight * row[x_index + num_values];
-                    alphax = weightx * row[next_x_index + num_values];
-                    alphay = weighty * next_row[x_index + num_values];
-                    alphaxy = weightxy * next_row[next_x_index + num_values];
-                    scaled_alpha = alpha + alphax + alphay + alphaxy;
-                    out_row[scaled_x + num_values] = scaled_alpha >> 16;
-                }
-
-                if (scaled_alpha == 255 << 16) {
-                    /* Simplified calculation for fully opaque pixels */
-                    for (uint_fast8_t component=0; component<num_values; component++) {
-                        out_row[scaled_x + component] = blerp_pixel (row, next_row, x_index+component, next_x_index+component, weight, weightx, weighty, weightxy) >> 16;
-                    }
-                }
-                else if (scaled_alpha == 0) {
-                    /* For speed, don't preserve the values of fully transparent pixels */
-                    for (uint_fast8_t component=0; component<num_values; component++) {
-                        out_row[scaled_x + component] = 0;
-                    }
-                }
-                else {
-                    /* Alpha-weight partially transparent pixels to avoid background colour bleeding */
-                    for (uint_fast8_t component=0; component<num_values; component++) {
-                        out_row[scaled_x + component] = blerp_pixel (row, next_row, x_index+component, next_x_index+component, alpha, alphax, alphay, alphaxy) / scaled_alpha;
-                    }
-                }
-            }
-
-            png_write_row (new_png_ptr, out_row);
-        }
-#else
-        /* Bicubic interpolation to improve the scaled image quality */
-        if (has_alpha) {
-            for (uint_fast16_t y = 0; y < height; y++) {
-                png_byte *row = row_pointers[y];
-                for (uint_fast16_t x_index = 0; x_index < width*4; x_index+=4) {
-                    const png_byte alpha = row[x_index + 3];
-                    if (alpha < 255) {
-                        for (uint_fast8_t component=0; component<3; component++) {
-                            row[x_index + component] = row[x_index + component]*alpha >> 8;
-                        }
-                    }
-                }
-            }
-        }
-
-        float downscale_offset = scaling_ratio < 1 ? 0 : (scaling_ratio - 1) / 2;
-        int_fast16_t scaled_alpha = 255;
-        float y_interp = downscale_offset;
-        for (uint_fast16_t scaled_y = 0; scaled_y < scaled_height; scaled_y++, y_interp+=scaling_ratio) {
-            const uint_fast32_t y = y_interp;
-            const png_byte *row1 = row_pointers[y];
-            const png_byte *row0 = y > 0 ? row_pointers[y-1] : row1;
-            const png_byte *row2 = y+1 < height ? row_pointers[y+1] : row1;
-            const png_byte *row3 = y+2 < height ? row_pointers[y+2] : row2;
-
-            float dy = y_interp - (int_fast32_t)y_interp;
-            float dy2 = dy * dy;
-            float dy3 = dy2 * dy;
-
-            float x_interp = downscale_offset;
-            for (uint_fast32_t scaled_x = 0; scaled_x < scaled_row_components; scaled_x+=num_components, x_interp+=scaling_ratio) {
-                const uint_fast32_t x = x_interp;
-                const uint_fast32_t x1 = x * num_components;
-                const uint_fast32_t x0 = x > 0 ? x1-num_components : x1;
-                const uint_fast32_t x2 = x+1 < width ? x1+num_components : x1;
-                const uint_fast32_t x3 = x+2 < width ? x2+num_components : x2;
-
-                float dx = x_interp - (int_fast32_t)x_interp;
-                float dx2 = dx * dx;
-                float dx3 = dx2 * dx;
-
-                if (has_alpha) {
-                    scaled_alpha = bcerp (row0, row1, row2, row3, x0, x1, x2, x3, 3, dx, dx2, dx3, dy, dy2, dy3);
-                    out_row[scaled_x + 3] = scaled_alpha < 0 ? 0 : scaled_alpha > 255 ? 255 : scaled_alpha;
-                }
-
-                if (scaled_alpha == 255) {
-                    for (uint_fast8_t component=0; component<3; component++) {
-                        const int_fast16_t pixel = bcerp (row0, row1, row2, row3, x0, x1, x2, x3, component, dx, dx2, dx3, dy, dy2, dy3);
-                        out_row[scaled_x + component] = pixel < 0 ? 0 : pixel > 255 ? 255 : pixel;
-                    }
-                }
-                else if (scaled_alpha == 0) {
-                    for (uint_fast8_t component=0; component<3; component++) {
-                        out_row[scaled_x + component] = 0;
-                    }
-                }
-                else {
-                    for (uint_fast8_t component=0; component<3; component++) {
-                        const int_fast16_t pixel = (bcerp (row0, row1, row2, row3, x0, x1, x2, x3, component, dx, dx2, dx3, dy, dy2, dy3)<<8) / scaled_alpha;
-                        out_row[scaled_x + component] = pixel < 0 ? 0 : pixel > 255 ? 255 : pixel;
-                    }
-                }
-            }
-
-            png_write_row (new_png_ptr, out_row);
+    for (png_uint_32 y = 0; y < height; y++) {
+        img_resampler_push_row (resampler, row_pointers[y]);
+        const png_byte *out_row;
+        while ((out_row = img_resampler_pull_row (resampler))) {
+            png_write_row (new_png_ptr, (png_bytep)out_row);
         }
-#endif
     }
 
     png_write_end (new_png_ptr, new_info_ptr);
@@ -806,11 +413,8 @@ error:
     if (new_png_ptr) {
         png_destroy_write_struct (&new_png_ptr, &new_info_ptr);
     }
-    if (out_row) {
-        free (out_row);
-    }
-    if (quick_dividers) {
-        free (quick_dividers);
+    if (resampler) {
+        img_resampler_free (resampler);
     }
 
     return err;
@@ -912,56 +516,9 @@ scale_file (const char *in, const char *out, int img_size)
 }
 #endif
 
-// esc_char is needed to prevent using file path separators,
-// e.g. to avoid writing arbitrary files using "../../../filename"
-static char
-esc_char (char c) {
-#ifndef WIN32
-    if (c == '/') {
-        return '\\';
-    }
-#else
-    if (c == '\\') {
-        return '_';
-    }
-#endif
-    return c;
-}
-
-static int
-make_cache_dir_path (const char *artist, char *outpath, int outsize) {
-    char esc_artist[NAME_MAX+1];
-    if (artist) {
-        size_t i = 0;
-        while (artist[i] && i < NAME_MAX) {
-            esc_artist[i] = esc_char (artist[i]);
-            i++;
-        }
-        esc_artist[i] = '\0';
-    }
-    else {
-        strcpy (esc_artist, "Unknown artist");
-    }
-
-    if (make_cache_root_path (outpath, outsize) < 0) {
-        return -1;
-    }
-
-    const size_t size_left = outsize - strlen (outpath);
-    int path_length;
-    path_length = snprintf (outpath+strlen (outpath), size_left, "covers2/%s/", esc_artist);
-    if (path_length >= size_left) {
-        trace ("Cache path truncated at %d bytes\n", (int)size_left);
-        return -1;
-    }
-
-    return 0;
-}
-
-static int
-make_cache_path (const char *filepath, const char *album, const char *artist, char *outpath, int outsize) {
-    outpath[0] = '\0';
-
+// The disk cache is shared by the tracks of the same album
+static char *
+make_cache_key (const char *filepath, const char *album, const char *artist) {
     if (!album || !*album) {
         if (filepath) {
             album = filepath;
@@ -971,33 +528,19 @@ make_cache_path (const char *filepath, const char *album, const char *artist, ch
         }
         else {
             trace ("not possible to get any unique album name\n");
-            return -1;
+            return NULL;
         }
     }
     if (!artist || !*artist) {
         artist = "Unknown artist";
     }
 
-    if (make_cache_dir_path (artist, outpath, outsize-NAME_MAX)) {
-        return -1;
-    }
-
-    int name_size = outsize - (int)strlen (outpath);
-    int max_album_chars = min (NAME_MAX, name_size) - (int)sizeof ("1.jpg.part");
-    if (max_album_chars <= 0) {
-        trace ("Path buffer not long enough for %s and filename\n", outpath);
-        return -1;
+    size_t size = strlen (artist) + strlen (album) + 2;
+    char *key = malloc (size);
+    if (key) {
+        snprintf (key, size, "%s\x1f%s", artist, album);
     }
-
-    char esc_album[max_album_chars+1];
-    const char *palbum = strlen (album) > max_album_chars ? album+strlen (album)-max_album_chars : album;
-    size_t i = 0;
-    do {
-        esc_album[i] = esc_char (palbum[i]);
-    } while (palbum[i++]);
-
-    sprintf (outpath+strlen (outpath), "%s%s", esc_album, ".jpg");
-    return 0;
+    return key;
 }
 
 static void
@@ -1057,20 +600,41 @@ queries_equal (ddb_cover_query_t *q1, ddb_cover_query_t *q2) {
     return 0;
 }
 
+static int
+append_query_callback (cover_query_t *q, ddb_cover_query_t *new_query, const ddb_cover_callback_t cb)
+{
+    if (!queries_equal (new_query, q->callbacks->info)) {
+        return 0;
+    }
+    cover_callback_t **last_callback = &q->callbacks;
+    while (*last_callback && (*last_callback)->cb != cache_reset_callback) {
+        last_callback = & (*last_callback)->next;
+    }
+    if (*last_callback) {
+        return 0;
+    }
+    *last_callback = new_query_callback (cb, new_query);
+    return 1;
+}
+
 static void
 enqueue_query (ddb_cover_query_t *new_query, const ddb_cover_callback_t cb)
 {
-    for (cover_query_t *q = queue; q; q = q->next) {
-        if (queries_equal (new_query, q->callbacks->info)) {
-            // append top existing pending query
-            cover_callback_t **last_callback = &q->callbacks;
-            while (*last_callback && (*last_callback)->cb != cache_reset_callback) {
-                last_callback = & (*last_callback)->next;
-            }
-            if (!*last_callback) {
-                *last_callback = new_query_callback (cb, new_query);
-                return;
-            }
+    // append to the same query being processed
+    for (cover_query_t *q = running; q; q = q->next) {
+        if (append_query_callback (q, new_query, cb)) {
+            return;
+        }
+    }
+
+    // append to the same waiting query, and move it to the front, since it's been requested again
+    for (cover_query_t **pq = &queue; *pq; pq = &(*pq)->next) {
+        cover_query_t *q = *pq;
+        if (append_query_callback (q, new_query, cb)) {
+            *pq = q->next;
+            q->next = queue;
+            queue = q;
+            return;
         }
     }
 
@@ -1088,17 +652,41 @@ enqueue_query (ddb_cover_query_t *new_query, const ddb_cover_callback_t cb)
         return;
     }
 
-    if (queue_tail) {
-        queue_tail->next = q;
+    q->next = queue;
+    queue = q;
+    queue_count++;
+    deadbeef->cond_signal (queue_cond);
+}
+
+// remove the oldest queries over the limit, the caller must cancel them
+static cover_query_t *
+trim_queue (void)
+{
+    if (queue_count <= MAX_PENDING_QUERIES) {
+        return NULL;
     }
-    else {
-        queue = q;
+    cover_query_t *trimmed = NULL;
+    cover_query_t **pq = &queue;
+    int n = 0;
+    while (*pq) {
+        cover_query_t *q = *pq;
+        // the cache reset queries have no track, and are never cancelled
+        if (n >= MAX_PENDING_QUERIES && q->callbacks->info->track) {
+            *pq = q->next;
+            q->next = trimmed;
+            trimmed = q;
+            queue_count--;
+        }
+        else {
+            pq = &q->next;
+            n++;
+        }
     }
-    queue_tail = q;
-    deadbeef->cond_signal (queue_cond);
+    return trimmed;
 }
 
-static char *filter_custom_mask = NULL;
+// scandir filters have no context, and several fetcher threads can scan at the same time
+static __thread char *filter_custom_mask = NULL;
 
 static int
 filter_custom (const struct dirent *f)
@@ -1176,7 +764,7 @@ scan_local_path (char *mask, const char *local_path, const char *uri, DB_vfs_t *
     return -1;
 }
 
-static const char *filter_strcasecmp_name = NULL;
+static __thread const char *filter_strcasecmp_name = NULL;
 
 static int
 filter_strcasecmp (const struct dirent *f)
@@ -1242,6 +830,9 @@ local_image_file (const char *local_path, const char *uri, DB_vfs_t *vfsplug, dd
             path = get_case_insensitive_path (local_path, folder, vfsplug);
             folder += strlen (folder)+1;
         }
+        if (!path) {
+            continue;
+        }
         trace ("scanning %s for artwork\n", path);
         for (char *mask = filemask; mask < filemask_end; mask += strlen (mask)+1) {
             if (mask[0] && !scan_local_path (mask, path, uri, vfsplug, cover)) {
@@ -1668,14 +1259,18 @@ mp4_extract_art (const char *fname, const char *outname, ddb_cover_info_t *cover
 }
 #endif
 
+// Returns 1 if found, -1 if not found,
+// 0 if the search was aborted or a server couldn't be reached
 static int
 web_lookups (const char *artist, const char *album, const char *cache_path, ddb_cover_info_t *cover)
 {
     if (!cache_path) {
         return 0;
     }
+    int failed = 0;
 #if USE_VFS_CURL
     if (artwork_enable_lfm) {
+        errno = 0;
         if (!fetch_from_lastfm (artist, album, cache_path)) {
             cover->filename = strdup (cache_path);
             return 1;
@@ -1683,9 +1278,11 @@ web_lookups (const char *artist, const char *album, const char *cache_path, ddb_
         if (errno == ECONNABORTED) {
             return 0;
         }
+        failed |= errno == EIO;
     }
 
     if (artwork_enable_mb) {
+        errno = 0;
         if (!fetch_from_musicbrainz (artist, album, cache_path)) {
             cover->filename = strdup (cache_path);
             return 1;
@@ -1693,9 +1290,11 @@ web_lookups (const char *artist, const char *album, const char *cache_path, ddb_
         if (errno == ECONNABORTED) {
             return 0;
         }
+        failed |= errno == EIO;
     }
 
     if (artwork_enable_aao) {
+        errno = 0;
         if (!fetch_from_albumart_org (artist, album, cache_path)) {
             cover->filename = strdup (cache_path);
             return 1;
@@ -1703,10 +1302,11 @@ web_lookups (const char *artist, const char *album, const char *cache_path, ddb_
         if (errno == ECONNABORTED) {
             return 0;
         }
+        failed |= errno == EIO;
     }
 #endif
 
-    return -1;
+    return failed ? 0 : -1;
 }
 
 static char *
@@ -1740,8 +1340,6 @@ scandir_plug (const char *vfs_fname)
     return NULL;
 }
 
-// might be used from process_query, when cache impl is finalized
-#if 0
 static int
 path_more_recent (const char *fname, const time_t placeholder_mtime)
 {
@@ -1758,52 +1356,67 @@ recheck_missing_artwork (const char *input_fname, const time_t placeholder_mtime
     /* Check if local files could have new associated artwork */
     if (deadbeef->is_local_file (fname)) {
         char *vfs_fname = vfs_path (fname);
-        const char *real_fname = vfs_fname ? vfs_fname : fname;
+        char *real_fname = vfs_fname ? vfs_fname : fname;
 
         /* Recheck artwork if file (track or VFS container) was modified since the last check */
         if (path_more_recent (real_fname, placeholder_mtime)) {
-            return 1;
+            res = 1;
         }
-
         /* Recheck local artwork if the directory contents have changed */
-        char *dname = strdup (dirname (fname));
-        res = artwork_enable_local && path_more_recent (dname, placeholder_mtime);
-        free (dname);
+        else if (artwork_enable_local) {
+            res = path_more_recent (dirname (real_fname), placeholder_mtime);
+        }
     }
 
     free (fname);
     return res;
 }
-#endif
 
-// Behavior:
-// Local cover: path is returned
-// Found in cache: path is returned
-// Embedded cover: !cache_disabled ? save_to_cash&return_path : return blob
-// Web cover: save_to_local ? save_to_local&return_path : ( !cache_disabled ? save_to_cache&return_path : NOP )
+#ifdef USE_VFS_CURL
+// Returns 1 if found, -1 when nothing was found, 0 if the search was aborted or failed
 static int
-process_query (const char *filepath, const char *album, const char *artist, ddb_cover_info_t *cover)
+fetch_from_web (const char *filepath, const char *album, const char *artist, const char *cache_path, ddb_cover_info_t *cover)
 {
-    char cache_path_buf[PATH_MAX];
-    char *cache_path = NULL;
+    if (artwork_enable_wos && strlen (filepath) > 3 && !strcasecmp (filepath+strlen (filepath)-3, ".ay")) {
+        errno = 0;
+        if (!fetch_from_wos (album, cache_path)) {
+            cover->filename = strdup(cache_path);
+            return 1;
+        }
+        if (errno == ECONNABORTED || errno == EIO) {
+            return 0;
+        }
+    }
 
-    if (!artwork_disable_cache) {
-        cache_path = cache_path_buf;
-        make_cache_path (filepath, album, artist, cache_path, sizeof (cache_path_buf));
+    int res = web_lookups (artist, album, cache_path, cover);
+    if (res >= 0) {
+        return res;
     }
 
-#if 0
-#warning FIXME not needed during development; also this assumes that disk cache is used for everything
-    /* Flood control, don't retry missing artwork for an hour unless something changes */
-    struct stat placeholder_stat;
-    if (!stat (cache_path, &placeholder_stat) && placeholder_stat.st_mtime + 60*60 > time (NULL)) {
-        int recheck = recheck_missing_artwork (filepath, placeholder_stat.st_mtime);
-        if (!recheck) {
-            return 0;
+    if (album) {
+        /* Try stripping parenthesised text off the end of the album name */
+        char *p = strpbrk (album, "([");
+        if (p) {
+            *p = '\0';
+            int res = web_lookups (artist, album, cache_path, cover);
+            *p = '(';
+            if (res >= 0) {
+                return res;
+            }
         }
     }
+    return -1;
+}
 #endif
 
+// Behavior:
+// Local cover: path is returned
+// Embedded cover: cache_path ? save_to_cache_path&return_path : return blob
+// Web cover: cache_path ? save_to_cache_path&return_path : NOP
+// Returns 1 if found, -1 if not found, 0 if the search was aborted
+static int
+find_cover (const char *filepath, const char *album, const char *artist, const char *cache_path, ddb_cover_info_t *cover)
+{
     int islocal = deadbeef->is_local_file (filepath);
 
     if (artwork_enable_embedded && islocal) {
@@ -1860,55 +1473,85 @@ process_query (const char *filepath, const char *album, const char *artist, ddb_
     }
 
     if (!cache_path) {
-        return 0;
+        return -1;
     }
 
 #ifdef USE_VFS_CURL
     /* Web lookups */
-    if (artwork_enable_wos && strlen (filepath) > 3 && !strcasecmp (filepath+strlen (filepath)-3, ".ay")) {
-        if (!fetch_from_wos (album, cache_path)) {
-            cover->filename = strdup(cache_path);
-            return 1;
-        }
-        if (errno == ECONNABORTED) {
-            return 0;
-        }
-    }
-
-    int res = web_lookups (artist, album, cache_path, cover);
+    deadbeef->mutex_lock (web_mutex);
+    int res = fetch_from_web (filepath, album, artist, cache_path, cover);
+    deadbeef->mutex_unlock (web_mutex);
     if (res >= 0) {
         return res;
     }
+#endif
 
-    if (album) {
-        /* Try stripping parenthesised text off the end of the album name */
-        char *p = strpbrk (album, "([");
-        if (p) {
-            *p = '\0';
-            int res = web_lookups (artist, album, cache_path, cover);
-            *p = '(';
-            if (res >= 0) {
-                return res;
-            }
+    return -1;
+}
+
+// Found in cache: path is returned
+// Embedded or web cover: saved to cache, unless it's disabled
+// Returns 1 if found, -1 if not found, 0 if the result shouldn't be remembered
+static int
+process_query (const char *filepath, const char *album, const char *artist, ddb_cover_info_t *cover)
+{
+    char *cache_key = artwork_disable_cache ? NULL : make_cache_key (filepath, album, artist);
+    if (!cache_key) {
+        return find_cover (filepath, album, artist, NULL, cover);
+    }
+
+    char cache_path[PATH_MAX];
+    time_t stored;
+    int cached = cache_lookup (cache_key, cache_path, sizeof (cache_path), &stored);
+    if (cached > 0) {
+        free (cache_key);
+        cover->filename = strdup (cache_path);
+        return 1;
+    }
+
+#if 0
+#warning FIXME not needed during development
+    /* Flood control, don't retry missing artwork for an hour unless something changes */
+    if (cached == 0 && stored + 60*60 > time (NULL)) {
+        int recheck = recheck_missing_artwork (filepath, stored);
+        if (!recheck) {
+            free (cache_key);
+            return 0;
         }
     }
 #endif
 
-    /* Touch placeholder */
-    write_file (cache_path, NULL, 0);
+    /* The new image is written outside of the cache, and moved in when it's known to be not a duplicate */
+    char incoming_path[PATH_MAX];
+    int res = find_cover (filepath, album, artist, cache_incoming_path (incoming_path, sizeof (incoming_path)) ? NULL : incoming_path, cover);
+    if (res > 0 && cover->filename && !strcmp (cover->filename, incoming_path)) {
+        free (cover->filename);
+        cover->filename = NULL;
+        if (!cache_store_file (cache_key, incoming_path, cache_path, sizeof (cache_path))) {
+            cover->filename = strdup (cache_path);
+        }
+        else {
+            res = 0;
+        }
+    }
+    else if (res < 0) {
+        cache_store_file (cache_key, NULL, NULL, 0);
+    }
 
-    return 0;
+    free (cache_key);
+    return res;
 }
 
+// Each callback gets its own reference to the cover,
+// the caller keeps the reference it holds.
 static void
 send_query_callbacks (cover_callback_t *callback, ddb_cover_info_t *cover) {
     if (cover) {
-        cover->refc = 0;
-        cover_callback_t *c = callback;
-        while (c) {
-            cover->refc++;
-            c = c->next;
+        int count = 0;
+        for (cover_callback_t *c = callback; c; c = c->next) {
+            count++;
         }
+        __atomic_add_fetch (&cover->refc, count, __ATOMIC_RELAXED);
     }
     while (callback) {
         callback->cb (cover ? 0 : -1, callback->info, cover);
@@ -1918,12 +1561,32 @@ send_query_callbacks (cover_callback_t *callback, ddb_cover_info_t *cover) {
     }
 }
 
+static void
+cancel_query_callbacks (cover_callback_t *callback) {
+    while (callback) {
+        callback->cb (DDB_ARTWORK_ERROR_CANCELLED, callback->info, NULL);
+        cover_callback_t *next = callback->next;
+        free (callback);
+        callback = next;
+    }
+}
+
+static void
+cancel_queries (cover_query_t *query) {
+    while (query) {
+        cover_query_t *next = query->next;
+        cancel_query_callbacks (query->callbacks);
+        query_free (query);
+        query = next;
+    }
+}
+
 static cover_query_t *
 query_pop (void) {
     cover_query_t *query = queue;
-    queue = queue ? queue->next : NULL;
-    if (!queue) {
-        queue_tail = NULL;
+    if (query) {
+        queue = query->next;
+        queue_count--;
     }
     return query;
 }
@@ -1936,13 +1599,12 @@ queue_clear (void) {
         query_free (queue);
         queue = next;
     }
-    queue_tail = NULL;
+    queue_count = 0;
 }
 
 static void
 cover_info_free (ddb_cover_info_t *cover) {
-    cover->refc--;
-    if (cover->refc != 0) {
+    if (__atomic_sub_fetch (&cover->refc, 1, __ATOMIC_ACQ_REL) != 0) {
         return;
     }
     if (cover->type) {
@@ -1966,30 +1628,29 @@ fetcher_thread (void *none)
 
     /* Loop until external terminate command */
     deadbeef->mutex_lock (queue_mutex);
-    while (!terminate) {
-        trace ("artwork fetcher: waiting for signal ...\n");
-        // FIXME: use deadbeef->cond_wait
-        pthread_cond_wait ((pthread_cond_t *)queue_cond, (pthread_mutex_t *)queue_mutex);
-        trace ("artwork fetcher: cond signalled, process queue\n");
-
-        /* Loop until queue is empty */
-        while (queue) {
-            deadbeef->mutex_unlock (queue_mutex);
-
-            ddb_cover_query_t *info = queue->callbacks->info;
+    for (;;) {
+        while (!terminate && !queue) {
+            trace ("artwork fetcher: waiting for signal ...\n");
+            // FIXME: use deadbeef->cond_wait
+            pthread_cond_wait ((pthread_cond_t *)queue_cond, (pthread_mutex_t *)queue_mutex);
+        }
+        if (terminate) {
+            break;
+        }
 
-            /* Process this query, hopefully writing a file into cache */
-            ddb_cover_info_t *cover = calloc (sizeof (ddb_cover_info_t), 1);
+        /* Take the most recent query, it stays visible to enqueue_query while processed */
+        cover_query_t *query = query_pop ();
+        query->next = running;
+        running = query;
+        deadbeef->mutex_unlock (queue_mutex);
 
-            if (!album_tf) {
-                album_tf = deadbeef->tf_compile ("%album%");
-            }
-            if (!artist_tf) {
-                artist_tf = deadbeef->tf_compile ("%artist%");
-            }
+        ddb_cover_query_t *info = query->callbacks->info;
+        ddb_cover_info_t *cover = NULL;
 
+        // the cache reset query has no track, it only needs the callback
+        if (info->track) {
             deadbeef->pl_lock ();
-            char *filepath = strdupa (deadbeef->pl_find_meta (info->track, ":URI"));
+            const char *filepath = strdupa (deadbeef->pl_find_meta (info->track, ":URI"));
             deadbeef->pl_unlock ();
 
             char album[1000];
@@ -1999,31 +1660,59 @@ fetcher_thread (void *none)
             ctx.it = info->track;
             deadbeef->tf_eval (&ctx, album_tf, album, sizeof (album));
             deadbeef->tf_eval (&ctx, artist_tf, artist, sizeof (artist));
-            
-            int cover_found = process_query (filepath, album, artist, cover);
 
-            deadbeef->mutex_lock (queue_mutex);
-            cover_query_t *query = query_pop ();
-            deadbeef->mutex_unlock (queue_mutex);
+            size_t keylen = strlen (filepath) + strlen (album) + strlen (artist) + 3;
+            char *key = alloca (keylen);
+            snprintf (key, keylen, "%s\x1f%s\x1f%s", filepath, album, artist);
 
-            if (!query) {
-                break;
+            time_t stored;
+            int cached = memcache_get (key, &cover, &stored);
+            if (cached && !cover && (stored + MISSING_ARTWORK_RECHECK_INTERVAL < time (NULL) || recheck_missing_artwork (filepath, stored))) {
+                cached = 0;
             }
 
-            /* Make all the callbacks (and free the chain), with data if a file was written */
-            if (cover_found) {
-                trace ("artwork fetcher: cover art file found: %s\n", cover->filename);
-                send_query_callbacks (query->callbacks, cover);
-            }
-            else {
-                trace ("artwork fetcher: no cover art found\n");
-                send_query_callbacks (query->callbacks, NULL);
+            if (!cached) {
+                /* Process this query, hopefully writing a file into cache */
+                int generation = __atomic_load_n (&memcache_generation, __ATOMIC_ACQUIRE);
+                cover = calloc (sizeof (ddb_cover_info_t), 1);
+                if (cover) {
+                    cover->refc = 1;
+                    int res = process_query (filepath, album, artist, cover);
+                    if (res <= 0) {
+                        cover_info_free (cover);
+                        cover = NULL;
+                    }
+                    // the settings could change while the query was processed
+                    if (res && generation == __atomic_load_n (&memcache_generation, __ATOMIC_ACQUIRE)) {
+                        memcache_put (key, cover);
+                    }
+                }
             }
-            query_free (query);
+        }
 
-            /* Look for what to do next */
-            deadbeef->mutex_lock (queue_mutex);
+        deadbeef->mutex_lock (queue_mutex);
+        cover_query_t **pq = &running;
+        while (*pq != query) {
+            pq = &(*pq)->next;
         }
+        *pq = query->next;
+        deadbeef->mutex_unlock (queue_mutex);
+
+        /* Make all the callbacks (and free the chain), with data if a file was written */
+        if (cover) {
+            trace ("artwork fetcher: cover art file found: %s\n", cover->filename);
+        }
+        else {
+            trace ("artwork fetcher: no cover art found\n");
+        }
+        send_query_callbacks (query->callbacks, cover);
+        query_free (query);
+        if (cover) {
+            cover_info_free (cover);
+        }
+
+        /* Look for what to do next */
+        deadbeef->mutex_lock (queue_mutex);
     }
     deadbeef->mutex_unlock (queue_mutex);
     trace ("artwork fetcher: terminate thread\n");
@@ -2033,7 +1722,44 @@ static void
 cover_get (ddb_cover_query_t *query, ddb_cover_callback_t callback) {
     deadbeef->mutex_lock (queue_mutex);
     enqueue_query (query, callback);
+    cover_query_t *trimmed = trim_queue ();
     deadbeef->mutex_unlock (queue_mutex);
+
+    cancel_queries (trimmed);
+}
+
+static void
+cover_cancel_query (ddb_cover_query_t *query) {
+    cover_callback_t *cancelled = NULL;
+
+    deadbeef->mutex_lock (queue_mutex);
+    cover_query_t **pq = &queue;
+    while (*pq) {
+        cover_query_t *q = *pq;
+        cover_callback_t **pc = &q->callbacks;
+        while (*pc) {
+            cover_callback_t *c = *pc;
+            if (c->info == query) {
+                *pc = c->next;
+                c->next = cancelled;
+                cancelled = c;
+            }
+            else {
+                pc = &c->next;
+            }
+        }
+        if (!q->callbacks) {
+            *pq = q->next;
+            queue_count--;
+            query_free (q);
+        }
+        else {
+            pq = &q->next;
+        }
+    }
+    deadbeef->mutex_unlock (queue_mutex);
+
+    cancel_query_callbacks (cancelled);
 }
 
 static void
@@ -2142,6 +1868,7 @@ artwork_configchanged (void)
         strcmp(old_artwork_folders, artwork_folders)
         ) {
         trace ("artwork config changed, invalidating cache...\n");
+        cache_clear ();
         deadbeef->mutex_lock (queue_mutex);
 
         // Submit a query for NULL image, with a callback that would reset the cache,
@@ -2152,6 +1879,10 @@ artwork_configchanged (void)
 
         artwork_abort_http_request ();
         deadbeef->mutex_unlock (queue_mutex);
+
+        // after the abort, so the aborted lookups don't put the old results back
+        __atomic_add_fetch (&memcache_generation, 1, __ATOMIC_RELEASE);
+        memcache_clear ();
     }
     free (old_artwork_filemask);
     free (old_artwork_folders);
@@ -2188,16 +1919,17 @@ invalidate_playitem_cache (DB_plugin_action_t *action, int ctx)
             ctx.it = it;
             deadbeef->tf_eval (&ctx, album_tf, album, sizeof (album));
             deadbeef->tf_eval (&ctx, artist_tf, artist, sizeof (artist));
-            char cache_path[PATH_MAX];
-            if (!make_cache_path (url, album, artist, cache_path, PATH_MAX)) {
-                char subdir_path[PATH_MAX];
-                make_cache_dir_path (artist, subdir_path, PATH_MAX);
-                const char *subdir_name = basename (subdir_path);
-                const char *entry_name = basename (cache_path);
-                trace ("Expire %s from cache\n", cache_path);
-                remove_cache_item (cache_path, subdir_path, subdir_name, entry_name);
+
+            size_t keylen = strlen (url) + strlen (album) + strlen (artist) + 3;
+            char *key = alloca (keylen);
+            snprintf (key, keylen, "%s\x1f%s\x1f%s", url, album, artist);
+            memcache_remove (key);
+
+            char *cache_key = make_cache_key (url, album, artist);
+            if (cache_key) {
+                cache_remove (cache_key);
+                free (cache_key);
             }
-            deadbeef->pl_unlock ();
         }
         deadbeef->pl_item_unref (it);
         it = deadbeef->pl_get_next (it, PL_MAIN);
@@ -2228,22 +1960,30 @@ artwork_get_actions (DB_playItem_t *it)
 static int
 artwork_plugin_stop (void)
 {
-    if (tid) {
-        trace ("Stopping fetcher thread ... \n");
+    if (queue_mutex && queue_cond) {
+        trace ("Stopping fetcher threads ... \n");
         deadbeef->mutex_lock (queue_mutex);
         queue_clear ();
         terminate = 1;
-        deadbeef->cond_signal (queue_cond);
-        while (queue) {
+        deadbeef->cond_broadcast (queue_cond);
+        while (running) {
             artwork_abort_http_request ();
             deadbeef->mutex_unlock (queue_mutex);
             usleep (10000);
             deadbeef->mutex_lock (queue_mutex);
         }
         deadbeef->mutex_unlock (queue_mutex);
-        deadbeef->thread_join (tid);
-        tid = 0;
-        trace ("Fetcher thread stopped\n");
+        for (int i = 0; i < FETCHER_THREADS; i++) {
+            if (tids[i]) {
+                deadbeef->thread_join (tids[i]);
+                tids[i] = 0;
+            }
+        }
+        trace ("Fetcher threads stopped\n");
+    }
+    if (web_mutex) {
+        deadbeef->mutex_free (web_mutex);
+        web_mutex = 0;
     }
     if (queue_mutex) {
         deadbeef->mutex_free (queue_mutex);
@@ -2271,6 +2011,7 @@ artwork_plugin_stop (void)
     }
 
     stop_cache_cleaner ();
+    memcache_deinit ();
 
     return 0;
 }
@@ -2285,19 +2026,26 @@ artwork_plugin_start (void)
     imlib_set_cache_size (0);
 #endif
 
+    album_tf = deadbeef->tf_compile ("%album%");
+    artist_tf = deadbeef->tf_compile ("%artist%");
+
+    memcache_init (MEMCACHE_SIZE, cover_info_free);
+    start_cache_cleaner ();
+
     terminate = 0;
+    web_mutex = deadbeef->mutex_create_nonrecursive ();
     queue_mutex = deadbeef->mutex_create_nonrecursive ();
     queue_cond = deadbeef->cond_create ();
-    if (queue_mutex && queue_cond) {
-        tid = deadbeef->thread_start_low_priority (fetcher_thread, NULL);
+    if (web_mutex && queue_mutex && queue_cond) {
+        for (int i = 0; i < FETCHER_THREADS; i++) {
+            tids[i] = deadbeef->thread_start_low_priority (fetcher_thread, NULL);
+        }
     }
-    if (!tid) {
+    if (!tids[0]) {
         artwork_plugin_stop ();
         return -1;
     }
 
-    start_cache_cleaner ();
-
     return 0;
 }
 
@@ -2373,6 +2121,7 @@ static ddb_artwork_plugin_t plugin = {
     .cover_get = cover_get,
     .reset = artwork_reset,
     .cover_info_free = cover_info_free,
+    .cancel_query = cover_cancel_query,
 };
 
 DB_plugin_t *
@@ -25,7 +25,7 @@
 #define __ARTWORK_H
 
 #define DDB_ARTWORK_MAJOR_VERSION 2
-#define DDB_ARTWORK_MINOR_VERSION 0
+#define DDB_ARTWORK_MINOR_VERSION 1
 
 // The flags below can be used in the `flags` member of the `ddb_cover_query_t` structure,
 // and can be OR'ed together.
@@ -49,6 +49,11 @@ enum {
     DDB_ARTWORK_FLAG_NO_CACHE = 0x00000004,
 };
 
+// The `error` passed to the callback, when the query was dropped before being processed (since 2.1)
+enum {
+    DDB_ARTWORK_ERROR_CANCELLED = -2,
+};
+
 // This structure needs to be passed to cover_get.
 // It must remain in memory until the callback is called.
 typedef struct ddb_cover_query_s {
@@ -102,6 +107,12 @@ typedef struct {
     //
     // The callback is not executed on the same thread, as cover_get.
     // Avoid running slow blocking code in the callbacks.
+    //
+    // Since 2.1, the queries are processed by several threads, the most recent ones first,
+    // so that the covers which are currently visible get loaded before the ones scrolled away from.
+    // When too many queries are waiting, the oldest ones are cancelled,
+    // with DDB_ARTWORK_ERROR_CANCELLED error.
+    // The results are kept in memory, so repeating a query is cheap.
     void
     (*cover_get) (ddb_cover_query_t *query, ddb_cover_callback_t callback);
 
@@ -112,6 +123,12 @@ typedef struct {
     // Free dynamically allocated data pointed by `cover`.
     void
     (*cover_info_free) (ddb_cover_info_t *cover);
+
+    // Since 2.1: Cancel the query, if it's still waiting in the queue,
+    // the callback is called with DDB_ARTWORK_ERROR_CANCELLED error.
+    // The query which is already being processed is not affected.
+    void
+    (*cancel_query) (ddb_cover_query_t *query);
 } ddb_artwork_plugin_t;
 
 #endif /*__ARTWORK_H*/
@@ -62,26 +62,37 @@ new_http_request (const char *url)
     return http_request;
 }
 
-static void
+// Returns 1 if the request was aborted
+static int
 close_http_request (DB_FILE *request)
 {
     deadbeef->mutex_lock (http_mutex);
     deadbeef->fclose (request);
+    int aborted = http_request != request;
     http_request = NULL;
     deadbeef->mutex_unlock (http_mutex);
+    return aborted;
 }
 
 size_t artwork_http_request (const char *url, char *buffer, const size_t buffer_size)
 {
+    buffer[0] = '\0';
     DB_FILE *request = new_http_request (url);
     if (!request) {
+        errno = EIO;
         return 0;
     }
 
     const size_t size = deadbeef->fread (buffer, 1, buffer_size-1, request);
     buffer[size] = '\0';
 
-    close_http_request (request);
+    if (close_http_request (request)) {
+        errno = ECONNABORTED;
+        return 0;
+    }
+    if (!size) {
+        errno = EIO;
+    }
 
     return size;
 }
@@ -131,6 +142,24 @@ ensure_dir (const char *path) {
     return res;
 }
 
+// Several fetcher threads can be writing the same file, so each gets a unique temporary file
+static FILE *
+open_tmp_file (const char *out, char *tmp_path, size_t size)
+{
+    snprintf (tmp_path, size, "%s.XXXXXX", out);
+    int fd = mkstemp (tmp_path);
+    if (fd < 0) {
+        return NULL;
+    }
+    fchmod (fd, 0644);
+    FILE *fp = fdopen (fd, "w+b");
+    if (!fp) {
+        close (fd);
+        unlink (tmp_path);
+    }
+    return fp;
+}
+
 #define BUFFER_SIZE 4096
 int
 copy_file (const char *in, const char *out) {
@@ -141,8 +170,7 @@ copy_file (const char *in, const char *out) {
     }
 
     char tmp_out[PATH_MAX];
-    snprintf (tmp_out, PATH_MAX, "%s.part", out);
-    FILE *fout = fopen (tmp_out, "w+b");
+    FILE *fout = open_tmp_file (out, tmp_out, sizeof (tmp_out));
     if (!fout) {
         trace ("artwork: failed to open file %s for writing\n", tmp_out);
         return -1;
@@ -151,7 +179,9 @@ copy_file (const char *in, const char *out) {
     DB_FILE *request = new_http_request (in);
     if (!request) {
         fclose (fout);
+        unlink (tmp_out);
         trace ("artwork: failed to open file %s for reading\n", in);
+        errno = EIO;
         return -1;
     }
 
@@ -168,10 +198,20 @@ copy_file (const char *in, const char *out) {
         file_bytes += bytes_read;
     } while (!err && bytes_read == BUFFER_SIZE);
 
-    close_http_request (request);
+    int error_code = 0;
+    if (close_http_request (request)) {
+        // don't keep the partial download
+        trace ("artwork: download of %s was aborted\n", in);
+        err = -1;
+        error_code = ECONNABORTED;
+    }
+    else if (!err && file_bytes == 0) {
+        err = -1;
+        error_code = EIO;
+    }
     fclose (fout);
 
-    if (file_bytes > 0 && !err) {
+    if (!err) {
         err = rename (tmp_out, out);
         if (err) {
             trace ("artwork: failed to move %s to %s: %s\n", tmp_out, out, strerror (errno));
@@ -179,6 +219,9 @@ copy_file (const char *in, const char *out) {
     }
 
     unlink (tmp_out);
+    if (error_code) {
+        errno = error_code;
+    }
     return err;
 }
 
@@ -189,8 +232,7 @@ int write_file (const char *out, const char *data, const size_t data_length)
     }
 
     char tmp_path[PATH_MAX];
-    snprintf (tmp_path, sizeof (tmp_path), "%s.part", out);
-    FILE *fp = fopen (tmp_path, "w+b");
+    FILE *fp = open_tmp_file (out, tmp_path, sizeof (tmp_path));
     if (!fp) {
         trace ("artwork: failed to open %s for writing\n", tmp_path);
         return -1;
@@ -29,10 +29,13 @@
 #define min(x,y) ((x)<(y)?(x):(y))
 #define max(x,y) ((x)>(y)?(x):(y))
 
+// On failure errno is set to ECONNABORTED if the request was aborted,
+// or to EIO if nothing could be downloaded.
 size_t artwork_http_request(const char *url, char *buffer, const size_t max_bytes);
 void artwork_abort_http_request(void);
 
 int ensure_dir(const char *path);
+// Downloads the url into the file, setting errno the same way as artwork_http_request.
 int copy_file (const char *in, const char *out);
 int write_file(const char *out, const char *data, const size_t data_length);
 
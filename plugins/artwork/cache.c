@@ -24,16 +24,18 @@
 #ifdef HAVE_CONFIG_H
     #include "../../config.h"
 #endif
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
-#include <libgen.h>
 #include <dirent.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <sys/stat.h>
 #include <limits.h>
 #include "artwork_internal.h"
+#include "cache.h"
+#include "memcache.h"
 #include "../../deadbeef.h"
 
 //#define trace(...) { fprintf(stderr, __VA_ARGS__); }
@@ -41,6 +43,65 @@
 
 extern DB_functions_t *deadbeef;
 
+// The images are stored once per content, as covers3/<first 2 digits of md5>/<md5>.jpg (or .png),
+// and covers3/index maps the sources (artist and album) to the images.
+//
+// index file layout: "DACI", uint32 version, then the records:
+// uint32 payload size, uint32 payload checksum, payload;
+// all numbers in native byte order.
+//
+// payload: uint8 type, uint32 source size, source (including the terminating zero), then for CACHE_RECORD_ENTRY:
+// uint8 image type, 16 bytes md5, int64 image size, int64 time stored, int64 time accessed
+//
+// A later record for the same source replaces the earlier one, so the changes are appended,
+// and the file is rewritten only when it has too many stale records.
+
+#define CACHE_DIR "covers3"
+#define CACHE_MAGIC "DACI"
+#define CACHE_VERSION 1
+#define CACHE_HEADER_SIZE 8
+#define CACHE_MAX_RECORD 65536
+#define CACHE_MIN_STALE 64
+
+// access times are written back with this resolution, to avoid writing the index on every lookup
+#define CACHE_ATIME_RESOLUTION (60*60)
+
+enum {
+    CACHE_RECORD_ENTRY = 1,
+    CACHE_RECORD_REMOVED = 2,
+};
+
+enum {
+    IMAGE_NONE = 0, // the source has no image
+    IMAGE_JPEG = 1,
+    IMAGE_PNG = 2,
+};
+
+typedef struct cache_entry_s {
+    char *source;
+    uint32_t source_hash;
+    uint8_t image_type;
+    uint8_t md5[16];
+    int64_t size;
+    int64_t ctime;
+    int64_t atime;
+    int64_t saved_atime;
+    int saved; // the record is in the file
+    struct cache_entry_s *next;
+} cache_entry_t;
+
+typedef struct cache_image_s {
+    uint8_t md5[16];
+    int refc;
+    struct cache_image_s *next;
+} cache_image_t;
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t alloc;
+} buffer_t;
+
 static uintptr_t files_mutex;
 static intptr_t tid;
 static uintptr_t thread_mutex;
@@ -48,6 +109,16 @@ static uintptr_t thread_cond;
 static int terminate;
 static int32_t cache_expiry_seconds;
 
+// the index, protected by files_mutex
+static char index_path[PATH_MAX];
+static cache_entry_t **entries;
+static cache_image_t **images;
+static size_t num_buckets; // same for both tables, power of 2
+static size_t num_entries;
+static size_t num_stale;
+static int index_rewrite;
+static unsigned incoming_counter;
+
 void cache_lock (void)
 {
     deadbeef->mutex_lock (files_mutex);
@@ -70,52 +141,689 @@ int make_cache_root_path (char *path, const size_t size)
 }
 
 static int
-filter_scaled_dirs (const struct dirent *f)
+make_cache_dir_path (char *path, const size_t size)
+{
+    if (make_cache_root_path (path, size)) {
+        return -1;
+    }
+    size_t l = strlen (path);
+    if (snprintf (path + l, size - l, CACHE_DIR "/") >= size - l) {
+        return -1;
+    }
+    return 0;
+}
+
+static uint32_t
+hash_string (const char *s)
+{
+    uint32_t h = 2166136261u;
+    for (const uint8_t *p = (const uint8_t *)s; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static uint32_t
+hash_md5 (const uint8_t *md5)
+{
+    uint32_t h;
+    memcpy (&h, md5, sizeof (h));
+    return h;
+}
+
+static int
+make_image_path (const uint8_t *md5, int image_type, char *path, size_t size)
+{
+    char hex[33];
+    deadbeef->md5_to_str (hex, md5);
+    if (make_cache_dir_path (path, size)) {
+        return -1;
+    }
+    size_t l = strlen (path);
+    if (snprintf (path + l, size - l, "%.2s/%s%s", hex, hex, image_type == IMAGE_PNG ? ".png" : ".jpg") >= size - l) {
+        return -1;
+    }
+    return 0;
+}
+
+// index
+
+static cache_entry_t **
+find_entry (const char *source, uint32_t source_hash)
+{
+    cache_entry_t **pe = &entries[source_hash & (num_buckets - 1)];
+    while (*pe && ((*pe)->source_hash != source_hash || strcmp ((*pe)->source, source))) {
+        pe = &(*pe)->next;
+    }
+    return pe;
+}
+
+static cache_image_t **
+find_image (const uint8_t *md5)
+{
+    cache_image_t **pi = &images[hash_md5 (md5) & (num_buckets - 1)];
+    while (*pi && memcmp ((*pi)->md5, md5, 16)) {
+        pi = &(*pi)->next;
+    }
+    return pi;
+}
+
+static void
+grow (void)
+{
+    size_t new_num_buckets = num_buckets * 2;
+    cache_entry_t **new_entries = calloc (new_num_buckets, sizeof (cache_entry_t *));
+    cache_image_t **new_images = calloc (new_num_buckets, sizeof (cache_image_t *));
+    if (!new_entries || !new_images) {
+        free (new_entries);
+        free (new_images);
+        return;
+    }
+    for (size_t i = 0; i < num_buckets; i++) {
+        while (entries[i]) {
+            cache_entry_t *e = entries[i];
+            entries[i] = e->next;
+            e->next = new_entries[e->source_hash & (new_num_buckets - 1)];
+            new_entries[e->source_hash & (new_num_buckets - 1)] = e;
+        }
+        while (images[i]) {
+            cache_image_t *im = images[i];
+            images[i] = im->next;
+            im->next = new_images[hash_md5 (im->md5) & (new_num_buckets - 1)];
+            new_images[hash_md5 (im->md5) & (new_num_buckets - 1)] = im;
+        }
+    }
+    free (entries);
+    free (images);
+    entries = new_entries;
+    images = new_images;
+    num_buckets = new_num_buckets;
+}
+
+// returns 1 if the image is not used anymore
+static int
+image_release (const uint8_t *md5)
 {
-    return !strncasecmp (f->d_name, "covers2-", 7);
+    cache_image_t **pi = find_image (md5);
+    if (!*pi || --(*pi)->refc > 0) {
+        return 0;
+    }
+    cache_image_t *im = *pi;
+    *pi = im->next;
+    free (im);
+    return 1;
 }
 
-void remove_cache_item (const char *entry_path, const char *subdir_path, const char *subdir_name, const char *entry_name)
+static void
+image_retain (const uint8_t *md5)
 {
-    /* Unlink the expired file, and the artist directory if it is empty */
+    cache_image_t **pi = find_image (md5);
+    if (*pi) {
+        (*pi)->refc++;
+        return;
+    }
+    cache_image_t *im = calloc (1, sizeof (cache_image_t));
+    if (im) {
+        memcpy (im->md5, md5, 16);
+        im->refc = 1;
+        *pi = im;
+    }
+}
+
+static void
+delete_image (const uint8_t *md5, int image_type)
+{
+    char path[PATH_MAX];
+    if (!make_image_path (md5, image_type, path, sizeof (path))) {
+        trace ("artwork cache: delete %s\n", path);
+        unlink (path);
+        memcache_remove_file (path);
+    }
+}
+
+static void
+remove_entry (cache_entry_t **pe)
+{
+    cache_entry_t *e = *pe;
+    *pe = e->next;
+    num_entries--;
+    if (e->saved) {
+        num_stale++;
+    }
+    if (e->image_type != IMAGE_NONE && image_release (e->md5)) {
+        delete_image (e->md5, e->image_type);
+    }
+    free (e->source);
+    free (e);
+}
+
+// takes the ownership of the source
+static cache_entry_t *
+add_entry (char *source, int image_type, const uint8_t *md5, int64_t size, int64_t ctime, int64_t atime)
+{
+    cache_entry_t *e = calloc (1, sizeof (cache_entry_t));
+    if (!e) {
+        free (source);
+        return NULL;
+    }
+
+    // retain the new image first, the replaced entry can have the same one
+    if (image_type != IMAGE_NONE) {
+        memcpy (e->md5, md5, 16);
+        image_retain (md5);
+    }
+
+    uint32_t source_hash = hash_string (source);
+    cache_entry_t **pe = find_entry (source, source_hash);
+    if (*pe) {
+        remove_entry (pe);
+    }
+
+    e->source = source;
+    e->source_hash = source_hash;
+    e->image_type = image_type;
+    e->size = size;
+    e->ctime = ctime;
+    e->atime = e->saved_atime = atime;
+    e->next = *pe;
+    *pe = e;
+    num_entries++;
+    if (num_entries > num_buckets) {
+        grow ();
+    }
+    return e;
+}
+
+// index file
+
+static void
+put (buffer_t *b, const void *data, size_t size)
+{
+    if (b->size + size > b->alloc) {
+        b->alloc = b->alloc ? b->alloc * 2 : 4096;
+        while (b->alloc < b->size + size) {
+            b->alloc *= 2;
+        }
+        b->data = realloc (b->data, b->alloc);
+    }
+    memcpy (b->data + b->size, data, size);
+    b->size += size;
+}
+
+static void
+put_u8 (buffer_t *b, uint8_t v)
+{
+    put (b, &v, sizeof (v));
+}
+
+static void
+put_u32 (buffer_t *b, uint32_t v)
+{
+    put (b, &v, sizeof (v));
+}
+
+static void
+put_i64 (buffer_t *b, int64_t v)
+{
+    put (b, &v, sizeof (v));
+}
+
+static uint32_t
+checksum (const uint8_t *data, size_t size)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        h ^= data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// the entry is NULL for the removal record
+static void
+put_record (buffer_t *b, const char *source, const cache_entry_t *e)
+{
+    size_t start = b->size;
+    put_u32 (b, 0);
+    put_u32 (b, 0);
+
+    size_t source_size = strlen (source) + 1;
+    put_u8 (b, e ? CACHE_RECORD_ENTRY : CACHE_RECORD_REMOVED);
+    put_u32 (b, (uint32_t)source_size);
+    put (b, source, source_size);
+    if (e) {
+        put_u8 (b, e->image_type);
+        put (b, e->md5, 16);
+        put_i64 (b, e->size);
+        put_i64 (b, e->ctime);
+        put_i64 (b, e->atime);
+    }
+
+    uint32_t size = (uint32_t)(b->size - start - 8);
+    uint32_t sum = checksum (b->data + start + 8, size);
+    memcpy (b->data + start, &size, 4);
+    memcpy (b->data + start + 4, &sum, 4);
+}
+
+static int
+read_record (const uint8_t *data, size_t size)
+{
+    // type, source size, and the terminating zero at least
+    if (size < 6) {
+        return -1;
+    }
+    uint8_t type = data[0];
+    uint32_t source_size;
+    memcpy (&source_size, data + 1, 4);
+    if (!source_size || source_size > size - 5 || data[5 + source_size - 1]) {
+        return -1;
+    }
+    const char *source = (const char *)data + 5;
+    const uint8_t *p = data + 5 + source_size;
+    size -= 5 + source_size;
+
+    if (type == CACHE_RECORD_REMOVED) {
+        cache_entry_t **pe = find_entry (source, hash_string (source));
+        if (*pe) {
+            remove_entry (pe);
+        }
+        num_stale++; // the removal record itself
+        return 0;
+    }
+    if (type != CACHE_RECORD_ENTRY || size != 1 + 16 + 8 * 3) {
+        return -1;
+    }
+
+    uint8_t image_type = p[0];
+    const uint8_t *md5 = p + 1;
+    int64_t image_size, ctime, atime;
+    memcpy (&image_size, p + 17, 8);
+    memcpy (&ctime, p + 25, 8);
+    memcpy (&atime, p + 33, 8);
+    if (image_type > IMAGE_PNG) {
+        return -1;
+    }
+    cache_entry_t *e = add_entry (strdup (source), image_type, md5, image_size, ctime, atime);
+    if (e) {
+        e->saved = 1;
+    }
+    return 0;
+}
+
+static void
+load_index (void)
+{
+    FILE *fp = fopen (index_path, "rb");
+    if (!fp) {
+        index_rewrite = 1;
+        return;
+    }
+
+    uint8_t *data = NULL;
+    long size = 0;
+    if (!fseek (fp, 0, SEEK_END) && (size = ftell (fp)) >= CACHE_HEADER_SIZE && !fseek (fp, 0, SEEK_SET)) {
+        data = malloc (size);
+        if (data && fread (data, 1, size, fp) != (size_t)size) {
+            size = 0;
+        }
+    }
+    fclose (fp);
+
+    uint32_t version = 0;
+    if (data && size >= CACHE_HEADER_SIZE) {
+        memcpy (&version, data + 4, 4);
+    }
+    if (!data || size < CACHE_HEADER_SIZE || memcmp (data, CACHE_MAGIC, 4) || version != CACHE_VERSION) {
+        free (data);
+        index_rewrite = 1;
+        return;
+    }
+
+    size_t pos = CACHE_HEADER_SIZE;
+    while (size - pos >= 8) {
+        uint32_t recsize, sum;
+        memcpy (&recsize, data + pos, 4);
+        memcpy (&sum, data + pos + 4, 4);
+        if (recsize > CACHE_MAX_RECORD || size - pos - 8 < recsize || checksum (data + pos + 8, recsize) != sum) {
+            break;
+        }
+        if (read_record (data + pos + 8, recsize)) {
+            break;
+        }
+        pos += 8 + recsize;
+    }
+    if (pos != (size_t)size) {
+        // drop the damaged tail
+        index_rewrite = 1;
+    }
+    free (data);
+}
+
+static int
+write_buffer (const char *fname, const char *mode, buffer_t *b)
+{
+    FILE *fp = fopen (fname, mode);
+    if (!fp) {
+        return -1;
+    }
+    int res = fwrite (b->data, 1, b->size, fp) == b->size ? 0 : -1;
+    if (fflush (fp)) {
+        res = -1;
+    }
+    if (!res && mode[0] == 'w') {
+        res = fsync (fileno (fp));
+    }
+    fclose (fp);
+    return res;
+}
+
+// write the unsaved entries, or the whole index when it has too many stale records
+static void
+save_index (void)
+{
+    buffer_t b;
+    memset (&b, 0, sizeof (b));
+
+    if (index_rewrite || (num_stale >= CACHE_MIN_STALE && num_stale > num_entries)) {
+        put (&b, CACHE_MAGIC, 4);
+        put_u32 (&b, CACHE_VERSION);
+        for (size_t i = 0; i < num_buckets; i++) {
+            for (cache_entry_t *e = entries[i]; e; e = e->next) {
+                put_record (&b, e->source, e);
+            }
+        }
+
+        char tmp[PATH_MAX+10];
+        snprintf (tmp, sizeof (tmp), "%s.part", index_path);
+        if (!ensure_dir (index_path) || write_buffer (tmp, "wb", &b) || rename (tmp, index_path)) {
+            trace ("artwork cache: failed to write %s\n", index_path);
+            unlink (tmp);
+        }
+        else {
+            for (size_t i = 0; i < num_buckets; i++) {
+                for (cache_entry_t *e = entries[i]; e; e = e->next) {
+                    e->saved = 1;
+                    e->saved_atime = e->atime;
+                }
+            }
+            index_rewrite = 0;
+            num_stale = 0;
+        }
+    }
+    else {
+        for (size_t i = 0; i < num_buckets; i++) {
+            for (cache_entry_t *e = entries[i]; e; e = e->next) {
+                if (!e->saved || e->atime - e->saved_atime >= CACHE_ATIME_RESOLUTION) {
+                    put_record (&b, e->source, e);
+                }
+            }
+        }
+        if (b.size) {
+            if (write_buffer (index_path, "ab", &b)) {
+                // a partially written record is dropped on the next load
+                index_rewrite = 1;
+            }
+            else {
+                for (size_t i = 0; i < num_buckets; i++) {
+                    for (cache_entry_t *e = entries[i]; e; e = e->next) {
+                        if (!e->saved || e->atime - e->saved_atime >= CACHE_ATIME_RESOLUTION) {
+                            if (e->saved) {
+                                num_stale++; // replaced by the new record
+                            }
+                            e->saved = 1;
+                            e->saved_atime = e->atime;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    free (b.data);
+}
+
+// Append the records right away, keeping the index consistent with the image files in case of a crash.
+// Falls back to rewriting the whole index.
+static void
+append_records (buffer_t *b)
+{
+    if (!index_rewrite && b->size && write_buffer (index_path, "ab", b)) {
+        // a partially written record is dropped on the next load
+        index_rewrite = 1;
+    }
+    if (index_rewrite) {
+        save_index ();
+    }
+}
+
+static void
+free_index (void)
+{
+    for (size_t i = 0; i < num_buckets; i++) {
+        while (entries[i]) {
+            cache_entry_t *e = entries[i];
+            entries[i] = e->next;
+            free (e->source);
+            free (e);
+        }
+        while (images[i]) {
+            cache_image_t *im = images[i];
+            images[i] = im->next;
+            free (im);
+        }
+    }
+    free (entries);
+    free (images);
+    entries = NULL;
+    images = NULL;
+    num_buckets = 0;
+    num_entries = 0;
+    num_stale = 0;
+}
+
+// public
+
+int cache_lookup (const char *source, char *path, const size_t size, time_t *stored)
+{
+    int res = -1;
+    cache_lock ();
+    if (entries) {
+        cache_entry_t *e = *find_entry (source, hash_string (source));
+        if (e) {
+            e->atime = time (NULL);
+            *stored = (time_t)e->ctime;
+            if (e->image_type == IMAGE_NONE) {
+                res = 0;
+            }
+            else if (!make_image_path (e->md5, e->image_type, path, size)) {
+                res = 1;
+            }
+        }
+    }
+    cache_unlock ();
+    return res;
+}
+
+int cache_incoming_path (char *path, const size_t size)
+{
+    if (make_cache_dir_path (path, size)) {
+        return -1;
+    }
+    unsigned n = __atomic_add_fetch (&incoming_counter, 1, __ATOMIC_RELAXED);
+    size_t l = strlen (path);
+    if (snprintf (path + l, size - l, "incoming-%d-%u", (int)getpid (), n) >= size - l) {
+        return -1;
+    }
+    return 0;
+}
+
+static int
+hash_file (const char *fname, uint8_t *md5, int *image_type, int64_t *image_size)
+{
+    FILE *fp = fopen (fname, "rb");
+    if (!fp) {
+        return -1;
+    }
+    DB_md5_t st;
+    deadbeef->md5_init (&st);
+    uint8_t buffer[4096];
+    size_t rb;
+    int64_t total = 0;
+    *image_type = IMAGE_JPEG;
+    while ((rb = fread (buffer, 1, sizeof (buffer), fp)) > 0) {
+        if (!total && rb >= 4 && !memcmp (buffer, "\x89PNG", 4)) {
+            *image_type = IMAGE_PNG;
+        }
+        deadbeef->md5_append (&st, buffer, (int)rb);
+        total += rb;
+    }
+    int err = ferror (fp);
+    fclose (fp);
+    if (err || !total) {
+        return -1;
+    }
+    deadbeef->md5_finish (&st, md5);
+    *image_size = total;
+    return 0;
+}
+
+int cache_store_file (const char *source, const char *fname, char *path, const size_t size)
+{
+    uint8_t md5[16];
+    int image_type = IMAGE_NONE;
+    int64_t image_size = 0;
+    if (fname && hash_file (fname, md5, &image_type, &image_size)) {
+        unlink (fname);
+        return -1;
+    }
+
     cache_lock ();
-    unlink (entry_path);
-    rmdir (subdir_path);
-
-    /* Remove any scaled copies of this file, plus parent directories that are now empty */
-    char cache_root_path[PATH_MAX];
-    make_cache_root_path (cache_root_path, PATH_MAX);
-    struct dirent **scaled_dirs = NULL;
-    int scaled_dirs_count = scandir (cache_root_path, &scaled_dirs, filter_scaled_dirs, NULL);
-    if (scaled_dirs_count < 0) {
+    if (!entries) {
+        cache_unlock ();
+        if (fname) {
+            unlink (fname);
+        }
+        return -1;
+    }
+
+    if (fname) {
+        if (make_image_path (md5, image_type, path, size)) {
+            cache_unlock ();
+            unlink (fname);
+            return -1;
+        }
+        if (*find_image (md5)) {
+            // the same image is already stored for another source
+            trace ("artwork cache: %s is a duplicate of %s\n", fname, path);
+            unlink (fname);
+        }
+        else if (!ensure_dir (path) || rename (fname, path)) {
+            trace ("artwork cache: failed to move %s to %s\n", fname, path);
+            cache_unlock ();
+            unlink (fname);
+            return -1;
+        }
+    }
+
+    time_t now = time (NULL);
+    cache_entry_t *e = add_entry (strdup (source), image_type, md5, image_size, now, now);
+    if (e) {
+        buffer_t b;
+        memset (&b, 0, sizeof (b));
+        put_record (&b, source, e);
+        append_records (&b);
+        e->saved = 1;
+        free (b.data);
+    }
+    else if (fname && !*find_image (md5)) {
+        unlink (path);
+    }
+    cache_unlock ();
+    return e ? 0 : -1;
+}
+
+void cache_remove (const char *source)
+{
+    cache_lock ();
+    if (entries) {
+        cache_entry_t **pe = find_entry (source, hash_string (source));
+        if (*pe) {
+            trace ("Expire %s from cache\n", source);
+            remove_entry (pe);
+            buffer_t b;
+            memset (&b, 0, sizeof (b));
+            put_record (&b, source, NULL);
+            num_stale++;
+            append_records (&b);
+            free (b.data);
+        }
+    }
+    cache_unlock ();
+}
+
+void cache_clear (void)
+{
+    cache_lock ();
+    if (!entries) {
         cache_unlock ();
         return;
     }
-    for (int i = 0; i < scaled_dirs_count; i++) {
-        char scaled_entry_path[PATH_MAX];
-        if (snprintf (scaled_entry_path, PATH_MAX, "%s%s/%s/%s", cache_root_path, scaled_dirs[i]->d_name, subdir_name, entry_name) < PATH_MAX) {
-            unlink (scaled_entry_path);
-            char *scaled_entry_dir = strdup (dirname (scaled_entry_path));
-            rmdir (scaled_entry_dir);
-            rmdir (dirname (scaled_entry_dir));
-            free (scaled_entry_dir);
+    for (size_t i = 0; i < num_buckets; i++) {
+        while (entries[i]) {
+            remove_entry (&entries[i]);
         }
-        free (scaled_dirs[i]);
     }
-    free (scaled_dirs);
+    index_rewrite = 1;
+    save_index ();
     cache_unlock ();
 }
 
+// remove the entries not accessed since the expiry time, and return the oldest access time of the remaining ones
+static time_t
+cache_expire (time_t expiry)
+{
+    time_t oldest = time (NULL);
+    buffer_t b;
+    memset (&b, 0, sizeof (b));
+    cache_lock ();
+    for (size_t i = 0; i < num_buckets; i++) {
+        cache_entry_t **pe = &entries[i];
+        while (*pe) {
+            if ((*pe)->atime <= expiry) {
+                trace ("%s expired from cache\n", (*pe)->source);
+                if ((*pe)->saved) {
+                    put_record (&b, (*pe)->source, NULL);
+                    num_stale++;
+                }
+                remove_entry (pe);
+            }
+            else {
+                if ((*pe)->atime < oldest) {
+                    oldest = (*pe)->atime;
+                }
+                pe = &(*pe)->next;
+            }
+        }
+    }
+    if (entries) {
+        append_records (&b);
+        save_index ();
+    }
+    cache_unlock ();
+    free (b.data);
+    return oldest;
+}
+
 static int
 path_ok (const size_t dir_length, const char *entry)
 {
     return strcmp (entry, ".") && strcmp (entry, "..") && dir_length + strlen (entry) + 1 < PATH_MAX;
 }
 
+// the previous versions stored a file per artist and album in covers2/<artist>/<album>.jpg
 static void
-cache_cleaner_thread (void *none)
+remove_old_cache (void)
 {
-    /* Find where it all happens */
     char covers_path[PATH_MAX];
     if (make_cache_root_path (covers_path, PATH_MAX-10)) {
         return;
@@ -123,63 +831,61 @@ cache_cleaner_thread (void *none)
     strcat (covers_path, "covers2");
     const size_t covers_path_length = strlen (covers_path);
 
-    deadbeef->mutex_lock (thread_mutex);
-    while (!terminate) {
-        time_t oldest_mtime = time (NULL);
-
-        /* Loop through the artist directories */
-        DIR *covers_dir = opendir (covers_path);
-        struct dirent *covers_subdir;
-        while (!terminate && covers_dir && (covers_subdir = readdir (covers_dir))) {
-            const int32_t cache_secs = cache_expiry_seconds;
-            deadbeef->mutex_unlock (thread_mutex);
-            if (cache_secs > 0 && path_ok (covers_path_length, covers_subdir->d_name)) {
-                trace ("Analyse %s for expired files\n", covers_subdir->d_name);
-                const time_t cache_expiry = time (NULL) - cache_secs;
-
-                /* Loop through the image files in this artist directory */
-                char subdir_path[PATH_MAX];
-                sprintf (subdir_path, "%s/%s", covers_path, covers_subdir->d_name);
-                const size_t subdir_path_length = strlen (subdir_path);
-                DIR *subdir = opendir (subdir_path);
-                struct dirent *entry;
-                while (subdir && (entry = readdir (subdir))) {
-                    if (path_ok (subdir_path_length, entry->d_name)) {
-                        char entry_path[PATH_MAX];
-                        sprintf (entry_path, "%s/%s", subdir_path, entry->d_name);
-
-                        /* Test against the cache expiry time (cache invalidation resets are not handled here) */
-                        struct stat stat_buf;
-                        if (!stat (entry_path, &stat_buf)) {
-                            if (stat_buf.st_mtime <= cache_expiry) {
-                                trace ("%s expired from cache\n", entry_path);
-                                remove_cache_item (entry_path, subdir_path, covers_subdir->d_name, entry->d_name);
-                            }
-                            else if (stat_buf.st_mtime < oldest_mtime) {
-                                oldest_mtime = stat_buf.st_mtime;
-                            }
-                        }
-                    }
-                }
-                if (subdir) {
-                    closedir (subdir);
-                }
+    DIR *covers_dir = opendir (covers_path);
+    if (!covers_dir) {
+        return;
+    }
+    struct dirent *covers_subdir;
+    while (!terminate && (covers_subdir = readdir (covers_dir))) {
+        if (!path_ok (covers_path_length, covers_subdir->d_name)) {
+            continue;
+        }
+        char subdir_path[PATH_MAX];
+        sprintf (subdir_path, "%s/%s", covers_path, covers_subdir->d_name);
+        const size_t subdir_path_length = strlen (subdir_path);
+        DIR *subdir = opendir (subdir_path);
+        struct dirent *entry;
+        while (subdir && (entry = readdir (subdir))) {
+            if (path_ok (subdir_path_length, entry->d_name)) {
+                char entry_path[PATH_MAX];
+                sprintf (entry_path, "%s/%s", subdir_path, entry->d_name);
+                unlink (entry_path);
             }
-            usleep (100000);
-            deadbeef->mutex_lock (thread_mutex);
         }
-        if (covers_dir) {
-            closedir (covers_dir);
-            covers_dir = NULL;
+        if (subdir) {
+            closedir (subdir);
+        }
+        rmdir (subdir_path);
+    }
+    closedir (covers_dir);
+    rmdir (covers_path);
+}
+
+static void
+cache_cleaner_thread (void *none)
+{
+    remove_old_cache ();
+
+    deadbeef->mutex_lock (thread_mutex);
+    while (!terminate) {
+        const int32_t cache_secs = cache_expiry_seconds;
+        deadbeef->mutex_unlock (thread_mutex);
+
+        /* A single pass over the index, the image files are only touched when they expire */
+        time_t oldest_atime = time (NULL);
+        if (cache_secs > 0) {
+            oldest_atime = cache_expire (time (NULL) - cache_secs);
         }
 
-        /* Sleep until just after the oldest file expires */
+        deadbeef->mutex_lock (thread_mutex);
+
+        /* Sleep until just after the oldest entry expires */
         if (cache_expiry_seconds > 0 && !terminate) {
             struct timespec wake_time = {
-                .tv_sec = time (NULL) + max (60, oldest_mtime - time (NULL) + cache_expiry_seconds),
+                .tv_sec = time (NULL) + max (60, oldest_atime - time (NULL) + cache_expiry_seconds),
                 .tv_nsec = 999999
             };
-            trace ("Cache cleaner sleeping for %d seconds\n", max (60, oldest_mtime - time (NULL) + cache_expiry_seconds));
+            trace ("Cache cleaner sleeping for %d seconds\n", max (60, oldest_atime - time (NULL) + cache_expiry_seconds));
             pthread_cond_timedwait ( (pthread_cond_t *)thread_cond, (pthread_mutex_t *)thread_mutex, &wake_time);
         }
 
@@ -215,6 +921,13 @@ void stop_cache_cleaner (void)
         trace ("Cache cleaner thread stopped\n");
     }
 
+    if (entries) {
+        cache_lock ();
+        save_index ();
+        free_index ();
+        cache_unlock ();
+    }
+
     if (thread_mutex) {
         deadbeef->mutex_free (thread_mutex);
         thread_mutex = 0;
@@ -238,6 +951,21 @@ int start_cache_cleaner (void)
     files_mutex = deadbeef->mutex_create_nonrecursive ();
     thread_mutex = deadbeef->mutex_create_nonrecursive ();
     thread_cond = deadbeef->cond_create ();
+
+    /* The index is loaded before the fetchers start, so the lookups never wait for the disk */
+    num_buckets = 256;
+    entries = calloc (num_buckets, sizeof (cache_entry_t *));
+    images = calloc (num_buckets, sizeof (cache_image_t *));
+    index_rewrite = 0;
+    if (!make_cache_dir_path (index_path, sizeof (index_path) - 10)) {
+        strcat (index_path, "index");
+        load_index ();
+    }
+    else {
+        index_path[0] = '\0';
+        free_index ();
+    }
+
     if (files_mutex && thread_mutex && thread_cond) {
         tid = deadbeef->thread_start_low_priority (cache_cleaner_thread, NULL);
         trace ("Cache cleaner thread started\n");
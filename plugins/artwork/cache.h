@@ -24,12 +24,33 @@
 #ifndef __ARTWORK_CACHE_H
 #define __ARTWORK_CACHE_H
 
+#include <time.h>
+
+// The disk cache of the cover images, each image is stored once, even when it's shared by several albums.
+// The sources (artist and album) are mapped to the images by a single index, loaded into memory at start,
+// and the entries which weren't accessed during the cache period are removed by the cache cleaner.
+
 void cache_lock(void);
 void cache_unlock(void);
 int make_cache_root_path(char *path, const size_t size);
-void remove_cache_item(const char *entry_path, const char *subdir_path, const char *subdir_name, const char *entry_name);
+
+// Returns 1 and the image path, if the source is cached,
+// 0 if the source is known to have no image, -1 if it's not cached.
+// The time when the entry was stored is returned in both cases.
+int cache_lookup(const char *source, char *path, const size_t size, time_t *stored);
+
+// A unique path for writing a new image file, to be passed to cache_store_file.
+int cache_incoming_path(char *path, const size_t size);
+
+// Moves the image file into the cache, and returns the image path.
+// When fname is NULL, the source is recorded as having no image.
+int cache_store_file(const char *source, const char *fname, char *path, const size_t size);
+
+void cache_remove(const char *source);
+void cache_clear(void);
+
 void cache_configchanged(void);
-void start_cache_cleaner(void);
+int start_cache_cleaner(void);
 void stop_cache_cleaner(void);
 
 #endif /*__ARTWORK_CACHE_H*/
@@ -0,0 +1,332 @@
+/*
+    Album Art plugin for DeaDBeeF
+    Copyright (C) 2009-2018 Alexey Yakovenko <waker@users.sourceforge.net>
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifdef HAVE_CONFIG_H
+    #include "../../config.h"
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "../../deadbeef.h"
+#include "memcache.h"
+
+extern DB_functions_t *deadbeef;
+
+typedef struct memcache_entry_s {
+    char *key;
+    uint32_t hash;
+    ddb_cover_info_t *cover;
+    time_t stored;
+    size_t size;
+    struct memcache_entry_s *next; // in the hash bucket
+    struct memcache_entry_s *lru_prev; // more recently used
+    struct memcache_entry_s *lru_next;
+} memcache_entry_t;
+
+static uintptr_t mutex;
+static memcache_entry_t **buckets;
+static size_t num_buckets;
+static size_t count;
+static size_t total_size;
+static size_t max_total_size;
+static memcache_entry_t *lru_head; // most recently used
+static memcache_entry_t *lru_tail;
+static void (*release) (ddb_cover_info_t *cover);
+
+static uint32_t
+hash_key (const char *key) {
+    uint32_t h = 2166136261u;
+    for (const uint8_t *p = (const uint8_t *)key; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static size_t
+entry_size (const char *key, const ddb_cover_info_t *cover) {
+    size_t size = sizeof (memcache_entry_t) + strlen (key) + 1;
+    for (; cover; cover = cover->next) {
+        size += sizeof (ddb_cover_info_t);
+        if (cover->type) {
+            size += strlen (cover->type) + 1;
+        }
+        if (cover->filename) {
+            size += strlen (cover->filename) + 1;
+        }
+        if (cover->blob) {
+            size += cover->blob_size;
+        }
+    }
+    return size;
+}
+
+static void
+lru_unlink (memcache_entry_t *e) {
+    if (e->lru_prev) {
+        e->lru_prev->lru_next = e->lru_next;
+    }
+    else {
+        lru_head = e->lru_next;
+    }
+    if (e->lru_next) {
+        e->lru_next->lru_prev = e->lru_prev;
+    }
+    else {
+        lru_tail = e->lru_prev;
+    }
+    e->lru_prev = e->lru_next = NULL;
+}
+
+static void
+lru_push_front (memcache_entry_t *e) {
+    e->lru_prev = NULL;
+    e->lru_next = lru_head;
+    if (lru_head) {
+        lru_head->lru_prev = e;
+    }
+    else {
+        lru_tail = e;
+    }
+    lru_head = e;
+}
+
+static memcache_entry_t **
+find_slot (const char *key, uint32_t hash) {
+    memcache_entry_t **pe = &buckets[hash & (num_buckets - 1)];
+    while (*pe && ((*pe)->hash != hash || strcmp ((*pe)->key, key))) {
+        pe = &(*pe)->next;
+    }
+    return pe;
+}
+
+// the cover is released by the caller, outside of the lock
+static ddb_cover_info_t *
+remove_entry (memcache_entry_t **pe) {
+    memcache_entry_t *e = *pe;
+    *pe = e->next;
+    lru_unlink (e);
+    count--;
+    total_size -= e->size;
+    ddb_cover_info_t *cover = e->cover;
+    free (e->key);
+    free (e);
+    return cover;
+}
+
+static void
+grow (void) {
+    size_t new_num_buckets = num_buckets * 2;
+    memcache_entry_t **new_buckets = calloc (new_num_buckets, sizeof (memcache_entry_t *));
+    if (!new_buckets) {
+        return;
+    }
+    for (size_t i = 0; i < num_buckets; i++) {
+        memcache_entry_t *e = buckets[i];
+        while (e) {
+            memcache_entry_t *next = e->next;
+            memcache_entry_t **b = &new_buckets[e->hash & (new_num_buckets - 1)];
+            e->next = *b;
+            *b = e;
+            e = next;
+        }
+    }
+    free (buckets);
+    buckets = new_buckets;
+    num_buckets = new_num_buckets;
+}
+
+typedef struct {
+    ddb_cover_info_t **covers;
+    size_t count;
+    size_t size;
+} release_list_t;
+
+static void
+release_list_add (release_list_t *l, ddb_cover_info_t *cover) {
+    if (!cover) {
+        return;
+    }
+    if (l->count == l->size) {
+        l->size = l->size ? l->size * 2 : 16;
+        l->covers = realloc (l->covers, l->size * sizeof (ddb_cover_info_t *));
+    }
+    l->covers[l->count++] = cover;
+}
+
+static void
+release_list_free (release_list_t *l) {
+    for (size_t i = 0; i < l->count; i++) {
+        release (l->covers[i]);
+    }
+    free (l->covers);
+}
+
+void
+memcache_init (size_t max_size, void (*cover_release) (ddb_cover_info_t *cover)) {
+    mutex = deadbeef->mutex_create_nonrecursive ();
+    num_buckets = 256;
+    buckets = calloc (num_buckets, sizeof (memcache_entry_t *));
+    count = 0;
+    total_size = 0;
+    max_total_size = max_size;
+    lru_head = lru_tail = NULL;
+    release = cover_release;
+}
+
+void
+memcache_deinit (void) {
+    if (!buckets) {
+        return;
+    }
+    memcache_clear ();
+    free (buckets);
+    buckets = NULL;
+    num_buckets = 0;
+    deadbeef->mutex_free (mutex);
+    mutex = 0;
+}
+
+int
+memcache_get (const char *key, ddb_cover_info_t **cover, time_t *stored) {
+    uint32_t hash = hash_key (key);
+    deadbeef->mutex_lock (mutex);
+    memcache_entry_t *e = *find_slot (key, hash);
+    if (e) {
+        lru_unlink (e);
+        lru_push_front (e);
+        *cover = e->cover;
+        if (stored) {
+            *stored = e->stored;
+        }
+        if (e->cover) {
+            __atomic_add_fetch (&e->cover->refc, 1, __ATOMIC_RELAXED);
+        }
+    }
+    deadbeef->mutex_unlock (mutex);
+    return e != NULL;
+}
+
+void
+memcache_put (const char *key, ddb_cover_info_t *cover) {
+    size_t size = entry_size (key, cover);
+    if (size > max_total_size / 4) {
+        // don't let a single huge image push out everything else
+        return;
+    }
+
+    uint32_t hash = hash_key (key);
+    release_list_t released;
+    memset (&released, 0, sizeof (released));
+
+    deadbeef->mutex_lock (mutex);
+    memcache_entry_t **pe = find_slot (key, hash);
+    if (*pe) {
+        release_list_add (&released, remove_entry (pe));
+    }
+
+    memcache_entry_t *e = calloc (1, sizeof (memcache_entry_t));
+    if (e) {
+        e->key = strdup (key);
+        e->hash = hash;
+        e->cover = cover;
+        e->stored = time (NULL);
+        e->size = size;
+        if (cover) {
+            __atomic_add_fetch (&cover->refc, 1, __ATOMIC_RELAXED);
+        }
+        e->next = buckets[hash & (num_buckets - 1)];
+        buckets[hash & (num_buckets - 1)] = e;
+        lru_push_front (e);
+        count++;
+        total_size += size;
+        if (count > num_buckets) {
+            grow ();
+        }
+
+        while (total_size > max_total_size && lru_tail && lru_tail != e) {
+            release_list_add (&released, remove_entry (find_slot (lru_tail->key, lru_tail->hash)));
+        }
+    }
+    deadbeef->mutex_unlock (mutex);
+
+    release_list_free (&released);
+}
+
+void
+memcache_remove (const char *key) {
+    ddb_cover_info_t *cover = NULL;
+    uint32_t hash = hash_key (key);
+    deadbeef->mutex_lock (mutex);
+    memcache_entry_t **pe = find_slot (key, hash);
+    if (*pe) {
+        cover = remove_entry (pe);
+    }
+    deadbeef->mutex_unlock (mutex);
+    if (cover) {
+        release (cover);
+    }
+}
+
+void
+memcache_remove_file (const char *filename) {
+    release_list_t released;
+    memset (&released, 0, sizeof (released));
+
+    deadbeef->mutex_lock (mutex);
+    for (size_t i = 0; i < num_buckets; i++) {
+        memcache_entry_t **pe = &buckets[i];
+        while (*pe) {
+            ddb_cover_info_t *cover = (*pe)->cover;
+            while (cover && !(cover->filename && !strcmp (cover->filename, filename))) {
+                cover = cover->next;
+            }
+            if (cover) {
+                release_list_add (&released, remove_entry (pe));
+            }
+            else {
+                pe = &(*pe)->next;
+            }
+        }
+    }
+    deadbeef->mutex_unlock (mutex);
+
+    release_list_free (&released);
+}
+
+void
+memcache_clear (void) {
+    release_list_t released;
+    memset (&released, 0, sizeof (released));
+
+    deadbeef->mutex_lock (mutex);
+    for (size_t i = 0; i < num_buckets; i++) {
+        while (buckets[i]) {
+            release_list_add (&released, remove_entry (&buckets[i]));
+        }
+    }
+    deadbeef->mutex_unlock (mutex);
+
+    release_list_free (&released);
+}
@@ -0,0 +1,52 @@
+/*
+    Album Art plugin for DeaDBeeF
+    Copyright (C) 2009-2018 Alexey Yakovenko <waker@users.sourceforge.net>
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+#ifndef __ARTWORK_MEMCACHE_H
+#define __ARTWORK_MEMCACHE_H
+
+#include <stddef.h>
+#include <time.h>
+#include "artwork.h"
+
+// In-memory cache of the query results, including the blobs, and the queries which found nothing.
+// The least recently used results are dropped when the total size goes over the limit.
+// The cache holds a reference to each cover, and releases it using the supplied function.
+
+void memcache_init (size_t max_size, void (*cover_release) (ddb_cover_info_t *cover));
+void memcache_deinit (void);
+
+// Returns 1 if the key is cached, and stores a new reference to the cover in *cover,
+// which is set to NULL if the query has found nothing.
+// The time when the result was cached is stored in *stored, if it's not NULL.
+int memcache_get (const char *key, ddb_cover_info_t **cover, time_t *stored);
+
+// Adds a reference to the cover, which can be NULL.
+void memcache_put (const char *key, ddb_cover_info_t *cover);
+
+void memcache_remove (const char *key);
+
+// Drop the results referring to the file, e.g. when it's removed from the disk cache.
+void memcache_remove_file (const char *filename);
+
+void memcache_clear (void);
+
+#endif /*__ARTWORK_MEMCACHE_H*/
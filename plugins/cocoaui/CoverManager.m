@@ -84,6 +84,16 @@ typedef struct {
 
 static void cover_loaded_callback (int error, ddb_cover_query_t *query, ddb_cover_info_t *cover) {
     // We want to load the images in background, to keep UI responsive
+    if (error == DDB_ARTWORK_ERROR_CANCELLED) {
+        // Dropped from the queue, it will be requested again if it's still displayed
+        dispatch_async(dispatch_get_main_queue(), ^{
+            deadbeef->pl_item_unref (query->track);
+            free (query->user_data);
+            free (query);
+        });
+        return;
+    }
+
     CoverManager *cm = [CoverManager defaultCoverManager];
     NSImage *img = nil;
     if (!img && cover && cover->blob) {
@@ -245,14 +245,16 @@ static NSMutableArray *g_rgControllers;
     const char *uri = deadbeef->pl_find_meta (_rg_settings.tracks[current], ":URI");
 
     [_progressText setStringValue:[NSString stringWithUTF8String:uri]];
-    [_progressIndicator setDoubleValue:(double)current/_rg_settings.num_tracks*100];
+    // tracks are scanned out of order, so the progress is based on the number of finished tracks
+    int done = _rg_settings.num_tracks_done;
+    [_progressIndicator setDoubleValue:(double)done/_rg_settings.num_tracks*100];
 
     struct timeval tv;
     gettimeofday (&tv, NULL);
     float timePassed = (tv.tv_sec-_rg_start_tv.tv_sec) + (tv.tv_usec - _rg_start_tv.tv_usec) / 1000000.f;
-    if (timePassed > 0 && _rg_settings.cd_samples_processed > 0 && current > 0) {
+    if (timePassed > 0 && _rg_settings.cd_samples_processed > 0 && done > 0) {
         float speed = [self getScanSpeed:_rg_settings.cd_samples_processed overTime:timePassed];
-        float predicted_samples_total = _rg_settings.cd_samples_processed / (float)current * _rg_settings.num_tracks;
+        float predicted_samples_total = _rg_settings.cd_samples_processed / (float)done * _rg_settings.num_tracks;
 
         float frac = (float)((double)predicted_samples_total / _rg_settings.cd_samples_processed);
         float est = timePassed * frac;
@@ -653,51 +653,17 @@ get_output_field (DB_playItem_t *it, const char *field, char *out, int sz)
 }
 
 static void
-get_output_field2 (DB_playItem_t *it, ddb_playlist_t *plt, const char *field, char *out, int sz)
-{
-    int idx = deadbeef->pl_get_idx_of (it);
-    char temp[PATH_MAX];
-
-    char *tf = deadbeef->tf_compile (field);
-    if (!tf) {
-        *out = 0;
-        return;
-    }
-
-    ddb_tf_context_t ctx = {
-        ._size = sizeof (ddb_tf_context_t),
-        .flags = DDB_TF_CONTEXT_HAS_INDEX,
-        .it = it,
-        .idx = idx,
-        .iter = PL_MAIN,
-        .plt = plt,
-    };
-
-    deadbeef->tf_eval (&ctx, tf, temp, sizeof (temp));
-    deadbeef->tf_free (tf);
-
-    char *o = out;
-    for (char *p = temp; *p && sz > 0; p++) {
-        if (*p == '/') {
-            *o++ = '-';
-        }
-        else
-        {
-            *o++ = *p;
+sanitize_output_field (char *field) {
+    for (; *field; field++) {
+        if (*field == '/') {
+            *field = '-';
         }
-        sz--;
     }
-
-    *o = 0;
-
-    //trace ("field '%s' expanded to '%s'\n", field, out);
 }
 
-
+// build the output path for one track, from the already expanded components of the output file pattern
 static void
-get_output_path_int (DB_playItem_t *it, ddb_playlist_t *plt, const char *outfolder_user, const char *outfile, ddb_encoder_preset_t *encoder_preset, int preserve_folder_structure, const char *root_folder, int write_to_source_folder, char *out, int sz, int use_new_tf) {
-//    trace ("get_output_path: %s %s %s\n", outfolder_user, outfile, root_folder);
-
+build_output_path (DB_playItem_t *it, const char *outfolder_user, const char **fnames, int ncomp, ddb_encoder_preset_t *encoder_preset, int preserve_folder_structure, const char *root_folder, int write_to_source_folder, char *out, int sz) {
     deadbeef->pl_lock ();
     const char *uri = strdupa (deadbeef->pl_find_meta (it, ":URI"));
     deadbeef->pl_unlock ();
@@ -731,40 +697,16 @@ get_output_path_int (DB_playItem_t *it, ddb_playlist_t *plt, const char *outfold
     }
 
     size_t l;
-    char fname[PATH_MAX];
-    char *pattern = strdupa (outfile);
 
     snprintf (out, sz, "%s/", outfolder);
 
-    // split path, and expand each path component using get_output_field
-    char *field = pattern;
-    char *s = pattern;
-    while (*s) {
-        if ((*s == '/') || (*s == '\\')) {
-            *s = '\0';
-            if (use_new_tf) {
-                get_output_field2(it, plt, field, fname, sizeof (fname));
-            }
-            else {
-                get_output_field (it, field, fname, sizeof (fname));
-            }
-
-            l = strlen (out);
-            snprintf (out+l, sz-l, "%s/", fname);
-
-            field = s+1;
-        }
-        s++;
+    for (int i = 0; i < ncomp - 1; i++) {
+        l = strlen (out);
+        snprintf (out+l, sz-l, "%s/", fnames[i]);
     }
 
     // last part of outfile is the filename
-    if (use_new_tf) {
-        get_output_field2(it, plt, field, fname, sizeof (fname));
-    }
-    else {
-        get_output_field (it, field, fname, sizeof(fname));
-    }
-
+    const char *fname = fnames[ncomp-1];
     l = strlen (out);
     if (encoder_preset->ext && encoder_preset->ext[0]) {
         snprintf (out+l, sz-l, "%s.%s", fname, encoder_preset->ext);
@@ -780,6 +722,98 @@ get_output_path_int (DB_playItem_t *it, ddb_playlist_t *plt, const char *outfold
     //trace ("converter output file is '%s'\n", out);
 }
 
+#define OUTPUT_PATH_CHUNK 64
+
+// get the output paths for `count` tracks, the path for tracks[i] is written at out + i*sz
+// with the new title formatting, each component of the output file pattern is compiled once,
+// and evaluated for a chunk of tracks at a time
+static void
+get_output_paths_int (DB_playItem_t **tracks, int count, ddb_playlist_t *plt, const char *outfolder_user, const char *outfile, ddb_encoder_preset_t *encoder_preset, int preserve_folder_structure, const char *root_folder, int write_to_source_folder, char *out, int sz, int use_new_tf) {
+//    trace ("get_output_paths: %d %s %s %s\n", count, outfolder_user, outfile, root_folder);
+
+    // split the pattern into path components
+    char *pattern = strdupa (outfile);
+    int ncomp = 1;
+    for (char *s = pattern; *s; s++) {
+        if ((*s == '/') || (*s == '\\')) {
+            ncomp++;
+        }
+    }
+    char *fields[ncomp];
+    char *bytecode[ncomp];
+    fields[0] = pattern;
+    int c = 1;
+    for (char *s = pattern; *s; s++) {
+        if ((*s == '/') || (*s == '\\')) {
+            *s = '\0';
+            fields[c++] = s+1;
+        }
+    }
+    for (c = 0; c < ncomp; c++) {
+        bytecode[c] = use_new_tf ? deadbeef->tf_compile (fields[c]) : NULL;
+    }
+
+    // expanded components, one arena of OUTPUT_PATH_CHUNK fields per component
+    const size_t arena_size = OUTPUT_PATH_CHUNK * PATH_MAX;
+    char *arena = malloc (arena_size * ncomp);
+    const char *results[ncomp][OUTPUT_PATH_CHUNK];
+    ddb_tf_context_t ctx = {
+        ._size = sizeof (ddb_tf_context_t),
+        .iter = PL_MAIN,
+        .plt = plt,
+    };
+
+    for (int n = 0; n < count; n += OUTPUT_PATH_CHUNK) {
+        int chunk = min (count - n, OUTPUT_PATH_CHUNK);
+        for (c = 0; c < ncomp; c++) {
+            char *comp_arena = arena + c * arena_size;
+            int res = 0;
+            if (!use_new_tf) {
+                for (int i = 0; i < chunk; i++) {
+                    results[c][i] = comp_arena + i * PATH_MAX;
+                    get_output_field (tracks[n+i], fields[c], comp_arena + i * PATH_MAX, PATH_MAX);
+                }
+                continue;
+            }
+            if (bytecode[c]) {
+                // the arena fits the whole chunk, so this evaluates all of it at once
+                res = deadbeef->tf_eval_batch (&ctx, bytecode[c], tracks + n, chunk, comp_arena, arena_size, PATH_MAX, results[c]);
+            }
+            if (res < 0) {
+                res = 0;
+            }
+            for (int i = 0; i < chunk; i++) {
+                if (i >= res) {
+                    results[c][i] = "";
+                }
+                else {
+                    sanitize_output_field ((char *)results[c][i]);
+                }
+            }
+        }
+
+        for (int i = 0; i < chunk; i++) {
+            const char *fnames[ncomp];
+            for (c = 0; c < ncomp; c++) {
+                fnames[c] = results[c][i];
+            }
+            build_output_path (tracks[n+i], outfolder_user, fnames, ncomp, encoder_preset, preserve_folder_structure, root_folder, write_to_source_folder, out + (size_t)(n+i) * sz, sz);
+        }
+    }
+
+    free (arena);
+    for (c = 0; c < ncomp; c++) {
+        if (bytecode[c]) {
+            deadbeef->tf_free (bytecode[c]);
+        }
+    }
+}
+
+static void
+get_output_path_int (DB_playItem_t *it, ddb_playlist_t *plt, const char *outfolder_user, const char *outfile, ddb_encoder_preset_t *encoder_preset, int preserve_folder_structure, const char *root_folder, int write_to_source_folder, char *out, int sz, int use_new_tf) {
+    get_output_paths_int (&it, 1, plt, outfolder_user, outfile, encoder_preset, preserve_folder_structure, root_folder, write_to_source_folder, out, sz, use_new_tf);
+}
+
 void
 get_output_path (DB_playItem_t *it, const char *outfolder_user, const char *outfile, ddb_encoder_preset_t *encoder_preset, int preserve_folder_structure, const char *root_folder, int write_to_source_folder, char *out, int sz) {
     get_output_path_int (it, NULL, outfolder_user, outfile, encoder_preset, preserve_folder_structure, root_folder, write_to_source_folder, out, sz, 0);
@@ -790,6 +824,11 @@ get_output_path2 (DB_playItem_t *it, ddb_playlist_t *plt, const char *outfolder_
     get_output_path_int (it, plt, outfolder_user, outfile, encoder_preset, preserve_folder_structure, root_folder, write_to_source_folder, out, sz, 1);
 }
 
+void
+get_output_paths (DB_playItem_t **tracks, int count, ddb_playlist_t *plt, const char *outfolder_user, const char *outfile, ddb_encoder_preset_t *encoder_preset, int preserve_folder_structure, const char *root_folder, int write_to_source_folder, char *out, int sz) {
+    get_output_paths_int (tracks, count, plt, outfolder_user, outfile, encoder_preset, preserve_folder_structure, root_folder, write_to_source_folder, out, sz, 1);
+}
+
 static void
 get_output_path_1_0 (DB_playItem_t *it, const char *outfolder, const char *outfile, ddb_encoder_preset_t *encoder_preset, char *out, int sz) {
     trace ("warning: old version of \"get_output_path\" has been called, please update your plugins which depend on converter 1.1\n");
@@ -1557,7 +1596,7 @@ static ddb_converter_t plugin = {
     .misc.plugin.api_vmajor = DB_API_VERSION_MAJOR,
     .misc.plugin.api_vminor = DB_API_VERSION_MINOR,
     .misc.plugin.version_major = 1,
-    .misc.plugin.version_minor = 5,
+    .misc.plugin.version_minor = 6,
     .misc.plugin.flags = DDB_PLUGIN_FLAG_LOGGING,
     .misc.plugin.type = DB_PLUGIN_MISC,
     .misc.plugin.name = "Converter",
@@ -1624,6 +1663,8 @@ static ddb_converter_t plugin = {
     .get_output_path2 = get_output_path2,
     // 1.5 entry points
     .convert2 = convert2,
+    // 1.6 entry points
+    .get_output_paths = get_output_paths,
 };
 
 DB_plugin_t *
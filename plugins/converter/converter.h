@@ -26,6 +26,8 @@
 #include <stdint.h>
 #include "../../deadbeef.h"
 
+// changes in 1.6:
+//   added get_output_paths
 // changes in 1.5:
 //   added mp4 tagging support
 //   added converter option to copy files without conversion, if file format isn't changing
@@ -266,6 +268,15 @@ typedef struct {
          // *pabort will be checked regularly, conversion will be interrupted if it's non-zero
          int *pabort
     );
+
+    // since 1.6
+    // same as get_output_path2, but for many tracks at once, which is much faster
+    // than calling get_output_path2 for each of them
+    // tracks: the tracks to get the output paths for, all from the playlist plt
+    // out: the buffer for count output paths, each sz bytes long;
+    //      the path of tracks[i] is written at out + i*sz
+    void
+    (*get_output_paths) (DB_playItem_t **tracks, int count, ddb_playlist_t *plt, const char *outfolder, const char *outfile, ddb_encoder_preset_t *encoder_preset, int preserve_folder_structure, const char *root_folder, int write_to_source_folder, char *out, int sz);
 } ddb_converter_t;
 
 #endif
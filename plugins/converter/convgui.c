@@ -218,7 +218,22 @@ converter_worker (void *ctx) {
         .rewrite_tags_after_copy = conv->retag_after_copy,
     };
 
+    // output paths are computed for a chunk of tracks at a time
+    const int paths_chunk = 64;
+    char (*outpaths)[2000] = NULL;
+    int have_paths_batch = converter_plugin->misc.plugin.version_minor >= 6;
+    if (have_paths_batch) {
+        outpaths = malloc (sizeof (*outpaths) * paths_chunk);
+    }
+
     for (int n = 0; n < conv->convert_items_count; n++) {
+        if (have_paths_batch && !(n % paths_chunk)) {
+            int count = conv->convert_items_count - n;
+            if (count > paths_chunk) {
+                count = paths_chunk;
+            }
+            converter_plugin->get_output_paths (conv->convert_items + n, count, conv->convert_playlist, conv->outfolder, conv->outfile, conv->encoder_preset, conv->preserve_folder_structure, root, conv->write_to_source_folder, outpaths[0], sizeof (*outpaths));
+        }
         update_progress_info_t *info = malloc (sizeof (update_progress_info_t));
         info->entry = conv->progress_entry;
         g_object_ref (info->entry);
@@ -228,7 +243,12 @@ converter_worker (void *ctx) {
         g_idle_add (update_progress_cb, info);
 
         char outpath[2000];
-        converter_plugin->get_output_path2 (conv->convert_items[n], conv->convert_playlist, conv->outfolder, conv->outfile, conv->encoder_preset, conv->preserve_folder_structure, root, conv->write_to_source_folder, outpath, sizeof (outpath));
+        if (have_paths_batch) {
+            memcpy (outpath, outpaths[n % paths_chunk], sizeof (outpath));
+        }
+        else {
+            converter_plugin->get_output_path2 (conv->convert_items[n], conv->convert_playlist, conv->outfolder, conv->outfile, conv->encoder_preset, conv->preserve_folder_structure, root, conv->write_to_source_folder, outpath, sizeof (outpath));
+        }
 
         int skip = 0;
         char *real_out = realpath(outpath, NULL);
@@ -260,6 +280,7 @@ converter_worker (void *ctx) {
         }
         deadbeef->pl_item_unref (conv->convert_items[n]);
     }
+    free (outpaths);
     g_idle_add (destroy_progress_cb, conv->progress);
     if (conv->convert_items) {
         free (conv->convert_items);
@@ -3397,6 +3397,62 @@ calc_group_height(DdbListview *listview, DdbListviewGroup *grp, int min_height,
     return grp->height;
 }
 
+#define GROUP_TITLES_CHUNK 256
+#define GROUP_TITLE_SIZE 1024
+
+// group titles of a chunk of consecutive items, formatted ahead in one pass per group level
+typedef struct {
+    DdbListviewIter items[GROUP_TITLES_CHUNK];
+    int count;
+    int pos;
+    int depth;
+    char *arena; // GROUP_TITLES_CHUNK titles per group level
+    const char **titles; // [depth][GROUP_TITLES_CHUNK]
+} DdbListviewGroupTitles;
+
+static void
+group_titles_fetch (DdbListview *listview, DdbListviewGroupTitles *gt, DdbListviewIter it) {
+    gt->count = 0;
+    gt->pos = 0;
+    // the items stay valid without references, since the caller holds pl_lock
+    listview->binding->ref (it);
+    while (it && gt->count < GROUP_TITLES_CHUNK) {
+        gt->items[gt->count++] = it;
+        it = next_playitem (listview, it);
+    }
+    if (it) {
+        listview->binding->unref (it);
+    }
+
+    const size_t arena_size = GROUP_TITLES_CHUNK * GROUP_TITLE_SIZE;
+    for (int d = 0; d < gt->depth; d++) {
+        char *arena = gt->arena + d * arena_size;
+        const char **titles = gt->titles + d * GROUP_TITLES_CHUNK;
+        int n = 0;
+        if (listview->binding->get_groups) {
+            n = listview->binding->get_groups (listview, gt->items, gt->count, d, arena, arena_size, GROUP_TITLE_SIZE, titles);
+        }
+        for (n = max (n, 0); n < gt->count; n++) {
+            titles[n] = arena + n * GROUP_TITLE_SIZE;
+            listview->binding->get_group (listview, gt->items[n], arena + n * GROUP_TITLE_SIZE, GROUP_TITLE_SIZE, d);
+        }
+    }
+}
+
+// returns the title of the group at `depth` for `it`, which must follow the previously requested item
+static const char *
+group_titles_get (DdbListview *listview, DdbListviewGroupTitles *gt, DdbListviewIter it, int depth) {
+    if (!gt->count || gt->items[gt->pos] != it) {
+        if (gt->pos + 1 < gt->count && gt->items[gt->pos + 1] == it) {
+            gt->pos++;
+        }
+        else {
+            group_titles_fetch (listview, gt, it);
+        }
+    }
+    return gt->titles[depth * GROUP_TITLES_CHUNK + gt->pos];
+}
+
 static int
 build_groups (DdbListview *listview) {
     listview->groups_build_idx = listview->binding->modification_idx();
@@ -3431,20 +3487,33 @@ build_groups (DdbListview *listview) {
     // groups
     if (listview->grouptitle_height) {
         DdbListviewGroup *last_group[group_depth];
-        char (*group_titles)[1024] = malloc(sizeof(char[1024]) * group_depth);
+        const char *group_titles[group_depth];
+        DdbListviewGroupTitles *gt = calloc (1, sizeof (DdbListviewGroupTitles));
+        gt->depth = group_depth;
+        gt->arena = malloc (GROUP_TITLES_CHUNK * GROUP_TITLE_SIZE * group_depth);
+        gt->titles = malloc (GROUP_TITLES_CHUNK * group_depth * sizeof (const char *));
         DdbListviewGroup *grp = listview->groups;
         // populate all subgroups from the first item
         for (int i = 0; i < group_depth; i++) {
             last_group[i] = grp;
             grp = grp->subgroups;
-            listview->binding->get_group(listview, it, group_titles[i], sizeof(*group_titles), i);
+            group_titles[i] = group_titles_get (listview, gt, it, i);
             last_group[i]->group_label_visible = group_titles[i][0] != 0;
         }
+        // the titles of the previous item must stay valid when the next chunk is fetched
+        char (*prev_titles)[GROUP_TITLE_SIZE] = malloc (sizeof (char[GROUP_TITLE_SIZE]) * group_depth);
         while ((it = next_playitem(listview, it))) {
+            if (gt->pos + 1 >= gt->count) {
+                for (int i = 0; i < group_depth; i++) {
+                    if (group_titles[i] != prev_titles[i]) {
+                        strcpy (prev_titles[i], group_titles[i]);
+                        group_titles[i] = prev_titles[i];
+                    }
+                }
+            }
             int make_new_group_offset = -1;
             for (int i = 0; i < group_depth; i++) {
-                char next_title[1024];
-                listview->binding->get_group(listview, it, next_title, sizeof(next_title), i);
+                const char *next_title = group_titles_get (listview, gt, it, i);
                 if (strcmp (group_titles[i], next_title)) {
                     make_new_group_offset = i;
                     break;
@@ -3455,9 +3524,8 @@ build_groups (DdbListview *listview) {
                 // finish remaining groups
                 // must be done in reverse order so heights are calculated correctly
                 for (int i = group_depth - 1; i >= make_new_group_offset; i--) {
-                    char next_title[1024];
                     last_group[i]->num_items++;
-                    listview->binding->get_group(listview, it, next_title, sizeof(next_title), i);
+                    const char *next_title = group_titles_get (listview, gt, it, i);
                     int height = calc_group_height (listview, last_group[i], i == listview->artwork_subgroup_level ? min_height : min_no_artwork_height, !(it > 0));
                     if (i == 0) {
                         full_height += height;
@@ -3470,7 +3538,7 @@ build_groups (DdbListview *listview) {
                     if (last_group[i] && i < group_depth - 1) {
                         last_group[i]->subgroups = last_group[i + 1];
                     }
-                    strcpy (group_titles[i], next_title);
+                    group_titles[i] = next_title;
                 }
             }
         }
@@ -3482,7 +3550,10 @@ build_groups (DdbListview *listview) {
                 full_height += height;
             }
         }
-        free(group_titles);
+        free (prev_titles);
+        free (gt->titles);
+        free (gt->arena);
+        free (gt);
     }
     // no groups fast path
     else {
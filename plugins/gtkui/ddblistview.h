@@ -88,6 +88,9 @@ typedef struct {
     int (*is_selected) (DdbListviewIter);
 
     int (*get_group) (DdbListview *listview, DdbListviewIter it, char *str, int size, int index);
+    // optional: get the titles of the group at `index` for `count` consecutive items at once,
+    // stored in the arena, each up to `size` bytes long; returns the number of items done
+    int (*get_groups) (DdbListview *listview, DdbListviewIter *its, int count, int index, char *arena, size_t arena_size, int size, const char **titles);
 
     void (*drag_n_drop) (DdbListviewIter before, DdbPlaylistHandle playlist_from, uint32_t *indices, int length, int copy);
     void (*external_drag_n_drop) (DdbListviewIter before, char *mem, int length);
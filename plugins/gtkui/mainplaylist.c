@@ -180,6 +180,7 @@ static DdbListviewBinding main_binding = {
     .prev = main_prev,
 
     .get_group = pl_common_get_group,
+    .get_groups = pl_common_get_groups,
     .groups_changed = main_groups_changed,
 
     .drag_n_drop = main_drag_n_drop,
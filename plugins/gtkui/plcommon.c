@@ -2016,6 +2016,51 @@ pl_common_get_group (DdbListview *listview, DdbListviewIter it, char *str, int s
     return fmt->next == NULL ? 0 : 1;
 }
 
+int
+pl_common_get_groups (DdbListview *listview, DdbListviewIter *its, int count, int index, char *arena, size_t arena_size, int size, const char **titles) {
+    if (!listview->group_formats->format || !listview->group_formats->format[0]) {
+        return -1;
+    }
+    DdbListviewGroupFormat *fmt = listview->group_formats;
+    while (index > 0) {
+        index--;
+        fmt = fmt->next;
+        if (fmt == NULL) {
+            return -1;
+        }
+    }
+    if (!fmt->bytecode) {
+        for (int i = 0; i < count; i++) {
+            titles[i] = "";
+        }
+        return count;
+    }
+
+    ddb_tf_context_t ctx = {
+        ._size = sizeof (ddb_tf_context_t),
+        .plt = deadbeef->plt_get_curr (),
+        .flags = DDB_TF_CONTEXT_NO_DYNAMIC,
+    };
+    int n = deadbeef->tf_eval_batch (&ctx, fmt->bytecode, (ddb_playItem_t **)its, count, arena, arena_size, size, titles);
+    if (ctx.plt) {
+        deadbeef->plt_unref (ctx.plt);
+        ctx.plt = NULL;
+    }
+
+    for (int i = 0; i < n; i++) {
+        char *str = (char *)titles[i];
+        char *lb = strchr (str, '\r');
+        if (lb) {
+            *lb = 0;
+        }
+        lb = strchr (str, '\n');
+        if (lb) {
+            *lb = 0;
+        }
+    }
+    return n;
+}
+
 void
 pl_common_draw_group_title (DdbListview *listview, cairo_t *drawable, DdbListviewIter it, int iter, int x, int y, int width, int height, int group_depth) {
     if (listview->group_formats->format && listview->group_formats->format[0]) {
@@ -79,6 +79,9 @@ pl_common_free_col_info (void *data);
 int
 pl_common_get_group (DdbListview *listview, DdbListviewIter it, char *str, int size, int index);
 
+int
+pl_common_get_groups (DdbListview *listview, DdbListviewIter *its, int count, int index, char *arena, size_t arena_size, int size, const char **titles);
+
 void
 pl_common_draw_group_title (DdbListview *listview, cairo_t *drawable, DdbListviewIter it, int iter, int x, int y, int width, int height, int group_depth);
 
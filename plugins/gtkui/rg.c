@@ -93,16 +93,18 @@ _ctl_progress (rgs_controller_t *ctl, int current) {
 
     GtkWidget *progressText = lookup_widget (ctl->progress_window, "rg_scan_progress_file");
     gtk_entry_set_text (GTK_ENTRY (progressText), uri);
+    // tracks are scanned out of order, so the progress is based on the number of finished tracks
+    int done = ctl->_rg_settings.num_tracks_done;
     GtkWidget *progressBar = lookup_widget (ctl->progress_window, "rg_scan_progress_bar");
-    gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR (progressBar), (double)current/ctl->_rg_settings.num_tracks);
+    gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR (progressBar), (double)done/ctl->_rg_settings.num_tracks);
     GtkWidget *statusLabel = lookup_widget (ctl->progress_window, "rg_scan_progress_status");
 
     struct timeval tv;
     gettimeofday (&tv, NULL);
     float timePassed = (tv.tv_sec-ctl->_rg_start_tv.tv_sec) + (tv.tv_usec - ctl->_rg_start_tv.tv_usec) / 1000000.f;
-    if (timePassed > 0 && ctl->_rg_settings.cd_samples_processed > 0 && current > 0) {
+    if (timePassed > 0 && ctl->_rg_settings.cd_samples_processed > 0 && done > 0) {
         float speed = _getScanSpeed (ctl->_rg_settings.cd_samples_processed, timePassed);
-        float predicted_samples_total = ctl->_rg_settings.cd_samples_processed / (float)current * ctl->_rg_settings.num_tracks;
+        float predicted_samples_total = ctl->_rg_settings.cd_samples_processed / (float)done * ctl->_rg_settings.num_tracks;
 
         float frac = (float)((double)predicted_samples_total / ctl->_rg_settings.cd_samples_processed);
         float est = timePassed * frac;
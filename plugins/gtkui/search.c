@@ -602,6 +602,7 @@ static DdbListviewBinding search_binding = {
     .get_idx = search_get_idx,
 
     .get_group = pl_common_get_group,
+    .get_groups = pl_common_get_groups,
     .groups_changed = search_groups_changed,
 
     .drag_n_drop = NULL,
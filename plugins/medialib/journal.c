@@ -0,0 +1,413 @@
+/*
+    Media Library plugin for DeaDBeeF Player
+    Copyright (C) 2009-2018 Alexey Yakovenko
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "journal.h"
+
+extern DB_functions_t *deadbeef;
+
+// file layout: "DBMJ", uint32 version, then the records:
+// uint32 payload size, uint32 payload checksum, payload;
+// all numbers in native byte order, same as dbpl.
+//
+// add payload: uint8 op, uint32 flags, int64 startsample, int64 endsample, float duration,
+// uint32 number of meta, then for each: uint16 key size, key, uint32 value size, value
+// (sizes include the terminating zeroes, multiple values are separated by zeroes)
+//
+// remove payload: uint8 op, int32 subtrack, uint16 uri size, uri
+
+#define JOURNAL_MAGIC "DBMJ"
+#define JOURNAL_VERSION 1
+#define JOURNAL_HEADER_SIZE 8
+#define JOURNAL_MAX_RECORD (64 << 20)
+
+enum {
+    JOURNAL_OP_ADD = 1,
+    JOURNAL_OP_REMOVE = 2,
+};
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t alloc;
+} buffer_t;
+
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+    int error;
+} reader_t;
+
+static uint32_t
+_checksum (const uint8_t *data, size_t size) {
+    // FNV-1a, only needs to catch torn writes
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        h ^= data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void
+_put (buffer_t *b, const void *data, size_t size) {
+    if (b->size + size > b->alloc) {
+        b->alloc = b->alloc ? b->alloc * 2 : 1024;
+        while (b->alloc < b->size + size) {
+            b->alloc *= 2;
+        }
+        b->data = realloc (b->data, b->alloc);
+    }
+    memcpy (b->data + b->size, data, size);
+    b->size += size;
+}
+
+static void
+_put_u8 (buffer_t *b, uint8_t v) {
+    _put (b, &v, sizeof (v));
+}
+
+static void
+_put_u16 (buffer_t *b, uint16_t v) {
+    _put (b, &v, sizeof (v));
+}
+
+static void
+_put_u32 (buffer_t *b, uint32_t v) {
+    _put (b, &v, sizeof (v));
+}
+
+static void
+_put_i64 (buffer_t *b, int64_t v) {
+    _put (b, &v, sizeof (v));
+}
+
+static const uint8_t *
+_get (reader_t *r, size_t size) {
+    if (r->error || r->size - r->pos < size) {
+        r->error = 1;
+        return NULL;
+    }
+    const uint8_t *p = r->data + r->pos;
+    r->pos += size;
+    return p;
+}
+
+#define GET_FN(name, type)\
+static type \
+name (reader_t *r) {\
+    type v = 0;\
+    const uint8_t *p = _get (r, sizeof (type));\
+    if (p) {\
+        memcpy (&v, p, sizeof (type));\
+    }\
+    return v;\
+}
+
+GET_FN(_get_u8, uint8_t)
+GET_FN(_get_u16, uint16_t)
+GET_FN(_get_u32, uint32_t)
+GET_FN(_get_i64, int64_t)
+GET_FN(_get_float, float)
+
+// returns a zero-terminated string of the given size, or NULL
+static const char *
+_get_string (reader_t *r, size_t size) {
+    const char *s = (const char *)_get (r, size);
+    if (!s || !size || s[size-1]) {
+        r->error = 1;
+        return NULL;
+    }
+    return s;
+}
+
+static int
+_replay_add (reader_t *r, ml_journal_replay_t *cb, void *user_data) {
+    uint32_t flags = _get_u32 (r);
+    int64_t startsample = _get_i64 (r);
+    int64_t endsample = _get_i64 (r);
+    float duration = _get_float (r);
+    uint32_t n_meta = _get_u32 (r);
+    if (r->error) {
+        return -1;
+    }
+
+    DB_playItem_t *it = deadbeef->pl_item_alloc ();
+    for (uint32_t i = 0; i < n_meta; i++) {
+        uint16_t keysize = _get_u16 (r);
+        const char *key = _get_string (r, keysize);
+        uint32_t valuesize = _get_u32 (r);
+        const char *value = _get_string (r, valuesize);
+        if (r->error) {
+            deadbeef->pl_item_unref (it);
+            return -1;
+        }
+        // multiple values are separated by zeroes
+        for (const char *v = value; v < value + valuesize; v += strlen (v) + 1) {
+            if (v == value) {
+                deadbeef->pl_add_meta (it, key, v);
+            }
+            else {
+                deadbeef->pl_append_meta (it, key, v);
+            }
+        }
+    }
+    deadbeef->pl_set_item_flags (it, flags);
+    deadbeef->pl_item_set_startsample (it, startsample);
+    deadbeef->pl_item_set_endsample (it, endsample);
+
+    if (deadbeef->pl_meta_exists (it, ":URI")) {
+        cb->add (it, duration, user_data);
+    }
+    deadbeef->pl_item_unref (it);
+    return 0;
+}
+
+static int
+_replay_remove (reader_t *r, ml_journal_replay_t *cb, void *user_data) {
+    int32_t subtrack = (int32_t)_get_u32 (r);
+    uint16_t urisize = _get_u16 (r);
+    const char *uri = _get_string (r, urisize);
+    if (r->error) {
+        return -1;
+    }
+    cb->remove (uri, subtrack, user_data);
+    return 0;
+}
+
+int
+ml_journal_replay (const char *fname, ml_journal_replay_t *cb, void *user_data) {
+    FILE *fp = fopen (fname, "rb");
+    if (!fp) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    struct stat st;
+    if (fstat (fileno (fp), &st)) {
+        fclose (fp);
+        return -1;
+    }
+    size_t size = st.st_size;
+    uint8_t *data = malloc (size ? size : 1);
+    if (fread (data, 1, size, fp) != size) {
+        fclose (fp);
+        free (data);
+        return -1;
+    }
+    fclose (fp);
+
+    int n = 0;
+    size_t good = 0;
+    uint32_t version = 0;
+    if (size >= JOURNAL_HEADER_SIZE) {
+        memcpy (&version, data + 4, sizeof (version));
+    }
+    if (size >= JOURNAL_HEADER_SIZE && !memcmp (data, JOURNAL_MAGIC, 4) && version == JOURNAL_VERSION) {
+        good = JOURNAL_HEADER_SIZE;
+        while (size - good >= 8) {
+            uint32_t recsize, sum;
+            memcpy (&recsize, data + good, 4);
+            memcpy (&sum, data + good + 4, 4);
+            if (recsize > size - good - 8 || _checksum (data + good + 8, recsize) != sum) {
+                break;
+            }
+            reader_t r = {
+                .data = data + good + 8,
+                .size = recsize,
+            };
+            uint8_t op = _get_u8 (&r);
+            int res = -1;
+            if (op == JOURNAL_OP_ADD) {
+                res = _replay_add (&r, cb, user_data);
+            }
+            else if (op == JOURNAL_OP_REMOVE) {
+                res = _replay_remove (&r, cb, user_data);
+            }
+            if (res < 0) {
+                break;
+            }
+            good += 8 + recsize;
+            n++;
+        }
+    }
+    free (data);
+
+    if (good < size) {
+        fprintf (stderr, "medialib: dropping %lld damaged bytes at the end of %s\n", (long long)(size - good), fname);
+        if (truncate (fname, good)) {
+            fprintf (stderr, "medialib: failed to truncate %s: %s\n", fname, strerror (errno));
+        }
+    }
+    return n;
+}
+
+static int
+_write_header (ml_journal_t *j) {
+    uint32_t version = JOURNAL_VERSION;
+    if (fwrite (JOURNAL_MAGIC, 1, 4, j->fp) != 4 || fwrite (&version, sizeof (version), 1, j->fp) != 1) {
+        return -1;
+    }
+    j->size = JOURNAL_HEADER_SIZE;
+    j->dirty = 1;
+    return 0;
+}
+
+int
+ml_journal_open (ml_journal_t *j, const char *fname) {
+    memset (j, 0, sizeof (ml_journal_t));
+    j->fp = fopen (fname, "ab");
+    if (!j->fp) {
+        fprintf (stderr, "medialib: failed to open %s: %s\n", fname, strerror (errno));
+        return -1;
+    }
+    j->fname = strdup (fname);
+    struct stat st;
+    if (fstat (fileno (j->fp), &st)) {
+        ml_journal_close (j);
+        return -1;
+    }
+    j->size = st.st_size;
+    // the replay has left either a valid header, or an empty file
+    if (!j->size && _write_header (j) < 0) {
+        ml_journal_close (j);
+        return -1;
+    }
+    return 0;
+}
+
+void
+ml_journal_close (ml_journal_t *j) {
+    if (j->fp) {
+        ml_journal_commit (j);
+        fclose (j->fp);
+        j->fp = NULL;
+    }
+    free (j->fname);
+    j->fname = NULL;
+}
+
+static int
+_write_record (ml_journal_t *j, buffer_t *b) {
+    int res = -1;
+    if (j->fp && b->size <= JOURNAL_MAX_RECORD) {
+        uint32_t size = (uint32_t)b->size;
+        uint32_t sum = _checksum (b->data, b->size);
+        if (fwrite (&size, 4, 1, j->fp) == 1
+            && fwrite (&sum, 4, 1, j->fp) == 1
+            && fwrite (b->data, 1, b->size, j->fp) == b->size) {
+            j->size += 8 + b->size;
+            j->dirty = 1;
+            res = 0;
+        }
+    }
+    free (b->data);
+    return res;
+}
+
+int
+ml_journal_write_add (ml_journal_t *j, DB_playItem_t *it) {
+    if (!j->fp) {
+        return -1;
+    }
+    buffer_t b = {0};
+    _put_u8 (&b, JOURNAL_OP_ADD);
+    _put_u32 (&b, deadbeef->pl_get_item_flags (it));
+    _put_i64 (&b, deadbeef->pl_item_get_startsample (it));
+    _put_i64 (&b, deadbeef->pl_item_get_endsample (it));
+    float duration = deadbeef->pl_get_item_duration (it);
+    _put (&b, &duration, sizeof (duration));
+
+    size_t n_meta_pos = b.size;
+    uint32_t n_meta = 0;
+    _put_u32 (&b, 0);
+
+    deadbeef->pl_lock ();
+    for (DB_metaInfo_t *m = deadbeef->pl_get_metadata_head (it); m; m = m->next) {
+        if (m->key[0] == '_' || m->key[0] == '!') {
+            continue; // skip reserved names
+        }
+        if (!m->value || m->valuesize <= 0) {
+            continue;
+        }
+        size_t keysize = strlen (m->key) + 1;
+        if (keysize > UINT16_MAX) {
+            continue;
+        }
+        _put_u16 (&b, (uint16_t)keysize);
+        _put (&b, m->key, keysize);
+        _put_u32 (&b, (uint32_t)m->valuesize);
+        _put (&b, m->value, m->valuesize);
+        n_meta++;
+    }
+    deadbeef->pl_unlock ();
+    memcpy (b.data + n_meta_pos, &n_meta, sizeof (n_meta));
+
+    return _write_record (j, &b);
+}
+
+int
+ml_journal_write_remove (ml_journal_t *j, const char *uri, int subtrack) {
+    size_t urisize = strlen (uri) + 1;
+    if (!j->fp || urisize > UINT16_MAX) {
+        return -1;
+    }
+    buffer_t b = {0};
+    _put_u8 (&b, JOURNAL_OP_REMOVE);
+    _put_u32 (&b, (uint32_t)subtrack);
+    _put_u16 (&b, (uint16_t)urisize);
+    _put (&b, uri, urisize);
+    return _write_record (j, &b);
+}
+
+int
+ml_journal_commit (ml_journal_t *j) {
+    if (!j->fp || !j->dirty) {
+        return 0;
+    }
+    j->dirty = 0;
+    if (fflush (j->fp) || fsync (fileno (j->fp))) {
+        fprintf (stderr, "medialib: failed to write %s: %s\n", j->fname, strerror (errno));
+        return -1;
+    }
+    return 0;
+}
+
+int
+ml_journal_reset (ml_journal_t *j) {
+    if (!j->fp) {
+        return -1;
+    }
+    fclose (j->fp);
+    j->fp = fopen (j->fname, "wb");
+    if (!j->fp || _write_header (j) < 0) {
+        fprintf (stderr, "medialib: failed to reset %s: %s\n", j->fname, strerror (errno));
+        return -1;
+    }
+    return ml_journal_commit (j);
+}
@@ -0,0 +1,74 @@
+/*
+    Media Library plugin for DeaDBeeF Player
+    Copyright (C) 2009-2018 Alexey Yakovenko
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+#ifndef __MEDIALIB_JOURNAL_H
+#define __MEDIALIB_JOURNAL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "../../deadbeef.h"
+
+// Append-only log of the changes made to the medialib playlist since it was last saved.
+// Each record carries its size and checksum, a torn record at the end is dropped on replay.
+// Replaying is idempotent: an added track replaces the track with the same file and subtrack,
+// so the log can be replayed on top of a snapshot which already includes some of it.
+
+typedef struct {
+    FILE *fp;
+    char *fname;
+    int64_t size;
+    int dirty;
+} ml_journal_t;
+
+typedef struct {
+    // `it` is not in any playlist yet, and must not be unreffed by the callback
+    void (*add) (DB_playItem_t *it, float duration, void *user_data);
+    // subtrack is -1 for the tracks which are not subtracks
+    void (*remove) (const char *uri, int subtrack, void *user_data);
+} ml_journal_replay_t;
+
+// Apply the records from the file, and cut off the damaged tail if any.
+// Returns the number of applied records, or -1 if the file can't be read.
+int
+ml_journal_replay (const char *fname, ml_journal_replay_t *cb, void *user_data);
+
+int
+ml_journal_open (ml_journal_t *j, const char *fname);
+
+void
+ml_journal_close (ml_journal_t *j);
+
+int
+ml_journal_write_add (ml_journal_t *j, DB_playItem_t *it);
+
+int
+ml_journal_write_remove (ml_journal_t *j, const char *uri, int subtrack);
+
+// make the records written so far durable
+int
+ml_journal_commit (ml_journal_t *j);
+
+// drop all records, after the playlist was saved
+int
+ml_journal_reset (ml_journal_t *j);
+
+#endif /*__MEDIALIB_JOURNAL_H*/
@@ -21,33 +21,68 @@
     3. This notice may not be removed or altered from any source distribution.
 */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
 #include <sys/time.h>
+#include <sys/stat.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
+#include <stdio.h>
 #include <limits.h>
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#define ML_USE_INOTIFY 1
+#endif
 #include "../../deadbeef.h"
+#include "medialib.h"
+#include "journal.h"
 
 DB_functions_t *deadbeef;
 
 static int filter_id;
 
+// the indexed fields, match DDB_MEDIALIB_FIELD_*
+#define ML_FIELD_COUNT 4
+
+typedef struct ml_entry_s ml_entry_t;
+
 typedef struct ml_string_s {
     const char *text;
+    int count; // number of tracks with this value, the string is removed from the index when it drops to 0
+    ml_entry_t **tracks; // posting list, unordered, `count` items
+    int tracks_size;
+    int rank; // position in the sorted list of the field values
     struct ml_string_s *bucket_next;
 } ml_string_t;
 
-typedef struct ml_entry_s {
+struct ml_entry_s {
     const char *file;
     const char *title;
     int subtrack;
-    ml_string_t *artist;
-    ml_string_t *album;
-    ml_string_t *genre;
-    ml_string_t *folder;
+    int64_t mtime; // of the file, when the track was read, see ml_stat
+    int64_t size;
+    unsigned scan_gen; // the last scan which found the file unchanged
+    DB_playItem_t *track;
+    ml_string_t *fields[ML_FIELD_COUNT]; // artist, album, genre, folder
+    int postings_idx[ML_FIELD_COUNT]; // position in the posting list of each field value
+    unsigned seq; // library order
+    unsigned mark; // used by the queries to remove duplicates
+    int removed; // removed while there were open cursors, see ml_index_remove_entry
+    struct ml_entry_s *prev;
     struct ml_entry_s *next;
     struct ml_entry_s *bucket_next;
-} ml_entry_t;
+};
+
+// stored in the tracks of the medialib playlist
+#define ML_META_MTIME ":MEDIALIB_MTIME"
+#define ML_META_SIZE ":MEDIALIB_SIZE"
 
 #define ML_HASH_SIZE 4096
 
@@ -55,9 +90,11 @@ typedef struct {
     // plain list of all tracks in the entire collection
     ml_entry_t *tracks;
 
+    ml_entry_t *tracks_tail;
+
     // hash formed by filename pointer
     // this hash purpose is to quickly check whether the filename is in the library already
-    // NOTE: this hash doesn't contain all of the tracks from the `tracks` list, because of subtracks
+    // all subtracks of a file are in the same bucket
     ml_entry_t *filename_hash[ML_HASH_SIZE];
 
     // hash tables for each index
@@ -65,6 +102,20 @@ typedef struct {
     ml_string_t *hash_artist[ML_HASH_SIZE];
     ml_string_t *hash_genre[ML_HASH_SIZE];
     ml_string_t *hash_folder[ML_HASH_SIZE];
+
+    // values of each field sorted case insensitive, rebuilt on demand by the queries
+    ml_string_t **sorted[ML_FIELD_COUNT];
+    int sorted_count[ML_FIELD_COUNT];
+    int sorted_size[ML_FIELD_COUNT];
+    int sorted_dirty[ML_FIELD_COUNT];
+
+    int count; // number of entries
+    unsigned next_seq;
+    unsigned query_mark;
+
+    // entries removed while cursors were open, freed when the last cursor is closed
+    int open_cursors;
+    ml_entry_t *retired;
 } ml_db_t;
 
 static uint32_t
@@ -90,38 +141,103 @@ hash_find (ml_string_t **hash, const char *val) {
     return hash_find_for_hashkey(hash, val, h);
 }
 
+// returns the existing or a new string, and counts one more track for it
 static ml_string_t *
 hash_add (ml_string_t **hash, const char *val) {
     uint32_t h = hash_for_ptr ((void *)val) & (ML_HASH_SIZE-1);
-    if (!hash_find_for_hashkey(hash, val, h)) {
-        deadbeef->metacache_ref (val);
-        ml_string_t *s = calloc (sizeof (ml_string_t), 1);
+    ml_string_t *s = hash_find_for_hashkey(hash, val, h);
+    if (!s) {
+        s = calloc (sizeof (ml_string_t), 1);
         s->bucket_next = hash[h];
         s->text = val;
         deadbeef->metacache_ref (val);
         hash[h] = s;
-        return s;
     }
-    return NULL;
+    s->count++;
+    return s;
+}
+
+// counts one less track for the string, and removes it when there are no more
+static void
+hash_release (ml_string_t **hash, ml_string_t *s) {
+    if (!s || --s->count > 0) {
+        return;
+    }
+    uint32_t h = hash_for_ptr ((void *)s->text) & (ML_HASH_SIZE-1);
+    ml_string_t **pp = &hash[h];
+    while (*pp != s) {
+        pp = &(*pp)->bucket_next;
+    }
+    *pp = s->bucket_next;
+    deadbeef->metacache_unref (s->text);
+    free (s);
 }
 
 static ddb_playlist_t *ml_playlist; // this playlist contains the actual data of the media library in plain list
 
 static ml_db_t db; // this is the index, which can be rebuilt from the playlist at any given time
+static uintptr_t db_mutex; // protects db; ml_playlist is only modified by the scanner thread
+static unsigned scan_gen; // incremented for every full scan
+
+// the changes since medialib.dbpl was saved, the playlist file is rewritten when the journal grows
+// to ML_JOURNAL_COMPACT_SIZE, and at least half the size of the playlist file
+static ml_journal_t journal;
+#define ML_JOURNAL_COMPACT_SIZE (1 << 20)
+// set when the journal can't be written, every commit rewrites the playlist file then
+static int journal_unavailable;
+
+static ml_string_t **
+ml_field_hash (int field) {
+    switch (field) {
+    case DDB_MEDIALIB_FIELD_ARTIST:
+        return db.hash_artist;
+    case DDB_MEDIALIB_FIELD_ALBUM:
+        return db.hash_album;
+    case DDB_MEDIALIB_FIELD_GENRE:
+        return db.hash_genre;
+    case DDB_MEDIALIB_FIELD_FOLDER:
+        return db.hash_folder;
+    }
+    return NULL;
+}
 
-#define REG_COL_DEF(col)\
-ml_string_t *\
-ml_reg_##col (ml_db_t *db, const char *c) {\
-    if (!c) {\
-        return NULL;\
-    }\
-    return hash_add (db->hash_##col, c);\
+// set the field value of the entry, and add the entry to the value's posting list
+static void
+ml_field_add (ml_entry_t *en, int field, const char *val) {
+    if (!val) {
+        return;
+    }
+    ml_string_t *s = hash_add (ml_field_hash (field), val);
+    if (s->count == 1) {
+        db.sorted_dirty[field] = 1;
+    }
+    if (s->count > s->tracks_size) {
+        s->tracks_size = s->tracks_size ? s->tracks_size * 2 : 4;
+        s->tracks = realloc (s->tracks, s->tracks_size * sizeof (ml_entry_t *));
+    }
+    s->tracks[s->count-1] = en;
+    en->postings_idx[field] = s->count-1;
+    en->fields[field] = s;
 }
 
-REG_COL_DEF(album);
-REG_COL_DEF(artist);
-REG_COL_DEF(genre);
-REG_COL_DEF(folder);
+static void
+ml_field_remove (ml_entry_t *en, int field) {
+    ml_string_t *s = en->fields[field];
+    if (!s) {
+        return;
+    }
+    // the last posting takes the place of the removed one
+    ml_entry_t *last = s->tracks[s->count-1];
+    s->tracks[en->postings_idx[field]] = last;
+    last->postings_idx[field] = en->postings_idx[field];
+    en->fields[field] = NULL;
+    if (s->count == 1) {
+        db.sorted_dirty[field] = 1;
+        free (s->tracks);
+        s->tracks = NULL;
+    }
+    hash_release (ml_field_hash (field), s);
+}
 
 DB_playItem_t *(*plt_insert_dir) (ddb_playlist_t *plt, DB_playItem_t *after, const char *dirname, int *pabort, int (*cb)(DB_playItem_t *it, void *data), void *user_data);
 
@@ -134,6 +250,40 @@ add_file_info_cb (DB_playItem_t *it, void *data) {
     return 0;
 }
 
+// the file modification time in nanoseconds, and the size; returns -1 if the file doesn't exist
+static int
+ml_stat (const char *fname, int64_t *mtime, int64_t *size) {
+    struct stat st;
+    if (stat (fname, &st) < 0) {
+        return -1;
+    }
+#ifdef __linux__
+    *mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#else
+    *mtime = (int64_t)st.st_mtime * 1000000000;
+#endif
+    *size = (int64_t)st.st_size;
+    return 0;
+}
+
+static void
+ml_track_set_stat (DB_playItem_t *it, int64_t mtime, int64_t size) {
+    char s[30];
+    snprintf (s, sizeof (s), "%lld", (long long)mtime);
+    deadbeef->pl_replace_meta (it, ML_META_MTIME, s);
+    snprintf (s, sizeof (s), "%lld", (long long)size);
+    deadbeef->pl_replace_meta (it, ML_META_SIZE, s);
+}
+
+static int64_t
+ml_track_get_int64 (DB_playItem_t *it, const char *key) {
+    deadbeef->pl_lock ();
+    const char *s = deadbeef->pl_find_meta (it, key);
+    int64_t val = s ? strtoll (s, NULL, 10) : -1;
+    deadbeef->pl_unlock ();
+    return val;
+}
+
 #define FREE_COL(col)\
     for (int idx_##col = 0; idx_##col < ML_HASH_SIZE; idx_##col++) {\
         ml_string_t *s = db.hash_##col[idx_##col];\
@@ -142,6 +292,7 @@ add_file_info_cb (DB_playItem_t *it, void *data) {
             if (s->text) {\
                 deadbeef->metacache_unref (s->text);\
             }\
+            free (s->tracks);\
             free (s);\
             s = next;\
         }\
@@ -165,91 +316,261 @@ ml_free_db (void) {
         if (db.tracks->file) {
             deadbeef->metacache_unref (db.tracks->file);
         }
+        if (db.tracks->track) {
+            deadbeef->pl_item_unref (db.tracks->track);
+        }
         free (db.tracks);
         db.tracks = next;
     }
 
+    while (db.retired) {
+        ml_entry_t *next = db.retired->next;
+        free (db.retired);
+        db.retired = next;
+    }
+
+    for (int f = 0; f < ML_FIELD_COUNT; f++) {
+        free (db.sorted[f]);
+    }
+
     memset (&db, 0, sizeof (db));
 }
 
-// This should be called only on pre-existing ml playlist.
-// Subsequent indexing should be done on the fly, using fileadd listener.
+// add the track to the index, mtime and size are of the track's file
+static ml_entry_t *
+ml_index_add_track (DB_playItem_t *it, int64_t mtime, int64_t size) {
+    char folder[PATH_MAX];
+
+    ml_entry_t *en = calloc (sizeof (ml_entry_t), 1);
+
+    deadbeef->pl_lock ();
+    const char *uri = deadbeef->pl_find_meta (it, ":URI");
+    const char *title = deadbeef->pl_find_meta (it, "title");
+    const char *artist = deadbeef->pl_find_meta (it, "artist");
+
+    // FIXME: album needs to be a combination of album + artist for indexing / library
+    const char *album = deadbeef->pl_find_meta (it, "album");
+    const char *genre = deadbeef->pl_find_meta (it, "genre");
+    ml_field_add (en, DDB_MEDIALIB_FIELD_ALBUM, album);
+    ml_field_add (en, DDB_MEDIALIB_FIELD_ARTIST, artist);
+    ml_field_add (en, DDB_MEDIALIB_FIELD_GENRE, genre);
+
+    char *fn = strrchr (uri, '/');
+    if (fn && fn - uri < sizeof (folder)) {
+        memcpy (folder, uri, fn-uri);
+        folder[fn-uri] = 0;
+        const char *s = deadbeef->metacache_add_string (folder);
+        ml_field_add (en, DDB_MEDIALIB_FIELD_FOLDER, s);
+        deadbeef->metacache_unref (s);
+    }
+
+    // uri and title are not indexed, only a part of track list,
+    // that's why they have an extra ref for each entry
+    deadbeef->metacache_ref (uri);
+    en->file = uri;
+    if (title) {
+        deadbeef->metacache_ref (title);
+    }
+    deadbeef->pl_unlock ();
+
+    if (deadbeef->pl_get_item_flags (it) & DDB_IS_SUBTRACK) {
+        en->subtrack = deadbeef->pl_find_meta_int (it, ":TRACKNUM", -1);
+    }
+    else {
+        en->subtrack = -1;
+    }
+    en->title = title;
+    en->mtime = mtime;
+    en->size = size;
+    en->scan_gen = scan_gen;
+    en->seq = db.next_seq++;
+    deadbeef->pl_item_ref (it);
+    en->track = it;
+
+    en->prev = db.tracks_tail;
+    if (db.tracks_tail) {
+        db.tracks_tail->next = en;
+    }
+    else {
+        db.tracks = en;
+    }
+    db.tracks_tail = en;
+
+    // add to the hash table
+    uint32_t hash = hash_for_ptr ((void *)en->file);
+    en->bucket_next = db.filename_hash[hash];
+    db.filename_hash[hash] = en;
+    db.count++;
+
+    return en;
+}
+
+// remove the entry from the index, and its track from the medialib playlist
 static void
-ml_index (void) {
-    ml_free_db();
+ml_index_remove_entry (ml_entry_t *en) {
+    ml_journal_write_remove (&journal, en->file, en->subtrack);
 
-    fprintf (stderr, "building index...\n");
+    if (en->prev) {
+        en->prev->next = en->next;
+    }
+    else {
+        db.tracks = en->next;
+    }
+    if (en->next) {
+        en->next->prev = en->prev;
+    }
+    else {
+        db.tracks_tail = en->prev;
+    }
 
-    struct timeval tm1, tm2;
-    gettimeofday (&tm1, NULL);
+    ml_entry_t **pp = &db.filename_hash[hash_for_ptr ((void *)en->file)];
+    while (*pp != en) {
+        pp = &(*pp)->bucket_next;
+    }
+    *pp = en->bucket_next;
 
-    ml_entry_t *tail = NULL;
+    for (int f = 0; f < ML_FIELD_COUNT; f++) {
+        ml_field_remove (en, f);
+    }
 
-    char folder[PATH_MAX];
+    if (en->title) {
+        deadbeef->metacache_unref (en->title);
+    }
+    deadbeef->metacache_unref (en->file);
+    deadbeef->plt_remove_item (ml_playlist, en->track);
+    deadbeef->pl_item_unref (en->track);
+    db.count--;
+
+    // the open cursors may point to the entry, they'll skip it
+    if (db.open_cursors) {
+        memset (en, 0, sizeof (ml_entry_t));
+        en->removed = 1;
+        en->next = db.retired;
+        db.retired = en;
+        return;
+    }
+    free (en);
+}
 
-    DB_playItem_t *it = deadbeef->plt_get_first (ml_playlist, PL_MAIN);
-    while (it) {
-        ml_entry_t *en = calloc (sizeof (ml_entry_t), 1);
+// returns the first entry of the file, file must be a metacache string
+static ml_entry_t *
+ml_index_find_file (const char *file) {
+    for (ml_entry_t *en = db.filename_hash[hash_for_ptr ((void *)file)]; en; en = en->bucket_next) {
+        if (en->file == file) {
+            return en;
+        }
+    }
+    return NULL;
+}
+
+// remove all tracks of the file; returns the number of removed tracks
+static int
+ml_index_remove_file (const char *fname) {
+    const char *file = deadbeef->metacache_get_string (fname);
+    if (!file) {
+        return 0;
+    }
+    int n = 0;
+    ml_entry_t *en;
+    while ((en = ml_index_find_file (file))) {
+        ml_index_remove_entry (en);
+        n++;
+    }
+    deadbeef->metacache_unref (file);
+    return n;
+}
 
+// remove all tracks of the files in the folder and its subfolders
+static int
+ml_index_remove_folder (const char *folder) {
+    size_t l = strlen (folder);
+    int n = 0;
+    ml_entry_t *next = NULL;
+    for (ml_entry_t *en = db.tracks; en; en = next) {
+        next = en->next;
+        if (!strncmp (en->file, folder, l) && en->file[l] == '/') {
+            ml_index_remove_entry (en);
+            n++;
+        }
+    }
+    return n;
+}
+
+// remove the track with the given file and subtrack (-1 if it's not a subtrack)
+static void
+ml_index_remove_track (const char *fname, int subtrack) {
+    const char *file = deadbeef->metacache_get_string (fname);
+    if (!file) {
+        return;
+    }
+    for (ml_entry_t *en = db.filename_hash[hash_for_ptr ((void *)file)]; en; en = en->bucket_next) {
+        if (en->file == file && en->subtrack == subtrack) {
+            ml_index_remove_entry (en);
+            break;
+        }
+    }
+    deadbeef->metacache_unref (file);
+}
+
+static void
+ml_replay_add (DB_playItem_t *it, float duration, void *user_data) {
+    deadbeef->pl_lock ();
+    char *uri = strdup (deadbeef->pl_find_meta (it, ":URI"));
+    deadbeef->pl_unlock ();
+    int subtrack = -1;
+    if (deadbeef->pl_get_item_flags (it) & DDB_IS_SUBTRACK) {
+        subtrack = deadbeef->pl_find_meta_int (it, ":TRACKNUM", -1);
+    }
+    ml_index_remove_track (uri, subtrack);
+    free (uri);
+
+    DB_playItem_t *tail = deadbeef->plt_get_last (ml_playlist, PL_MAIN);
+    deadbeef->plt_insert_item (ml_playlist, tail, it);
+    if (tail) {
+        deadbeef->pl_item_unref (tail);
+    }
+    deadbeef->plt_set_item_duration (ml_playlist, it, duration);
+    ml_index_add_track (it, ml_track_get_int64 (it, ML_META_MTIME), ml_track_get_int64 (it, ML_META_SIZE));
+}
+
+static void
+ml_replay_remove (const char *uri, int subtrack, void *user_data) {
+    ml_index_remove_track (uri, subtrack);
+}
+
+// index the tracks of the medialib playlist following `after`, which were just added by the scanner
+static int
+ml_index_new_tracks (DB_playItem_t *after) {
+    int n = 0;
+    const char *prev_uri = NULL;
+    int64_t mtime = -1;
+    int64_t size = -1;
+    DB_playItem_t *it = after ? deadbeef->pl_get_next (after, PL_MAIN) : deadbeef->plt_get_first (ml_playlist, PL_MAIN);
+    while (it) {
+        deadbeef->pl_lock ();
         const char *uri = deadbeef->pl_find_meta (it, ":URI");
-        const char *title = deadbeef->pl_find_meta (it, "title");
-        const char *artist = deadbeef->pl_find_meta (it, "artist");
-
-        // FIXME: album needs to be a combination of album + artist for indexing / library
-        const char *album = deadbeef->pl_find_meta (it, "album");
-        const char *genre = deadbeef->pl_find_meta (it, "genre");
-        ml_string_t *alb = ml_reg_album (&db, album);
-        ml_string_t *art = ml_reg_artist (&db, artist);
-        ml_string_t *gnr = ml_reg_genre (&db, genre);
-
-        char *fn = strrchr (uri, '/');
-        ml_string_t *fld = NULL;
-        if (fn) {
-            memcpy (folder, uri, fn-uri);
-            folder[fn-uri] = 0;
-            const char *s = deadbeef->metacache_add_string (folder);
-            fld = ml_reg_folder (&db, s);
-            deadbeef->metacache_unref (s);
-        }
-
-        // uri and title are not indexed, only a part of track list,
-        // that's why they have an extra ref for each entry
-        deadbeef->metacache_ref (uri);
-        en->file = uri;
-        if (title) {
-            deadbeef->metacache_ref (title);
-        }
-        if (deadbeef->pl_get_item_flags (it) & DDB_IS_SUBTRACK) {
-            en->subtrack = deadbeef->pl_find_meta_int (it, ":TRACKNUM", -1);
-        }
-        else {
-            en->subtrack = -1;
-        }
-        en->title = title;
-        en->artist = art;
-        en->album = alb;
-        en->genre = gnr;
-        en->folder = fld;
-
-        if (tail) {
-            tail->next = en;
-            tail = en;
-        }
-        else {
-            tail = db.tracks = en;
-        }
-
-        // add to the hash table
-        // at this point, we only have unique pointers, and don't need a duplicate check
-        uint32_t hash = hash_for_ptr ((void *)en->file);
-        en->bucket_next = db.filename_hash[hash];
-        db.filename_hash[hash] = en;
+        deadbeef->pl_unlock ();
+        // subtracks share the file
+        if (uri != prev_uri) {
+            if (!uri || ml_stat (uri, &mtime, &size) < 0) {
+                mtime = size = -1;
+            }
+            prev_uri = uri;
+        }
+        ml_track_set_stat (it, mtime, size);
+        ml_index_add_track (it, mtime, size);
+        ml_journal_write_add (&journal, it);
+        n++;
 
         DB_playItem_t *next = deadbeef->pl_get_next (it, PL_MAIN);
         deadbeef->pl_item_unref (it);
         it = next;
     }
+    return n;
+}
 
+static void
+ml_index_print_stats (void) {
     int nalb = 0;
     int nart = 0;
     int ngnr = 0;
@@ -261,19 +582,319 @@ ml_index (void) {
         for (s = db.hash_genre[i]; s; s = s->bucket_next, ngnr++);
         for (s = db.hash_folder[i]; s; s = s->bucket_next, nfld++);
     }
+    fprintf (stderr, "%d albums, %d artists, %d genres, %d folders\n", nalb, nart, ngnr, nfld);
+}
+
+// This should be called only on pre-existing ml playlist.
+// Subsequent indexing is done incrementally by the scanner.
+static void
+ml_index (void) {
+    ml_free_db();
+
+    fprintf (stderr, "building index...\n");
+
+    struct timeval tm1, tm2;
+    gettimeofday (&tm1, NULL);
+
+    DB_playItem_t *it = deadbeef->plt_get_first (ml_playlist, PL_MAIN);
+    while (it) {
+        ml_index_add_track (it, ml_track_get_int64 (it, ML_META_MTIME), ml_track_get_int64 (it, ML_META_SIZE));
+        DB_playItem_t *next = deadbeef->pl_get_next (it, PL_MAIN);
+        deadbeef->pl_item_unref (it);
+        it = next;
+    }
+
     gettimeofday (&tm2, NULL);
     long ms = (tm2.tv_sec*1000+tm2.tv_usec/1000) - (tm1.tv_sec*1000+tm1.tv_usec/1000);
 
-    fprintf (stderr, "index build time: %f seconds (%d albums, %d artists, %d genres, %d folders)\n", ms / 1000.f, nalb, nart, ngnr, nfld);
+    fprintf (stderr, "index build time: %f seconds\n", ms / 1000.f);
+    ml_index_print_stats ();
+}
+
+#if ML_USE_INOTIFY
+// inotify watches for all folders of the library, the changes are applied in batches,
+// after the file system was quiet for ML_WATCH_DELAY ms
+#define ML_WATCH_DELAY 1000
+
+enum {
+    ML_OP_UPDATE_FILE,
+    ML_OP_REMOVE_FILE,
+    ML_OP_ADD_FOLDER,
+    ML_OP_REMOVE_FOLDER,
+};
+
+typedef struct ml_op_s {
+    int op;
+    char *path;
+    struct ml_op_s *next;
+} ml_op_t;
+
+static int watch_fd = -1;
+static char **watch_paths; // indexed by watch descriptor
+static int watch_paths_size;
+static ml_op_t *watch_ops;
+static ml_op_t *watch_ops_tail;
+
+static void
+ml_watch_add (const char *path) {
+    if (watch_fd < 0) {
+        return;
+    }
+    int wd = inotify_add_watch (watch_fd, path, IN_ONLYDIR|IN_CLOSE_WRITE|IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_DELETE_SELF);
+    if (wd < 0) {
+        if (errno == ENOSPC) {
+            fprintf (stderr, "medialib: inotify watch limit reached, changes in %s will only be found on the next scan\n", path);
+        }
+        return;
+    }
+    if (wd >= watch_paths_size) {
+        int size = watch_paths_size ? watch_paths_size : 1024;
+        while (size <= wd) {
+            size *= 2;
+        }
+        watch_paths = realloc (watch_paths, size * sizeof (char *));
+        memset (watch_paths + watch_paths_size, 0, (size - watch_paths_size) * sizeof (char *));
+        watch_paths_size = size;
+    }
+    free (watch_paths[wd]);
+    watch_paths[wd] = strdup (path);
+}
+
+static void
+ml_watch_free (void) {
+    if (watch_fd >= 0) {
+        close (watch_fd);
+        watch_fd = -1;
+    }
+    for (int i = 0; i < watch_paths_size; i++) {
+        free (watch_paths[i]);
+    }
+    free (watch_paths);
+    watch_paths = NULL;
+    watch_paths_size = 0;
+    while (watch_ops) {
+        ml_op_t *next = watch_ops->next;
+        free (watch_ops->path);
+        free (watch_ops);
+        watch_ops = next;
+    }
+    watch_ops_tail = NULL;
+}
+
+// queue the operation, replacing any earlier one on the same path
+static void
+ml_watch_queue (int op, const char *dir, const char *name) {
+    size_t l = strlen (dir) + strlen (name) + 2;
+    char *path = malloc (l);
+    snprintf (path, l, "%s/%s", dir, name);
+
+    ml_op_t *prev = NULL;
+    for (ml_op_t *o = watch_ops; o; prev = o, o = o->next) {
+        if (!strcmp (o->path, path)) {
+            if (prev) {
+                prev->next = o->next;
+            }
+            else {
+                watch_ops = o->next;
+            }
+            if (watch_ops_tail == o) {
+                watch_ops_tail = prev;
+            }
+            free (o->path);
+            free (o);
+            break;
+        }
+    }
+
+    ml_op_t *o = calloc (1, sizeof (ml_op_t));
+    o->op = op;
+    o->path = path;
+    if (watch_ops_tail) {
+        watch_ops_tail->next = o;
+    }
+    else {
+        watch_ops = o;
+    }
+    watch_ops_tail = o;
+}
+
+// returns the number of events read
+static int
+ml_watch_read_events (void) {
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    int n = 0;
+    for (;;) {
+        ssize_t len = read (watch_fd, buf, sizeof (buf));
+        if (len <= 0) {
+            break;
+        }
+        for (char *p = buf; p < buf + len; ) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            p += sizeof (struct inotify_event) + ev->len;
+            n++;
+
+            if (ev->wd < 0 || ev->wd >= watch_paths_size || !watch_paths[ev->wd]) {
+                continue;
+            }
+            if (ev->mask & IN_IGNORED) {
+                free (watch_paths[ev->wd]);
+                watch_paths[ev->wd] = NULL;
+                continue;
+            }
+            if (!ev->len || ev->name[0] == '.') {
+                continue;
+            }
+            const char *dir = watch_paths[ev->wd];
+            if (ev->mask & IN_ISDIR) {
+                if (ev->mask & (IN_CREATE|IN_MOVED_TO)) {
+                    ml_watch_queue (ML_OP_ADD_FOLDER, dir, ev->name);
+                }
+                else if (ev->mask & (IN_DELETE|IN_MOVED_FROM)) {
+                    ml_watch_queue (ML_OP_REMOVE_FOLDER, dir, ev->name);
+                }
+            }
+            else if (ev->mask & (IN_CLOSE_WRITE|IN_MOVED_TO)) {
+                ml_watch_queue (ML_OP_UPDATE_FILE, dir, ev->name);
+            }
+            else if (ev->mask & (IN_DELETE|IN_MOVED_FROM)) {
+                ml_watch_queue (ML_OP_REMOVE_FILE, dir, ev->name);
+            }
+        }
+    }
+    return n;
+}
+#endif
+
+// add a file or a folder to the medialib playlist, and index the new tracks
+static int
+ml_scan_path (const char *path, int is_dir) {
+    DB_playItem_t *tail = deadbeef->plt_get_last (ml_playlist, PL_MAIN);
+    if (is_dir) {
+        plt_insert_dir (ml_playlist, tail, path, &scanner_terminate, add_file_info_cb, NULL);
+    }
+    else {
+        deadbeef->plt_insert_file2 (-1, ml_playlist, tail, path, &scanner_terminate, add_file_info_cb, NULL);
+    }
+    deadbeef->mutex_lock (db_mutex);
+    int n = ml_index_new_tracks (tail);
+    deadbeef->mutex_unlock (db_mutex);
+    if (tail) {
+        deadbeef->pl_item_unref (tail);
+    }
+    return n;
+}
+
+#if ML_USE_INOTIFY
+// returns the number of changed tracks
+static int
+ml_watch_apply (void) {
+    int changed = 0;
+    while (watch_ops && !scanner_terminate) {
+        ml_op_t *o = watch_ops;
+        watch_ops = o->next;
+        if (!watch_ops) {
+            watch_ops_tail = NULL;
+        }
+
+        switch (o->op) {
+        case ML_OP_UPDATE_FILE: {
+            int64_t mtime, size;
+            if (ml_stat (o->path, &mtime, &size) < 0) {
+                break;
+            }
+            deadbeef->mutex_lock (db_mutex);
+            const char *file = deadbeef->metacache_get_string (o->path);
+            ml_entry_t *en = file ? ml_index_find_file (file) : NULL;
+            int unchanged = en && en->mtime == mtime && en->size == size;
+            if (file) {
+                deadbeef->metacache_unref (file);
+            }
+            if (!unchanged) {
+                changed += ml_index_remove_file (o->path);
+            }
+            deadbeef->mutex_unlock (db_mutex);
+            if (!unchanged) {
+                changed += ml_scan_path (o->path, 0);
+            }
+            break;
+        }
+        case ML_OP_REMOVE_FILE:
+            deadbeef->mutex_lock (db_mutex);
+            changed += ml_index_remove_file (o->path);
+            deadbeef->mutex_unlock (db_mutex);
+            break;
+        case ML_OP_ADD_FOLDER:
+            // also sets up the watches, see ml_fileadd_filter
+            changed += ml_scan_path (o->path, 1);
+            break;
+        case ML_OP_REMOVE_FOLDER:
+            deadbeef->mutex_lock (db_mutex);
+            changed += ml_index_remove_folder (o->path);
+            deadbeef->mutex_unlock (db_mutex);
+            break;
+        }
+        free (o->path);
+        free (o);
+    }
+    return changed;
+}
+#endif
+
+// write the playlist file, and start a new journal
+static int
+ml_db_compact (const char *plpath) {
+    if (deadbeef->plt_save (ml_playlist, NULL, NULL, plpath, NULL, NULL, NULL) < 0) {
+        fprintf (stderr, "medialib: failed to save %s\n", plpath);
+        return -1;
+    }
+    // the journal can only be dropped after the playlist file is on disk
+    int fd = open (plpath, O_RDONLY);
+    if (fd < 0 || fsync (fd)) {
+        if (fd >= 0) {
+            close (fd);
+        }
+        return -1;
+    }
+    close (fd);
+    if (ml_journal_reset (&journal) < 0) {
+        journal_unavailable = !journal.fp;
+        return -1;
+    }
+    return 0;
+}
+
+// make the changes durable
+static void
+ml_db_commit (const char *plpath) {
+    if (journal_unavailable) {
+        ml_db_compact (plpath);
+        return;
+    }
+    if (ml_journal_commit (&journal) < 0 && ml_db_compact (plpath) < 0) {
+        return;
+    }
+    struct stat st;
+    int64_t plsize = stat (plpath, &st) ? 0 : st.st_size;
+    if (journal.size >= ML_JOURNAL_COMPACT_SIZE && journal.size >= plsize / 2) {
+        ml_db_compact (plpath);
+    }
 }
 
 static void
 scanner_thread (void *none) {
     char plpath[PATH_MAX];
+    char journalpath[PATH_MAX];
     snprintf (plpath, sizeof (plpath), "%s/medialib.dbpl", deadbeef->get_system_dir (DDB_SYS_DIR_CONFIG));
+    snprintf (journalpath, sizeof (journalpath), "%s/medialib.journal", deadbeef->get_system_dir (DDB_SYS_DIR_CONFIG));
 
     struct timeval tm1, tm2;
 
+    const char *musicdir = deadbeef->conf_get_str_fast ("medialib.path", NULL);
+    if (!musicdir) {
+        return;
+    }
+    char *dir = strdup (musicdir);
+
     if (!ml_playlist) {
         ml_playlist = deadbeef->plt_alloc ("medialib");
 
@@ -284,40 +905,104 @@ scanner_thread (void *none) {
         long ms = (tm2.tv_sec*1000+tm2.tv_usec/1000) - (tm1.tv_sec*1000+tm1.tv_usec/1000);
         fprintf (stderr, "ml playlist load time: %f seconds\n", ms / 1000.f);
 
+        ml_journal_replay_t replay = {
+            .add = ml_replay_add,
+            .remove = ml_replay_remove,
+        };
+        deadbeef->mutex_lock (db_mutex);
         if (plt_head) {
-//            for (int i = 0; i < 100; i++) {
-                ml_index ();
-//            }
+            ml_index ();
         }
+        gettimeofday (&tm1, NULL);
+        int n = ml_journal_replay (journalpath, &replay, NULL);
+        gettimeofday (&tm2, NULL);
+        deadbeef->mutex_unlock (db_mutex);
+        ms = (tm2.tv_sec*1000+tm2.tv_usec/1000) - (tm1.tv_sec*1000+tm1.tv_usec/1000);
+        fprintf (stderr, "ml journal replay time: %f seconds (%d records)\n", ms / 1000.f, n);
     }
 
-    gettimeofday (&tm1, NULL);
+    if (!journal.fp) {
+        // no way to record the changes incrementally without it
+        journal_unavailable = ml_journal_open (&journal, journalpath) < 0;
+    }
 
-    const char *musicdir = deadbeef->conf_get_str_fast ("medialib.path", NULL);
-    if (!musicdir) {
-        return;
+#if ML_USE_INOTIFY
+    if (deadbeef->conf_get_int ("medialib.watch", 1)) {
+        watch_fd = inotify_init1 (IN_NONBLOCK|IN_CLOEXEC);
     }
+#endif
+
+    gettimeofday (&tm1, NULL);
 
-    printf ("adding dir: %s\n", musicdir);
-    plt_insert_dir (ml_playlist, NULL, musicdir, &scanner_terminate, add_file_info_cb, NULL);
+    // unchanged files get the new scan_gen in ml_fileadd_filter, new files in ml_index_new_tracks,
+    // the tracks of the modified and deleted files keep the old one
+    int changed = 0;
+    struct stat st;
+    if (!stat (dir, &st) && S_ISDIR (st.st_mode)) {
+        scan_gen++;
+        printf ("adding dir: %s\n", dir);
+        changed += ml_scan_path (dir, 1);
+
+        if (!scanner_terminate) {
+            deadbeef->mutex_lock (db_mutex);
+            ml_entry_t *next = NULL;
+            for (ml_entry_t *en = db.tracks; en; en = next) {
+                next = en->next;
+                if (en->scan_gen != scan_gen) {
+                    ml_index_remove_entry (en);
+                    changed++;
+                }
+            }
+            deadbeef->mutex_unlock (db_mutex);
+        }
+    }
+    else {
+        fprintf (stderr, "medialib: %s is not available, keeping the library as is\n", dir);
+    }
 
     gettimeofday (&tm2, NULL);
     long ms = (tm2.tv_sec*1000+tm2.tv_usec/1000) - (tm1.tv_sec*1000+tm1.tv_usec/1000);
-    fprintf (stderr, "scan time: %f seconds (%d tracks)\n", ms / 1000.f, deadbeef->plt_get_item_count (ml_playlist, PL_MAIN));
+    fprintf (stderr, "scan time: %f seconds (%d tracks, %d changed)\n", ms / 1000.f, deadbeef->plt_get_item_count (ml_playlist, PL_MAIN), changed);
+
+    if (changed) {
+        ml_db_commit (plpath);
+    }
 
-    deadbeef->plt_save (ml_playlist, NULL, NULL, plpath, NULL, NULL, NULL);
+#if ML_USE_INOTIFY
+    while (watch_fd >= 0 && !scanner_terminate) {
+        struct pollfd pfd = { .fd = watch_fd, .events = POLLIN };
+        int res = poll (&pfd, 1, watch_ops ? ML_WATCH_DELAY : 200);
+        if (res > 0) {
+            ml_watch_read_events ();
+        }
+        else if (res == 0 && watch_ops) {
+            if (ml_watch_apply ()) {
+                ml_db_commit (plpath);
+            }
+        }
+    }
+    ml_watch_free ();
+#endif
+    free (dir);
 }
 
 //#define FILTER_PERF
 
-// intention is to skip the files which are already indexed
+// intention is to skip the files which are already indexed, and didn't change since
 // how to speed this up:
 // first check if a folder exists (early out?)
 static int
 ml_fileadd_filter (ddb_file_found_data_t *data, void *user_data) {
     int res = 0;
 
-    if (data->plt != ml_playlist || data->is_dir) {
+    if (data->plt != ml_playlist) {
+        return 0;
+    }
+
+    if (data->is_dir) {
+#if ML_USE_INOTIFY
+        ml_watch_add (data->filename);
+#endif
         return 0;
     }
 
@@ -331,20 +1016,18 @@ ml_fileadd_filter (ddb_file_found_data_t *data, void *user_data) {
         return 0;
     }
 
-    uint32_t hash = (((uint32_t)(s))>>1) & (ML_HASH_SIZE-1);
-
-    if (!db.filename_hash[hash]) {
-        return 0;
-    }
-
-    ml_entry_t *en = db.filename_hash[hash];
-    while (en) {
-        if (en->file == s) {
-            res = -1;
-            break;
+    deadbeef->mutex_lock (db_mutex);
+    ml_entry_t *en = ml_index_find_file (s);
+    int64_t mtime, size;
+    if (en && !ml_stat (data->filename, &mtime, &size) && en->mtime == mtime && en->size == size) {
+        for (; en; en = en->bucket_next) {
+            if (en->file == s) {
+                en->scan_gen = scan_gen;
+            }
         }
-        en = en->bucket_next;
+        res = -1;
     }
+    deadbeef->mutex_unlock (db_mutex);
 
 #if FILTER_PERF
     gettimeofday (&tm2, NULL);
@@ -363,6 +1046,475 @@ ml_fileadd_filter (ddb_file_found_data_t *data, void *user_data) {
     return res;
 }
 
+// queries
+enum {
+    ML_QUERY_ALL,
+    ML_QUERY_EQUAL,
+    ML_QUERY_PREFIX,
+    ML_QUERY_AND,
+    ML_QUERY_OR,
+};
+
+struct ddb_medialib_query_s {
+    int op;
+    int field;
+    char *value;
+    struct ddb_medialib_query_s *a;
+    struct ddb_medialib_query_s *b;
+
+    // resolved against the index by ml_query_prepare
+    ml_string_t *s; // ML_QUERY_EQUAL
+    int first; // ML_QUERY_PREFIX: the range of the value ranks
+    int last;
+    int estimate; // upper bound of the number of matching tracks
+};
+
+struct ddb_medialib_cursor_s {
+    int count;
+    ml_entry_t **tracks;
+    const char **values;
+    int *counts;
+    int holds_entries; // counted in db.open_cursors
+};
+
+typedef struct {
+    ml_entry_t **items;
+    int count;
+    int size;
+} ml_entry_list_t;
+
+// the conditions which have to be checked for each candidate
+typedef struct ml_filter_s {
+    ddb_medialib_query_t *query;
+    struct ml_filter_s *next;
+} ml_filter_t;
+
+static int
+ml_cmp_strings (const void *a, const void *b) {
+    const ml_string_t *x = *(const ml_string_t **)a;
+    const ml_string_t *y = *(const ml_string_t **)b;
+    int res = strcasecmp (x->text, y->text);
+    return res ? res : strcmp (x->text, y->text);
+}
+
+// update the sorted value list and the ranks of the field, if it changed since the last query
+static void
+ml_sort_field_values (int field) {
+    if (!db.sorted_dirty[field]) {
+        return;
+    }
+    ml_string_t **hash = ml_field_hash (field);
+    int n = 0;
+    for (int i = 0; i < ML_HASH_SIZE; i++) {
+        for (ml_string_t *s = hash[i]; s; s = s->bucket_next) {
+            if (n == db.sorted_size[field]) {
+                db.sorted_size[field] = n ? n * 2 : 1024;
+                db.sorted[field] = realloc (db.sorted[field], db.sorted_size[field] * sizeof (ml_string_t *));
+            }
+            db.sorted[field][n++] = s;
+        }
+    }
+    if (n > 1) {
+        qsort (db.sorted[field], n, sizeof (ml_string_t *), ml_cmp_strings);
+    }
+    for (int i = 0; i < n; i++) {
+        db.sorted[field][i]->rank = i;
+    }
+    db.sorted_count[field] = n;
+    db.sorted_dirty[field] = 0;
+}
+
+static void
+ml_query_prepare (ddb_medialib_query_t *q) {
+    switch (q->op) {
+    case ML_QUERY_ALL:
+        q->estimate = db.count;
+        break;
+    case ML_QUERY_EQUAL:
+        q->s = NULL;
+        if (!q->value) {
+            q->estimate = db.count;
+            break;
+        }
+        const char *val = deadbeef->metacache_get_string (q->value);
+        if (val) {
+            q->s = hash_find (ml_field_hash (q->field), val);
+            deadbeef->metacache_unref (val);
+        }
+        q->estimate = q->s ? q->s->count : 0;
+        break;
+    case ML_QUERY_PREFIX: {
+        ml_sort_field_values (q->field);
+        ml_string_t **sorted = db.sorted[q->field];
+        int lo = 0;
+        int hi = db.sorted_count[q->field];
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (strcasecmp (sorted[mid]->text, q->value) < 0) {
+                lo = mid + 1;
+            }
+            else {
+                hi = mid;
+            }
+        }
+        // the values with the prefix follow each other in the case insensitive order
+        size_t l = strlen (q->value);
+        q->first = q->last = lo;
+        q->estimate = 0;
+        while (q->last < db.sorted_count[q->field] && !strncasecmp (sorted[q->last]->text, q->value, l)) {
+            q->estimate += sorted[q->last]->count;
+            q->last++;
+        }
+        break;
+    }
+    case ML_QUERY_AND:
+        ml_query_prepare (q->a);
+        ml_query_prepare (q->b);
+        q->estimate = q->a->estimate < q->b->estimate ? q->a->estimate : q->b->estimate;
+        break;
+    case ML_QUERY_OR:
+        ml_query_prepare (q->a);
+        ml_query_prepare (q->b);
+        q->estimate = q->a->estimate + q->b->estimate;
+        if (q->estimate > db.count) {
+            q->estimate = db.count;
+        }
+        break;
+    }
+}
+
+static int
+ml_query_match (ddb_medialib_query_t *q, ml_entry_t *en) {
+    switch (q->op) {
+    case ML_QUERY_ALL:
+        return 1;
+    case ML_QUERY_EQUAL:
+        if (!q->value) {
+            return !en->fields[q->field];
+        }
+        return q->s && en->fields[q->field] == q->s;
+    case ML_QUERY_PREFIX: {
+        ml_string_t *s = en->fields[q->field];
+        return s && s->rank >= q->first && s->rank < q->last;
+    }
+    case ML_QUERY_AND:
+        return ml_query_match (q->a, en) && ml_query_match (q->b, en);
+    case ML_QUERY_OR:
+        return ml_query_match (q->a, en) || ml_query_match (q->b, en);
+    }
+    return 0;
+}
+
+// append the entry to the results, unless it passed already
+static void
+ml_query_add_result (ml_entry_list_t *res, ml_filter_t *filter, ml_entry_t *en) {
+    if (en->mark == db.query_mark) {
+        return;
+    }
+    for (; filter; filter = filter->next) {
+        if (!ml_query_match (filter->query, en)) {
+            return;
+        }
+    }
+    en->mark = db.query_mark;
+    if (res->count == res->size) {
+        res->size = res->size ? res->size * 2 : 256;
+        res->items = realloc (res->items, res->size * sizeof (ml_entry_t *));
+    }
+    res->items[res->count++] = en;
+}
+
+// the candidates are taken from the posting lists, where possible,
+// and checked against the rest of the query
+static void
+ml_query_collect (ddb_medialib_query_t *q, ml_filter_t *filter, ml_entry_list_t *res) {
+    switch (q->op) {
+    case ML_QUERY_EQUAL:
+        if (!q->value) {
+            break;
+        }
+        if (q->s) {
+            for (int i = 0; i < q->s->count; i++) {
+                ml_query_add_result (res, filter, q->s->tracks[i]);
+            }
+        }
+        return;
+    case ML_QUERY_PREFIX:
+        for (int r = q->first; r < q->last; r++) {
+            ml_string_t *s = db.sorted[q->field][r];
+            for (int i = 0; i < s->count; i++) {
+                ml_query_add_result (res, filter, s->tracks[i]);
+            }
+        }
+        return;
+    case ML_QUERY_AND: {
+        int a_first = q->a->estimate <= q->b->estimate;
+        ml_filter_t f = {
+            .query = a_first ? q->b : q->a,
+            .next = filter,
+        };
+        ml_query_collect (a_first ? q->a : q->b, &f, res);
+        return;
+    }
+    case ML_QUERY_OR:
+        ml_query_collect (q->a, filter, res);
+        ml_query_collect (q->b, filter, res);
+        return;
+    }
+
+    // no index to use
+    ml_filter_t f = {
+        .query = q,
+        .next = filter,
+    };
+    for (ml_entry_t *en = db.tracks; en; en = en->next) {
+        ml_query_add_result (res, &f, en);
+    }
+}
+
+// evaluate the query, the caller must hold db_mutex
+static void
+ml_query_run (ddb_medialib_query_t *q, ml_entry_list_t *res) {
+    ml_query_prepare (q);
+    if (!++db.query_mark) {
+        for (ml_entry_t *en = db.tracks; en; en = en->next) {
+            en->mark = 0;
+        }
+        db.query_mark = 1;
+    }
+    ml_query_collect (q, NULL, res);
+}
+
+static int sort_field; // qsort comparators don't take context, protected by db_mutex
+static int sort_descending;
+
+static int
+ml_cmp_entries (const void *a, const void *b) {
+    const ml_entry_t *x = *(const ml_entry_t **)a;
+    const ml_entry_t *y = *(const ml_entry_t **)b;
+    int res = 0;
+    switch (sort_field) {
+    case DDB_MEDIALIB_FIELD_ARTIST:
+    case DDB_MEDIALIB_FIELD_ALBUM:
+    case DDB_MEDIALIB_FIELD_GENRE:
+    case DDB_MEDIALIB_FIELD_FOLDER: {
+        // the tracks without the value go first
+        int rx = x->fields[sort_field] ? x->fields[sort_field]->rank : -1;
+        int ry = y->fields[sort_field] ? y->fields[sort_field]->rank : -1;
+        res = rx < ry ? -1 : rx > ry;
+        break;
+    }
+    case DDB_MEDIALIB_FIELD_TITLE:
+        res = strcasecmp (x->title ? x->title : "", y->title ? y->title : "");
+        break;
+    case DDB_MEDIALIB_FIELD_FILE:
+        res = strcmp (x->file, y->file);
+        if (!res) {
+            res = x->subtrack < y->subtrack ? -1 : x->subtrack > y->subtrack;
+        }
+        break;
+    }
+    if (res) {
+        return sort_descending ? -res : res;
+    }
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static ddb_medialib_query_t *
+ml_query_alloc (int op, int field, const char *value) {
+    ddb_medialib_query_t *q = calloc (1, sizeof (ddb_medialib_query_t));
+    q->op = op;
+    q->field = field;
+    q->value = value ? strdup (value) : NULL;
+    return q;
+}
+
+static ddb_medialib_query_t *
+ml_query_all (void) {
+    return ml_query_alloc (ML_QUERY_ALL, -1, NULL);
+}
+
+static ddb_medialib_query_t *
+ml_query_equal (int field, const char *value) {
+    if (field < 0 || field >= ML_FIELD_COUNT) {
+        return NULL;
+    }
+    return ml_query_alloc (ML_QUERY_EQUAL, field, value);
+}
+
+static ddb_medialib_query_t *
+ml_query_prefix (int field, const char *prefix) {
+    if (field < 0 || field >= ML_FIELD_COUNT || !prefix) {
+        return NULL;
+    }
+    return ml_query_alloc (ML_QUERY_PREFIX, field, prefix);
+}
+
+static void
+ml_query_free (ddb_medialib_query_t *q) {
+    if (!q) {
+        return;
+    }
+    ml_query_free (q->a);
+    ml_query_free (q->b);
+    free (q->value);
+    free (q);
+}
+
+static ddb_medialib_query_t *
+ml_query_combine (int op, ddb_medialib_query_t *a, ddb_medialib_query_t *b) {
+    if (!a || !b) {
+        ml_query_free (a);
+        ml_query_free (b);
+        return NULL;
+    }
+    ddb_medialib_query_t *q = ml_query_alloc (op, -1, NULL);
+    q->a = a;
+    q->b = b;
+    return q;
+}
+
+static ddb_medialib_query_t *
+ml_query_and (ddb_medialib_query_t *a, ddb_medialib_query_t *b) {
+    return ml_query_combine (ML_QUERY_AND, a, b);
+}
+
+static ddb_medialib_query_t *
+ml_query_or (ddb_medialib_query_t *a, ddb_medialib_query_t *b) {
+    return ml_query_combine (ML_QUERY_OR, a, b);
+}
+
+static ddb_medialib_cursor_t *
+ml_find_tracks (ddb_medialib_query_t *query, int field, uint32_t flags) {
+    if (!query || !db_mutex || field < -1 || field > DDB_MEDIALIB_FIELD_FILE) {
+        return NULL;
+    }
+    ml_entry_list_t res = {0};
+
+    deadbeef->mutex_lock (db_mutex);
+    ml_query_run (query, &res);
+    if (res.count > 1) {
+        if (field >= 0 && field < ML_FIELD_COUNT) {
+            ml_sort_field_values (field);
+        }
+        sort_field = field;
+        sort_descending = (flags & DDB_MEDIALIB_SORT_DESCENDING) ? 1 : 0;
+        qsort (res.items, res.count, sizeof (ml_entry_t *), ml_cmp_entries);
+    }
+    db.open_cursors++;
+    deadbeef->mutex_unlock (db_mutex);
+
+    ddb_medialib_cursor_t *cursor = calloc (1, sizeof (ddb_medialib_cursor_t));
+    cursor->count = res.count;
+    cursor->tracks = res.items;
+    cursor->holds_entries = 1;
+    return cursor;
+}
+
+static ddb_medialib_cursor_t *
+ml_find_values (ddb_medialib_query_t *query, int field) {
+    if (!query || !db_mutex || field < 0 || field >= ML_FIELD_COUNT) {
+        return NULL;
+    }
+    ml_entry_list_t res = {0};
+    ddb_medialib_cursor_t *cursor = calloc (1, sizeof (ddb_medialib_cursor_t));
+
+    deadbeef->mutex_lock (db_mutex);
+    ml_query_run (query, &res);
+
+    // count the tracks per value rank, which gives the sorted order for free
+    ml_sort_field_values (field);
+    int nvalues = db.sorted_count[field];
+    int *counts = calloc (nvalues ? nvalues : 1, sizeof (int));
+    for (int i = 0; i < res.count; i++) {
+        ml_string_t *s = res.items[i]->fields[field];
+        if (s) {
+            if (!counts[s->rank]++) {
+                cursor->count++;
+            }
+        }
+    }
+    cursor->values = malloc ((cursor->count ? cursor->count : 1) * sizeof (const char *));
+    cursor->counts = malloc ((cursor->count ? cursor->count : 1) * sizeof (int));
+    int n = 0;
+    for (int r = 0; r < nvalues; r++) {
+        if (counts[r]) {
+            cursor->values[n] = db.sorted[field][r]->text;
+            cursor->counts[n] = counts[r];
+            deadbeef->metacache_ref (cursor->values[n]);
+            n++;
+        }
+    }
+    deadbeef->mutex_unlock (db_mutex);
+
+    free (counts);
+    free (res.items);
+    return cursor;
+}
+
+static int
+ml_cursor_count (ddb_medialib_cursor_t *cursor) {
+    return cursor->count;
+}
+
+static int
+ml_cursor_get_tracks (ddb_medialib_cursor_t *cursor, int offset, DB_playItem_t **tracks, int count) {
+    if (!cursor->tracks || offset < 0) {
+        return 0;
+    }
+    int n = 0;
+    deadbeef->mutex_lock (db_mutex);
+    for (int i = offset; i < cursor->count && i < offset + count; i++) {
+        ml_entry_t *en = cursor->tracks[i];
+        if (en->removed) {
+            continue;
+        }
+        deadbeef->pl_item_ref (en->track);
+        tracks[n++] = en->track;
+    }
+    deadbeef->mutex_unlock (db_mutex);
+    return n;
+}
+
+static int
+ml_cursor_get_values (ddb_medialib_cursor_t *cursor, int offset, const char **values, int *counts, int count) {
+    if (!cursor->values || offset < 0) {
+        return 0;
+    }
+    int n = 0;
+    for (int i = offset; i < cursor->count && i < offset + count; i++, n++) {
+        values[n] = cursor->values[i];
+        if (counts) {
+            counts[n] = cursor->counts[i];
+        }
+    }
+    return n;
+}
+
+static void
+ml_cursor_free (ddb_medialib_cursor_t *cursor) {
+    if (cursor->holds_entries) {
+        deadbeef->mutex_lock (db_mutex);
+        if (!--db.open_cursors) {
+            while (db.retired) {
+                ml_entry_t *next = db.retired->next;
+                free (db.retired);
+                db.retired = next;
+            }
+        }
+        deadbeef->mutex_unlock (db_mutex);
+    }
+    free (cursor->tracks);
+    if (cursor->values) {
+        for (int i = 0; i < cursor->count; i++) {
+            deadbeef->metacache_unref (cursor->values[i]);
+        }
+        free (cursor->values);
+        free (cursor->counts);
+    }
+    free (cursor);
+}
+
 static int
 ml_connect (void) {
 #if 0
@@ -381,7 +1533,9 @@ ml_connect (void) {
 
 static int
 ml_start (void) {
+    db_mutex = deadbeef->mutex_create ();
     filter_id = deadbeef->register_fileadd_filter (ml_fileadd_filter, NULL);
+    tid = deadbeef->thread_start_low_priority (scanner_thread, NULL);
     return 0;
 }
 
@@ -397,8 +1551,15 @@ ml_stop (void) {
         filter_id = 0;
     }
 
+    ml_journal_close (&journal);
+    ml_free_db ();
     if (ml_playlist) {
         deadbeef->plt_free (ml_playlist);
+        ml_playlist = NULL;
+    }
+    if (db_mutex) {
+        deadbeef->mutex_free (db_mutex);
+        db_mutex = 0;
     }
 
     return 0;
@@ -409,16 +1570,12 @@ ml_message (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
     return 0;
 }
 
-typedef struct ddb_medialib_plugin_s {
-    DB_misc_t plugin;
-} ddb_medialib_plugin_t;
-
 // define plugin interface
 static ddb_medialib_plugin_t plugin = {
     .plugin.plugin.api_vmajor = DB_API_VERSION_MAJOR,
     .plugin.plugin.api_vminor = DB_API_VERSION_MINOR,
-    .plugin.plugin.version_major = 0,
-    .plugin.plugin.version_minor = 1,
+    .plugin.plugin.version_major = DDB_MEDIALIB_MAJOR_VERSION,
+    .plugin.plugin.version_minor = DDB_MEDIALIB_MINOR_VERSION,
     .plugin.plugin.type = DB_PLUGIN_MISC,
     .plugin.plugin.id = "medialib",
     .plugin.plugin.name = "Media Library",
@@ -451,6 +1608,18 @@ static ddb_medialib_plugin_t plugin = {
     .plugin.plugin.stop = ml_stop,
 //    .plugin.plugin.configdialog = settings_dlg,
     .plugin.plugin.message = ml_message,
+    .query_all = ml_query_all,
+    .query_equal = ml_query_equal,
+    .query_prefix = ml_query_prefix,
+    .query_and = ml_query_and,
+    .query_or = ml_query_or,
+    .query_free = ml_query_free,
+    .find_tracks = ml_find_tracks,
+    .find_values = ml_find_values,
+    .cursor_count = ml_cursor_count,
+    .cursor_get_tracks = ml_cursor_get_tracks,
+    .cursor_get_values = ml_cursor_get_values,
+    .cursor_free = ml_cursor_free,
 };
 
 DB_plugin_t *
@@ -0,0 +1,114 @@
+/*
+    Media Library plugin for DeaDBeeF Player
+    Copyright (C) 2009-2018 Alexey Yakovenko
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+#ifndef __MEDIALIB_H
+#define __MEDIALIB_H
+
+#define DDB_MEDIALIB_MAJOR_VERSION 1
+#define DDB_MEDIALIB_MINOR_VERSION 0
+
+// The fields which can be used in queries and for sorting.
+// Title and file are not indexed, and can only be used for sorting.
+enum {
+    DDB_MEDIALIB_FIELD_ARTIST,
+    DDB_MEDIALIB_FIELD_ALBUM,
+    DDB_MEDIALIB_FIELD_GENRE,
+    DDB_MEDIALIB_FIELD_FOLDER,
+    DDB_MEDIALIB_FIELD_TITLE,
+    DDB_MEDIALIB_FIELD_FILE,
+};
+
+// Flags for find_tracks
+enum {
+    DDB_MEDIALIB_SORT_DESCENDING = 0x00000001,
+};
+
+// A query is a tree of conditions, built using the query_* functions.
+// Queries are not thread-safe, but can be reused for multiple searches.
+typedef struct ddb_medialib_query_s ddb_medialib_query_t;
+
+// A cursor is a snapshot of the search results, sorted when created.
+// Tracks removed from the library after the search are skipped by cursor_get_tracks.
+// All cursors must be freed before the plugin is stopped.
+typedef struct ddb_medialib_cursor_s ddb_medialib_cursor_t;
+
+typedef struct {
+    DB_misc_t plugin;
+
+    // Matches all tracks in the library
+    ddb_medialib_query_t *
+    (*query_all) (void);
+
+    // Matches the tracks with the field equal to the value, case sensitive.
+    // NULL value matches the tracks which don't have the field.
+    // Returns NULL if the field is not indexed.
+    ddb_medialib_query_t *
+    (*query_equal) (int field, const char *value);
+
+    // Matches the tracks with the field starting with the prefix, ASCII case insensitive.
+    // Returns NULL if the field is not indexed.
+    ddb_medialib_query_t *
+    (*query_prefix) (int field, const char *prefix);
+
+    // Combine two queries, taking the ownership of both.
+    // If either is NULL, the other one is freed, and NULL is returned.
+    ddb_medialib_query_t *
+    (*query_and) (ddb_medialib_query_t *a, ddb_medialib_query_t *b);
+
+    ddb_medialib_query_t *
+    (*query_or) (ddb_medialib_query_t *a, ddb_medialib_query_t *b);
+
+    void
+    (*query_free) (ddb_medialib_query_t *query);
+
+    // Find the matching tracks, sorted by the sort_field, in the library order if it's -1.
+    // Ties are kept in the library order.
+    ddb_medialib_cursor_t *
+    (*find_tracks) (ddb_medialib_query_t *query, int sort_field, uint32_t flags);
+
+    // Find the distinct values of the indexed field among the matching tracks, sorted ASCII case insensitive.
+    // Tracks which don't have the field are not counted.
+    ddb_medialib_cursor_t *
+    (*find_values) (ddb_medialib_query_t *query, int field);
+
+    // The number of tracks or values in the cursor
+    int
+    (*cursor_count) (ddb_medialib_cursor_t *cursor);
+
+    // Fetch up to `count` tracks starting at `offset`, into the `tracks` array.
+    // The tracks must be unreffed by the caller.
+    // Returns the number of tracks stored, which can be less than the number of requested tracks,
+    // if some of them were removed from the library.
+    int
+    (*cursor_get_tracks) (ddb_medialib_cursor_t *cursor, int offset, DB_playItem_t **tracks, int count);
+
+    // Fetch up to `count` values starting at `offset`, and the number of matching tracks for each value.
+    // The strings are valid until the cursor is freed, `counts` can be NULL.
+    // Returns the number of values stored.
+    int
+    (*cursor_get_values) (ddb_medialib_cursor_t *cursor, int offset, const char **values, int *counts, int count);
+
+    void
+    (*cursor_free) (ddb_medialib_cursor_t *cursor);
+} ddb_medialib_plugin_t;
+
+#endif /*__MEDIALIB_H*/
@@ -709,7 +709,7 @@ static DB_decoder_t plugin = {
     .plugin.version_major = 1,
     .plugin.version_minor = 0,
     .plugin.type = DB_PLUGIN_DECODER,
-    .plugin.flags = DDB_PLUGIN_FLAG_REPLAYGAIN,
+    .plugin.flags = DDB_PLUGIN_FLAG_REPLAYGAIN | DDB_PLUGIN_FLAG_INSERT_THREADSAFE,
     .plugin.id = "stdmpg",
     .plugin.name = "MP3 player",
     .plugin.descr = "MPEG v1/2 layer1/2/3 decoder\n\n"
@@ -746,7 +746,7 @@ static DB_decoder_t plugin = {
     .plugin.version_major = 1,
     .plugin.version_minor = 0,
     .plugin.type = DB_PLUGIN_DECODER,
-    .plugin.flags = DDB_PLUGIN_FLAG_LOGGING,
+    .plugin.flags = DDB_PLUGIN_FLAG_LOGGING | DDB_PLUGIN_FLAG_INSERT_THREADSAFE,
     .plugin.name = "Opus player",
     .plugin.id = "opus",
     .plugin.descr = "Opus player based on libogg, libopus and libopusfile.",
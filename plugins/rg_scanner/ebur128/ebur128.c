@@ -7,6 +7,7 @@
 #include <math.h> /* You may have to define _USE_MATH_DEFINES if you use MSVC */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 /* This can be replaced by any BSD-like queue implementation. */
 #include <sys/queue.h>
@@ -420,6 +421,85 @@ static void ebur128_check_true_peak(ebur128_state* st, size_t frames) {
     st->d->v[ci][1] = fabs(st->d->v[ci][1]) < DBL_MIN ? 0.0 : st->d->v[ci][1];
 #endif
 
+#if defined(__SSE2__) && defined(__SSE2_MATH__)
+#include <emmintrin.h>
+/* Stereo float input, which is the common case, with both channels filtered
+ * at once: the lanes of each register hold the left and the right channel.
+ * The operations are done in the same order as in the scalar filter, so the
+ * results are identical. Returns 0 if the input is not supported. */
+static int ebur128_filter_float_stereo(ebur128_state* st, const float* src,
+                                       size_t frames) {
+  double* audio_data = st->d->audio_data + st->d->audio_data_index;
+  int c0, c1;
+  size_t i, k;
+  __m128d v[5], a[5], b[5];
+
+  if (st->channels != 2 || ebur128_use_speex_resampler(st)) return 0;
+  c0 = st->d->channel_map[0] - 1;
+  c1 = st->d->channel_map[1] - 1;
+  if (c0 < 0 || c1 < 0 || c0 > 4 || c1 > 4 || c0 == c1) return 0;
+
+  {
+    TURN_ON_FTZ
+
+    if ((st->mode & EBUR128_MODE_SAMPLE_PEAK) == EBUR128_MODE_SAMPLE_PEAK) {
+      const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+      __m128 max = _mm_setzero_ps();
+      float m[4];
+      for (i = 0; i + 2 <= frames; i += 2) {
+        max = _mm_max_ps(max, _mm_and_ps(_mm_loadu_ps(src + i * 2), abs_mask));
+      }
+      _mm_storeu_ps(m, max);
+      m[0] = m[0] > m[2] ? m[0] : m[2];
+      m[1] = m[1] > m[3] ? m[1] : m[3];
+      for (; i < frames; ++i) {
+        if (fabsf(src[i * 2]) > m[0]) m[0] = fabsf(src[i * 2]);
+        if (fabsf(src[i * 2 + 1]) > m[1]) m[1] = fabsf(src[i * 2 + 1]);
+      }
+      if (m[0] > st->d->sample_peak[0]) st->d->sample_peak[0] = m[0];
+      if (m[1] > st->d->sample_peak[1]) st->d->sample_peak[1] = m[1];
+    }
+
+    for (k = 0; k < 5; ++k) {
+      v[k] = _mm_set_pd(st->d->v[c1][k], st->d->v[c0][k]);
+      a[k] = _mm_set1_pd(st->d->a[k]);
+      b[k] = _mm_set1_pd(st->d->b[k]);
+    }
+    for (i = 0; i < frames; ++i) {
+      __m128d x = _mm_cvtps_pd(_mm_castpd_ps(_mm_load_sd((const double*) (src + i * 2))));
+      v[0] = _mm_sub_pd(x, _mm_mul_pd(a[1], v[1]));
+      v[0] = _mm_sub_pd(v[0], _mm_mul_pd(a[2], v[2]));
+      v[0] = _mm_sub_pd(v[0], _mm_mul_pd(a[3], v[3]));
+      v[0] = _mm_sub_pd(v[0], _mm_mul_pd(a[4], v[4]));
+      __m128d y = _mm_mul_pd(b[0], v[0]);
+      y = _mm_add_pd(y, _mm_mul_pd(b[1], v[1]));
+      y = _mm_add_pd(y, _mm_mul_pd(b[2], v[2]));
+      y = _mm_add_pd(y, _mm_mul_pd(b[3], v[3]));
+      y = _mm_add_pd(y, _mm_mul_pd(b[4], v[4]));
+      _mm_storeu_pd(audio_data + i * 2, y);
+      v[4] = v[3];
+      v[3] = v[2];
+      v[2] = v[1];
+      v[1] = v[0];
+    }
+    for (k = 0; k < 5; ++k) {
+      _mm_storel_pd(&st->d->v[c0][k], v[k]);
+      _mm_storeh_pd(&st->d->v[c1][k], v[k]);
+    }
+
+    TURN_OFF_FTZ
+  }
+  return 1;
+}
+#define EBUR128_FAST_FILTER_float(st, src, frames) \
+  ebur128_filter_float_stereo(st, src, frames)
+#else
+#define EBUR128_FAST_FILTER_float(st, src, frames) 0
+#endif
+#define EBUR128_FAST_FILTER_short(st, src, frames) 0
+#define EBUR128_FAST_FILTER_int(st, src, frames) 0
+#define EBUR128_FAST_FILTER_double(st, src, frames) 0
+
 #define EBUR128_FILTER(type, min_scale, max_scale)                             \
 static void ebur128_filter_##type(ebur128_state* st, const type* src,          \
                                   size_t frames) {                             \
@@ -428,6 +508,8 @@ static void ebur128_filter_##type(ebur128_state* st, const type* src,          \
   double* audio_data = st->d->audio_data + st->d->audio_data_index;            \
   size_t i, c;                                                                 \
                                                                                \
+  if (EBUR128_FAST_FILTER_##type(st, src, frames)) return;                     \
+                                                                               \
   TURN_ON_FTZ                                                                  \
                                                                                \
   if ((st->mode & EBUR128_MODE_SAMPLE_PEAK) == EBUR128_MODE_SAMPLE_PEAK) {     \
@@ -980,6 +1062,24 @@ int ebur128_sample_peak(ebur128_state* st,
   return EBUR128_SUCCESS;
 }
 
+int ebur128_get_histogram(ebur128_state* st, unsigned long* out) {
+  if (!st->d->use_histogram) {
+    return EBUR128_ERROR_INVALID_MODE;
+  }
+  memcpy(out, st->d->block_energy_histogram,
+         EBUR128_HISTOGRAM_BINS * sizeof(unsigned long));
+  return EBUR128_SUCCESS;
+}
+
+int ebur128_set_histogram(ebur128_state* st, const unsigned long* histogram) {
+  if (!st->d->use_histogram) {
+    return EBUR128_ERROR_INVALID_MODE;
+  }
+  memcpy(st->d->block_energy_histogram, histogram,
+         EBUR128_HISTOGRAM_BINS * sizeof(unsigned long));
+  return EBUR128_SUCCESS;
+}
+
 #ifdef USE_SPEEX_RESAMPLER
 int ebur128_true_peak(ebur128_state* st,
                       unsigned int channel_number,
@@ -258,6 +258,35 @@ int ebur128_sample_peak(ebur128_state* st,
                         unsigned int channel_number,
                         double* out);
 
+/** Number of bins in the gating block energy histogram. */
+#define EBUR128_HISTOGRAM_BINS 1000
+
+/** \brief Get the gating block energy histogram.
+ *
+ *  Together with the sample peak, the histogram is enough to calculate the
+ *  global loudness of a state later, alone or with other states.
+ *
+ *  @param st library state
+ *  @param out array of EBUR128_HISTOGRAM_BINS block counts
+ *  @return
+ *    - EBUR128_SUCCESS on success.
+ *    - EBUR128_ERROR_INVALID_MODE if mode "EBUR128_MODE_HISTOGRAM" has not
+ *      been set.
+ */
+int ebur128_get_histogram(ebur128_state* st, unsigned long* out);
+
+/** \brief Replace the gating block energy histogram.
+ *
+ *  @param st library state
+ *  @param histogram array of EBUR128_HISTOGRAM_BINS block counts, as returned
+ *                   by ebur128_get_histogram()
+ *  @return
+ *    - EBUR128_SUCCESS on success.
+ *    - EBUR128_ERROR_INVALID_MODE if mode "EBUR128_MODE_HISTOGRAM" has not
+ *      been set.
+ */
+int ebur128_set_histogram(ebur128_state* st, const unsigned long* histogram);
+
 /** \brief Get maximum true peak of selected channel in float format.
  *
  *  Uses an implementation defined algorithm to calculate the true peak. Do not
@@ -0,0 +1,710 @@
+/*
+ * ReplayGain Scanner plugin for DeaDBeeF Player
+ *
+ * Copyright (c) 2016 Alexey Yakovenko
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "rg_cache.h"
+#include "ebur128/ebur128.h"
+
+extern DB_functions_t *deadbeef;
+
+// file layout: "DRGC", uint32 version, then the records:
+// uint32 payload size, uint32 payload checksum, payload;
+// all numbers in native byte order.
+//
+// payload: uint32 path size, path (including the terminating zero),
+// int64 startsample, int64 endsample, int64 file size, int64 mtime, 16 bytes md5, float peak,
+// uint32 number of non-empty histogram bins, then for each: uint16 bin, uint32 count
+//
+// A later record for the same path and sample range replaces the earlier one,
+// so the new results are appended, and the file is rewritten only when it has too many stale records.
+
+#define CACHE_MAGIC "DRGC"
+#define CACHE_VERSION 1
+#define CACHE_HEADER_SIZE 8
+#define CACHE_MAX_RECORD (1 << 20)
+#define CACHE_MIN_STALE 64
+#define HASH_BUFFER_SIZE 65536
+
+typedef struct {
+    uint16_t bin;
+    uint32_t count;
+} rg_cache_bin_t;
+
+typedef struct {
+    char *path;
+    int64_t startsample;
+    int64_t endsample;
+    int64_t size;
+    int64_t mtime;
+    uint8_t hash[16];
+    float peak;
+    uint32_t num_bins;
+    rg_cache_bin_t *bins;
+    int next_path; // index of the next entry in the same bucket of path_table
+    int next_hash;
+    unsigned removed : 1;
+    unsigned saved : 1; // already written to the file
+} rg_cache_entry_t;
+
+struct rg_cache_s {
+    char *fname;
+    uintptr_t mutex;
+    rg_cache_entry_t *entries;
+    int count;
+    int alloc;
+    int live;
+    int stale; // removed entries, which are still in the file
+    int rewrite; // the file is damaged or has a different version
+    int *path_table;
+    int *hash_table;
+    int table_size; // power of 2
+};
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t alloc;
+} buffer_t;
+
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+    int error;
+} reader_t;
+
+static uint32_t
+_fnv (uint32_t h, const void *data, size_t size) {
+    const uint8_t *p = data;
+    for (size_t i = 0; i < size; i++) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static uint32_t
+_checksum (const uint8_t *data, size_t size) {
+    return _fnv (2166136261u, data, size);
+}
+
+static uint32_t
+_path_hash (const char *path, int64_t startsample, int64_t endsample) {
+    uint32_t h = _fnv (2166136261u, path, strlen (path));
+    h = _fnv (h, &startsample, sizeof (startsample));
+    return _fnv (h, &endsample, sizeof (endsample));
+}
+
+static uint32_t
+_content_hash (const uint8_t *hash, int64_t startsample, int64_t endsample) {
+    uint32_t h = _fnv (2166136261u, hash, 16);
+    h = _fnv (h, &startsample, sizeof (startsample));
+    return _fnv (h, &endsample, sizeof (endsample));
+}
+
+static void
+_put (buffer_t *b, const void *data, size_t size) {
+    if (b->size + size > b->alloc) {
+        b->alloc = b->alloc ? b->alloc * 2 : 4096;
+        while (b->alloc < b->size + size) {
+            b->alloc *= 2;
+        }
+        b->data = realloc (b->data, b->alloc);
+    }
+    memcpy (b->data + b->size, data, size);
+    b->size += size;
+}
+
+static void
+_put_u16 (buffer_t *b, uint16_t v) {
+    _put (b, &v, sizeof (v));
+}
+
+static void
+_put_u32 (buffer_t *b, uint32_t v) {
+    _put (b, &v, sizeof (v));
+}
+
+static void
+_put_i64 (buffer_t *b, int64_t v) {
+    _put (b, &v, sizeof (v));
+}
+
+static void
+_put_float (buffer_t *b, float v) {
+    _put (b, &v, sizeof (v));
+}
+
+static const uint8_t *
+_get (reader_t *r, size_t size) {
+    if (r->error || r->size - r->pos < size) {
+        r->error = 1;
+        return NULL;
+    }
+    const uint8_t *p = r->data + r->pos;
+    r->pos += size;
+    return p;
+}
+
+#define GET_FN(name, type)\
+static type \
+name (reader_t *r) {\
+    type v = 0;\
+    const uint8_t *p = _get (r, sizeof (type));\
+    if (p) {\
+        memcpy (&v, p, sizeof (type));\
+    }\
+    return v;\
+}
+
+GET_FN(_get_u16, uint16_t)
+GET_FN(_get_u32, uint32_t)
+GET_FN(_get_i64, int64_t)
+GET_FN(_get_float, float)
+
+// index
+
+static rg_cache_entry_t *
+_find_path (rg_cache_t *cache, const char *path, int64_t startsample, int64_t endsample) {
+    if (!cache->table_size) {
+        return NULL;
+    }
+    uint32_t h = _path_hash (path, startsample, endsample) & (cache->table_size - 1);
+    for (int i = cache->path_table[h]; i >= 0; i = cache->entries[i].next_path) {
+        rg_cache_entry_t *e = &cache->entries[i];
+        if (e->startsample == startsample && e->endsample == endsample && !strcmp (e->path, path)) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static rg_cache_entry_t *
+_find_hash (rg_cache_t *cache, const uint8_t *hash, int64_t startsample, int64_t endsample) {
+    if (!cache->table_size) {
+        return NULL;
+    }
+    uint32_t h = _content_hash (hash, startsample, endsample) & (cache->table_size - 1);
+    for (int i = cache->hash_table[h]; i >= 0; i = cache->entries[i].next_hash) {
+        rg_cache_entry_t *e = &cache->entries[i];
+        if (e->startsample == startsample && e->endsample == endsample && !memcmp (e->hash, hash, 16)) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static void
+_link_entry (rg_cache_t *cache, int idx) {
+    rg_cache_entry_t *e = &cache->entries[idx];
+    uint32_t h = _path_hash (e->path, e->startsample, e->endsample) & (cache->table_size - 1);
+    e->next_path = cache->path_table[h];
+    cache->path_table[h] = idx;
+    h = _content_hash (e->hash, e->startsample, e->endsample) & (cache->table_size - 1);
+    e->next_hash = cache->hash_table[h];
+    cache->hash_table[h] = idx;
+}
+
+static void
+_unlink_entry (rg_cache_t *cache, int idx) {
+    rg_cache_entry_t *e = &cache->entries[idx];
+    uint32_t h = _path_hash (e->path, e->startsample, e->endsample) & (cache->table_size - 1);
+    for (int *p = &cache->path_table[h]; *p >= 0; p = &cache->entries[*p].next_path) {
+        if (*p == idx) {
+            *p = e->next_path;
+            break;
+        }
+    }
+    h = _content_hash (e->hash, e->startsample, e->endsample) & (cache->table_size - 1);
+    for (int *p = &cache->hash_table[h]; *p >= 0; p = &cache->entries[*p].next_hash) {
+        if (*p == idx) {
+            *p = e->next_hash;
+            break;
+        }
+    }
+}
+
+static void
+_rehash (rg_cache_t *cache, int size) {
+    free (cache->path_table);
+    free (cache->hash_table);
+    cache->table_size = size;
+    cache->path_table = malloc (size * sizeof (int));
+    cache->hash_table = malloc (size * sizeof (int));
+    for (int i = 0; i < size; i++) {
+        cache->path_table[i] = -1;
+        cache->hash_table[i] = -1;
+    }
+    for (int i = 0; i < cache->count; i++) {
+        if (!cache->entries[i].removed) {
+            _link_entry (cache, i);
+        }
+    }
+}
+
+static void
+_remove_entry (rg_cache_t *cache, rg_cache_entry_t *e) {
+    _unlink_entry (cache, (int)(e - cache->entries));
+    e->removed = 1;
+    free (e->path);
+    free (e->bins);
+    e->path = NULL;
+    e->bins = NULL;
+    cache->live--;
+    if (e->saved) {
+        cache->stale++;
+    }
+}
+
+// takes the ownership of path and bins
+static rg_cache_entry_t *
+_add_entry (rg_cache_t *cache, char *path, int64_t startsample, int64_t endsample, int64_t size, int64_t mtime, const uint8_t *hash, float peak, rg_cache_bin_t *bins, uint32_t num_bins) {
+    rg_cache_entry_t *prev = _find_path (cache, path, startsample, endsample);
+    if (prev) {
+        _remove_entry (cache, prev);
+    }
+
+    if (cache->count == cache->alloc) {
+        cache->alloc = cache->alloc ? cache->alloc * 2 : 256;
+        cache->entries = realloc (cache->entries, cache->alloc * sizeof (rg_cache_entry_t));
+    }
+    int idx = cache->count++;
+    rg_cache_entry_t *e = &cache->entries[idx];
+    memset (e, 0, sizeof (rg_cache_entry_t));
+    e->path = path;
+    e->startsample = startsample;
+    e->endsample = endsample;
+    e->size = size;
+    e->mtime = mtime;
+    memcpy (e->hash, hash, 16);
+    e->peak = peak;
+    e->bins = bins;
+    e->num_bins = num_bins;
+    cache->live++;
+
+    if (cache->table_size < cache->count) {
+        _rehash (cache, cache->table_size ? cache->table_size * 2 : 256);
+    }
+    else {
+        _link_entry (cache, idx);
+    }
+    return e;
+}
+
+static void
+_entry_get (rg_cache_entry_t *e, unsigned long *histogram, float *peak) {
+    memset (histogram, 0, EBUR128_HISTOGRAM_BINS * sizeof (unsigned long));
+    for (uint32_t i = 0; i < e->num_bins; i++) {
+        histogram[e->bins[i].bin] = e->bins[i].count;
+    }
+    *peak = e->peak;
+}
+
+// file
+
+static int
+_read_record (rg_cache_t *cache, reader_t *r) {
+    uint32_t pathsize = _get_u32 (r);
+    const char *path = (const char *)_get (r, pathsize);
+    int64_t startsample = _get_i64 (r);
+    int64_t endsample = _get_i64 (r);
+    int64_t size = _get_i64 (r);
+    int64_t mtime = _get_i64 (r);
+    const uint8_t *hash = _get (r, 16);
+    float peak = _get_float (r);
+    uint32_t num_bins = _get_u32 (r);
+    if (r->error || !pathsize || path[pathsize-1] || num_bins > EBUR128_HISTOGRAM_BINS) {
+        return -1;
+    }
+
+    rg_cache_bin_t *bins = num_bins ? malloc (num_bins * sizeof (rg_cache_bin_t)) : NULL;
+    for (uint32_t i = 0; i < num_bins; i++) {
+        bins[i].bin = _get_u16 (r);
+        bins[i].count = _get_u32 (r);
+        if (bins[i].bin >= EBUR128_HISTOGRAM_BINS) {
+            r->error = 1;
+        }
+    }
+    if (r->error) {
+        free (bins);
+        return -1;
+    }
+
+    rg_cache_entry_t *e = _add_entry (cache, strdup (path), startsample, endsample, size, mtime, hash, peak, bins, num_bins);
+    e->saved = 1;
+    return 0;
+}
+
+static void
+_write_record (buffer_t *b, rg_cache_entry_t *e) {
+    size_t start = b->size;
+    _put_u32 (b, 0);
+    _put_u32 (b, 0);
+
+    size_t pathsize = strlen (e->path) + 1;
+    _put_u32 (b, (uint32_t)pathsize);
+    _put (b, e->path, pathsize);
+    _put_i64 (b, e->startsample);
+    _put_i64 (b, e->endsample);
+    _put_i64 (b, e->size);
+    _put_i64 (b, e->mtime);
+    _put (b, e->hash, 16);
+    _put_float (b, e->peak);
+    _put_u32 (b, e->num_bins);
+    for (uint32_t i = 0; i < e->num_bins; i++) {
+        _put_u16 (b, e->bins[i].bin);
+        _put_u32 (b, e->bins[i].count);
+    }
+
+    uint32_t size = (uint32_t)(b->size - start - 8);
+    uint32_t checksum = _checksum (b->data + start + 8, size);
+    memcpy (b->data + start, &size, 4);
+    memcpy (b->data + start + 4, &checksum, 4);
+}
+
+rg_cache_t *
+rg_cache_load (const char *fname) {
+    rg_cache_t *cache = calloc (1, sizeof (rg_cache_t));
+    cache->fname = strdup (fname);
+    cache->mutex = deadbeef->mutex_create ();
+
+    FILE *fp = fopen (fname, "rb");
+    if (!fp) {
+        cache->rewrite = 1;
+        return cache;
+    }
+
+    uint8_t *data = NULL;
+    long size = 0;
+    if (!fseek (fp, 0, SEEK_END) && (size = ftell (fp)) >= CACHE_HEADER_SIZE && !fseek (fp, 0, SEEK_SET)) {
+        data = malloc (size);
+        if (fread (data, 1, size, fp) != (size_t)size) {
+            size = 0;
+        }
+    }
+    fclose (fp);
+
+    uint32_t version = 0;
+    if (data && size >= CACHE_HEADER_SIZE) {
+        memcpy (&version, data + 4, 4);
+    }
+    if (!data || size < CACHE_HEADER_SIZE || memcmp (data, CACHE_MAGIC, 4) || version != CACHE_VERSION) {
+        free (data);
+        cache->rewrite = 1;
+        return cache;
+    }
+
+    size_t pos = CACHE_HEADER_SIZE;
+    while (pos < (size_t)size) {
+        uint32_t recsize, checksum;
+        if (size - pos < 8) {
+            break;
+        }
+        memcpy (&recsize, data + pos, 4);
+        memcpy (&checksum, data + pos + 4, 4);
+        if (recsize > CACHE_MAX_RECORD || size - pos - 8 < recsize || _checksum (data + pos + 8, recsize) != checksum) {
+            break;
+        }
+        reader_t r = { .data = data + pos + 8, .size = recsize };
+        if (_read_record (cache, &r)) {
+            break;
+        }
+        pos += 8 + recsize;
+    }
+    if (pos != (size_t)size) {
+        // drop the damaged tail
+        cache->rewrite = 1;
+    }
+    free (data);
+    return cache;
+}
+
+static int
+_write_file (FILE *fp, buffer_t *b) {
+    int res = fwrite (b->data, 1, b->size, fp) == b->size ? 0 : -1;
+    if (fflush (fp)) {
+        res = -1;
+    }
+    return res;
+}
+
+int
+rg_cache_save (rg_cache_t *cache) {
+    deadbeef->mutex_lock (cache->mutex);
+
+    int res = 0;
+    buffer_t b;
+    memset (&b, 0, sizeof (b));
+
+    if (cache->rewrite || (cache->stale >= CACHE_MIN_STALE && cache->stale > cache->live)) {
+        uint32_t version = CACHE_VERSION;
+        _put (&b, CACHE_MAGIC, 4);
+        _put_u32 (&b, version);
+        for (int i = 0; i < cache->count; i++) {
+            if (!cache->entries[i].removed) {
+                _write_record (&b, &cache->entries[i]);
+            }
+        }
+
+        char tmp[strlen (cache->fname) + 10];
+        snprintf (tmp, sizeof (tmp), "%s.part", cache->fname);
+        FILE *fp = fopen (tmp, "wb");
+        if (!fp) {
+            res = -1;
+            goto out;
+        }
+        res = _write_file (fp, &b);
+        if (!res) {
+            res = fsync (fileno (fp));
+        }
+        fclose (fp);
+        if (res || rename (tmp, cache->fname)) {
+            unlink (tmp);
+            res = -1;
+            goto out;
+        }
+        cache->rewrite = 0;
+        cache->stale = 0;
+    }
+    else {
+        for (int i = 0; i < cache->count; i++) {
+            if (!cache->entries[i].removed && !cache->entries[i].saved) {
+                _write_record (&b, &cache->entries[i]);
+            }
+        }
+        if (!b.size) {
+            goto out;
+        }
+        FILE *fp = fopen (cache->fname, "ab");
+        if (!fp) {
+            res = -1;
+            goto out;
+        }
+        res = _write_file (fp, &b);
+        fclose (fp);
+        if (res) {
+            // a partially written record will be dropped on the next load
+            cache->rewrite = 1;
+            goto out;
+        }
+    }
+
+    for (int i = 0; i < cache->count; i++) {
+        cache->entries[i].saved = 1;
+    }
+
+out:
+    free (b.data);
+    deadbeef->mutex_unlock (cache->mutex);
+    return res;
+}
+
+void
+rg_cache_free (rg_cache_t *cache) {
+    for (int i = 0; i < cache->count; i++) {
+        free (cache->entries[i].path);
+        free (cache->entries[i].bins);
+    }
+    free (cache->entries);
+    free (cache->path_table);
+    free (cache->hash_table);
+    free (cache->fname);
+    deadbeef->mutex_free (cache->mutex);
+    free (cache);
+}
+
+// keys
+
+// md5 of the file without the leading and trailing tags,
+// which are id3v2, apev2, id3v1, and the flac metadata blocks
+static int
+_payload_hash (const char *path, uint8_t *hash) {
+    DB_FILE *fp = deadbeef->fopen (path);
+    if (!fp) {
+        return -1;
+    }
+
+    int64_t size = deadbeef->fgetlength (fp);
+    uint32_t head = 0, tail = 0;
+    deadbeef->junk_get_tag_offsets (fp, &head, &tail);
+    int64_t start = head;
+    int64_t end = size - tail;
+
+    uint8_t buf[4];
+    if (deadbeef->fseek (fp, start, SEEK_SET) == 0 && deadbeef->fread (buf, 1, 4, fp) == 4 && !memcmp (buf, "fLaC", 4)) {
+        start += 4;
+        for (;;) {
+            if (deadbeef->fread (buf, 1, 4, fp) != 4) {
+                break;
+            }
+            start += 4 + ((buf[1] << 16) | (buf[2] << 8) | buf[3]);
+            if ((buf[0] & 0x80) || deadbeef->fseek (fp, start, SEEK_SET)) {
+                break;
+            }
+        }
+    }
+    if (start > end) {
+        start = end;
+    }
+
+    if (deadbeef->fseek (fp, start, SEEK_SET)) {
+        deadbeef->fclose (fp);
+        return -1;
+    }
+
+    DB_md5_t md5;
+    deadbeef->md5_init (&md5);
+    char *buffer = malloc (HASH_BUFFER_SIZE);
+    int64_t remaining = end - start;
+    int res = 0;
+    while (remaining > 0) {
+        size_t sz = remaining < HASH_BUFFER_SIZE ? (size_t)remaining : HASH_BUFFER_SIZE;
+        size_t rb = deadbeef->fread (buffer, 1, sz, fp);
+        if (rb != sz) {
+            res = -1;
+            break;
+        }
+        deadbeef->md5_append (&md5, (const uint8_t *)buffer, (int)rb);
+        remaining -= rb;
+    }
+    free (buffer);
+    deadbeef->fclose (fp);
+    deadbeef->md5_finish (&md5, hash);
+    return res;
+}
+
+int
+rg_cache_key_init (rg_cache_key_t *key, DB_playItem_t *track) {
+    memset (key, 0, sizeof (rg_cache_key_t));
+
+    deadbeef->pl_lock ();
+    const char *uri = deadbeef->pl_find_meta_raw (track, ":URI");
+    if (!uri || !deadbeef->is_local_file (uri)) {
+        deadbeef->pl_unlock ();
+        return -1;
+    }
+    if (!strncasecmp (uri, "file://", 7)) {
+        uri += 7;
+    }
+    key->path = strdup (uri);
+    deadbeef->pl_unlock ();
+
+    key->startsample = deadbeef->pl_item_get_startsample (track);
+    key->endsample = deadbeef->pl_item_get_endsample (track);
+
+    struct stat st;
+    if (stat (key->path, &st) || !S_ISREG (st.st_mode)) {
+        rg_cache_key_free (key);
+        return -1;
+    }
+    key->size = st.st_size;
+    key->mtime = st.st_mtime;
+    return 0;
+}
+
+void
+rg_cache_key_free (rg_cache_key_t *key) {
+    free (key->path);
+    key->path = NULL;
+}
+
+static void
+_store (rg_cache_t *cache, rg_cache_key_t *key, const unsigned long *histogram, float peak) {
+    rg_cache_entry_t *e = _find_path (cache, key->path, key->startsample, key->endsample);
+    if (e && e->size == key->size && e->mtime == key->mtime && !memcmp (e->hash, key->hash, 16)) {
+        return;
+    }
+
+    uint32_t num_bins = 0;
+    for (int i = 0; i < EBUR128_HISTOGRAM_BINS; i++) {
+        if (histogram[i]) {
+            num_bins++;
+        }
+    }
+    rg_cache_bin_t *bins = num_bins ? malloc (num_bins * sizeof (rg_cache_bin_t)) : NULL;
+    num_bins = 0;
+    for (int i = 0; i < EBUR128_HISTOGRAM_BINS; i++) {
+        if (histogram[i]) {
+            bins[num_bins].bin = i;
+            bins[num_bins].count = (uint32_t)histogram[i];
+            num_bins++;
+        }
+    }
+
+    _add_entry (cache, strdup (key->path), key->startsample, key->endsample, key->size, key->mtime, key->hash, peak, bins, num_bins);
+}
+
+int
+rg_cache_lookup (rg_cache_t *cache, rg_cache_key_t *key, unsigned long *histogram, float *peak) {
+    deadbeef->mutex_lock (cache->mutex);
+    rg_cache_entry_t *e = _find_path (cache, key->path, key->startsample, key->endsample);
+    if (e && e->size == key->size && e->mtime == key->mtime) {
+        memcpy (key->hash, e->hash, 16);
+        key->has_hash = 1;
+        _entry_get (e, histogram, peak);
+        deadbeef->mutex_unlock (cache->mutex);
+        return 0;
+    }
+    deadbeef->mutex_unlock (cache->mutex);
+
+    // the file was changed, moved, or never scanned; reading it is still much faster than decoding
+    if (!key->has_hash) {
+        if (_payload_hash (key->path, key->hash)) {
+            return -1;
+        }
+        key->has_hash = 1;
+    }
+
+    deadbeef->mutex_lock (cache->mutex);
+    e = _find_hash (cache, key->hash, key->startsample, key->endsample);
+    if (e) {
+        _entry_get (e, histogram, peak);
+        // remember the new path, size and mtime
+        _store (cache, key, histogram, *peak);
+    }
+    deadbeef->mutex_unlock (cache->mutex);
+    return e ? 0 : -1;
+}
+
+void
+rg_cache_store (rg_cache_t *cache, rg_cache_key_t *key, const unsigned long *histogram, float peak) {
+    if (!key->has_hash) {
+        if (_payload_hash (key->path, key->hash)) {
+            return;
+        }
+        key->has_hash = 1;
+    }
+    deadbeef->mutex_lock (cache->mutex);
+    _store (cache, key, histogram, peak);
+    deadbeef->mutex_unlock (cache->mutex);
+}
@@ -0,0 +1,78 @@
+/*
+ * ReplayGain Scanner plugin for DeaDBeeF Player
+ *
+ * Copyright (c) 2016 Alexey Yakovenko
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef __RG_CACHE_H
+#define __RG_CACHE_H
+
+#include <stdint.h>
+#include "../../deadbeef.h"
+
+// Scan results of the local files, stored between the scans.
+// A track is found by its path and sample range when the file size and mtime didn't change,
+// otherwise by the md5 of the file contents without the tags at the start and the end of the file,
+// so editing the tags or moving the file doesn't require a rescan.
+// The cached result is the gating block histogram and the peak, enough to recalculate both
+// the track gain and the album gain, with any reference loudness.
+
+typedef struct rg_cache_s rg_cache_t;
+
+typedef struct {
+    char *path;
+    int64_t startsample;
+    int64_t endsample;
+    int64_t size;
+    int64_t mtime;
+    uint8_t hash[16];
+    int has_hash;
+} rg_cache_key_t;
+
+// Never returns NULL, a missing or damaged file gives an empty cache.
+// The functions below are thread-safe.
+rg_cache_t *
+rg_cache_load (const char *fname);
+
+// Write the changes back to the file.
+int
+rg_cache_save (rg_cache_t *cache);
+
+void
+rg_cache_free (rg_cache_t *cache);
+
+// Returns -1 if the track can't be cached, e.g. it's not a local file.
+int
+rg_cache_key_init (rg_cache_key_t *key, DB_playItem_t *track);
+
+void
+rg_cache_key_free (rg_cache_key_t *key);
+
+// Fills EBUR128_HISTOGRAM_BINS histogram values and the peak.
+// Returns 0 if found.
+int
+rg_cache_lookup (rg_cache_t *cache, rg_cache_key_t *key, unsigned long *histogram, float *peak);
+
+void
+rg_cache_store (rg_cache_t *cache, rg_cache_key_t *key, const unsigned long *histogram, float peak);
+
+#endif //__RG_CACHE_H
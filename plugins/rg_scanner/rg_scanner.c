@@ -29,9 +29,13 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <sys/time.h>
+#include <sys/stat.h>
 
 #include "../../deadbeef.h"
 #include "ebur128/ebur128.h"
+#include "rg_cache.h"
 #include "../../strdupa.h"
 
 #define trace(...) { deadbeef->log_detailed (&plugin.misc.plugin, 0, __VA_ARGS__); }
@@ -41,169 +45,220 @@ static const char *album_signature = "$if2(%album artist% - %album%,%filename%)"
 static ddb_rg_scanner_t plugin;
 static DB_functions_t *deadbeef;
 
+// decode buffers, reused by a worker for all its tracks
+typedef struct {
+    char *buffer;
+    size_t buffer_size;
+    float *bufferf;
+    size_t bufferf_size;
+    unsigned long histogram[EBUR128_HISTOGRAM_BINS];
+} rg_buffers_t;
+
+// tracks are taken from the queue by a fixed number of workers, longest first,
+// so that a long track started last doesn't keep the whole scan waiting
 typedef struct {
-    int track_index;
     ddb_rg_scanner_settings_t *settings;
     ebur128_state **gain_state;
-    ebur128_state **peak_state;
-} track_state_t;
+    rg_cache_t *cache; // NULL if disabled
+    int *order;
+    int next; // protected by settings->sync_mutex
+    struct timeval start_tv;
+} rg_queue_t;
+
+typedef struct {
+    int index;
+    float duration;
+} rg_track_duration_t;
+
+#define RG_BLOCK_FRAMES 4096
+
+static void *
+_grow_buffer (void *buffer, size_t *size, size_t needed) {
+    if (needed > *size) {
+        free (buffer);
+        buffer = malloc (needed);
+        *size = needed;
+    }
+    return buffer;
+}
+
+static void
+_set_track_result (ddb_rg_scanner_settings_t *settings, int track_index, ebur128_state *state, float peak) {
+    settings->results[track_index].track_peak = peak;
+
+    // calculate track loudness
+    double loudness = settings->ref_loudness;
+    ebur128_loudness_global (state, &loudness);
+
+    /*
+     * EBUR128 sets the target level to -23 LUFS = 84dB
+     * -> -23 - loudness = track gain to get to 84dB
+     *
+     * The old implementation of RG used 89dB, most people still use that
+     * -> the above + (loudness - 84) = track gain to get to 89dB (or user specified)
+     */
+    settings->results[track_index].track_gain = -23 - loudness + settings->ref_loudness - 84;
+}
 
-void
-rg_calc_thread(void *ctx) {
+static void
+rg_calc_track (ddb_rg_scanner_settings_t *settings, int track_index, ebur128_state **gain_state, rg_cache_t *cache, rg_buffers_t *buffers) {
     DB_decoder_t *dec = NULL;
     DB_fileinfo_t *fileinfo = NULL;
+    DB_playItem_t *track = settings->tracks[track_index];
+    rg_cache_key_t key;
+    int cacheable = 0;
 
-    char *buffer = NULL;
-    char *bufferf = NULL;
-
-    track_state_t *st = (track_state_t *)ctx;
-    if (st->settings->pabort && *(st->settings->pabort)) {
+    if (settings->pabort && *(settings->pabort)) {
         return;
     }
-    if (deadbeef->pl_get_item_duration (st->settings->tracks[st->track_index]) <= 0) {
-        st->settings->results[st->track_index].scan_result = DDB_RG_SCAN_RESULT_INVALID_FILE;
+    if (deadbeef->pl_get_item_duration (track) <= 0) {
+        settings->results[track_index].scan_result = DDB_RG_SCAN_RESULT_INVALID_FILE;
         return;
     }
 
+    if (cache && !rg_cache_key_init (&key, track)) {
+        cacheable = 1;
+        float peak;
+        if (!rg_cache_lookup (cache, &key, buffers->histogram, &peak)) {
+            // the histogram is all that's needed for the track and album loudness
+            ebur128_state *state = ebur128_init (1, 44100, EBUR128_MODE_I|EBUR128_MODE_HISTOGRAM);
+            ebur128_set_histogram (state, buffers->histogram);
+            gain_state[track_index] = state;
+            _set_track_result (settings, track_index, state, peak);
+            rg_cache_key_free (&key);
+            return;
+        }
+    }
 
     deadbeef->pl_lock ();
-    dec = (DB_decoder_t *)deadbeef->plug_get_for_id (deadbeef->pl_find_meta (st->settings->tracks[st->track_index], ":DECODER"));
+    dec = (DB_decoder_t *)deadbeef->plug_get_for_id (deadbeef->pl_find_meta (track, ":DECODER"));
     deadbeef->pl_unlock ();
 
-    if (dec) {
-        fileinfo = dec->open (DDB_DECODER_HINT_RAW_SIGNAL);
+    if (!dec) {
+        goto error;
+    }
 
-        if (fileinfo && dec->init (fileinfo, DB_PLAYITEM (st->settings->tracks[st->track_index])) != 0) {
-            st->settings->results[st->track_index].scan_result = DDB_RG_SCAN_RESULT_FILE_NOT_FOUND;
-            goto error;
-        }
+    fileinfo = dec->open (DDB_DECODER_HINT_RAW_SIGNAL);
+    if (!fileinfo) {
+        goto error;
+    }
 
-        if (fileinfo) {
-            st->gain_state[st->track_index] = ebur128_init(fileinfo->fmt.channels, fileinfo->fmt.samplerate, EBUR128_MODE_I);
-            st->peak_state[st->track_index] = ebur128_init(fileinfo->fmt.channels, fileinfo->fmt.samplerate, EBUR128_MODE_SAMPLE_PEAK);
-
-            // speaker mask mapping from WAV to EBUR128
-            static const int chmap[18] = {
-                EBUR128_LEFT,
-                EBUR128_RIGHT,
-                EBUR128_CENTER,
-                EBUR128_UNUSED,
-                EBUR128_LEFT_SURROUND,
-                EBUR128_RIGHT_SURROUND,
-                EBUR128_LEFT_SURROUND,
-                EBUR128_RIGHT_SURROUND,
-                EBUR128_CENTER,
-                EBUR128_LEFT_SURROUND,
-                EBUR128_RIGHT_SURROUND,
-                EBUR128_CENTER,
-                EBUR128_LEFT_SURROUND,
-                EBUR128_CENTER,
-                EBUR128_RIGHT_SURROUND,
-                EBUR128_LEFT_SURROUND,
-                EBUR128_CENTER,
-                EBUR128_RIGHT_SURROUND,
-            };
-
-            uint32_t channelmask = fileinfo->fmt.channelmask;
-
-            // first 18 speaker positions are known, the rest will be marked as UNUSED
-            int ch = 0;
-            for (int i = 0; i < 32 && ch < fileinfo->fmt.channels; i++) {
-                if (i < 18) {
-                    if (channelmask & (1<<i))
-                    {
-                        ebur128_set_channel (st->gain_state[st->track_index], ch, chmap[i]);
-                        ebur128_set_channel (st->peak_state[st->track_index], ch, chmap[i]);
-                        ch++;
-                    }
-                }
-                else {
-                    ebur128_set_channel (st->gain_state[st->track_index], ch, EBUR128_UNUSED);
-                    ebur128_set_channel (st->peak_state[st->track_index], ch, EBUR128_UNUSED);
-                    ch++;
-                }
+    if (dec->init (fileinfo, DB_PLAYITEM (track)) != 0) {
+        settings->results[track_index].scan_result = DDB_RG_SCAN_RESULT_FILE_NOT_FOUND;
+        goto error;
+    }
+
+    // the same state collects the loudness and the peak, so the audio is filtered only once;
+    // the histogram mode keeps the loudness data small enough to be cached
+    ebur128_state *state = ebur128_init (fileinfo->fmt.channels, fileinfo->fmt.samplerate, EBUR128_MODE_I|EBUR128_MODE_SAMPLE_PEAK|EBUR128_MODE_HISTOGRAM);
+    gain_state[track_index] = state;
+
+    // speaker mask mapping from WAV to EBUR128
+    static const int chmap[18] = {
+        EBUR128_LEFT,
+        EBUR128_RIGHT,
+        EBUR128_CENTER,
+        EBUR128_UNUSED,
+        EBUR128_LEFT_SURROUND,
+        EBUR128_RIGHT_SURROUND,
+        EBUR128_LEFT_SURROUND,
+        EBUR128_RIGHT_SURROUND,
+        EBUR128_CENTER,
+        EBUR128_LEFT_SURROUND,
+        EBUR128_RIGHT_SURROUND,
+        EBUR128_CENTER,
+        EBUR128_LEFT_SURROUND,
+        EBUR128_CENTER,
+        EBUR128_RIGHT_SURROUND,
+        EBUR128_LEFT_SURROUND,
+        EBUR128_CENTER,
+        EBUR128_RIGHT_SURROUND,
+    };
+
+    uint32_t channelmask = fileinfo->fmt.channelmask;
+
+    // first 18 speaker positions are known, the rest will be marked as UNUSED
+    int ch = 0;
+    for (int i = 0; i < 32 && ch < fileinfo->fmt.channels; i++) {
+        if (i < 18) {
+            if (channelmask & (1<<i))
+            {
+                ebur128_set_channel (state, ch, chmap[i]);
+                ch++;
             }
+        }
+        else {
+            ebur128_set_channel (state, ch, EBUR128_UNUSED);
+            ch++;
+        }
+    }
 
-            int samplesize = fileinfo->fmt.channels * fileinfo->fmt.bps / 8;
+    int samplesize = fileinfo->fmt.channels * fileinfo->fmt.bps / 8;
 
-            int bs = 2000 * samplesize;
-            ddb_waveformat_t fmt;
+    int bs = RG_BLOCK_FRAMES * samplesize;
+    ddb_waveformat_t fmt;
 
-            buffer = malloc (bs);
+    buffers->buffer = _grow_buffer (buffers->buffer, &buffers->buffer_size, bs);
+    char *buffer = buffers->buffer;
+    float *bufferf;
 
-            if (!fileinfo->fmt.is_float) {
-                bufferf = malloc (2000 * sizeof (float) * fileinfo->fmt.channels);
-                memcpy (&fmt, &fileinfo->fmt, sizeof (fmt));
-                fmt.bps = 32;
-                fmt.is_float = 1;
-            }
-            else {
-                bufferf = buffer;
-            }
+    if (!fileinfo->fmt.is_float) {
+        buffers->bufferf = _grow_buffer (buffers->bufferf, &buffers->bufferf_size, RG_BLOCK_FRAMES * sizeof (float) * fileinfo->fmt.channels);
+        bufferf = buffers->bufferf;
+        memcpy (&fmt, &fileinfo->fmt, sizeof (fmt));
+        fmt.bps = 32;
+        fmt.is_float = 1;
+    }
+    else {
+        bufferf = (float *)buffer;
+    }
 
-            int eof = 0;
-            for (;;) {
-                if (eof) {
-                    break;
-                }
-                if (st->settings->pabort && *(st->settings->pabort)) {
-                    break;
-                }
+    int eof = 0;
+    for (;;) {
+        if (eof) {
+            break;
+        }
+        if (settings->pabort && *(settings->pabort)) {
+            break;
+        }
 
-                int sz = dec->read (fileinfo, buffer, bs); // read one block
+        int sz = dec->read (fileinfo, buffer, bs); // read one block
 
-                deadbeef->mutex_lock (st->settings->sync_mutex);
-                int samplesize = fileinfo->fmt.channels * (fileinfo->fmt.bps >> 3);
-                int numsamples = sz / samplesize;
-                st->settings->cd_samples_processed += numsamples * 44100 / fileinfo->fmt.samplerate;
-                deadbeef->mutex_unlock (st->settings->sync_mutex);
+        int numsamples = sz / samplesize;
+        deadbeef->mutex_lock (settings->sync_mutex);
+        settings->cd_samples_processed += (uint64_t)numsamples * 44100 / fileinfo->fmt.samplerate;
+        deadbeef->mutex_unlock (settings->sync_mutex);
 
-                if (sz != bs) {
-                    eof = 1;
-                }
+        if (sz != bs) {
+            eof = 1;
+        }
 
-                // convert from native output to float,
-                // only if the input is not float already
-                if (!fileinfo->fmt.is_float) {
-                    deadbeef->pcm_convert (&fileinfo->fmt, buffer, &fmt, bufferf, sz);
-                }
+        // convert from native output to float,
+        // only if the input is not float already
+        if (!fileinfo->fmt.is_float) {
+            deadbeef->pcm_convert (&fileinfo->fmt, buffer, &fmt, (char *)bufferf, sz);
+        }
 
-                int frames = sz / samplesize;
+        ebur128_add_frames_float (state, bufferf, numsamples); // collect data
+    }
 
-                ebur128_add_frames_float (st->gain_state[st->track_index], (float*) bufferf, frames); // collect data
-                ebur128_add_frames_float (st->peak_state[st->track_index], (float*) bufferf, frames); // collect data
+    if (!settings->pabort || !(*(settings->pabort))) {
+        // calculating track peak
+        // libEBUR128 calculates peak per channel, so we have to pick the highest value
+        double tr_peak = 0;
+        double ch_peak = 0;
+        for (int ch = 0; ch < fileinfo->fmt.channels; ++ch) {
+            ebur128_sample_peak (state, ch, &ch_peak);
+            if (ch_peak > tr_peak) {
+                tr_peak = ch_peak;
             }
         }
 
-        if (!st->settings->pabort || !(*(st->settings->pabort))) {
-            // calculating track peak
-            // libEBUR128 calculates peak per channel, so we have to pick the highest value
-            double tr_peak = 0;
-            double ch_peak = 0;
-            int res;
-            for (int ch = 0; ch < fileinfo->fmt.channels; ++ch) {
-                res = ebur128_sample_peak (st->peak_state[st->track_index], ch, &ch_peak);
-                //trace ("rg_scanner: peak for ch %d: %f\n", ch, ch_peak);
-                if (ch_peak > tr_peak) {
-                    //trace ("rg_scanner: %f > %f\n", ch_peak, tr_peak);
-                    tr_peak = ch_peak;
-                }
-            }
-
-            st->settings->results[st->track_index].track_peak = (float) tr_peak;
+        _set_track_result (settings, track_index, state, (float)tr_peak);
 
-            // calculate track loudness
-            double loudness = st->settings->ref_loudness;
-            ebur128_loudness_global (st->gain_state[st->track_index], &loudness);
-
-            /*
-             * EBUR128 sets the target level to -23 LUFS = 84dB
-             * -> -23 - loudness = track gain to get to 84dB
-             *
-             * The old implementation of RG used 89dB, most people still use that
-             * -> the above + (loudness - 84) = track gain to get to 89dB (or user specified)
-             */
-            st->settings->results[st->track_index].track_gain = -23 - loudness + st->settings->ref_loudness - 84;
+        if (cacheable) {
+            ebur128_get_histogram (state, buffers->histogram);
+            rg_cache_store (cache, &key, buffers->histogram, (float)tr_peak);
         }
     }
 
@@ -212,16 +267,79 @@ error:
     if (fileinfo) {
         dec->free (fileinfo);
     }
+    if (cacheable) {
+        rg_cache_key_free (&key);
+    }
+}
 
-    if (buffer && buffer != bufferf) {
-        free (buffer);
-        buffer = NULL;
+static void
+_report_progress (rg_queue_t *q, int current_track) {
+    ddb_rg_scanner_settings_t *settings = q->settings;
+    if (settings->_size >= sizeof (ddb_rg_scanner_settings_t)) {
+        struct timeval tv;
+        gettimeofday (&tv, NULL);
+        float elapsed = (tv.tv_sec - q->start_tv.tv_sec) + (tv.tv_usec - q->start_tv.tv_usec) / 1000000.f;
+        if (elapsed > 0) {
+            settings->tracks_per_second = settings->num_tracks_done / elapsed;
+            settings->realtime_factor = settings->cd_samples_processed / 44100.f / elapsed;
+        }
+    }
+    if (settings->progress_callback) {
+        settings->progress_callback (current_track, settings->progress_cb_user_data);
+    }
+}
+
+static void
+rg_worker (void *ctx) {
+    rg_queue_t *q = ctx;
+    ddb_rg_scanner_settings_t *settings = q->settings;
+    rg_buffers_t *buffers = calloc (1, sizeof (rg_buffers_t));
+
+    for (;;) {
+        deadbeef->mutex_lock (settings->sync_mutex);
+        if (q->next >= settings->num_tracks || (settings->pabort && *(settings->pabort))) {
+            deadbeef->mutex_unlock (settings->sync_mutex);
+            break;
+        }
+        int track_index = q->order[q->next++];
+        // the callbacks are serialized by the mutex
+        _report_progress (q, track_index);
+        deadbeef->mutex_unlock (settings->sync_mutex);
+
+        rg_calc_track (settings, track_index, q->gain_state, q->cache, buffers);
+
+        deadbeef->mutex_lock (settings->sync_mutex);
+        if (settings->_size >= sizeof (ddb_rg_scanner_settings_t)) {
+            settings->num_tracks_done++;
+        }
+        deadbeef->mutex_unlock (settings->sync_mutex);
+    }
+
+    free (buffers->buffer);
+    free (buffers->bufferf);
+    free (buffers);
+}
+
+static int
+_duration_cmp (const void *a, const void *b) {
+    const rg_track_duration_t *x = a;
+    const rg_track_duration_t *y = b;
+    if (x->duration != y->duration) {
+        return x->duration > y->duration ? -1 : 1;
     }
+    return x->index - y->index;
+}
 
-    if (bufferf) {
-        free (bufferf);
-        bufferf = NULL;
+static rg_cache_t *
+_load_cache (void) {
+    const char *cachedir = deadbeef->get_system_dir (DDB_SYS_DIR_CACHE);
+    if (!cachedir || !*cachedir) {
+        return NULL;
     }
+    mkdir (cachedir, 0755);
+    char fname[strlen (cachedir) + 20];
+    snprintf (fname, sizeof (fname), "%s/rg_scanner.cache", cachedir);
+    return rg_cache_load (fname);
 }
 
 static int
@@ -259,7 +377,8 @@ _update_album_gain (ddb_rg_scanner_settings_t *settings, int i, int album_start,
 
 int
 rg_scan (ddb_rg_scanner_settings_t *settings) {
-    if (settings->_size != sizeof (ddb_rg_scanner_settings_t)) {
+    // the callers built against the 1.0 structure don't get the throughput stats
+    if (settings->_size != sizeof (ddb_rg_scanner_settings_t) && settings->_size != offsetof (ddb_rg_scanner_settings_t, num_tracks_done)) {
         return -1;
     }
 
@@ -278,60 +397,66 @@ rg_scan (ddb_rg_scanner_settings_t *settings) {
     //trace ("rg_scanner: using %d thread(s)\n", settings->num_threads);
 
     ebur128_state **gain_state = NULL;
-    ebur128_state **peak_state = NULL;
 
     if (settings->ref_loudness == 0) {
         settings->ref_loudness = DDB_RG_SCAN_DEFAULT_LOUDNESS;
     }
+    if (settings->_size >= sizeof (ddb_rg_scanner_settings_t)) {
+        settings->num_tracks_done = 0;
+        settings->tracks_per_second = 0;
+        settings->realtime_factor = 0;
+    }
 
     double loudness = settings->ref_loudness;
 
     // allocate status array
     gain_state = calloc (settings->num_tracks, sizeof (ebur128_state *));
-    peak_state = calloc (settings->num_tracks, sizeof (ebur128_state *));
-
-    // used for joining threads
-    intptr_t *rg_threads = calloc (settings->num_tracks, sizeof (intptr_t));
-    track_state_t *track_states = calloc (settings->num_tracks, sizeof (track_state_t));
-
-    // calculate gain for each track and album
-    for (int i = 0; i < settings->num_tracks; ++i) {
-        if (settings->progress_callback) {
-            settings->progress_callback (i, settings->progress_cb_user_data);
-        }
-        // limit number of parallel threads
-        if (i >= settings->num_threads) {
-            // simple blocking mechanism: join the 'oldest' thread
-            deadbeef->thread_join(rg_threads[i - settings->num_threads]);
-            rg_threads[i - settings->num_threads] = 0;
-        }
 
-        if (settings->pabort && *(settings->pabort)) {
-            goto cleanup;
+    // longest tracks first
+    rg_track_duration_t *durations = calloc (settings->num_tracks, sizeof (rg_track_duration_t));
+    for (int i = 0; i < settings->num_tracks; i++) {
+        durations[i].index = i;
+        durations[i].duration = deadbeef->pl_get_item_duration (settings->tracks[i]);
+    }
+    qsort (durations, settings->num_tracks, sizeof (rg_track_duration_t), _duration_cmp);
+
+    rg_queue_t queue;
+    memset (&queue, 0, sizeof (queue));
+    queue.settings = settings;
+    queue.gain_state = gain_state;
+    if (deadbeef->conf_get_int ("rg_scanner.use_cache", 1)) {
+        queue.cache = _load_cache ();
+    }
+    queue.order = calloc (settings->num_tracks, sizeof (int));
+    for (int i = 0; i < settings->num_tracks; i++) {
+        queue.order[i] = durations[i].index;
+    }
+    free (durations);
+    gettimeofday (&queue.start_tv, NULL);
+
+    // the calling thread is one of the workers
+    int num_workers = settings->num_threads < settings->num_tracks ? settings->num_threads : settings->num_tracks;
+    intptr_t *rg_threads = calloc (num_workers > 0 ? num_workers : 1, sizeof (intptr_t));
+    for (int i = 1; i < num_workers; i++) {
+        rg_threads[i] = deadbeef->thread_start (rg_worker, &queue);
+    }
+    rg_worker (&queue);
+    for (int i = 1; i < num_workers; i++) {
+        if (rg_threads[i]) {
+            deadbeef->thread_join (rg_threads[i]);
         }
-
-        // initialize arguments
-        track_states[i].track_index = i;
-        track_states[i].settings = settings;
-        track_states[i].gain_state = gain_state;
-        track_states[i].peak_state = peak_state;
-
-        // run thread
-        rg_threads[i] = deadbeef->thread_start(&rg_calc_thread, (void*)(&track_states[i]));
     }
+    free (rg_threads);
+    free (queue.order);
 
-    // wait for remaining threads to join
-    int remaining_thread_id = settings->num_tracks - settings->num_threads;
-    if (remaining_thread_id < 0) {
-        remaining_thread_id = 0;
+    if (queue.cache) {
+        // also keeps the tracks finished before an abort
+        rg_cache_save (queue.cache);
+        rg_cache_free (queue.cache);
     }
-    for (int i = remaining_thread_id; i < settings->num_tracks; ++i) {
-        deadbeef->thread_join(rg_threads[i]);
-        rg_threads[i] = 0;
 
-        if (settings->pabort && *(settings->pabort)) {
-            goto cleanup;
-        }
+    if (settings->pabort && *(settings->pabort)) {
+        goto cleanup;
     }
 
     if (settings->mode == DDB_RG_SCAN_MODE_ALBUMS_FROM_TAGS) {
@@ -381,25 +506,6 @@ rg_scan (ddb_rg_scanner_settings_t *settings) {
     }
 
 cleanup:
-    // free thread storage
-    if (rg_threads) {
-        // join the still-active threads
-        for (int i = 0; i < settings->num_tracks; i++) {
-            if (rg_threads[i]) {
-                deadbeef->thread_join (rg_threads[i]);
-                rg_threads[i] = 0;
-            }
-        }
-
-        free (rg_threads);
-        rg_threads = NULL;
-    }
-
-    if (track_states) {
-        free (track_states);
-        track_states = NULL;
-    }
-
     if (gain_state) {
         for (int i = 0; i < settings->num_tracks; ++i) {
             if (gain_state[i]) {
@@ -410,16 +516,6 @@ cleanup:
         gain_state = NULL;
     }
 
-    if (peak_state) {
-        for (int i = 0; i < settings->num_tracks; ++i) {
-            if (peak_state[i]) {
-                ebur128_destroy (&peak_state[i]);
-            }
-        }
-        free (peak_state);
-        peak_state = NULL;
-    }
-
     if (album_signature_tf) {
         deadbeef->tf_free (album_signature_tf);
         album_signature_tf = NULL;
@@ -523,12 +619,16 @@ rg_remove (DB_playItem_t *track) {
     return _rg_write_meta (track);
 }
 
+static const char settings_dlg[] =
+    "property \"Remember the results, to skip unchanged files when rescanning\" checkbox rg_scanner.use_cache 1;\n"
+;
+
 // plugin structure and info
 static ddb_rg_scanner_t plugin = {
     .misc.plugin.api_vmajor = DB_API_VERSION_MAJOR,
     .misc.plugin.api_vminor = DB_API_VERSION_MINOR,
     .misc.plugin.version_major = 1,
-    .misc.plugin.version_minor = 0,
+    .misc.plugin.version_minor = 2,
     .misc.plugin.flags = DDB_PLUGIN_FLAG_LOGGING,
     .misc.plugin.type = DB_PLUGIN_MISC,
     .misc.plugin.name = "ReplayGain Scanner",
@@ -563,6 +663,7 @@ static ddb_rg_scanner_t plugin = {
         "OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN\n"
         "THE SOFTWARE.\n",
     .misc.plugin.website = "http://deadbeef.sf.net",
+    .misc.plugin.configdialog = settings_dlg,
     .scan = rg_scan,
     .apply = rg_apply,
     .remove = rg_remove
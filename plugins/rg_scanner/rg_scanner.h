@@ -76,7 +76,9 @@ typedef struct {
     // Optional pointer to the abort flag; the scanner will abort if the pointed value is non-zero
     int *pabort;
 
-    // Optional progress callback, with the current track index.
+    // Optional progress callback, with the index of the track which has just been started.
+    // The tracks are scanned longest first, not in the array order.
+    // The callback may be called from any of the scanning threads, but never concurrently.
     void (*progress_callback) (int current_track, void *user_data);
 
     // An additional user-defined parameter, which will be passed to the progress_callback.
@@ -88,11 +90,20 @@ typedef struct {
 
     // Internal mutex, used for thread syncronization
     uintptr_t sync_mutex;
+
+    // Since version 1.1: throughput, set by the scanner before each progress callback.
+    // The scanner accepts the 1.0 structure without these fields, as indicated by _size.
+    int num_tracks_done;
+    float tracks_per_second;
+    float realtime_factor; // seconds of audio scanned per second
 } ddb_rg_scanner_settings_t;
 
 typedef struct {
     DB_misc_t misc;
 
+    // Since version 1.2, the results of the local files are cached,
+    // and the unchanged files are not decoded again.
+    // Config variable: rg_scanner.use_cache=1
     int (*scan) (ddb_rg_scanner_settings_t *settings);
 
     // flags specify which fields must be set / added
@@ -0,0 +1,722 @@
+/*
+    CURL VFS plugin for DeaDBeeF Player
+    Copyright (C) 2009-2014 Alexey Yakovenko
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+#ifdef HAVE_CONFIG_H
+    #include "../../config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "httpcache.h"
+#include "../../deadbeef.h"
+
+//#define trace(...) { fprintf(stderr, __VA_ARGS__); }
+#define trace(...)
+
+extern DB_functions_t *deadbeef;
+
+// The files are stored as vfs_curl/<md5 of url>.data and vfs_curl/<md5 of url>.index,
+// the modification time of the index is the last access time.
+//
+// index file layout: "DHCI", uint32 version,
+// uint32 url size, url (including the terminating zero), int64 length,
+// uint32 content type size, content type (including the terminating zero, empty if unknown),
+// uint32 etag size, etag, uint32 last modified size, last modified (the same way as the content type),
+// uint32 number of ranges, then for each: int64 start, int64 end;
+// all numbers in native byte order.
+// The data can be used only with the etag or the last modification time,
+// which are checked with the server before the cached data is read.
+
+#define CACHE_DIR "vfs_curl"
+#define INDEX_MAGIC "DHCI"
+#define INDEX_VERSION 2
+#define MAX_STRING 65536
+#define MAX_RANGES (1 << 20)
+
+typedef struct {
+    int64_t start;
+    int64_t end;
+} cache_range_t;
+
+struct httpcache_entry_s {
+    char name[33];
+    char *url;
+    char *content_type;
+    char *etag;
+    char *last_modified;
+    int64_t length;
+    int fd;
+    cache_range_t *ranges; // sorted, not overlapping and not adjacent
+    int nranges;
+    int ranges_alloc;
+    int modified;
+    int refc;
+    struct httpcache_entry_s *next;
+};
+
+typedef struct {
+    char name[33];
+    time_t atime;
+    int64_t size;
+} cache_file_t;
+
+static uintptr_t mutex;
+static httpcache_entry_t *open_entries;
+static int64_t max_size;
+static char cache_path[PATH_MAX];
+
+void
+httpcache_init (void) {
+    mutex = deadbeef->mutex_create ();
+    const char *root = deadbeef->get_system_dir (DDB_SYS_DIR_CACHE);
+    if (!root || snprintf (cache_path, sizeof (cache_path), "%s/" CACHE_DIR, root) >= sizeof (cache_path)) {
+        *cache_path = 0;
+    }
+}
+
+void
+httpcache_free (void) {
+    if (mutex) {
+        deadbeef->mutex_free (mutex);
+        mutex = 0;
+    }
+}
+
+static void
+trim (int64_t limit);
+
+void
+httpcache_set_max_size (int64_t size) {
+    deadbeef->mutex_lock (mutex);
+    if (!*cache_path) {
+        size = 0;
+    }
+    // the files of a disabled cache are removed, even if it was disabled before the start
+    if (size == 0 || size < max_size) {
+        trim (size);
+    }
+    max_size = size;
+    deadbeef->mutex_unlock (mutex);
+}
+
+int64_t
+httpcache_get_max_size (void) {
+    deadbeef->mutex_lock (mutex);
+    int64_t size = max_size;
+    deadbeef->mutex_unlock (mutex);
+    return size;
+}
+
+static int
+make_path (char *path, size_t size, const char *name, const char *ext) {
+    return snprintf (path, size, "%s/%s%s", cache_path, name, ext) >= size ? -1 : 0;
+}
+
+static int
+make_dir (const char *path) {
+    char tmp[PATH_MAX];
+    if (snprintf (tmp, sizeof (tmp), "%s", path) >= sizeof (tmp)) {
+        return -1;
+    }
+    for (char *p = tmp + 1; *p; p++) {
+        if (*p == '/') {
+            *p = 0;
+            mkdir (tmp, 0755);
+            *p = '/';
+        }
+    }
+    return mkdir (tmp, 0755) && errno != EEXIST ? -1 : 0;
+}
+
+static void
+url_hash (const char *url, char *name) {
+    uint8_t sig[16];
+    deadbeef->md5 (sig, url, (int)strlen (url));
+    deadbeef->md5_to_str (name, sig);
+    name[32] = 0;
+}
+
+static void
+touch_index (const char *name) {
+    char path[PATH_MAX];
+    if (!make_path (path, sizeof (path), name, ".index")) {
+        utimes (path, NULL);
+    }
+}
+
+static httpcache_entry_t *
+find_open (const char *name) {
+    for (httpcache_entry_t *e = open_entries; e; e = e->next) {
+        if (!strcmp (e->name, name)) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static void
+entry_free (httpcache_entry_t *e) {
+    if (e->fd >= 0) {
+        close (e->fd);
+    }
+    free (e->url);
+    free (e->content_type);
+    free (e->etag);
+    free (e->last_modified);
+    free (e->ranges);
+    free (e);
+}
+
+static int
+read_string (FILE *f, char **s) {
+    uint32_t size;
+    if (fread (&size, sizeof (size), 1, f) != 1 || size == 0 || size > MAX_STRING) {
+        return -1;
+    }
+    char *str = malloc (size);
+    if (!str) {
+        return -1;
+    }
+    if (fread (str, size, 1, f) != 1 || str[size-1]) {
+        free (str);
+        return -1;
+    }
+    *s = str;
+    return 0;
+}
+
+// the empty strings are read as NULL
+static int
+read_optional_string (FILE *f, char **s) {
+    if (read_string (f, s)) {
+        return -1;
+    }
+    if (!**s) {
+        free (*s);
+        *s = NULL;
+    }
+    return 0;
+}
+
+static int
+write_string (FILE *f, const char *s) {
+    uint32_t size = (uint32_t)strlen (s) + 1;
+    return fwrite (&size, sizeof (size), 1, f) != 1 || fwrite (s, size, 1, f) != 1 ? -1 : 0;
+}
+
+static httpcache_entry_t *
+entry_load (const char *name, const char *url) {
+    char path[PATH_MAX];
+    if (make_path (path, sizeof (path), name, ".index")) {
+        return NULL;
+    }
+    FILE *f = fopen (path, "rb");
+    if (!f) {
+        return NULL;
+    }
+
+    httpcache_entry_t *e = calloc (1, sizeof (httpcache_entry_t));
+    strcpy (e->name, name);
+    e->fd = -1;
+
+    char magic[4];
+    uint32_t version;
+    uint32_t nranges;
+    if (fread (magic, sizeof (magic), 1, f) != 1 || memcmp (magic, INDEX_MAGIC, 4)
+        || fread (&version, sizeof (version), 1, f) != 1 || version != INDEX_VERSION
+        || read_string (f, &e->url) || strcmp (e->url, url)
+        || fread (&e->length, sizeof (e->length), 1, f) != 1 || e->length <= 0
+        || read_optional_string (f, &e->content_type)
+        || read_optional_string (f, &e->etag)
+        || read_optional_string (f, &e->last_modified)
+        || (!e->etag && !e->last_modified)
+        || fread (&nranges, sizeof (nranges), 1, f) != 1 || nranges > MAX_RANGES) {
+        goto error;
+    }
+    if (nranges > 0) {
+        e->ranges = malloc (nranges * sizeof (cache_range_t));
+        if (!e->ranges || fread (e->ranges, sizeof (cache_range_t), nranges, f) != nranges) {
+            goto error;
+        }
+        e->ranges_alloc = nranges;
+        int64_t prev = -1;
+        for (int i = 0; i < nranges; i++) {
+            if (e->ranges[i].start <= prev || e->ranges[i].end <= e->ranges[i].start || e->ranges[i].end > e->length) {
+                goto error;
+            }
+            prev = e->ranges[i].end;
+        }
+        e->nranges = nranges;
+    }
+    fclose (f);
+    f = NULL;
+
+    if (make_path (path, sizeof (path), name, ".data")) {
+        goto error;
+    }
+    e->fd = open (path, O_RDWR);
+    if (e->fd < 0) {
+        goto error;
+    }
+    trace ("httpcache: loaded %s, %d ranges\n", url, e->nranges);
+    return e;
+
+error:
+    trace ("httpcache: failed to load the index of %s\n", url);
+    if (f) {
+        fclose (f);
+    }
+    entry_free (e);
+    return NULL;
+}
+
+static int
+entry_save (httpcache_entry_t *e) {
+    char path[PATH_MAX];
+    char tmp[PATH_MAX];
+    if (make_path (path, sizeof (path), e->name, ".index") || make_path (tmp, sizeof (tmp), e->name, ".index.tmp")) {
+        return -1;
+    }
+    FILE *f = fopen (tmp, "wb");
+    if (!f) {
+        return -1;
+    }
+    uint32_t version = INDEX_VERSION;
+    uint32_t nranges = e->nranges;
+    int err = fwrite (INDEX_MAGIC, 4, 1, f) != 1
+        || fwrite (&version, sizeof (version), 1, f) != 1
+        || write_string (f, e->url)
+        || fwrite (&e->length, sizeof (e->length), 1, f) != 1
+        || write_string (f, e->content_type ? e->content_type : "")
+        || write_string (f, e->etag ? e->etag : "")
+        || write_string (f, e->last_modified ? e->last_modified : "")
+        || fwrite (&nranges, sizeof (nranges), 1, f) != 1
+        || (nranges > 0 && fwrite (e->ranges, sizeof (cache_range_t), nranges, f) != nranges);
+    if (fclose (f) || err || rename (tmp, path)) {
+        unlink (tmp);
+        return -1;
+    }
+    e->modified = 0;
+    return 0;
+}
+
+static httpcache_entry_t *
+entry_new (const char *name, const char *url, int64_t length) {
+    char path[PATH_MAX];
+    if (make_dir (cache_path) || make_path (path, sizeof (path), name, ".data")) {
+        return NULL;
+    }
+    int fd = open (path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        trace ("httpcache: failed to create %s\n", path);
+        return NULL;
+    }
+    httpcache_entry_t *e = calloc (1, sizeof (httpcache_entry_t));
+    strcpy (e->name, name);
+    e->url = strdup (url);
+    e->length = length;
+    e->fd = fd;
+    return e;
+}
+
+static int
+cmp_file_atime (const void *a, const void *b) {
+    const cache_file_t *fa = a;
+    const cache_file_t *fb = b;
+    return fa->atime < fb->atime ? -1 : fa->atime > fb->atime ? 1 : 0;
+}
+
+// removes the least recently used files which are not open, until the total size is within the limit;
+// the leftovers of the interrupted writes are removed too
+static void
+trim (int64_t limit) {
+    DIR *dir = opendir (cache_path);
+    if (!dir) {
+        return;
+    }
+    cache_file_t *files = NULL;
+    int nfiles = 0;
+    int files_alloc = 0;
+    int64_t total = 0;
+    char path[PATH_MAX];
+    struct dirent *de;
+    while ((de = readdir (dir))) {
+        const char *ext = strchr (de->d_name, '.');
+        if (!ext || ext - de->d_name != 32) {
+            continue;
+        }
+        char name[33];
+        memcpy (name, de->d_name, 32);
+        name[32] = 0;
+        int is_open = find_open (name) != NULL;
+
+        struct stat st;
+        if (!strcmp (ext, ".index")) {
+            if (make_path (path, sizeof (path), name, ".data")) {
+                continue;
+            }
+            if (stat (path, &st)) {
+                if (!is_open && !make_path (path, sizeof (path), name, ".index")) {
+                    unlink (path);
+                }
+                continue;
+            }
+            int64_t size = (int64_t)st.st_blocks * 512;
+            total += size;
+            if (is_open || make_path (path, sizeof (path), name, ".index") || stat (path, &st)) {
+                continue;
+            }
+            if (nfiles == files_alloc) {
+                files_alloc = files_alloc ? files_alloc * 2 : 64;
+                cache_file_t *f = realloc (files, files_alloc * sizeof (cache_file_t));
+                if (!f) {
+                    break;
+                }
+                files = f;
+            }
+            strcpy (files[nfiles].name, name);
+            files[nfiles].atime = st.st_mtime;
+            files[nfiles].size = size;
+            nfiles++;
+        }
+        else if (is_open || make_path (path, sizeof (path), de->d_name, "")) {
+            continue;
+        }
+        else if (!strcmp (ext, ".index.tmp")) {
+            unlink (path);
+        }
+        else if (!strcmp (ext, ".data")) {
+            // the data file is kept only while its index exists
+            char index_path[PATH_MAX];
+            if (!make_path (index_path, sizeof (index_path), name, ".index") && stat (index_path, &st) && errno == ENOENT) {
+                unlink (path);
+            }
+        }
+    }
+    closedir (dir);
+
+    if (total > limit && nfiles > 0) {
+        qsort (files, nfiles, sizeof (cache_file_t), cmp_file_atime);
+        for (int i = 0; i < nfiles && total > limit; i++) {
+            trace ("httpcache: removing %s, %lld bytes\n", files[i].name, (long long)files[i].size);
+            if (!make_path (path, sizeof (path), files[i].name, ".index")) {
+                unlink (path);
+            }
+            if (!make_path (path, sizeof (path), files[i].name, ".data")) {
+                unlink (path);
+            }
+            total -= files[i].size;
+        }
+    }
+    free (files);
+}
+
+static void
+entry_reset (httpcache_entry_t *e, int64_t length) {
+    trace ("httpcache: %s was changed, length %lld -> %lld\n", e->url, (long long)e->length, (long long)length);
+    if (ftruncate (e->fd, 0)) {
+        trace ("httpcache: failed to truncate the data file\n");
+    }
+    e->length = length;
+    e->nranges = 0;
+    e->modified = 1;
+}
+
+static void
+entry_set_content_type (httpcache_entry_t *e, const char *content_type) {
+    if (content_type && (!e->content_type || strcmp (e->content_type, content_type))) {
+        free (e->content_type);
+        e->content_type = strdup (content_type);
+        e->modified = 1;
+    }
+}
+
+static void
+set_validator (httpcache_entry_t *e, char **validator, const char *value) {
+    if (value ? !*validator || strcmp (*validator, value) : *validator != NULL) {
+        free (*validator);
+        *validator = value ? strdup (value) : NULL;
+        e->modified = 1;
+    }
+}
+
+static void
+entry_set_validators (httpcache_entry_t *e, const char *etag, const char *last_modified) {
+    set_validator (e, &e->etag, etag);
+    set_validator (e, &e->last_modified, last_modified);
+}
+
+// the validators are compared when both the cache and the response have them
+static int
+entry_matches (httpcache_entry_t *e, int64_t length, const char *etag, const char *last_modified) {
+    return e->length == length
+        && (!etag || !e->etag || !strcmp (etag, e->etag))
+        && (!last_modified || !e->last_modified || !strcmp (last_modified, e->last_modified));
+}
+
+httpcache_entry_t *
+httpcache_get (const char *url) {
+    char name[33];
+    url_hash (url, name);
+    deadbeef->mutex_lock (mutex);
+    httpcache_entry_t *e = NULL;
+    if (max_size > 0) {
+        e = find_open (name);
+        if (!e && (e = entry_load (name, url))) {
+            touch_index (name);
+            e->next = open_entries;
+            open_entries = e;
+        }
+        if (e) {
+            e->refc++;
+        }
+    }
+    deadbeef->mutex_unlock (mutex);
+    return e;
+}
+
+httpcache_entry_t *
+httpcache_create (const char *url, int64_t length, const char *content_type, const char *etag, const char *last_modified) {
+    char name[33];
+    url_hash (url, name);
+    deadbeef->mutex_lock (mutex);
+    if (max_size <= 0) {
+        deadbeef->mutex_unlock (mutex);
+        return NULL;
+    }
+    httpcache_entry_t *e = find_open (name);
+    if (!e && (e = entry_load (name, url))) {
+        e->next = open_entries;
+        open_entries = e;
+    }
+    if (e && !entry_matches (e, length, etag, last_modified)) {
+        entry_reset (e, length);
+    }
+    if (!e) {
+        // make room for the new file
+        trim (max_size - length);
+        e = entry_new (name, url, length);
+        if (!e) {
+            deadbeef->mutex_unlock (mutex);
+            return NULL;
+        }
+        e->modified = 1;
+        e->next = open_entries;
+        open_entries = e;
+    }
+    entry_set_content_type (e, content_type);
+    entry_set_validators (e, etag, last_modified);
+    // save the index right away, so that the data file is known to belong to an entry
+    if (e->modified) {
+        entry_save (e);
+    }
+    else {
+        touch_index (name);
+    }
+    e->refc++;
+    deadbeef->mutex_unlock (mutex);
+    return e;
+}
+
+void
+httpcache_reset (httpcache_entry_t *e, int64_t length, const char *content_type, const char *etag, const char *last_modified) {
+    deadbeef->mutex_lock (mutex);
+    entry_reset (e, length);
+    entry_set_content_type (e, content_type);
+    entry_set_validators (e, etag, last_modified);
+    entry_save (e);
+    deadbeef->mutex_unlock (mutex);
+}
+
+int
+httpcache_matches (httpcache_entry_t *e, int64_t length, const char *etag, const char *last_modified) {
+    deadbeef->mutex_lock (mutex);
+    int res = entry_matches (e, length, etag, last_modified);
+    deadbeef->mutex_unlock (mutex);
+    return res;
+}
+
+char *
+httpcache_get_if_range (httpcache_entry_t *e) {
+    deadbeef->mutex_lock (mutex);
+    // a weak etag can't be used for the range requests
+    const char *validator = e->etag && strncmp (e->etag, "W/", 2) ? e->etag : e->last_modified;
+    char *res = validator ? strdup (validator) : NULL;
+    deadbeef->mutex_unlock (mutex);
+    return res;
+}
+
+void
+httpcache_release (httpcache_entry_t *e) {
+    deadbeef->mutex_lock (mutex);
+    if (--e->refc == 0) {
+        httpcache_entry_t **prev = &open_entries;
+        while (*prev != e) {
+            prev = &(*prev)->next;
+        }
+        *prev = e->next;
+        if (!e->modified || entry_save (e)) {
+            touch_index (e->name);
+        }
+        entry_free (e);
+        trim (max_size);
+    }
+    deadbeef->mutex_unlock (mutex);
+}
+
+int64_t
+httpcache_get_length (httpcache_entry_t *e) {
+    deadbeef->mutex_lock (mutex);
+    int64_t length = e->length;
+    deadbeef->mutex_unlock (mutex);
+    return length;
+}
+
+char *
+httpcache_get_content_type (httpcache_entry_t *e) {
+    deadbeef->mutex_lock (mutex);
+    char *content_type = e->content_type ? strdup (e->content_type) : NULL;
+    deadbeef->mutex_unlock (mutex);
+    return content_type;
+}
+
+// returns the index of the first range which ends after pos
+static int
+find_range (httpcache_entry_t *e, int64_t pos) {
+    int lo = 0;
+    int hi = e->nranges;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (e->ranges[mid].end <= pos) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static int
+add_range (httpcache_entry_t *e, int64_t start, int64_t end) {
+    // merge with the ranges which overlap or touch the new one
+    int i = find_range (e, start - 1);
+    int j = i;
+    while (j < e->nranges && e->ranges[j].start <= end) {
+        if (e->ranges[j].start < start) {
+            start = e->ranges[j].start;
+        }
+        if (e->ranges[j].end > end) {
+            end = e->ranges[j].end;
+        }
+        j++;
+    }
+    if (j == i) {
+        if (e->nranges == e->ranges_alloc) {
+            int n = e->ranges_alloc ? e->ranges_alloc * 2 : 16;
+            if (n > MAX_RANGES) {
+                return -1;
+            }
+            cache_range_t *ranges = realloc (e->ranges, n * sizeof (cache_range_t));
+            if (!ranges) {
+                return -1;
+            }
+            e->ranges = ranges;
+            e->ranges_alloc = n;
+        }
+        memmove (e->ranges + i + 1, e->ranges + i, (e->nranges - i) * sizeof (cache_range_t));
+        e->nranges++;
+    }
+    else {
+        memmove (e->ranges + i + 1, e->ranges + j, (e->nranges - j) * sizeof (cache_range_t));
+        e->nranges -= j - i - 1;
+    }
+    e->ranges[i].start = start;
+    e->ranges[i].end = end;
+    return 0;
+}
+
+int64_t
+httpcache_available (httpcache_entry_t *e, int64_t pos) {
+    deadbeef->mutex_lock (mutex);
+    int i = find_range (e, pos);
+    int64_t res = i < e->nranges && e->ranges[i].start <= pos ? e->ranges[i].end - pos : 0;
+    deadbeef->mutex_unlock (mutex);
+    return res;
+}
+
+int64_t
+httpcache_read (httpcache_entry_t *e, void *buffer, int64_t pos, int64_t size) {
+    int64_t done = 0;
+    while (done < size) {
+        ssize_t rd = pread (e->fd, (uint8_t *)buffer + done, size - done, pos + done);
+        if (rd < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rd <= 0) {
+            break;
+        }
+        done += rd;
+    }
+    if (done < size) {
+        // the data file was truncated or damaged, everything needs to be downloaded again
+        trace ("httpcache: failed to read %s at %lld\n", e->url, (long long)pos);
+        deadbeef->mutex_lock (mutex);
+        e->nranges = 0;
+        e->modified = 1;
+        deadbeef->mutex_unlock (mutex);
+        return -1;
+    }
+    return done;
+}
+
+int
+httpcache_write (httpcache_entry_t *e, const void *buffer, int64_t pos, int64_t size) {
+    int64_t done = 0;
+    while (done < size) {
+        ssize_t wr = pwrite (e->fd, (const uint8_t *)buffer + done, size - done, pos + done);
+        if (wr < 0 && errno == EINTR) {
+            continue;
+        }
+        if (wr <= 0) {
+            trace ("httpcache: failed to write %s at %lld\n", e->url, (long long)pos);
+            return -1;
+        }
+        done += wr;
+    }
+    deadbeef->mutex_lock (mutex);
+    int res = pos + size <= e->length ? add_range (e, pos, pos + size) : -1;
+    e->modified = 1;
+    deadbeef->mutex_unlock (mutex);
+    return res;
+}
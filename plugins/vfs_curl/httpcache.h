@@ -0,0 +1,99 @@
+/*
+    CURL VFS plugin for DeaDBeeF Player
+    Copyright (C) 2009-2014 Alexey Yakovenko
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifndef __HTTPCACHE_H
+#define __HTTPCACHE_H
+
+#include <stdint.h>
+
+// On-disk cache of the downloaded parts of the remote files, so seeking back
+// or playing a file again doesn't download the same data twice.
+// Each url gets a sparse data file, and an index with the length, the content type,
+// the etag and the last modification time reported by the server,
+// and the list of the byte ranges which are in the data file.
+// Only the files which have an etag or a last modification time can be cached,
+// the user checks them with the server before using the cached data.
+// When the total size is over the limit, the least recently used files are removed.
+//
+// An entry can be shared by several open streams of the same url.
+// All functions are thread-safe.
+
+typedef struct httpcache_entry_s httpcache_entry_t;
+
+void
+httpcache_init (void);
+
+void
+httpcache_free (void);
+
+// 0 disables the cache
+void
+httpcache_set_max_size (int64_t size);
+
+int64_t
+httpcache_get_max_size (void);
+
+// Returns the entry of the url, or NULL if nothing is cached for it.
+httpcache_entry_t *
+httpcache_get (const char *url);
+
+// Returns the entry of the url, creating it if needed.
+// The cached data is dropped if the length or the validators don't match.
+httpcache_entry_t *
+httpcache_create (const char *url, int64_t length, const char *content_type, const char *etag, const char *last_modified);
+
+// Drops the cached data, when the file was changed on the server.
+void
+httpcache_reset (httpcache_entry_t *entry, int64_t length, const char *content_type, const char *etag, const char *last_modified);
+
+// Returns 1 if the response of the server describes the cached file.
+int
+httpcache_matches (httpcache_entry_t *entry, int64_t length, const char *etag, const char *last_modified);
+
+// Returns a copy of the value for the If-Range header, or NULL if there is no strong validator.
+char *
+httpcache_get_if_range (httpcache_entry_t *entry);
+
+void
+httpcache_release (httpcache_entry_t *entry);
+
+int64_t
+httpcache_get_length (httpcache_entry_t *entry);
+
+// Returns a copy of the content type, or NULL if it's unknown.
+char *
+httpcache_get_content_type (httpcache_entry_t *entry);
+
+// Returns the number of the cached bytes starting at pos.
+int64_t
+httpcache_available (httpcache_entry_t *entry, int64_t pos);
+
+// Reads the data reported by httpcache_available.
+// Returns -1 if the data file is damaged, the entry is emptied in that case.
+int64_t
+httpcache_read (httpcache_entry_t *entry, void *buffer, int64_t pos, int64_t size);
+
+int
+httpcache_write (httpcache_entry_t *entry, const void *buffer, int64_t pos, int64_t size);
+
+#endif
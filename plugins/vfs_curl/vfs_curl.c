@@ -29,17 +29,38 @@
 #include <assert.h>
 #include <curl/curlver.h>
 #include <time.h>
+#include <pthread.h>
 #include "../../deadbeef.h"
+#include "httpcache.h"
 
 #define trace(...) { deadbeef->log_detailed (&plugin.plugin, 0, __VA_ARGS__); }
 
 #define min(x,y) ((x)<(y)?(x):(y))
 #define max(x,y) ((x)>(y)?(x):(y))
 
-static DB_functions_t *deadbeef;
+DB_functions_t *deadbeef;
 
-#define BUFFER_SIZE (0x10000)
-#define BUFFER_MASK 0xffff
+// The buffer size is a power of 2. Half of it is filled ahead of the reader,
+// and the other half keeps the data which was already read, for seeking backwards.
+// The buffer grows up to vfs_curl.max_buffer_size when the reader drains it completely,
+// which happens with the high bitrate streams on jittery connections.
+#define MIN_BUFFER_SIZE (0x4000)
+#define DEFAULT_BUFFER_SIZE (0x10000)
+#define DEFAULT_MAX_BUFFER_SIZE (0x100000)
+#define MAX_BUFFER_SIZE (0x1000000)
+
+#define CURL_BUFFER_SIZE (0x8000)
+
+// The seekable files (known length, and the server supports range requests) are read through
+// the disk cache instead of the ring buffer: the http thread stores the data in the cache,
+// and a read of the data which is not cached restarts the download at that position.
+// The range requests carry the etag or the last modification time of the cached file in If-Range,
+// and the cached data is read only after a response of the server has confirmed it.
+// The read-ahead in the cache is max_buffer_size.
+#define DEFAULT_CACHE_SIZE 256 // MiB
+
+// the download skips the cached data, unless it's a small piece, which is cheaper to download again
+#define CACHE_SKIP_SIZE (0x40000)
 
 #define MAX_METADATA 1024
 
@@ -57,17 +78,30 @@ enum {
 typedef struct {
     DB_vfs_t *vfs;
     char *url;
-    uint8_t buffer[BUFFER_SIZE];
+    uint8_t *buffer;
+    int32_t buffer_size;
+    int32_t max_buffer_size;
 
     DB_playItem_t *track;
-    int64_t pos; // position in stream; use "& BUFFER_MASK" to make it index into ringbuffer
+    int64_t pos; // position in stream; use "& (buffer_size-1)" to make it index into ringbuffer
     int64_t length;
     int32_t remaining; // remaining bytes in buffer read from stream
+    int32_t history; // bytes before pos which are still in the buffer
     int64_t skipbytes;
     intptr_t tid; // thread id which does http requests
     intptr_t mutex;
+    uintptr_t cond; // signalled when data arrives, space is freed, or the status changes
+    int32_t writer_need; // free space which the http thread waits for, 0 if it's not waiting
+    uint8_t reader_waiting; // http_read waits for data
+    uint8_t buffer_was_full; // read-ahead reached the limit since the last underrun
+    uint8_t accept_ranges; // the server supports range requests
+    httpcache_entry_t *cache; // set when the data goes through the disk cache instead of the ring buffer
+    uint8_t cache_valid; // the server has confirmed that the cached data is up to date
+    int64_t netpos; // position of the next byte from the http thread, when using the cache
     uint8_t nheaderpackets;
     char *content_type;
+    char *etag; // validators of the current response
+    char *last_modified;
     CURL *curl;
     struct timeval last_read_time;
     uint8_t status;
@@ -120,11 +154,164 @@ http_reg_open_file (DB_FILE *fp);
 static void
 http_unreg_open_file (DB_FILE *fp);
 
+// wakes up the http thread and the readers; must be called with fp->mutex locked
+static void
+http_signal (HTTP_FILE *fp) {
+    deadbeef->cond_broadcast (fp->cond);
+}
+
+// waits for http_signal with fp->mutex locked once;
+// wakes up every second anyway, to check for the abort requests and the timeouts
+static void
+http_wait (HTTP_FILE *fp) {
+    struct timeval tv;
+    gettimeofday (&tv, NULL);
+    struct timespec ts;
+    ts.tv_sec = tv.tv_sec + 1;
+    ts.tv_nsec = tv.tv_usec * 1000;
+    pthread_cond_timedwait ((pthread_cond_t *)fp->cond, (pthread_mutex_t *)fp->mutex, &ts);
+}
+
+static int32_t
+http_readahead_size (HTTP_FILE *fp) {
+    return fp->buffer_size / 2;
+}
+
+// called with fp->mutex locked, after the reader has consumed some data
+static void
+http_consumed (HTTP_FILE *fp, int32_t size) {
+    fp->pos += size;
+    fp->remaining -= size;
+    fp->history = min (fp->history + size, fp->buffer_size - fp->remaining);
+    if (fp->writer_need && http_readahead_size (fp) - fp->remaining >= fp->writer_need) {
+        http_signal (fp);
+    }
+}
+
+// Doubles the buffer, keeping the unread data and the history at their positions;
+// called with fp->mutex locked
+static void
+http_grow_buffer (HTTP_FILE *fp) {
+    if (fp->buffer_size >= fp->max_buffer_size) {
+        return;
+    }
+    int32_t size = fp->buffer_size * 2;
+    uint8_t *buffer = malloc (size);
+    if (!buffer) {
+        return;
+    }
+    int64_t start = fp->pos - fp->history;
+    int32_t n = fp->history + fp->remaining;
+    for (int32_t i = 0; i < n; ) {
+        int32_t from = (start + i) & (fp->buffer_size - 1);
+        int32_t to = (start + i) & (size - 1);
+        int32_t cp = min (n - i, min (fp->buffer_size - from, size - to));
+        memcpy (buffer + to, fp->buffer + from, cp);
+        i += cp;
+    }
+    free (fp->buffer);
+    fp->buffer = buffer;
+    fp->buffer_size = size;
+    trace ("vfs_curl: buffer drained, increased its size to %d bytes\n", size);
+}
+
+static void
+http_start_streamer (HTTP_FILE *fp);
+
+static int64_t
+http_cache_readahead_size (HTTP_FILE *fp) {
+    return fp->max_buffer_size;
+}
+
+// checks whether the http thread is about to download the data at pos;
+// called with fp->mutex locked
+static int
+http_cache_fetching (HTTP_FILE *fp, int64_t pos) {
+    if (fp->status != STATUS_INITIAL && fp->status != STATUS_READING && fp->status != STATUS_SEEK) {
+        return 0;
+    }
+    return fp->tid && pos >= fp->netpos && pos - fp->netpos < http_cache_readahead_size (fp);
+}
+
+// checks whether the http thread needs to continue the download at netpos,
+// otherwise it waits until the reader gets closer; called with fp->mutex locked
+static int
+http_cache_need_fetch (HTTP_FILE *fp) {
+    return fp->netpos < fp->length && fp->netpos - fp->pos < http_cache_readahead_size (fp);
+}
+
+// restarts the download at pos with a range request; called with fp->mutex locked
+static void
+http_cache_fetch (HTTP_FILE *fp, int64_t pos) {
+    if (fp->status == STATUS_ABORTED) {
+        return;
+    }
+    trace ("vfs_curl: fetching %s from %lld\n", fp->url, pos);
+    fp->netpos = pos;
+    if (!fp->tid) {
+        fp->status = STATUS_INITIAL;
+        http_start_streamer (fp);
+    }
+    else {
+        fp->status = STATUS_SEEK;
+        http_signal (fp);
+    }
+}
+
+// called when the response body starts, with fp->mutex locked:
+// switches the seekable files to the disk cache, and checks that the cached file didn't change
+static void
+http_cache_begin (HTTP_FILE *fp) {
+    int seekable = fp->length > 0 && fp->accept_ranges && !fp->icyheader && !fp->icy_metaint;
+    if (fp->cache) {
+        // the requests of the cached files are range requests with If-Range,
+        // so the whole file is sent only if it was changed
+        long response = 0;
+        curl_easy_getinfo (fp->curl, CURLINFO_RESPONSE_CODE, &response);
+        int partial = response == 206;
+        if (partial && httpcache_matches (fp->cache, fp->length, fp->etag, fp->last_modified)) {
+            fp->cache_valid = 1;
+            return;
+        }
+        if (!seekable || (!partial && fp->cache_valid)) {
+            trace ("vfs_curl: %s is not seekable anymore\n", fp->url);
+            fp->status = STATUS_ABORTED;
+            return;
+        }
+        trace ("vfs_curl: %s was changed on the server\n", fp->url);
+        httpcache_reset (fp->cache, fp->length, fp->content_type, fp->etag, fp->last_modified);
+        fp->cache_valid = 1;
+        if (!partial && fp->netpos > 0) {
+            // the response starts at the beginning of the file, request the data at netpos again
+            fp->status = STATUS_SEEK;
+        }
+        return;
+    }
+    // without a validator, the cached data couldn't be checked later
+    if (!seekable || (!fp->etag && !fp->last_modified) || fp->length > httpcache_get_max_size ()) {
+        return;
+    }
+    fp->cache = httpcache_create (fp->url, fp->length, fp->content_type, fp->etag, fp->last_modified);
+    if (!fp->cache) {
+        return;
+    }
+    fp->cache_valid = 1;
+    trace ("vfs_curl: caching %s\n", fp->url);
+    // the request has started at the read position, and the ring buffer is empty
+    fp->netpos = fp->pos;
+    fp->pos += fp->skipbytes;
+    fp->skipbytes = 0;
+    fp->remaining = 0;
+    fp->history = 0;
+    free (fp->buffer);
+    fp->buffer = NULL;
+}
+
 static size_t
-http_curl_write_wrapper (HTTP_FILE *fp, void *ptr, size_t size) {
+http_cache_write (HTTP_FILE *fp, void *ptr, size_t size) {
     size_t avail = size;
+    deadbeef->mutex_lock (fp->mutex);
     while (avail > 0) {
-        deadbeef->mutex_lock (fp->mutex);
         if (fp->status == STATUS_SEEK) {
             trace ("vfs_curl seek request, aborting current request\n");
             deadbeef->mutex_unlock (fp->mutex);
@@ -133,34 +320,169 @@ http_curl_write_wrapper (HTTP_FILE *fp, void *ptr, size_t size) {
         if (http_need_abort ((DB_FILE*)fp)) {
             fp->status = STATUS_ABORTED;
             trace ("vfs_curl STATUS_ABORTED in the middle of packet\n");
+            http_signal (fp);
+            break;
+        }
+        if (fp->netpos >= fp->length) {
+            // more data than expected, drop it
+            avail = 0;
+            break;
+        }
+        int64_t readahead = http_cache_readahead_size (fp) - (fp->netpos - fp->pos);
+        if (readahead <= 0) {
+            fp->writer_need = 1;
+            http_wait (fp);
+            fp->writer_need = 0;
+            gettimeofday (&fp->last_read_time, NULL);
+            continue;
+        }
+        int64_t cached = httpcache_available (fp->cache, fp->netpos);
+        if (cached > 0 && (cached >= CACHE_SKIP_SIZE || fp->netpos + cached >= fp->length)) {
+            trace ("vfs_curl: %lld bytes at %lld are cached, restarting request\n", cached, fp->netpos);
+            fp->netpos += cached;
+            fp->status = STATUS_SEEK;
             deadbeef->mutex_unlock (fp->mutex);
+            return 0;
+        }
+
+        int64_t pos = fp->netpos;
+        int64_t cp = min ((int64_t)avail, min (readahead, fp->length - pos));
+        deadbeef->mutex_unlock (fp->mutex);
+        int res = httpcache_write (fp->cache, ptr, pos, cp);
+        deadbeef->mutex_lock (fp->mutex);
+        if (res < 0) {
+            trace ("vfs_curl: failed to write the cache\n");
+            fp->status = STATUS_ABORTED;
+            http_signal (fp);
             break;
         }
-        int sz = BUFFER_SIZE/2 - fp->remaining; // number of bytes free in buffer
-                                                // don't allow to fill more than half -- used for seeking backwards
+        ptr += cp;
+        avail -= cp;
+        if (fp->status != STATUS_SEEK) {
+            fp->netpos = pos + cp;
+        }
+        if (fp->reader_waiting) {
+            http_signal (fp);
+        }
+    }
+    deadbeef->mutex_unlock (fp->mutex);
+    return size - avail;
+}
 
-        if (sz > 5000) { // wait until there are at least 5k bytes free
-            int cp = min (avail, sz);
-            int writepos = (fp->pos + fp->remaining) & BUFFER_MASK;
-            // copy 1st portion (before end of buffer
-            int part1 = BUFFER_SIZE - writepos;
-            // may not be more than total
-            part1 = min (part1, cp);
-            memcpy (fp->buffer+writepos, ptr, part1);
-            ptr += part1;
-            avail -= part1;
-            fp->remaining += part1;
-            cp -= part1;
-            if (cp > 0) {
-                memcpy (fp->buffer, ptr, cp);
-                ptr += cp;
-                avail -= cp;
-                fp->remaining += cp;
+// reads from the disk cache, and makes the http thread download the missing data;
+// called with fp->mutex locked, returns the number of bytes read
+static size_t
+http_cache_read (HTTP_FILE *fp, uint8_t *ptr, size_t size) {
+    int64_t readahead = http_cache_readahead_size (fp);
+    size_t sz = size;
+    while (sz > 0 && fp->pos < fp->length) {
+        // until the server confirms the cached data, it's requested like the missing data
+        int64_t avail = fp->cache_valid ? httpcache_available (fp->cache, fp->pos) : 0;
+
+        // keep the next missing part of the read-ahead downloading
+        int64_t missing = fp->pos + avail;
+        if (missing < fp->length && missing - fp->pos < readahead && !http_cache_fetching (fp, missing)) {
+            http_cache_fetch (fp, missing);
+        }
+
+        if (avail > 0) {
+            int64_t pos = fp->pos;
+            deadbeef->mutex_unlock (fp->mutex);
+            // on failure the entry is emptied, and the data is downloaded again
+            int64_t rd = httpcache_read (fp->cache, ptr, pos, min (avail, (int64_t)sz));
+            deadbeef->mutex_lock (fp->mutex);
+            if (rd > 0) {
+                fp->pos += rd;
+                ptr += rd;
+                sz -= rd;
+                if (fp->writer_need && fp->netpos - fp->pos < readahead) {
+                    http_signal (fp);
+                }
             }
+            continue;
+        }
+
+        if (fp->status == STATUS_ABORTED) {
+            break;
+        }
+        if (http_need_abort ((DB_FILE *)fp)) {
+            fp->status = STATUS_ABORTED;
+            http_signal (fp);
+            break;
+        }
+        if (fp->status == STATUS_READING) {
+            struct timeval tm;
+            gettimeofday (&tm, NULL);
+            float sec = tm.tv_sec - fp->last_read_time.tv_sec;
+            if (sec > TIMEOUT) {
+                trace ("http_read: timed out, restarting request\n");
+                memcpy (&fp->last_read_time, &tm, sizeof (struct timeval));
+                fp->status = STATUS_SEEK;
+                http_signal (fp);
+            }
+        }
+        fp->reader_waiting = 1;
+        http_wait (fp);
+        fp->reader_waiting = 0;
+    }
+    return size - sz;
+}
+
+static size_t
+http_curl_write_wrapper (HTTP_FILE *fp, void *ptr, size_t size) {
+    if (fp->cache) {
+        return http_cache_write (fp, ptr, size);
+    }
+    size_t avail = size;
+    deadbeef->mutex_lock (fp->mutex);
+    while (avail > 0) {
+        if (fp->status == STATUS_SEEK) {
+            trace ("vfs_curl seek request, aborting current request\n");
+            deadbeef->mutex_unlock (fp->mutex);
+            return 0;
+        }
+        if (http_need_abort ((DB_FILE*)fp)) {
+            fp->status = STATUS_ABORTED;
+            trace ("vfs_curl STATUS_ABORTED in the middle of packet\n");
+            http_signal (fp);
+            break;
+        }
+        int32_t readahead = http_readahead_size (fp);
+        int32_t sz = readahead - fp->remaining; // number of bytes free in buffer
+                                                // don't allow to fill more than half -- used for seeking backwards
+
+        // wait for the reader to free some space, in chunks of 1/8 of read-ahead to avoid waking up too often
+        int32_t need = min (avail, max (readahead / 8, 1));
+        if (sz < need) {
+            fp->buffer_was_full = 1;
+            fp->writer_need = need;
+            http_wait (fp);
+            fp->writer_need = 0;
+            gettimeofday (&fp->last_read_time, NULL);
+            continue;
+        }
+
+        int32_t cp = min (avail, sz);
+        int32_t writepos = (fp->pos + fp->remaining) & (fp->buffer_size - 1);
+        // copy 1st portion (before end of buffer
+        int32_t part1 = fp->buffer_size - writepos;
+        // may not be more than total
+        part1 = min (part1, cp);
+        memcpy (fp->buffer+writepos, ptr, part1);
+        memcpy (fp->buffer, ptr + part1, cp - part1);
+        ptr += cp;
+        avail -= cp;
+        fp->remaining += cp;
+        // the new data replaces the oldest history
+        fp->history = min (fp->history, fp->buffer_size - fp->remaining);
+        if (fp->remaining == readahead) {
+            fp->buffer_was_full = 1;
+        }
+        if (fp->reader_waiting) {
+            http_signal (fp);
         }
-        deadbeef->mutex_unlock (fp->mutex);
-        usleep (3000);
     }
+    deadbeef->mutex_unlock (fp->mutex);
     return size - avail;
 }
 
@@ -302,6 +624,8 @@ http_stream_reset (HTTP_FILE *fp) {
     fp->icyheader = 0;
     fp->gotsomeheader = 0;
     fp->remaining = 0;
+    fp->history = 0;
+    fp->buffer_was_full = 0;
     fp->metadata_size = 0;
     fp->metadata_have_size = 0;
     fp->skipbytes = 0;
@@ -310,6 +634,19 @@ http_stream_reset (HTTP_FILE *fp) {
     fp->wait_meta = 0;
 }
 
+static void
+http_update_status (HTTP_FILE *fp) {
+    deadbeef->mutex_lock (fp->mutex);
+    if (fp->status == STATUS_INITIAL && fp->gotheader) {
+        http_cache_begin (fp);
+        if (fp->status == STATUS_INITIAL) {
+            fp->status = STATUS_READING;
+        }
+        http_signal (fp);
+    }
+    deadbeef->mutex_unlock (fp->mutex);
+}
+
 static size_t
 http_curl_write (void *ptr, size_t size, size_t nmemb, void *stream) {
     int avail = size * nmemb;
@@ -359,15 +696,12 @@ http_curl_write (void *ptr, size_t size, size_t nmemb, void *stream) {
             fp->gotheader = 1;
         }
         if (!avail) {
+            http_update_status (fp);
             return nmemb*size;
         }
     }
 
-    deadbeef->mutex_lock (fp->mutex);
-    if (fp->status == STATUS_INITIAL && fp->gotheader) {
-        fp->status = STATUS_READING;
-    }
-    deadbeef->mutex_unlock (fp->mutex);
+    http_update_status (fp);
 
     while (fp->icy_metaint > 0) {
 //            trace ("wait_meta=%d, avail=%d\n", fp->wait_meta, avail);
@@ -498,6 +832,14 @@ parse_header (const uint8_t *p, const uint8_t *e, uint8_t *key, int keysize, uin
     return v;
 }
 
+// the reader uses the length with fp->mutex locked, when the file is cached
+static void
+http_set_length (HTTP_FILE *fp, int64_t length) {
+    deadbeef->mutex_lock (fp->mutex);
+    fp->length = length;
+    deadbeef->mutex_unlock (fp->mutex);
+}
+
 static size_t
 http_content_header_handler (void *ptr, size_t size, size_t nmemb, void *stream) {
 //    trace ("http_content_header_handler\n");
@@ -513,6 +855,14 @@ http_content_header_handler (void *ptr, size_t size, size_t nmemb, void *stream)
         fp->length = -1;
     }
 
+    // the validators of the previous response, e.g. a redirect, don't apply
+    if (size * nmemb >= 5 && !memcmp (p, "HTTP/", 5)) {
+        free (fp->etag);
+        fp->etag = NULL;
+        free (fp->last_modified);
+        fp->last_modified = NULL;
+    }
+
     while (p < end) {
         if (p <= end - 4) {
             if (!memcmp (p, "\r\n\r\n", 4)) {
@@ -533,7 +883,31 @@ http_content_header_handler (void *ptr, size_t size, size_t nmemb, void *stream)
             fp->content_type = strdup (value);
         }
         else if (!strcasecmp (key, "Content-Length")) {
-            fp->length = atoi (value);
+            // the length of a partial response is the length of the range
+            long response = 0;
+            curl_easy_getinfo (fp->curl, CURLINFO_RESPONSE_CODE, &response);
+            if (response != 206) {
+                http_set_length (fp, atoll ((char *)value));
+            }
+        }
+        else if (!strcasecmp ((const char *)key, "Content-Range")) {
+            // bytes <first>-<last>/<length>
+            const char *total = strchr ((const char *)value, '/');
+            if (total && total[1] != '*') {
+                http_set_length (fp, atoll (total + 1));
+            }
+            fp->accept_ranges = 1;
+        }
+        else if (!strcasecmp ((const char *)key, "Accept-Ranges")) {
+            fp->accept_ranges = !strcasecmp ((const char *)value, "bytes");
+        }
+        else if (!strcasecmp ((const char *)key, "ETag")) {
+            free (fp->etag);
+            fp->etag = strdup ((const char *)value);
+        }
+        else if (!strcasecmp ((const char *)key, "Last-Modified")) {
+            free (fp->last_modified);
+            fp->last_modified = strdup ((const char *)value);
         }
         else if (!strcasecmp (key, "icy-name")) {
             if (fp->track) {
@@ -588,6 +962,7 @@ http_curl_control (void *stream, double dltotal, double dlnow, double ultotal, d
         memcpy (&fp->last_read_time, &tm, sizeof (struct timeval));
         http_stream_reset (fp);
         fp->status = STATUS_SEEK;
+        http_signal (fp);
     }
     else if (fp->status == STATUS_SEEK) {
         trace ("vfs_curl STATUS_SEEK in progress callback\n");
@@ -597,6 +972,7 @@ http_curl_control (void *stream, double dltotal, double dlnow, double ultotal, d
     if (http_need_abort ((DB_FILE *)fp)) {
         fp->status = STATUS_ABORTED;
         trace ("vfs_curl STATUS_ABORTED in progress callback\n");
+        http_signal (fp);
         deadbeef->mutex_unlock (fp->mutex);
         return -1;
     }
@@ -609,15 +985,26 @@ http_destroy (HTTP_FILE *fp) {
     if (fp->content_type) {
         free (fp->content_type);
     }
+    free (fp->etag);
+    free (fp->last_modified);
     if (fp->track) {
         deadbeef->pl_item_unref (fp->track);
     }
     if (fp->url) {
         free (fp->url);
     }
+    if (fp->cond) {
+        deadbeef->cond_free (fp->cond);
+    }
     if (fp->mutex) {
         deadbeef->mutex_free (fp->mutex);
     }
+    if (fp->buffer) {
+        free (fp->buffer);
+    }
+    if (fp->cache) {
+        httpcache_release (fp->cache);
+    }
     free (fp);
 }
 
@@ -626,7 +1013,9 @@ http_thread_func (void *ctx) {
     HTTP_FILE *fp = (HTTP_FILE *)ctx;
     CURL *curl;
     curl = curl_easy_init ();
-    fp->length = -1;
+    if (!fp->cache) {
+        fp->length = -1;
+    }
     fp->status = STATUS_INITIAL;
     fp->curl = curl;
 
@@ -635,6 +1024,10 @@ http_thread_func (void *ctx) {
     trace ("vfs_curl: started loading data %s\n", fp->url);
     for (;;) {
         struct curl_slist *headers = NULL;
+        deadbeef->mutex_lock (fp->mutex);
+        int64_t from = fp->cache ? fp->netpos : fp->pos;
+        fp->accept_ranges = 0;
+        deadbeef->mutex_unlock (fp->mutex);
         curl_easy_reset (curl);
         curl_easy_setopt (curl, CURLOPT_URL, fp->url);
         char ua[100];
@@ -644,7 +1037,7 @@ http_thread_func (void *ctx) {
         curl_easy_setopt (curl, CURLOPT_WRITEFUNCTION, http_curl_write);
         curl_easy_setopt (curl, CURLOPT_WRITEDATA, ctx);
         curl_easy_setopt (curl, CURLOPT_ERRORBUFFER, fp->http_err);
-        curl_easy_setopt (curl, CURLOPT_BUFFERSIZE, BUFFER_SIZE/2);
+        curl_easy_setopt (curl, CURLOPT_BUFFERSIZE, CURL_BUFFER_SIZE);
         curl_easy_setopt (curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
         curl_easy_setopt (curl, CURLOPT_HEADERFUNCTION, http_content_header_handler);
         curl_easy_setopt (curl, CURLOPT_HEADERDATA, ctx);
@@ -656,10 +1049,23 @@ http_thread_func (void *ctx) {
         curl_easy_setopt (curl, CURLOPT_FOLLOWLOCATION, 1);
         curl_easy_setopt (curl, CURLOPT_MAXREDIRS, 10);
         headers = curl_slist_append (headers, "Icy-Metadata:1");
-        curl_easy_setopt (curl, CURLOPT_HTTPHEADER, headers);
-        if (fp->pos > 0 && fp->length >= 0) {
-            curl_easy_setopt (curl, CURLOPT_RESUME_FROM, (long)fp->pos);
+        char range[30];
+        if (fp->cache) {
+            // unlike CURLOPT_RESUME_FROM, doesn't fail when the server sends the whole file
+            snprintf (range, sizeof (range), "%lld-", (long long)from);
+            curl_easy_setopt (curl, CURLOPT_RANGE, range);
+            char *if_range = httpcache_get_if_range (fp->cache);
+            if (if_range) {
+                char header[300];
+                snprintf (header, sizeof (header), "If-Range: %s", if_range);
+                headers = curl_slist_append (headers, header);
+                free (if_range);
+            }
+        }
+        else if (from > 0 && fp->length >= 0) {
+            curl_easy_setopt (curl, CURLOPT_RESUME_FROM_LARGE, (curl_off_t)from);
         }
+        curl_easy_setopt (curl, CURLOPT_HTTPHEADER, headers);
         if (deadbeef->conf_get_int ("network.proxy", 0)) {
             deadbeef->conf_lock ();
             curl_easy_setopt (curl, CURLOPT_PROXY, deadbeef->conf_get_str_fast ("network.proxy.address", ""));
@@ -715,9 +1121,30 @@ http_thread_func (void *ctx) {
             trace ("curl error:\n%s\n", fp->http_err);
         }
         deadbeef->mutex_lock (fp->mutex);
+        if (fp->cache && fp->status != STATUS_SEEK && fp->status != STATUS_ABORTED
+            && fp->netpos == from && fp->netpos < fp->length) {
+            // nothing was received, don't let the reader request the same data again and again
+            trace ("vfs_curl: failed to fetch %s from %lld\n", fp->url, from);
+            fp->status = STATUS_ABORTED;
+            http_signal (fp);
+        }
+        if (fp->cache && fp->status == STATUS_SEEK && !http_cache_need_fetch (fp)) {
+            // the rest of the read-ahead is cached
+            fp->status = STATUS_FINISHED;
+        }
+        if (fp->status != STATUS_SEEK && fp->status != STATUS_ABORTED && !http_need_abort ((DB_FILE *)fp)) {
+            // the reader may still seek outside of the buffered data, which needs a new request
+            trace ("vfs_curl: transfer finished, waiting for seek or close\n");
+            fp->status = STATUS_FINISHED;
+            http_signal (fp);
+            while (fp->status == STATUS_FINISHED && !http_need_abort ((DB_FILE *)fp)) {
+                http_wait (fp);
+            }
+        }
         if (fp->status != STATUS_SEEK) {
             trace ("vfs_curl: break loop\n");
             deadbeef->mutex_unlock (fp->mutex);
+            curl_slist_free_all (headers);
             break;
         }
         else {
@@ -755,12 +1182,34 @@ http_thread_func (void *ctx) {
         trace ("vfs_curl: thread ended normally\n");
         fp->status = STATUS_FINISHED;
     }
+    http_signal (fp);
     deadbeef->mutex_unlock (fp->mutex);
 }
 
+// reads a size in KiB from the config, rounded up to a power of 2
+static int32_t
+http_buffer_size_conf (const char *key, int32_t def, int32_t min_size) {
+    int64_t size = (int64_t)deadbeef->conf_get_int (key, def / 1024) * 1024;
+    int32_t res = min_size;
+    while (res < size && res < MAX_BUFFER_SIZE) {
+        res *= 2;
+    }
+    return res;
+}
+
 static void
 http_start_streamer (HTTP_FILE *fp) {
-    fp->mutex = deadbeef->mutex_create ();
+    if (!fp->cache) {
+        fp->buffer = malloc (fp->buffer_size);
+        if (!fp->buffer) {
+            trace ("vfs_curl: failed to allocate %d bytes for the buffer of %s\n", fp->buffer_size, fp->url);
+            deadbeef->mutex_lock (fp->mutex);
+            fp->status = STATUS_ABORTED;
+            http_signal (fp);
+            deadbeef->mutex_unlock (fp->mutex);
+            return;
+        }
+    }
     fp->tid = deadbeef->thread_start (http_thread_func, fp);
 //    deadbeef->thread_detach (fp->tid);
 }
@@ -779,10 +1228,22 @@ http_open (const char *fname) {
     }
     trace ("http_open\n");
     HTTP_FILE *fp = malloc (sizeof (HTTP_FILE));
-    http_reg_open_file ((DB_FILE *)fp);
     memset (fp, 0, sizeof (HTTP_FILE));
     fp->vfs = &plugin;
     fp->url = strdup (fname);
+    fp->mutex = deadbeef->mutex_create ();
+    fp->cond = deadbeef->cond_create ();
+    fp->buffer_size = http_buffer_size_conf ("vfs_curl.buffer_size", DEFAULT_BUFFER_SIZE, MIN_BUFFER_SIZE);
+    fp->max_buffer_size = http_buffer_size_conf ("vfs_curl.max_buffer_size", DEFAULT_MAX_BUFFER_SIZE, fp->buffer_size);
+
+    fp->cache = httpcache_get (fname);
+    if (fp->cache) {
+        // nothing is downloaded until the reader gets to the data which is not cached
+        trace ("vfs_curl: %s is in the cache\n", fname);
+        fp->length = httpcache_get_length (fp->cache);
+        fp->content_type = httpcache_get_content_type (fp->cache);
+    }
+    http_reg_open_file ((DB_FILE *)fp);
     return (DB_FILE*)fp;
 }
 
@@ -806,8 +1267,8 @@ http_close (DB_FILE *stream) {
         deadbeef->thread_join (fp->tid);
     }
     http_cancel_abort ((DB_FILE *)fp);
-    http_destroy (fp);
     http_unreg_open_file ((DB_FILE *)fp);
+    http_destroy (fp);
     trace ("http_close done\n");
 }
 
@@ -818,73 +1279,91 @@ http_read (void *ptr, size_t size, size_t nmemb, DB_FILE *stream) {
     HTTP_FILE *fp = (HTTP_FILE *)stream;
 //    trace ("http_read %d (status=%d)\n", size*nmemb, fp->status);
     fp->seektoend = 0;
-    if (fp->status == STATUS_ABORTED || (fp->status == STATUS_FINISHED && fp->remaining == 0)) {
-        errno = ECONNABORTED;
-        return 0;
-    }
-    if (!fp->tid) {
+    if (!fp->tid && !fp->cache) {
         http_start_streamer (fp);
     }
 
     size_t sz = size * nmemb;
-    while ((fp->remaining > 0 || fp->status != STATUS_FINISHED && fp->status != STATUS_ABORTED) && sz > 0)
-    {
+    deadbeef->mutex_lock (fp->mutex);
+    if (!fp->cache && (fp->status == STATUS_ABORTED || (fp->status == STATUS_FINISHED && fp->remaining == 0))) {
+        deadbeef->mutex_unlock (fp->mutex);
+        errno = ECONNABORTED;
+        return 0;
+    }
+    while (sz > 0) {
+        if (fp->cache) {
+            // the http thread has switched to the disk cache
+            sz -= http_cache_read (fp, ptr, sz);
+            break;
+        }
+
+        // skip the data up to the position of the forward seek
+        int skip = min (fp->remaining, fp->skipbytes);
+        if (skip > 0) {
+            fp->skipbytes -= skip;
+            http_consumed (fp, skip);
+        }
+
+        if (fp->remaining > 0 && fp->skipbytes == 0) {
+            //trace ("http_read %lld/%lld/%d\n", fp->pos, fp->length, fp->remaining);
+            int cp = min (sz, fp->remaining);
+            int readpos = fp->pos & (fp->buffer_size - 1);
+            int part1 = fp->buffer_size-readpos;
+            part1 = min (part1, cp);
+//            trace ("readpos=%d, remaining=%d, req=%d, cp=%d, part1=%d, part2=%d\n", readpos, fp->remaining, sz, cp, part1, cp-part1);
+            memcpy (ptr, fp->buffer+readpos, part1);
+            memcpy (ptr+part1, fp->buffer, cp-part1);
+            http_consumed (fp, cp);
+            sz -= cp;
+            ptr += cp;
+            continue;
+        }
+
+        if (fp->status == STATUS_FINISHED || fp->status == STATUS_ABORTED) {
+            break;
+        }
+        if (http_need_abort (stream)) {
+            // don't wait for the http thread to notice
+            fp->status = STATUS_ABORTED;
+            http_signal (fp);
+            break;
+        }
+
         // wait until data is available
-        while ((fp->remaining == 0 || fp->skipbytes > 0) && fp->status != STATUS_FINISHED && fp->status != STATUS_ABORTED) {
-//            trace ("vfs_curl: readwait, status: %d..\n", fp->status);
-            deadbeef->mutex_lock (fp->mutex);
-            if (fp->status == STATUS_READING) {
-                struct timeval tm;
-                gettimeofday (&tm, NULL);
-                float sec = tm.tv_sec - fp->last_read_time.tv_sec;
-                if (sec > TIMEOUT) {
-                    trace ("http_read: timed out, restarting read\n");
-                    memcpy (&fp->last_read_time, &tm, sizeof (struct timeval));
-                    http_stream_reset (fp);
-                    fp->status = STATUS_SEEK;
-                    deadbeef->mutex_unlock (fp->mutex);
-                    if (fp->track) { // don't touch streamer if the stream is not assosiated with a track
-                        deadbeef->streamer_reset (1);
-                        continue;
-                    }
-                    errno = ETIMEDOUT;
-                    return 0;
+//        trace ("vfs_curl: readwait, status: %d..\n", fp->status);
+        if (fp->status == STATUS_READING) {
+            struct timeval tm;
+            gettimeofday (&tm, NULL);
+            float sec = tm.tv_sec - fp->last_read_time.tv_sec;
+            if (sec > TIMEOUT) {
+                trace ("http_read: timed out, restarting read\n");
+                memcpy (&fp->last_read_time, &tm, sizeof (struct timeval));
+                http_stream_reset (fp);
+                fp->status = STATUS_SEEK;
+                http_signal (fp);
+                deadbeef->mutex_unlock (fp->mutex);
+                if (fp->track) { // don't touch streamer if the stream is not assosiated with a track
+                    deadbeef->streamer_reset (1);
+                    deadbeef->mutex_lock (fp->mutex);
+                    continue;
                 }
+                errno = ETIMEDOUT;
+                return 0;
             }
-            int skip = min (fp->remaining, fp->skipbytes);
-            if (skip > 0) {
-//                trace ("skipping %d bytes\n");
-                fp->pos += skip;
-                fp->remaining -= skip;
-                fp->skipbytes -= skip;
+            if (fp->buffer_was_full && !fp->skipbytes) {
+                // the reader has drained the full buffer, the stream needs more read-ahead
+                fp->buffer_was_full = 0;
+                http_grow_buffer (fp);
             }
-            deadbeef->mutex_unlock (fp->mutex);
-            usleep (3000);
-        }
-    //    trace ("buffer remaining: %d\n", fp->remaining);
-        deadbeef->mutex_lock (fp->mutex);
-        //trace ("http_read %lld/%lld/%d\n", fp->pos, fp->length, fp->remaining);
-        int cp = min (sz, fp->remaining);
-        int readpos = fp->pos & BUFFER_MASK;
-        int part1 = BUFFER_SIZE-readpos;
-        part1 = min (part1, cp);
-//        trace ("readpos=%d, remaining=%d, req=%d, cp=%d, part1=%d, part2=%d\n", readpos, fp->remaining, sz, cp, part1, cp-part1);
-        memcpy (ptr, fp->buffer+readpos, part1);
-        fp->remaining -= part1;
-        fp->pos += part1;
-        sz -= part1;
-        ptr += part1;
-        cp -= part1;
-        if (cp > 0) {
-            memcpy (ptr, fp->buffer, cp);
-            fp->remaining -= cp;
-            fp->pos += cp;
-            sz -= cp;
-            ptr += cp;
         }
-        deadbeef->mutex_unlock (fp->mutex);
+        fp->reader_waiting = 1;
+        http_wait (fp);
+        fp->reader_waiting = 0;
     }
-    if (fp->status == STATUS_ABORTED) {
+    // the data from the cache is still returned after a failed request, but not after http_abort
+    int aborted = fp->status == STATUS_ABORTED && (!fp->cache || sz == size * nmemb || http_need_abort (stream));
+    deadbeef->mutex_unlock (fp->mutex);
+    if (aborted) {
         errno = ECONNABORTED;
         return 0;
     }
@@ -908,7 +1387,7 @@ http_seek (DB_FILE *stream, int64_t offset, int whence) {
         trace ("vfs_curl: can't seek in curl stream relative to EOF\n");
         return -1;
     }
-    if (!fp->tid) {
+    if (!fp->tid && !fp->cache) {
         if (offset == 0 && (whence == SEEK_SET || whence == SEEK_CUR)) {
             return 0;
         }
@@ -918,6 +1397,22 @@ http_seek (DB_FILE *stream, int64_t offset, int whence) {
         }
     }
     deadbeef->mutex_lock (fp->mutex);
+    if (fp->cache) {
+        // the data is downloaded with a range request if it's not cached, when the reader gets to it
+        if (whence == SEEK_CUR) {
+            offset += fp->pos;
+        }
+        if (offset < 0) {
+            deadbeef->mutex_unlock (fp->mutex);
+            return -1;
+        }
+        fp->pos = offset;
+        if (fp->writer_need) {
+            http_signal (fp);
+        }
+        deadbeef->mutex_unlock (fp->mutex);
+        return 0;
+    }
     if (whence == SEEK_CUR) {
         whence = SEEK_SET;
         offset = fp->pos + offset;
@@ -928,14 +1423,15 @@ http_seek (DB_FILE *stream, int64_t offset, int whence) {
             deadbeef->mutex_unlock (fp->mutex);
             return 0;
         }
-        else if (fp->pos < offset && fp->pos + BUFFER_SIZE > offset) {
+        else if (fp->pos < offset && fp->pos + fp->buffer_size > offset) {
             fp->skipbytes = offset - fp->pos;
             deadbeef->mutex_unlock (fp->mutex);
             return 0;
         }
-        else if (fp->pos-offset >= 0 && fp->pos-offset <= BUFFER_SIZE-fp->remaining) {
+        else if (fp->pos-offset >= 0 && fp->pos-offset <= fp->history) {
             fp->skipbytes = 0;
             fp->remaining += fp->pos - offset;
+            fp->history -= fp->pos - offset;
             fp->pos = offset;
             deadbeef->mutex_unlock (fp->mutex);
             return 0;
@@ -945,6 +1441,7 @@ http_seek (DB_FILE *stream, int64_t offset, int whence) {
     http_stream_reset (fp);
     fp->pos = offset;
     fp->status = STATUS_SEEK;
+    http_signal (fp);
 
     deadbeef->mutex_unlock (fp->mutex);
     return 0;
@@ -965,13 +1462,20 @@ http_rewind (DB_FILE *stream) {
     trace ("http_rewind\n");
     assert (stream);
     HTTP_FILE *fp = (HTTP_FILE *)stream;
-    if (fp->tid) {
-        deadbeef->mutex_lock (fp->mutex);
+    deadbeef->mutex_lock (fp->mutex);
+    if (fp->cache) {
+        fp->pos = 0;
+        if (fp->writer_need) {
+            http_signal (fp);
+        }
+    }
+    else if (fp->tid) {
         fp->status = STATUS_SEEK;
         http_stream_reset (fp);
         fp->pos = 0;
-        deadbeef->mutex_unlock (fp->mutex);
+        http_signal (fp);
     }
+    deadbeef->mutex_unlock (fp->mutex);
 }
 
 static int64_t
@@ -983,12 +1487,17 @@ http_getlength (DB_FILE *stream) {
         trace ("length: -1\n");
         return -1;
     }
+    if (fp->cache) {
+        return fp->length;
+    }
     if (!fp->tid) {
         http_start_streamer (fp);
     }
+    deadbeef->mutex_lock (fp->mutex);
     while (fp->status == STATUS_INITIAL) {
-        usleep (3000);
+        http_wait (fp);
     }
+    deadbeef->mutex_unlock (fp->mutex);
     trace ("length: %lld\n", fp->length);
     return fp->length;
 }
@@ -1001,16 +1510,18 @@ http_get_content_type (DB_FILE *stream) {
     if (fp->status == STATUS_ABORTED) {
         return NULL;
     }
-    if (fp->gotheader) {
+    if (fp->gotheader || fp->cache) {
         return fp->content_type;
     }
     if (!fp->tid) {
         http_start_streamer (fp);
     }
     trace ("http_get_content_type waiting for response...\n");
+    deadbeef->mutex_lock (fp->mutex);
     while (fp->status != STATUS_FINISHED && fp->status != STATUS_ABORTED && !fp->gotheader) {
-        usleep (3000);
+        http_wait (fp);
     }
+    deadbeef->mutex_unlock (fp->mutex);
     return fp->content_type;
 }
 
@@ -1033,6 +1544,14 @@ http_abort (DB_FILE *fp) {
             abort_files[num_abort_files++] = fp;
         }
     }
+    // wake up the http thread and the readers, if the file is still open;
+    // fp->mutex can't be taken here, a missed wakeup is picked up by the periodic check in http_wait
+    for (i = 0; i < num_open_files; i++) {
+        if (open_files[i] == fp) {
+            deadbeef->cond_broadcast (((HTTP_FILE *)fp)->cond);
+            break;
+        }
+    }
     deadbeef->mutex_unlock (biglock);
 }
 
@@ -1116,10 +1635,17 @@ http_unreg_open_file (DB_FILE *fp) {
     deadbeef->mutex_unlock (biglock);
 }
 
+static void
+vfs_curl_apply_cache_size (void) {
+    httpcache_set_max_size ((int64_t)deadbeef->conf_get_int ("vfs_curl.cache_size", DEFAULT_CACHE_SIZE) * 1024 * 1024);
+}
+
 static int
 vfs_curl_start (void) {
     allow_new_streams = 1;
     biglock = deadbeef->mutex_create ();
+    httpcache_init ();
+    vfs_curl_apply_cache_size ();
     return 0;
 }
 
@@ -1130,6 +1656,17 @@ vfs_curl_stop (void) {
         deadbeef->mutex_free (biglock);
         biglock = 0;
     }
+    httpcache_free ();
+    return 0;
+}
+
+static int
+vfs_curl_message (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
+    switch (id) {
+    case DB_EV_CONFIGCHANGED:
+        vfs_curl_apply_cache_size ();
+        break;
+    }
     return 0;
 }
 
@@ -1146,6 +1683,9 @@ http_is_streaming (void) {
 }
 
 static const char settings_dlg[] =
+    "property \"Buffer size (KiB)\" entry vfs_curl.buffer_size 64;\n"
+    "property \"Maximum buffer size for fast streams (KiB)\" entry vfs_curl.max_buffer_size 1024;\n"
+    "property \"Disk cache for seekable files (MiB, 0 to disable)\" entry vfs_curl.cache_size 256;\n"
     "property \"Enable logging\" checkbox vfs_curl.trace 0;\n"
 ;
 
@@ -1185,6 +1725,7 @@ static DB_vfs_t plugin = {
     .plugin.configdialog = settings_dlg,
     .plugin.start = vfs_curl_start,
     .plugin.stop = vfs_curl_stop,
+    .plugin.message = vfs_curl_message,
     .open = http_open,
     .set_track = http_set_track,
     .close = http_close,
@@ -814,6 +814,7 @@ static DB_decoder_t plugin = {
     .plugin.version_major = 1,
     .plugin.version_minor = 0,
     .plugin.type = DB_PLUGIN_DECODER,
+    .plugin.flags = DDB_PLUGIN_FLAG_INSERT_THREADSAFE,
     .plugin.id = "stdogg",
     .plugin.name = "Ogg Vorbis decoder",
     .plugin.descr = "Ogg Vorbis decoder using standard xiph.org libraries",
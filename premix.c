@@ -35,6 +35,34 @@
 #define trace(...) { fprintf(stderr, __VA_ARGS__); }
 //#define trace(fmt,...)
 
+#if defined(__SSE2__)
+#define PCM_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// AVX2 kernels are compiled with the target attribute, and selected at runtime
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && (__GNUC__ >= 5 || defined(__clang__))
+#define PCM_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#define PCM_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+static inline int32_t
+float_to_s32 (float fsample) {
+    // 1.f can't be represented exactly, and needs to be clipped to the max int32
+    if (fsample >= 1.f) {
+        return 0x7fffffff;
+    }
+    else if (fsample < -1.f) {
+        fsample = -1.f;
+    }
+    return (int32_t)(fsample * (float)0x80000000);
+}
+
 
 static inline void
 pcm_write_samples_8_to_8 (const ddb_waveformat_t * restrict inputfmt, const char * restrict input, const ddb_waveformat_t * restrict outputfmt, char * restrict output, int nsamples, int * restrict channelmap, int outputsamplesize) {
@@ -449,14 +477,7 @@ pcm_write_samples_float_to_32 (const ddb_waveformat_t * restrict inputfmt, const
                 continue;
             }
             float fsample = (*((float*)(input + channelmap[c] * 4)));
-            if (fsample > (float)0x7fffffff/0x80000000) {
-                fsample = (float)0x7fffffff/0x80000000;
-            }
-            else if (fsample < -1.f) {
-                fsample = -1.f;
-            }
-            int32_t sample = fsample * (float)0x80000000;
-            *((int32_t *)(output + 4 * c)) = sample;
+            *((int32_t *)(output + 4 * c)) = float_to_s32 (fsample);
         }
         input += 4 * inputfmt->channels;
         output += outputsamplesize;
@@ -525,6 +546,666 @@ remap_fn_t remappers[8][8] = {
     }
 };
 
+// Kernels for the common case, when the input and output have the same channel layout,
+// so that the samples can be converted as a flat array of n = nsamples * channels values.
+typedef void (*pcm_flat_fn_t) (const char * restrict input, char * restrict output, int n);
+
+static void
+pcm_flat_16_to_24 (const char * restrict input, char * restrict output, int n) {
+    for (int i = 0; i < n; i++) {
+        output[0] = 0;
+        output[1] = input[0];
+        output[2] = input[1];
+        input += 2;
+        output += 3;
+    }
+}
+
+static void
+pcm_flat_16_to_32 (const char * restrict input, char * restrict output, int n) {
+    const int16_t *in = (const int16_t *)input;
+    int32_t *out = (int32_t *)output;
+    for (int i = 0; i < n; i++) {
+        out[i] = (int32_t)((uint32_t)(uint16_t)in[i] << 16);
+    }
+}
+
+static void
+pcm_flat_16_to_float (const char * restrict input, char * restrict output, int n) {
+    const int16_t *in = (const int16_t *)input;
+    float *out = (float *)output;
+    for (int i = 0; i < n; i++) {
+        out[i] = in[i] / (float)0x8000;
+    }
+}
+
+static void
+pcm_flat_24_to_16 (const char * restrict input, char * restrict output, int n) {
+    for (int i = 0; i < n; i++) {
+        output[0] = input[1];
+        output[1] = input[2];
+        input += 3;
+        output += 2;
+    }
+}
+
+static void
+pcm_flat_24_to_32 (const char * restrict input, char * restrict output, int n) {
+    for (int i = 0; i < n; i++) {
+        output[0] = 0;
+        output[1] = input[0];
+        output[2] = input[1];
+        output[3] = input[2];
+        input += 3;
+        output += 4;
+    }
+}
+
+static void
+pcm_flat_24_to_float (const char * restrict input, char * restrict output, int n) {
+    float *out = (float *)output;
+    for (int i = 0; i < n; i++) {
+        int32_t sample = ((unsigned char)input[0]) | ((unsigned char)input[1]<<8) | ((signed char)input[2]<<16);
+        out[i] = sample / (float)0x800000;
+        input += 3;
+    }
+}
+
+static void
+pcm_flat_32_to_16 (const char * restrict input, char * restrict output, int n) {
+    const int32_t *in = (const int32_t *)input;
+    int16_t *out = (int16_t *)output;
+    for (int i = 0; i < n; i++) {
+        out[i] = (int16_t)(in[i]>>16);
+    }
+}
+
+static void
+pcm_flat_32_to_24 (const char * restrict input, char * restrict output, int n) {
+    for (int i = 0; i < n; i++) {
+        output[0] = input[1];
+        output[1] = input[2];
+        output[2] = input[3];
+        input += 4;
+        output += 3;
+    }
+}
+
+static void
+pcm_flat_32_to_float (const char * restrict input, char * restrict output, int n) {
+    const int32_t *in = (const int32_t *)input;
+    float *out = (float *)output;
+    for (int i = 0; i < n; i++) {
+        out[i] = in[i] / (float)0x80000000;
+    }
+}
+
+static void
+pcm_flat_float_to_16 (const char * restrict input, char * restrict output, int n) {
+    const float *in = (const float *)input;
+    int16_t *out = (int16_t *)output;
+    fpu_control ctl;
+    fpu_setround (&ctl);
+    for (int i = 0; i < n; i++) {
+        int isample = ftoi (in[i]*0x8000);
+        if (isample > 0x7fff) {
+            isample = 0x7fff;
+        }
+        else if (isample < -0x8000) {
+            isample = -0x8000;
+        }
+        out[i] = (int16_t)isample;
+    }
+    fpu_restore (ctl);
+}
+
+static void
+pcm_flat_float_to_24 (const char * restrict input, char * restrict output, int n) {
+    const float *in = (const float *)input;
+    fpu_control ctl;
+    fpu_setround (&ctl);
+    for (int i = 0; i < n; i++) {
+        int32_t outsample = (int32_t)ftoi (in[i] * 0x800000);
+        if (outsample >= 0x7fffff) {
+            outsample = 0x7fffff;
+        }
+        else if (outsample < -0x800000) {
+            outsample = -0x800000;
+        }
+        output[0] = (outsample&0x0000ff);
+        output[1] = (outsample&0x00ff00)>>8;
+        output[2] = (outsample&0xff0000)>>16;
+        output += 3;
+    }
+    fpu_restore (ctl);
+}
+
+static void
+pcm_flat_float_to_32 (const char * restrict input, char * restrict output, int n) {
+    const float *in = (const float *)input;
+    int32_t *out = (int32_t *)output;
+    for (int i = 0; i < n; i++) {
+        out[i] = float_to_s32 (in[i]);
+    }
+}
+
+// indexed the same way as remappers, same format conversions are done by memcpy
+static const pcm_flat_fn_t flat_converters[8][8] = {
+    [1] = {
+        [2] = pcm_flat_16_to_24,
+        [3] = pcm_flat_16_to_32,
+        [7] = pcm_flat_16_to_float,
+    },
+    [2] = {
+        [1] = pcm_flat_24_to_16,
+        [3] = pcm_flat_24_to_32,
+        [7] = pcm_flat_24_to_float,
+    },
+    [3] = {
+        [1] = pcm_flat_32_to_16,
+        [2] = pcm_flat_32_to_24,
+        [7] = pcm_flat_32_to_float,
+    },
+    [7] = {
+        [1] = pcm_flat_float_to_16,
+        [2] = pcm_flat_float_to_24,
+        [3] = pcm_flat_float_to_32,
+    },
+};
+
+// SIMD versions of the most used flat kernels.
+// Each one converts as many samples as it can in whole vectors,
+// and leaves the rest to the scalar version.
+typedef struct {
+    const char *name;
+    pcm_flat_fn_t s16_to_s32;
+    pcm_flat_fn_t s16_to_float;
+    pcm_flat_fn_t s32_to_s16;
+    pcm_flat_fn_t s32_to_float;
+    pcm_flat_fn_t float_to_s16;
+    pcm_flat_fn_t float_to_s32;
+} pcm_simd_kernels_t;
+
+#if PCM_HAVE_SSE2
+static void
+pcm_flat_16_to_32_sse2 (const char * restrict input, char * restrict output, int n) {
+    const int16_t *in = (const int16_t *)input;
+    int32_t *out = (int32_t *)output;
+    const __m128i zero = _mm_setzero_si128 ();
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i s = _mm_loadu_si128 ((const __m128i *)(in + i));
+        _mm_storeu_si128 ((__m128i *)(out + i), _mm_unpacklo_epi16 (zero, s));
+        _mm_storeu_si128 ((__m128i *)(out + i + 4), _mm_unpackhi_epi16 (zero, s));
+    }
+    pcm_flat_16_to_32 (input + i * 2, output + i * 4, n - i);
+}
+
+static void
+pcm_flat_16_to_float_sse2 (const char * restrict input, char * restrict output, int n) {
+    const int16_t *in = (const int16_t *)input;
+    float *out = (float *)output;
+    const __m128 scale = _mm_set1_ps (1.f / 0x8000);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i s = _mm_loadu_si128 ((const __m128i *)(in + i));
+        // sign-extend by unpacking into the upper halves, and shifting down
+        __m128i lo = _mm_srai_epi32 (_mm_unpacklo_epi16 (s, s), 16);
+        __m128i hi = _mm_srai_epi32 (_mm_unpackhi_epi16 (s, s), 16);
+        _mm_storeu_ps (out + i, _mm_mul_ps (_mm_cvtepi32_ps (lo), scale));
+        _mm_storeu_ps (out + i + 4, _mm_mul_ps (_mm_cvtepi32_ps (hi), scale));
+    }
+    pcm_flat_16_to_float (input + i * 2, output + i * 4, n - i);
+}
+
+static void
+pcm_flat_32_to_16_sse2 (const char * restrict input, char * restrict output, int n) {
+    const int32_t *in = (const int32_t *)input;
+    int16_t *out = (int16_t *)output;
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i a = _mm_srai_epi32 (_mm_loadu_si128 ((const __m128i *)(in + i)), 16);
+        __m128i b = _mm_srai_epi32 (_mm_loadu_si128 ((const __m128i *)(in + i + 4)), 16);
+        _mm_storeu_si128 ((__m128i *)(out + i), _mm_packs_epi32 (a, b));
+    }
+    pcm_flat_32_to_16 (input + i * 4, output + i * 2, n - i);
+}
+
+static void
+pcm_flat_32_to_float_sse2 (const char * restrict input, char * restrict output, int n) {
+    const int32_t *in = (const int32_t *)input;
+    float *out = (float *)output;
+    const __m128 scale = _mm_set1_ps (1.f / 0x80000000);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i s = _mm_loadu_si128 ((const __m128i *)(in + i));
+        _mm_storeu_ps (out + i, _mm_mul_ps (_mm_cvtepi32_ps (s), scale));
+    }
+    pcm_flat_32_to_float (input + i * 4, output + i * 4, n - i);
+}
+
+static void
+pcm_flat_float_to_16_sse2 (const char * restrict input, char * restrict output, int n) {
+    const float *in = (const float *)input;
+    int16_t *out = (int16_t *)output;
+    const __m128 scale = _mm_set1_ps (0x8000);
+    const __m128 lo = _mm_set1_ps (-0x8000);
+    const __m128 hi = _mm_set1_ps (0x7fff);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        // max returns the 2nd operand for NaN, same as the scalar version, which gives -0x8000
+        __m128 a = _mm_min_ps (_mm_max_ps (_mm_mul_ps (_mm_loadu_ps (in + i), scale), lo), hi);
+        __m128 b = _mm_min_ps (_mm_max_ps (_mm_mul_ps (_mm_loadu_ps (in + i + 4), scale), lo), hi);
+        _mm_storeu_si128 ((__m128i *)(out + i), _mm_packs_epi32 (_mm_cvtps_epi32 (a), _mm_cvtps_epi32 (b)));
+    }
+    pcm_flat_float_to_16 (input + i * 4, output + i * 2, n - i);
+}
+
+static void
+pcm_flat_float_to_32_sse2 (const char * restrict input, char * restrict output, int n) {
+    const float *in = (const float *)input;
+    int32_t *out = (int32_t *)output;
+    const __m128 scale = _mm_set1_ps ((float)0x80000000);
+    const __m128 lo = _mm_set1_ps (-1.f);
+    const __m128 hi = _mm_set1_ps (1.f);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 x = _mm_min_ps (_mm_max_ps (_mm_loadu_ps (in + i), lo), hi);
+        __m128i s = _mm_cvttps_epi32 (_mm_mul_ps (x, scale));
+        // 1.f overflows to 0x80000000, flip it to 0x7fffffff
+        s = _mm_xor_si128 (s, _mm_castps_si128 (_mm_cmpge_ps (x, hi)));
+        _mm_storeu_si128 ((__m128i *)(out + i), s);
+    }
+    pcm_flat_float_to_32 (input + i * 4, output + i * 4, n - i);
+}
+
+static const pcm_simd_kernels_t pcm_kernels_sse2 = {
+    .name = "sse2",
+    .s16_to_s32 = pcm_flat_16_to_32_sse2,
+    .s16_to_float = pcm_flat_16_to_float_sse2,
+    .s32_to_s16 = pcm_flat_32_to_16_sse2,
+    .s32_to_float = pcm_flat_32_to_float_sse2,
+    .float_to_s16 = pcm_flat_float_to_16_sse2,
+    .float_to_s32 = pcm_flat_float_to_32_sse2,
+};
+#endif
+
+#if PCM_HAVE_AVX2
+#define PCM_AVX2 __attribute__((target("avx2")))
+
+PCM_AVX2 static void
+pcm_flat_16_to_32_avx2 (const char * restrict input, char * restrict output, int n) {
+    const int16_t *in = (const int16_t *)input;
+    int32_t *out = (int32_t *)output;
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i s = _mm256_cvtepi16_epi32 (_mm_loadu_si128 ((const __m128i *)(in + i)));
+        _mm256_storeu_si256 ((__m256i *)(out + i), _mm256_slli_epi32 (s, 16));
+    }
+    pcm_flat_16_to_32 (input + i * 2, output + i * 4, n - i);
+}
+
+PCM_AVX2 static void
+pcm_flat_16_to_float_avx2 (const char * restrict input, char * restrict output, int n) {
+    const int16_t *in = (const int16_t *)input;
+    float *out = (float *)output;
+    const __m256 scale = _mm256_set1_ps (1.f / 0x8000);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i s = _mm256_cvtepi16_epi32 (_mm_loadu_si128 ((const __m128i *)(in + i)));
+        _mm256_storeu_ps (out + i, _mm256_mul_ps (_mm256_cvtepi32_ps (s), scale));
+    }
+    pcm_flat_16_to_float (input + i * 2, output + i * 4, n - i);
+}
+
+PCM_AVX2 static void
+pcm_flat_32_to_16_avx2 (const char * restrict input, char * restrict output, int n) {
+    const int32_t *in = (const int32_t *)input;
+    int16_t *out = (int16_t *)output;
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i a = _mm256_srai_epi32 (_mm256_loadu_si256 ((const __m256i *)(in + i)), 16);
+        __m256i b = _mm256_srai_epi32 (_mm256_loadu_si256 ((const __m256i *)(in + i + 8)), 16);
+        // packs works within 128 bit lanes, reorder the 64 bit quarters back
+        __m256i s = _mm256_permute4x64_epi64 (_mm256_packs_epi32 (a, b), _MM_SHUFFLE (3, 1, 2, 0));
+        _mm256_storeu_si256 ((__m256i *)(out + i), s);
+    }
+    pcm_flat_32_to_16 (input + i * 4, output + i * 2, n - i);
+}
+
+PCM_AVX2 static void
+pcm_flat_32_to_float_avx2 (const char * restrict input, char * restrict output, int n) {
+    const int32_t *in = (const int32_t *)input;
+    float *out = (float *)output;
+    const __m256 scale = _mm256_set1_ps (1.f / 0x80000000);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i s = _mm256_loadu_si256 ((const __m256i *)(in + i));
+        _mm256_storeu_ps (out + i, _mm256_mul_ps (_mm256_cvtepi32_ps (s), scale));
+    }
+    pcm_flat_32_to_float (input + i * 4, output + i * 4, n - i);
+}
+
+PCM_AVX2 static void
+pcm_flat_float_to_16_avx2 (const char * restrict input, char * restrict output, int n) {
+    const float *in = (const float *)input;
+    int16_t *out = (int16_t *)output;
+    const __m256 scale = _mm256_set1_ps (0x8000);
+    const __m256 lo = _mm256_set1_ps (-0x8000);
+    const __m256 hi = _mm256_set1_ps (0x7fff);
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256 a = _mm256_min_ps (_mm256_max_ps (_mm256_mul_ps (_mm256_loadu_ps (in + i), scale), lo), hi);
+        __m256 b = _mm256_min_ps (_mm256_max_ps (_mm256_mul_ps (_mm256_loadu_ps (in + i + 8), scale), lo), hi);
+        __m256i s = _mm256_packs_epi32 (_mm256_cvtps_epi32 (a), _mm256_cvtps_epi32 (b));
+        s = _mm256_permute4x64_epi64 (s, _MM_SHUFFLE (3, 1, 2, 0));
+        _mm256_storeu_si256 ((__m256i *)(out + i), s);
+    }
+    pcm_flat_float_to_16 (input + i * 4, output + i * 2, n - i);
+}
+
+PCM_AVX2 static void
+pcm_flat_float_to_32_avx2 (const char * restrict input, char * restrict output, int n) {
+    const float *in = (const float *)input;
+    int32_t *out = (int32_t *)output;
+    const __m256 scale = _mm256_set1_ps ((float)0x80000000);
+    const __m256 lo = _mm256_set1_ps (-1.f);
+    const __m256 hi = _mm256_set1_ps (1.f);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 x = _mm256_min_ps (_mm256_max_ps (_mm256_loadu_ps (in + i), lo), hi);
+        __m256i s = _mm256_cvttps_epi32 (_mm256_mul_ps (x, scale));
+        s = _mm256_xor_si256 (s, _mm256_castps_si256 (_mm256_cmp_ps (x, hi, _CMP_GE_OQ)));
+        _mm256_storeu_si256 ((__m256i *)(out + i), s);
+    }
+    pcm_flat_float_to_32 (input + i * 4, output + i * 4, n - i);
+}
+
+static const pcm_simd_kernels_t pcm_kernels_avx2 = {
+    .name = "avx2",
+    .s16_to_s32 = pcm_flat_16_to_32_avx2,
+    .s16_to_float = pcm_flat_16_to_float_avx2,
+    .s32_to_s16 = pcm_flat_32_to_16_avx2,
+    .s32_to_float = pcm_flat_32_to_float_avx2,
+    .float_to_s16 = pcm_flat_float_to_16_avx2,
+    .float_to_s32 = pcm_flat_float_to_32_avx2,
+};
+#endif
+
+#if PCM_HAVE_NEON
+static void
+pcm_flat_16_to_32_neon (const char * restrict input, char * restrict output, int n) {
+    const int16_t *in = (const int16_t *)input;
+    int32_t *out = (int32_t *)output;
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t s = vld1q_s16 (in + i);
+        vst1q_s32 (out + i, vshll_n_s16 (vget_low_s16 (s), 16));
+        vst1q_s32 (out + i + 4, vshll_n_s16 (vget_high_s16 (s), 16));
+    }
+    pcm_flat_16_to_32 (input + i * 2, output + i * 4, n - i);
+}
+
+static void
+pcm_flat_16_to_float_neon (const char * restrict input, char * restrict output, int n) {
+    const int16_t *in = (const int16_t *)input;
+    float *out = (float *)output;
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t s = vld1q_s16 (in + i);
+        vst1q_f32 (out + i, vmulq_n_f32 (vcvtq_f32_s32 (vmovl_s16 (vget_low_s16 (s))), 1.f / 0x8000));
+        vst1q_f32 (out + i + 4, vmulq_n_f32 (vcvtq_f32_s32 (vmovl_s16 (vget_high_s16 (s))), 1.f / 0x8000));
+    }
+    pcm_flat_16_to_float (input + i * 2, output + i * 4, n - i);
+}
+
+static void
+pcm_flat_32_to_16_neon (const char * restrict input, char * restrict output, int n) {
+    const int32_t *in = (const int32_t *)input;
+    int16_t *out = (int16_t *)output;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        vst1_s16 (out + i, vshrn_n_s32 (vld1q_s32 (in + i), 16));
+    }
+    pcm_flat_32_to_16 (input + i * 4, output + i * 2, n - i);
+}
+
+static void
+pcm_flat_32_to_float_neon (const char * restrict input, char * restrict output, int n) {
+    const int32_t *in = (const int32_t *)input;
+    float *out = (float *)output;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        vst1q_f32 (out + i, vmulq_n_f32 (vcvtq_f32_s32 (vld1q_s32 (in + i)), 1.f / 0x80000000));
+    }
+    pcm_flat_32_to_float (input + i * 4, output + i * 4, n - i);
+}
+
+static void
+pcm_flat_float_to_16_neon (const char * restrict input, char * restrict output, int n) {
+    const float *in = (const float *)input;
+    int16_t *out = (int16_t *)output;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        // both conversions saturate
+        int32x4_t s = vcvtnq_s32_f32 (vmulq_n_f32 (vld1q_f32 (in + i), 0x8000));
+        vst1_s16 (out + i, vqmovn_s32 (s));
+    }
+    pcm_flat_float_to_16 (input + i * 4, output + i * 2, n - i);
+}
+
+static void
+pcm_flat_float_to_32_neon (const char * restrict input, char * restrict output, int n) {
+    const float *in = (const float *)input;
+    int32_t *out = (int32_t *)output;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t x = vmaxq_f32 (vld1q_f32 (in + i), vdupq_n_f32 (-1.f));
+        // the conversion saturates, so 1.f gives 0x7fffffff
+        vst1q_s32 (out + i, vcvtq_s32_f32 (vmulq_n_f32 (x, (float)0x80000000)));
+    }
+    pcm_flat_float_to_32 (input + i * 4, output + i * 4, n - i);
+}
+
+static const pcm_simd_kernels_t pcm_kernels_neon = {
+    .name = "neon",
+    .s16_to_s32 = pcm_flat_16_to_32_neon,
+    .s16_to_float = pcm_flat_16_to_float_neon,
+    .s32_to_s16 = pcm_flat_32_to_16_neon,
+    .s32_to_float = pcm_flat_32_to_float_neon,
+    .float_to_s16 = pcm_flat_float_to_16_neon,
+    .float_to_s32 = pcm_flat_float_to_32_neon,
+};
+#endif
+
+static const pcm_simd_kernels_t *
+pcm_simd_kernels (int simd) {
+    switch (simd) {
+#if PCM_HAVE_SSE2
+    case PCM_SIMD_SSE2:
+        return &pcm_kernels_sse2;
+#endif
+#if PCM_HAVE_AVX2
+    case PCM_SIMD_AVX2:
+        return &pcm_kernels_avx2;
+#endif
+#if PCM_HAVE_NEON
+    case PCM_SIMD_NEON:
+        return &pcm_kernels_neon;
+#endif
+    default:
+        return NULL;
+    }
+}
+
+static int
+pcm_simd_supported (int simd) {
+    switch (simd) {
+    case PCM_SIMD_NONE:
+        return 1;
+#if PCM_HAVE_AVX2
+    case PCM_SIMD_AVX2:
+        __builtin_cpu_init ();
+        return __builtin_cpu_supports ("avx2");
+#endif
+    default:
+        return pcm_simd_kernels (simd) != NULL;
+    }
+}
+
+int
+pcm_simd_detect (void) {
+    static const int preference[] = { PCM_SIMD_AVX2, PCM_SIMD_NEON, PCM_SIMD_SSE2 };
+    for (int i = 0; i < (int)(sizeof (preference) / sizeof (preference[0])); i++) {
+        if (pcm_simd_supported (preference[i])) {
+            return preference[i];
+        }
+    }
+    return PCM_SIMD_NONE;
+}
+
+const char *
+pcm_simd_name (int simd) {
+    if (simd == PCM_SIMD_NONE) {
+        return "scalar";
+    }
+    const pcm_simd_kernels_t *k = pcm_simd_kernels (simd);
+    return k ? k->name : NULL;
+}
+
+// selected on the first pcm_convert call
+static int pcm_simd = -1;
+
+int
+pcm_simd_set (int simd) {
+    if (!pcm_simd_supported (simd)) {
+        return -1;
+    }
+    __atomic_store_n (&pcm_simd, simd, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static int
+pcm_get_simd (void) {
+    int simd = __atomic_load_n (&pcm_simd, __ATOMIC_RELAXED);
+    if (simd < 0) {
+        simd = pcm_simd_detect ();
+        __atomic_store_n (&pcm_simd, simd, __ATOMIC_RELAXED);
+    }
+    return simd;
+}
+
+static pcm_flat_fn_t
+pcm_get_flat_converter (int inidx, int outidx) {
+    int simd = pcm_get_simd ();
+    const pcm_simd_kernels_t *k = pcm_simd_kernels (simd);
+    if (k) {
+        switch (inidx << 3 | outidx) {
+        case 1 << 3 | 3:
+            return k->s16_to_s32;
+        case 1 << 3 | 7:
+            return k->s16_to_float;
+        case 3 << 3 | 1:
+            return k->s32_to_s16;
+        case 3 << 3 | 7:
+            return k->s32_to_float;
+        case 7 << 3 | 1:
+            return k->float_to_s16;
+        case 7 << 3 | 3:
+            return k->float_to_s32;
+        }
+    }
+    return flat_converters[inidx][outidx];
+}
+
+// Channel maps are rebuilt only when the channel layout changes.
+// pcm_convert can be called from several threads, so each one gets its own small cache.
+#define CHANNELMAP_CACHE_SIZE 4
+
+typedef struct {
+    int valid;
+    int inchannels;
+    uint32_t inmask;
+    int outchannels;
+    uint32_t outmask;
+    int channelmap[32];
+    uint32_t usedmask; // output channels which get data
+    int identity; // same channels in the same order, no remapping needed
+} pcm_channelmap_t;
+
+static __thread pcm_channelmap_t channelmap_cache[CHANNELMAP_CACHE_SIZE];
+static __thread int channelmap_cache_next;
+
+static void
+pcm_build_channelmap (pcm_channelmap_t *m) {
+    int *channelmap = m->channelmap;
+    for (int i = 0; i < 32; i++) {
+        channelmap[i] = -1;
+    }
+    uint32_t outchannels = 0;
+    uint32_t inputbitmask = 1;
+    for (int i = 0; i < m->inchannels; i++) {
+        // find next input channel
+        while (inputbitmask < 0x80000000 && !(m->inmask & inputbitmask)) {
+            inputbitmask <<= 1;
+        }
+        if (!(m->inmask & inputbitmask)) {
+            trace ("pcm_convert: channelmask doesn't correspond to the inputfmt (channels=%d, channelmask=%X)!\n", m->inchannels, m->inmask);
+            break;
+        }
+        if (m->outmask & inputbitmask) {
+            int o = 0;
+            uint32_t outputbitmask = 1;
+            while (outputbitmask < 0x80000000 && (m->outmask & outputbitmask) != inputbitmask) {
+                outputbitmask <<= 1;
+                o++;
+            }
+            if (!(m->inmask & outputbitmask)) {
+                // no corresponding output channel -- ignore
+                continue;
+            }
+            outchannels |= outputbitmask;
+            channelmap[i] = o; // input channel i going to output channel o
+            //trace ("channelmap[%d]=%d\n", i, o);
+        }
+        else {
+            channelmap[i] = -1;
+        }
+        inputbitmask <<= 1;
+    }
+    m->usedmask = outchannels;
+
+    m->identity = m->inchannels == m->outchannels && outchannels == m->outmask && m->inchannels <= 32;
+    for (int i = 0; m->identity && i < m->outchannels; i++) {
+        if (channelmap[i] != i) {
+            m->identity = 0;
+        }
+    }
+}
+
+static const pcm_channelmap_t *
+pcm_get_channelmap (const ddb_waveformat_t *inputfmt, const ddb_waveformat_t *outputfmt) {
+    for (int i = 0; i < CHANNELMAP_CACHE_SIZE; i++) {
+        pcm_channelmap_t *m = &channelmap_cache[i];
+        if (m->valid
+            && m->inchannels == inputfmt->channels
+            && m->inmask == inputfmt->channelmask
+            && m->outchannels == outputfmt->channels
+            && m->outmask == outputfmt->channelmask) {
+            return m;
+        }
+    }
+    pcm_channelmap_t *m = &channelmap_cache[channelmap_cache_next];
+    channelmap_cache_next = (channelmap_cache_next + 1) % CHANNELMAP_CACHE_SIZE;
+    m->valid = 1;
+    m->inchannels = inputfmt->channels;
+    m->inmask = inputfmt->channelmask;
+    m->outchannels = outputfmt->channels;
+    m->outmask = outputfmt->channelmask;
+    pcm_build_channelmap (m);
+    return m;
+}
+
 int
 pcm_convert (const ddb_waveformat_t * restrict inputfmt, const char * restrict input, const ddb_waveformat_t * restrict outputfmt, char * restrict output, int inputsize) {
     // calculate output size
@@ -535,54 +1216,31 @@ pcm_convert (const ddb_waveformat_t * restrict inputfmt, const char * restrict i
     // The conversion preserves the speaker mapping,
     // which means that if a channel doesn't map to a speaker in the output -- it will be discarded.
 
-    uint32_t outchannels = 0;
-
     if (output) {
-        // build channelmap
-        int channelmap[32];
-        for (int i = 0; i < 32; i++) {
-            channelmap[i] = -1;
-        }
-        uint32_t inputbitmask = 1;
-        for (int i = 0; i < inputfmt->channels; i++) {
-            // find next input channel
-            while (inputbitmask < 0x80000000 && !(inputfmt->channelmask & inputbitmask)) {
-                inputbitmask <<= 1;
-            }
-            if (!(inputfmt->channelmask & inputbitmask)) {
-                trace ("pcm_convert: channelmask doesn't correspond to the inputfmt (channels=%d, channelmask=%X)!\n", inputfmt->channels, inputfmt->channelmask);
-                break;
+        const pcm_channelmap_t *m = pcm_get_channelmap (inputfmt, outputfmt);
+
+        int outidx = ((outputfmt->bps >> 3) - 1) | (outputfmt->is_float << 2);
+        int inidx = ((inputfmt->bps >> 3) - 1) | (inputfmt->is_float << 2);
+
+        if (m->identity) {
+            if (inidx == outidx) {
+                memcpy (output, input, nsamples * outputsamplesize);
+                return nsamples * outputsamplesize;
             }
-            if (outputfmt->channelmask & inputbitmask) {
-                int o = 0;
-                uint32_t outputbitmask = 1;
-                while (outputbitmask < 0x80000000 && (outputfmt->channelmask & outputbitmask) != inputbitmask) {
-                    outputbitmask <<= 1;
-                    o++;
-                }
-                if (!(inputfmt->channelmask & outputbitmask)) {
-                    // no corresponding output channel -- ignore
-                    continue;
-                }
-                outchannels |= outputbitmask;
-                channelmap[i] = o; // input channel i going to output channel o
-                //trace ("channelmap[%d]=%d\n", i, o);
-            }
-            else {
-                channelmap[i] = -1;
+            pcm_flat_fn_t flat = pcm_get_flat_converter (inidx, outidx);
+            if (flat) {
+                flat (input, output, nsamples * outputfmt->channels);
+                return nsamples * outputsamplesize;
             }
-            inputbitmask <<= 1;
         }
 
-        if (outchannels != outputfmt->channelmask) {
+        if (m->usedmask != outputfmt->channelmask) {
             // some of the channels are not used
             memset (output, 0, nsamples * outputsamplesize);
         }
 
-        int outidx = ((outputfmt->bps >> 3) - 1) | (outputfmt->is_float << 2);
-        int inidx = ((inputfmt->bps >> 3) - 1) | (inputfmt->is_float << 2);
         if (remappers[inidx][outidx]) {
-            remappers[inidx][outidx] (inputfmt, input, outputfmt, output, nsamples, channelmap, outputsamplesize);
+            remappers[inidx][outidx] (inputfmt, input, outputfmt, output, nsamples, (int *)m->channelmap, outputsamplesize);
         }
         else {
             trace ("no converter from %d %s to %d %s ([%d][%d])\n", inputfmt->bps, inputfmt->is_float ? "float" : "", outputfmt->bps, outputfmt->is_float ? "float" : "", inidx, outidx);
@@ -591,3 +1249,236 @@ pcm_convert (const ddb_waveformat_t * restrict inputfmt, const char * restrict i
     return nsamples * outputsamplesize;
 }
 
+// TPDF dither: the difference of two uniform random values, in (-1, 1) LSB.
+// The generator state is per thread, since the gain can be applied from several threads.
+static __thread uint32_t dither_state[4] = { 0x9e3779b9, 0x7f4a7c15, 0x85ebca6b, 0xc2b2ae35 };
+
+static inline float
+dither_next (void) {
+    uint32_t x = dither_state[0];
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    dither_state[0] = x;
+    return ((int32_t)(x & 0xffff) - (int32_t)(x >> 16)) * (1.f / 0x10000);
+}
+
+static void
+pcm_gain_8 (char *bytes, int n, float gain) {
+    int8_t *s = (int8_t *)bytes;
+    fpu_control ctl;
+    fpu_setround (&ctl);
+    for (int i = 0; i < n; i++) {
+        int sample = ftoi (s[i] * gain + dither_next ());
+        if (sample > 0x7f) {
+            sample = 0x7f;
+        }
+        else if (sample < -0x80) {
+            sample = -0x80;
+        }
+        s[i] = (int8_t)sample;
+    }
+    fpu_restore (ctl);
+}
+
+static void
+pcm_gain_16 (char *bytes, int n, float gain) {
+    int16_t *s = (int16_t *)bytes;
+    fpu_control ctl;
+    fpu_setround (&ctl);
+    for (int i = 0; i < n; i++) {
+        int sample = ftoi (s[i] * gain + dither_next ());
+        if (sample > 0x7fff) {
+            sample = 0x7fff;
+        }
+        else if (sample < -0x8000) {
+            sample = -0x8000;
+        }
+        s[i] = (int16_t)sample;
+    }
+    fpu_restore (ctl);
+}
+
+static void
+pcm_gain_24 (char *bytes, int n, float gain) {
+    fpu_control ctl;
+    fpu_setround (&ctl);
+    for (int i = 0; i < n; i++) {
+        int32_t sample = ((unsigned char)bytes[0]) | ((unsigned char)bytes[1]<<8) | ((signed char)bytes[2]<<16);
+        sample = ftoi (sample * gain + dither_next ());
+        if (sample > 0x7fffff) {
+            sample = 0x7fffff;
+        }
+        else if (sample < -0x800000) {
+            sample = -0x800000;
+        }
+        bytes[0] = (sample&0x0000ff);
+        bytes[1] = (sample&0x00ff00)>>8;
+        bytes[2] = (sample&0xff0000)>>16;
+        bytes += 3;
+    }
+    fpu_restore (ctl);
+}
+
+// 32 bit samples are scaled in double precision without dither,
+// the rounding error at that depth is far below any DAC noise floor
+static void
+pcm_gain_32 (char *bytes, int n, float gain) {
+    int32_t *s = (int32_t *)bytes;
+    double g = gain;
+    for (int i = 0; i < n; i++) {
+        double sample = s[i] * g;
+        if (sample > 0x7fffffff) {
+            sample = 0x7fffffff;
+        }
+        else if (sample < -(double)0x80000000) {
+            sample = -(double)0x80000000;
+        }
+        s[i] = (int32_t)sample;
+    }
+}
+
+static void
+pcm_gain_float (char *bytes, int n, float gain) {
+    float *s = (float *)bytes;
+    if (gain > 1.f) {
+        // only amplification can push the samples out of range
+        for (int i = 0; i < n; i++) {
+            float sample = s[i] * gain;
+            s[i] = sample > 1.f ? 1.f : sample < -1.f ? -1.f : sample;
+        }
+    }
+    else {
+        for (int i = 0; i < n; i++) {
+            s[i] *= gain;
+        }
+    }
+}
+
+#if PCM_HAVE_SSE2
+static inline __m128
+dither_next_sse2 (__m128i *state) {
+    __m128i x = *state;
+    x = _mm_xor_si128 (x, _mm_slli_epi32 (x, 13));
+    x = _mm_xor_si128 (x, _mm_srli_epi32 (x, 17));
+    x = _mm_xor_si128 (x, _mm_slli_epi32 (x, 5));
+    *state = x;
+    __m128i d = _mm_sub_epi32 (_mm_and_si128 (x, _mm_set1_epi32 (0xffff)), _mm_srli_epi32 (x, 16));
+    return _mm_mul_ps (_mm_cvtepi32_ps (d), _mm_set1_ps (1.f / 0x10000));
+}
+
+static void
+pcm_gain_16_sse2 (char *bytes, int n, float gain) {
+    int16_t *s = (int16_t *)bytes;
+    const __m128 g = _mm_set1_ps (gain);
+    const __m128 lo = _mm_set1_ps (-0x8000);
+    const __m128 hi = _mm_set1_ps (0x7fff);
+    __m128i state = _mm_loadu_si128 ((__m128i *)dither_state);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128 ((__m128i *)(s + i));
+        __m128 a = _mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpacklo_epi16 (v, v), 16));
+        __m128 b = _mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpackhi_epi16 (v, v), 16));
+        a = _mm_add_ps (_mm_mul_ps (a, g), dither_next_sse2 (&state));
+        b = _mm_add_ps (_mm_mul_ps (b, g), dither_next_sse2 (&state));
+        a = _mm_min_ps (_mm_max_ps (a, lo), hi);
+        b = _mm_min_ps (_mm_max_ps (b, lo), hi);
+        _mm_storeu_si128 ((__m128i *)(s + i), _mm_packs_epi32 (_mm_cvtps_epi32 (a), _mm_cvtps_epi32 (b)));
+    }
+    _mm_storeu_si128 ((__m128i *)dither_state, state);
+    pcm_gain_16 (bytes + i * 2, n - i, gain);
+}
+
+static void
+pcm_gain_float_sse2 (char *bytes, int n, float gain) {
+    float *s = (float *)bytes;
+    const __m128 g = _mm_set1_ps (gain);
+    int i = 0;
+    if (gain > 1.f) {
+        const __m128 lo = _mm_set1_ps (-1.f);
+        const __m128 hi = _mm_set1_ps (1.f);
+        for (; i + 4 <= n; i += 4) {
+            __m128 x = _mm_mul_ps (_mm_loadu_ps (s + i), g);
+            _mm_storeu_ps (s + i, _mm_min_ps (_mm_max_ps (x, lo), hi));
+        }
+    }
+    else {
+        for (; i + 4 <= n; i += 4) {
+            _mm_storeu_ps (s + i, _mm_mul_ps (_mm_loadu_ps (s + i), g));
+        }
+    }
+    pcm_gain_float (bytes + i * 4, n - i, gain);
+}
+#endif
+
+static int
+pcm_is_silent (const char *bytes, int size) {
+    int i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t x;
+        memcpy (&x, bytes + i, 8);
+        if (x) {
+            return 0;
+        }
+    }
+    for (; i < size; i++) {
+        if (bytes[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void
+pcm_apply_gain (const ddb_waveformat_t *fmt, char *bytes, int size, float gain) {
+    if (gain == 1.f) {
+        return;
+    }
+    int samplesize = fmt->bps >> 3;
+    if (!samplesize) {
+        return;
+    }
+    int n = size / samplesize;
+    if (gain <= 0.f) {
+        memset (bytes, 0, n * samplesize);
+        return;
+    }
+    if (!fmt->is_float && fmt->bps != 32 && pcm_is_silent (bytes, n * samplesize)) {
+        // digital silence stays silent, rather than turning into dither noise
+        return;
+    }
+
+    int simd = pcm_get_simd ();
+
+    switch (fmt->bps) {
+    case 8:
+        pcm_gain_8 (bytes, n, gain);
+        break;
+    case 16:
+#if PCM_HAVE_SSE2
+        if (simd != PCM_SIMD_NONE) {
+            pcm_gain_16_sse2 (bytes, n, gain);
+            break;
+        }
+#endif
+        pcm_gain_16 (bytes, n, gain);
+        break;
+    case 24:
+        pcm_gain_24 (bytes, n, gain);
+        break;
+    case 32:
+        if (fmt->is_float) {
+#if PCM_HAVE_SSE2
+            if (simd != PCM_SIMD_NONE) {
+                pcm_gain_float_sse2 (bytes, n, gain);
+                break;
+            }
+#endif
+            pcm_gain_float (bytes, n, gain);
+        }
+        else {
+            pcm_gain_32 (bytes, n, gain);
+        }
+        break;
+    }
+}
@@ -32,4 +32,32 @@
 int
 pcm_convert (const ddb_waveformat_t * restrict inputfmt, const char * restrict input, const ddb_waveformat_t * restrict outputfmt, char * restrict output, int inputsize);
 
+// Multiply the samples by gain, in place; gain 0 produces silence.
+// Integer samples are scaled in floating point, and get TPDF dither, except 32 bit,
+// and blocks of digital silence are left untouched.
+void
+pcm_apply_gain (const ddb_waveformat_t *fmt, char *bytes, int size, float gain);
+
+// Kernel sets for the common format conversions,
+// pcm_convert uses the best one supported by the CPU by default.
+enum {
+    PCM_SIMD_NONE,
+    PCM_SIMD_SSE2,
+    PCM_SIMD_AVX2,
+    PCM_SIMD_NEON,
+};
+
+// returns the best kernel set supported by the CPU
+int
+pcm_simd_detect (void);
+
+// returns the name of the kernel set, or NULL if it isn't built
+const char *
+pcm_simd_name (int simd);
+
+// override the kernel set used by pcm_convert, e.g. for benchmarking;
+// returns -1 if it's not supported
+int
+pcm_simd_set (int simd);
+
 #endif
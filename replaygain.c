@@ -31,29 +31,13 @@
 #include "replaygain.h"
 #include "conf.h"
 #include "common.h"
+#include "premix.h"
 
 static ddb_replaygain_settings_t current_settings;
 
 void
 replaygain_apply_with_settings (ddb_replaygain_settings_t *settings, ddb_waveformat_t *fmt, char *bytes, int numbytes) {
-    if (settings->processing_flags == 0) {
-        return;
-    }
-    if (fmt->bps == 16) {
-        apply_replay_gain_int16 (settings, bytes, numbytes);
-    }
-    else if (fmt->bps == 24) {
-        apply_replay_gain_int24 (settings, bytes, numbytes);
-    }
-    else if (fmt->bps == 8) {
-        apply_replay_gain_int8 (settings, bytes, numbytes);
-    }
-    else if (fmt->bps == 32 && !fmt->is_float) {
-        apply_replay_gain_int32 (settings, bytes, numbytes);
-    }
-    else if (fmt->bps == 32 && fmt->is_float) {
-        apply_replay_gain_float32 (settings, bytes, numbytes);
-    }
+    pcm_apply_gain (fmt, bytes, numbytes, replaygain_get_scale (settings));
 }
 
 void
@@ -141,166 +125,80 @@ _get_source_mode (int mode) {
     }
 }
 
-static inline int
-get_int_volume (ddb_replaygain_settings_t *settings) {
-    int vol = 1000;
+float
+replaygain_get_scale (ddb_replaygain_settings_t *settings) {
+    if (settings->processing_flags == 0) {
+        return 1.f;
+    }
 
+    float vol = 1.f;
     int mode = _get_source_mode (settings->source_mode);
     switch (mode) {
     case DDB_RG_SOURCE_MODE_TRACK:
         if (!settings->has_track_gain) {
-            vol = settings->preamp_without_rg * 1000;
+            vol = settings->preamp_without_rg;
         } else {
-            vol = settings->preamp_with_rg * settings->trackgain * 1000;
+            vol = settings->preamp_with_rg * settings->trackgain;
         }
         if (settings->processing_flags & DDB_RG_PROCESSING_PREVENT_CLIPPING) {
-            if (vol * settings->trackpeak > 1000) {
-                vol = 1000 / settings->trackpeak;
+            if (vol * settings->trackpeak > 1.f) {
+                vol = 1.f / settings->trackpeak;
             }
         }
         break;
     case DDB_RG_SOURCE_MODE_ALBUM:
         if (!settings->has_album_gain) {
-            vol = settings->preamp_without_rg *  1000;
+            vol = settings->preamp_without_rg;
         } else {
-            vol = settings->preamp_with_rg * settings->albumgain * 1000;
+            vol = settings->preamp_with_rg * settings->albumgain;
         }
         if (settings->processing_flags & DDB_RG_PROCESSING_PREVENT_CLIPPING) {
-            if (vol * settings->albumpeak > 1000) {
-                vol = 1000 / settings->albumpeak;
+            if (vol * settings->albumpeak > 1.f) {
+                vol = 1.f / settings->albumpeak;
             }
         }
         break;
     default:
         break;
     }
-    return vol == 1000 ? -1 : vol;
+    return vol;
+}
+
+float
+replaygain_get_current_scale (void) {
+    return replaygain_get_scale (&current_settings);
+}
+
+static void
+apply_replay_gain (ddb_replaygain_settings_t *settings, int bps, int is_float, char *bytes, int size) {
+    ddb_waveformat_t fmt = {
+        .bps = bps,
+        .is_float = is_float,
+    };
+    pcm_apply_gain (&fmt, bytes, size, replaygain_get_scale (settings));
 }
 
 void
 apply_replay_gain_int8 (ddb_replaygain_settings_t *settings, char *bytes, int size) {
-    int vol = get_int_volume (settings);
-    if (vol < 0) {
-        return;
-    }
-    int8_t *s = (int8_t*)bytes;
-    for (int j = 0; j < size; j++) {
-        int32_t sample = ((int8_t)(*s)) * vol / 1000;
-        if (sample > 0x7f) {
-            sample = 0x7f;
-        }
-        else if (sample < -0x80) {
-            sample = -0x80;
-        }
-        *s = (int8_t)sample;
-        s++;
-    }
+    apply_replay_gain (settings, 8, 0, bytes, size);
 }
 
 void
 apply_replay_gain_int16 (ddb_replaygain_settings_t *settings, char *bytes, int size) {
-    int vol = get_int_volume (settings);
-    if (vol < 0) {
-        return;
-    }
-    int16_t *s = (int16_t*)bytes;
-    for (int j = 0; j < size/2; j++) {
-        int32_t sample = ((int32_t)(*s)) * vol / 1000;
-        if (sample > 0x7fff) {
-            sample = 0x7fff;
-        }
-        else if (sample < -0x8000) {
-            sample = -0x8000;
-        }
-        *s = (int16_t)sample;
-        s++;
-    }
+    apply_replay_gain (settings, 16, 0, bytes, size);
 }
 
 void
 apply_replay_gain_int24 (ddb_replaygain_settings_t *settings, char *bytes, int size) {
-    int64_t vol = get_int_volume (settings);
-    if (vol < 0) {
-        return;
-    }
-    char *s = (char*)bytes;
-    for (int j = 0; j < size/3; j++) {
-        int32_t sample = ((unsigned char)s[0]) | ((unsigned char)s[1]<<8) | ((signed char)s[2]<<16);
-        sample = (int32_t)(sample * vol / 1000);
-        if (sample > 0x7fffff) {
-            sample = 0x7fffff;
-        }
-        else if (sample < -0x800000) {
-            sample = -0x800000;
-        }
-        s[0] = (sample&0x0000ff);
-        s[1] = (sample&0x00ff00)>>8;
-        s[2] = (sample&0xff0000)>>16;
-        s += 3;
-    }
+    apply_replay_gain (settings, 24, 0, bytes, size);
 }
 
 void
 apply_replay_gain_int32 (ddb_replaygain_settings_t *settings, char *bytes, int size) {
-    int64_t vol = get_int_volume (settings);
-    if (vol < 0) {
-        return;
-    }
-    int32_t *s = (int32_t*)bytes;
-    for (int j = 0; j < size/4; j++) {
-        int64_t sample = ((int32_t)(*s)) * vol / 1000;
-        *s = (int32_t)sample;
-        s++;
-    }
+    apply_replay_gain (settings, 32, 0, bytes, size);
 }
 
 void
 apply_replay_gain_float32 (ddb_replaygain_settings_t *settings, char *bytes, int size) {
-    float vol = 1.f;
-    int mode = _get_source_mode (settings->source_mode);
-    switch (mode) {
-    case DDB_RG_SOURCE_MODE_TRACK:
-        if (!settings->has_track_gain) {
-            vol = settings->preamp_without_rg;
-        } else {
-            vol = settings->preamp_with_rg * settings->trackgain;
-        }
-        if (settings->processing_flags & DDB_RG_PROCESSING_PREVENT_CLIPPING) {
-            if (vol * settings->trackpeak > 1.f) {
-                vol = 1.f / settings->trackpeak;
-            }
-        }
-        break;
-    case DDB_RG_SOURCE_MODE_ALBUM:
-        if (!settings->has_album_gain) {
-            vol = settings->preamp_without_rg;
-        } else {
-            vol = settings->preamp_with_rg * settings->albumgain;
-        }
-        if (settings->processing_flags & DDB_RG_PROCESSING_PREVENT_CLIPPING) {
-            if (vol * settings->albumpeak > 1.f) {
-                vol = 1.f / settings->albumpeak;
-            }
-        }
-        break;
-    default:
-        break;
-    }
-
-    if (vol == 1) {
-        return;
-    }
-
-    float *s = (float*)bytes;
-    for (int j = 0; j < size/4; j++) {
-        float sample = ((float)*s) * vol;
-        if (sample > 1.f) {
-            sample = 1.f;
-        }
-        else if (sample < -1.f) {
-            sample = -1.f;
-        }
-        *s = sample;
-        s++;
-    }
+    apply_replay_gain (settings, 32, 1, bytes, size);
 }
@@ -41,6 +41,14 @@ replaygain_apply_with_settings (ddb_replaygain_settings_t *settings, ddb_wavefor
 void
 replaygain_set_current (ddb_replaygain_settings_t *settings);
 
+// returns the amplitude scale for the settings, 1 if no gain needs to be applied
+float
+replaygain_get_scale (ddb_replaygain_settings_t *settings);
+
+// same, for the settings of the track being streamed
+float
+replaygain_get_current_scale (void);
+
 void
 apply_replay_gain_int8 (ddb_replaygain_settings_t *settings, char *bytes, int size);
 
@@ -2,7 +2,7 @@
   This file is part of Deadbeef Player source code
   http://deadbeef.sourceforge.net
 
-  basic ring buffer implementation
+  lock-free single-producer/single-consumer ring buffer
 
   Copyright (C) 2009-2013 Alexey Yakovenko
 
@@ -28,66 +28,95 @@
 #include <string.h>
 #include "ringbuf.h"
 
+// head and tail are running byte counters, which are allowed to wrap around;
+// each side publishes its own counter with release semantics,
+// and reads the other side's counter with acquire semantics,
+// so that the data is visible before the counter which covers it.
+
 void
 ringbuf_init (ringbuf_t *p, char *buffer, size_t size) {
     memset (p, 0, sizeof (ringbuf_t));
     p->bytes = buffer;
-    p->cursor = 0;
     p->size = size;
-    p->remaining = 0;
+}
+
+size_t
+ringbuf_read_space (ringbuf_t *p) {
+    size_t head = __atomic_load_n (&p->head, __ATOMIC_ACQUIRE);
+    size_t tail = __atomic_load_n (&p->tail, __ATOMIC_RELAXED);
+    return head - tail;
+}
+
+size_t
+ringbuf_write_space (ringbuf_t *p) {
+    size_t head = __atomic_load_n (&p->head, __ATOMIC_RELAXED);
+    size_t tail = __atomic_load_n (&p->tail, __ATOMIC_ACQUIRE);
+    return p->size - (head - tail);
 }
 
 int
 ringbuf_write (ringbuf_t *p, char *bytes, size_t size) {
-    if (p->size - p->remaining < size) {
+    if (ringbuf_write_space (p) < size) {
         return -1;
     }
 
-    size_t cursor = p->cursor + p->remaining;
-    cursor %= p->size;
+    size_t head = __atomic_load_n (&p->head, __ATOMIC_RELAXED);
+    size_t cursor = head % p->size;
 
-    if (p->size - cursor >= size) { // split
+    if (p->size - cursor >= size) {
         memcpy (p->bytes + cursor, bytes, size);
-        p->remaining += size;
     }
-    else {
+    else { // split
         size_t n = p->size - cursor;
-        if (n > 0) {
-            memcpy (p->bytes + cursor, bytes, n);
-            p->remaining += n;
-            size -= n;
-            bytes += n;
-        }
-        memcpy (p->bytes, bytes, size);
-        p->remaining += size;
+        memcpy (p->bytes + cursor, bytes, n);
+        memcpy (p->bytes, bytes + n, size - n);
     }
+
+    __atomic_store_n (&p->head, head + size, __ATOMIC_RELEASE);
     return 0;
 }
 
+char *
+ringbuf_write_ptr (ringbuf_t *p, size_t *size) {
+    size_t space = ringbuf_write_space (p);
+    size_t head = __atomic_load_n (&p->head, __ATOMIC_RELAXED);
+    size_t cursor = head % p->size;
+    size_t contiguous = p->size - cursor;
+    *size = space < contiguous ? space : contiguous;
+    return p->bytes + cursor;
+}
+
+void
+ringbuf_write_commit (ringbuf_t *p, size_t size) {
+    size_t head = __atomic_load_n (&p->head, __ATOMIC_RELAXED);
+    __atomic_store_n (&p->head, head + size, __ATOMIC_RELEASE);
+}
+
 int
 ringbuf_read (ringbuf_t *p, char *bytes, size_t size) {
-    if (p->remaining < size) {
-        size = p->remaining;
+    size_t remaining = ringbuf_read_space (p);
+    if (remaining < size) {
+        size = remaining;
     }
-    int rb = size;
 
-    if (p->size - p->cursor >= size) {
-        memcpy (bytes, p->bytes + p->cursor, size);
-        p->cursor += size;
-        p->remaining -= size;
+    size_t tail = __atomic_load_n (&p->tail, __ATOMIC_RELAXED);
+    size_t cursor = tail % p->size;
+
+    if (p->size - cursor >= size) {
+        memcpy (bytes, p->bytes + cursor, size);
     }
-    else {
-        size_t n = p->size - p->cursor;
-        if (n > 0) {
-            memcpy (bytes, p->bytes + p->cursor, n);
-            p->cursor += n;
-            p->remaining -= n;
-            bytes += n;
-            size -= n;
-        }
-        memcpy (bytes, p->bytes, size);
-        p->cursor = size;
-        p->remaining -= size;
+    else { // split
+        size_t n = p->size - cursor;
+        memcpy (bytes, p->bytes + cursor, n);
+        memcpy (bytes + n, p->bytes, size - n);
     }
-    return rb;
+
+    __atomic_store_n (&p->tail, tail + size, __ATOMIC_RELEASE);
+    return (int)size;
+}
+
+void
+ringbuf_flush (ringbuf_t *p) {
+    size_t head = __atomic_load_n (&p->head, __ATOMIC_ACQUIRE);
+    __atomic_store_n (&p->tail, head, __ATOMIC_RELEASE);
 }
@@ -29,20 +29,50 @@
 
 #include <sys/types.h>
 
+// Lock-free ring buffer for exactly one producer and one consumer thread.
+// ringbuf_write, ringbuf_write_ptr, ringbuf_write_commit and ringbuf_write_space may only be called by the producer,
+// ringbuf_read, ringbuf_read_space and ringbuf_flush only by the consumer.
+
+#define RINGBUF_CACHELINE 64
+
 typedef struct {
     char *bytes;
     size_t size;
-    size_t cursor;
-    size_t remaining;
+    // total number of bytes written, only modified by the producer
+    size_t head __attribute__((aligned(RINGBUF_CACHELINE)));
+    // total number of bytes read, only modified by the consumer
+    size_t tail __attribute__((aligned(RINGBUF_CACHELINE)));
+    char _pad[RINGBUF_CACHELINE - sizeof (size_t)];
 } ringbuf_t;
 
 void
 ringbuf_init (ringbuf_t *p, char *buffer, size_t size);
 
+// write all of the bytes, or nothing; returns -1 if there's not enough space
 int
 ringbuf_write (ringbuf_t *p, char *bytes, size_t size);
 
+// get the contiguous free space at the write position, for writing into the ring directly;
+// *size is set to the number of bytes which may be written, and can be less than the total free space
+char *
+ringbuf_write_ptr (ringbuf_t *p, size_t *size);
+
+// publish size bytes, written to the pointer returned by ringbuf_write_ptr
+void
+ringbuf_write_commit (ringbuf_t *p, size_t size);
+
+// read up to size bytes, returns the number of bytes read
 int
 ringbuf_read (ringbuf_t *p, char *bytes, size_t size);
 
+size_t
+ringbuf_read_space (ringbuf_t *p);
+
+size_t
+ringbuf_write_space (ringbuf_t *p);
+
+// drop everything that was written so far
+void
+ringbuf_flush (ringbuf_t *p);
+
 #endif
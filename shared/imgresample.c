@@ -0,0 +1,542 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2018 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "imgresample.h"
+
+#if defined(__SSE2__)
+#define IMG_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// AVX2 kernels are compiled with the target attribute, and selected at runtime
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && (__GNUC__ >= 5 || defined(__clang__))
+#define IMG_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+
+// The filter weights are Q14, and the horizontally filtered rows keep 7 fractional bits,
+// so both passes fit 16 bit multiplies with 32 bit sums.
+#define WEIGHT_BITS 14
+#define HROW_BITS 7
+
+// the source rows are copied with this many extra bytes, the SIMD kernels read whole pixels of 4 bytes
+#define ROW_PADDING 16
+
+typedef struct {
+    int *start; // the first source pixel for each destination pixel
+    int *count;
+    int *offset; // of the weights of each destination pixel
+    int16_t *weights;
+    int max_count;
+} contrib_t;
+
+// Horizontal pass: src has `channels` bytes per pixel, the output row has `stride` values per pixel.
+typedef void (*hfilter_fn_t) (const uint8_t *src, int channels, int stride, const contrib_t *h, int dst_width, int16_t *out);
+
+// Vertical pass over `lanes` values of n rows.
+typedef void (*vfilter_fn_t) (int16_t * const *rows, const int16_t *weights, int n, int lanes, uint8_t *out);
+
+typedef struct {
+    const char *name;
+    hfilter_fn_t hfilter; // used for 3 and 4 channels, with stride 4
+    vfilter_fn_t vfilter;
+} img_simd_kernels_t;
+
+struct img_resampler_s {
+    int src_width;
+    int src_height;
+    int dst_width;
+    int dst_height;
+    int channels;
+    int has_alpha;
+    int stride;
+    contrib_t h;
+    contrib_t v;
+    uint8_t *src_row;
+    int16_t *ring; // v.max_count horizontally filtered rows
+    int16_t **rows;
+    uint8_t *out; // the vertical pass output, with `stride` values per pixel
+    uint8_t *out_row;
+    int pushed;
+    int pulled;
+    hfilter_fn_t hfilter;
+    vfilter_fn_t vfilter;
+};
+
+// contributions
+
+static void
+contrib_free (contrib_t *c) {
+    free (c->start);
+    free (c->count);
+    free (c->offset);
+    free (c->weights);
+    memset (c, 0, sizeof (contrib_t));
+}
+
+static int
+contrib_init (contrib_t *c, int src, int dst) {
+    memset (c, 0, sizeof (contrib_t));
+    const double ratio = (double)src / dst;
+    const double radius = ratio > 1 ? ratio : 1;
+    const int max_taps = (int)(2 * radius) + 2;
+
+    c->start = malloc (dst * sizeof (int));
+    c->count = malloc (dst * sizeof (int));
+    c->offset = malloc (dst * sizeof (int));
+    c->weights = malloc ((size_t)dst * max_taps * sizeof (int16_t));
+    double *w = malloc (max_taps * sizeof (double));
+    if (!c->start || !c->count || !c->offset || !c->weights || !w) {
+        free (w);
+        contrib_free (c);
+        return -1;
+    }
+
+    int offset = 0;
+    for (int i = 0; i < dst; i++) {
+        const double center = (i + 0.5) * ratio - 0.5;
+        int lo = (int)floor (center - radius) + 1;
+        int hi = (int)floor (center + radius);
+        if (lo < 0) {
+            lo = 0;
+        }
+        if (hi > src - 1) {
+            hi = src - 1;
+        }
+        if (hi < lo) {
+            hi = lo = center < 0 ? 0 : src - 1;
+        }
+
+        double total = 0;
+        for (int k = lo; k <= hi; k++) {
+            double d = fabs (k - center) / radius;
+            w[k - lo] = d < 1 ? 1 - d : 0;
+            total += w[k - lo];
+        }
+        if (total <= 0) {
+            w[0] = total = 1;
+            hi = lo;
+        }
+
+        // drop the zero weights at the ends
+        while (lo < hi && w[0] <= 0) {
+            memmove (w, w + 1, (hi - lo) * sizeof (double));
+            lo++;
+        }
+        while (hi > lo && w[hi - lo] <= 0) {
+            hi--;
+        }
+
+        // quantize, and put the rounding error into the largest weight, so that the sum is exact
+        const int n = hi - lo + 1;
+        int16_t *q = c->weights + offset;
+        int sum = 0;
+        int largest = 0;
+        for (int k = 0; k < n; k++) {
+            q[k] = (int16_t)lrint (w[k] / total * (1 << WEIGHT_BITS));
+            sum += q[k];
+            if (q[k] > q[largest]) {
+                largest = k;
+            }
+        }
+        q[largest] += (1 << WEIGHT_BITS) - sum;
+
+        c->start[i] = lo;
+        c->count[i] = n;
+        c->offset[i] = offset;
+        offset += n;
+        if (n > c->max_count) {
+            c->max_count = n;
+        }
+    }
+    free (w);
+    return 0;
+}
+
+// scalar kernels
+
+static void
+hfilter_scalar (const uint8_t *src, int channels, int stride, const contrib_t *h, int dst_width, int16_t *out) {
+    for (int x = 0; x < dst_width; x++) {
+        const uint8_t *p = src + h->start[x] * channels;
+        const int16_t *w = h->weights + h->offset[x];
+        const int n = h->count[x];
+        for (int ch = 0; ch < channels; ch++) {
+            int32_t acc = 0;
+            for (int k = 0; k < n; k++) {
+                acc += p[k * channels + ch] * w[k];
+            }
+            out[x * stride + ch] = (int16_t)((acc + (1 << (WEIGHT_BITS - HROW_BITS - 1))) >> (WEIGHT_BITS - HROW_BITS));
+        }
+        for (int ch = channels; ch < stride; ch++) {
+            out[x * stride + ch] = 0;
+        }
+    }
+}
+
+static void
+vfilter_scalar (int16_t * const *rows, const int16_t *weights, int n, int lanes, uint8_t *out) {
+    for (int i = 0; i < lanes; i++) {
+        int32_t acc = 1 << (WEIGHT_BITS + HROW_BITS - 1);
+        for (int k = 0; k < n; k++) {
+            acc += rows[k][i] * weights[k];
+        }
+        acc >>= WEIGHT_BITS + HROW_BITS;
+        out[i] = acc < 0 ? 0 : acc > 255 ? 255 : (uint8_t)acc;
+    }
+}
+
+static inline int32_t
+weight_pair (const int16_t *w) {
+    return (int32_t)((uint16_t)w[0] | ((uint32_t)(uint16_t)w[1] << 16));
+}
+
+#if IMG_HAVE_SSE2
+// 3 or 4 channels, 2 source pixels per multiply-add
+static void
+hfilter_sse2 (const uint8_t *src, int channels, int stride, const contrib_t *h, int dst_width, int16_t *out) {
+    const __m128i zero = _mm_setzero_si128 ();
+    const __m128i round = _mm_set1_epi32 (1 << (WEIGHT_BITS - HROW_BITS - 1));
+    for (int x = 0; x < dst_width; x++) {
+        const uint8_t *p = src + h->start[x] * channels;
+        const int16_t *w = h->weights + h->offset[x];
+        const int n = h->count[x];
+        __m128i acc = round;
+        int k = 0;
+        for (; k + 2 <= n; k += 2, p += channels * 2) {
+            int32_t a, b;
+            memcpy (&a, p, 4);
+            memcpy (&b, p + channels, 4);
+            // a0 a1 a2 a3 b0 b1 b2 b3 -> a0 b0 a1 b1 a2 b2 a3 b3
+            __m128i px = _mm_unpacklo_epi8 (_mm_unpacklo_epi32 (_mm_cvtsi32_si128 (a), _mm_cvtsi32_si128 (b)), zero);
+            px = _mm_unpacklo_epi16 (px, _mm_srli_si128 (px, 8));
+            acc = _mm_add_epi32 (acc, _mm_madd_epi16 (px, _mm_set1_epi32 (weight_pair (w + k))));
+        }
+        if (k < n) {
+            int32_t a;
+            memcpy (&a, p, 4);
+            __m128i px = _mm_unpacklo_epi16 (_mm_unpacklo_epi8 (_mm_cvtsi32_si128 (a), zero), zero);
+            acc = _mm_add_epi32 (acc, _mm_madd_epi16 (px, _mm_set1_epi32 ((uint16_t)w[k])));
+        }
+        acc = _mm_srai_epi32 (acc, WEIGHT_BITS - HROW_BITS);
+        _mm_storel_epi64 ((__m128i *)(out + x * 4), _mm_packs_epi32 (acc, acc));
+    }
+}
+
+static void
+vfilter_sse2 (int16_t * const *rows, const int16_t *weights, int n, int lanes, uint8_t *out) {
+    const __m128i round = _mm_set1_epi32 (1 << (WEIGHT_BITS + HROW_BITS - 1));
+    int i = 0;
+    for (; i + 8 <= lanes; i += 8) {
+        __m128i lo = round;
+        __m128i hi = round;
+        int k = 0;
+        for (; k + 2 <= n; k += 2) {
+            __m128i a = _mm_loadu_si128 ((const __m128i *)(rows[k] + i));
+            __m128i b = _mm_loadu_si128 ((const __m128i *)(rows[k+1] + i));
+            __m128i w = _mm_set1_epi32 (weight_pair (weights + k));
+            lo = _mm_add_epi32 (lo, _mm_madd_epi16 (_mm_unpacklo_epi16 (a, b), w));
+            hi = _mm_add_epi32 (hi, _mm_madd_epi16 (_mm_unpackhi_epi16 (a, b), w));
+        }
+        if (k < n) {
+            __m128i a = _mm_loadu_si128 ((const __m128i *)(rows[k] + i));
+            __m128i w = _mm_set1_epi32 ((uint16_t)weights[k]);
+            lo = _mm_add_epi32 (lo, _mm_madd_epi16 (_mm_unpacklo_epi16 (a, _mm_setzero_si128 ()), w));
+            hi = _mm_add_epi32 (hi, _mm_madd_epi16 (_mm_unpackhi_epi16 (a, _mm_setzero_si128 ()), w));
+        }
+        lo = _mm_srai_epi32 (lo, WEIGHT_BITS + HROW_BITS);
+        hi = _mm_srai_epi32 (hi, WEIGHT_BITS + HROW_BITS);
+        __m128i v = _mm_packs_epi32 (lo, hi);
+        _mm_storel_epi64 ((__m128i *)(out + i), _mm_packus_epi16 (v, v));
+    }
+    if (i < lanes) {
+        int16_t *tail[n];
+        for (int k = 0; k < n; k++) {
+            tail[k] = rows[k] + i;
+        }
+        vfilter_scalar (tail, weights, n, lanes - i, out + i);
+    }
+}
+
+static const img_simd_kernels_t img_kernels_sse2 = {
+    .name = "sse2",
+    .hfilter = hfilter_sse2,
+    .vfilter = vfilter_sse2,
+};
+#endif
+
+#if IMG_HAVE_AVX2
+#define IMG_AVX2 __attribute__((target("avx2")))
+
+IMG_AVX2 static void
+vfilter_avx2 (int16_t * const *rows, const int16_t *weights, int n, int lanes, uint8_t *out) {
+    const __m256i round = _mm256_set1_epi32 (1 << (WEIGHT_BITS + HROW_BITS - 1));
+    int i = 0;
+    for (; i + 16 <= lanes; i += 16) {
+        __m256i lo = round;
+        __m256i hi = round;
+        int k = 0;
+        for (; k + 2 <= n; k += 2) {
+            __m256i a = _mm256_loadu_si256 ((const __m256i *)(rows[k] + i));
+            __m256i b = _mm256_loadu_si256 ((const __m256i *)(rows[k+1] + i));
+            __m256i w = _mm256_set1_epi32 (weight_pair (weights + k));
+            lo = _mm256_add_epi32 (lo, _mm256_madd_epi16 (_mm256_unpacklo_epi16 (a, b), w));
+            hi = _mm256_add_epi32 (hi, _mm256_madd_epi16 (_mm256_unpackhi_epi16 (a, b), w));
+        }
+        if (k < n) {
+            __m256i a = _mm256_loadu_si256 ((const __m256i *)(rows[k] + i));
+            __m256i w = _mm256_set1_epi32 ((uint16_t)weights[k]);
+            lo = _mm256_add_epi32 (lo, _mm256_madd_epi16 (_mm256_unpacklo_epi16 (a, _mm256_setzero_si256 ()), w));
+            hi = _mm256_add_epi32 (hi, _mm256_madd_epi16 (_mm256_unpackhi_epi16 (a, _mm256_setzero_si256 ()), w));
+        }
+        // unpack, madd and pack work within the 128 bit lanes, so the order is restored by the packs,
+        // and the permute only gathers the two halves
+        lo = _mm256_srai_epi32 (lo, WEIGHT_BITS + HROW_BITS);
+        hi = _mm256_srai_epi32 (hi, WEIGHT_BITS + HROW_BITS);
+        __m256i v = _mm256_packs_epi32 (lo, hi);
+        v = _mm256_permute4x64_epi64 (_mm256_packus_epi16 (v, v), 0x08);
+        _mm_storeu_si128 ((__m128i *)(out + i), _mm256_castsi256_si128 (v));
+    }
+    if (i < lanes) {
+        int16_t *tail[n];
+        for (int k = 0; k < n; k++) {
+            tail[k] = rows[k] + i;
+        }
+        vfilter_scalar (tail, weights, n, lanes - i, out + i);
+    }
+}
+
+static const img_simd_kernels_t img_kernels_avx2 = {
+    .name = "avx2",
+#if IMG_HAVE_SSE2
+    .hfilter = hfilter_sse2,
+#else
+    .hfilter = hfilter_scalar,
+#endif
+    .vfilter = vfilter_avx2,
+};
+#endif
+
+static const img_simd_kernels_t img_kernels_scalar = {
+    .name = "scalar",
+    .hfilter = hfilter_scalar,
+    .vfilter = vfilter_scalar,
+};
+
+static const img_simd_kernels_t *
+img_simd_kernels (int simd) {
+    switch (simd) {
+    case IMG_RESAMPLE_SIMD_NONE:
+        return &img_kernels_scalar;
+#if IMG_HAVE_SSE2
+    case IMG_RESAMPLE_SIMD_SSE2:
+        return &img_kernels_sse2;
+#endif
+#if IMG_HAVE_AVX2
+    case IMG_RESAMPLE_SIMD_AVX2:
+        return &img_kernels_avx2;
+#endif
+    default:
+        return NULL;
+    }
+}
+
+static int
+img_simd_supported (int simd) {
+    switch (simd) {
+#if IMG_HAVE_AVX2
+    case IMG_RESAMPLE_SIMD_AVX2:
+        __builtin_cpu_init ();
+        return __builtin_cpu_supports ("avx2");
+#endif
+    default:
+        return img_simd_kernels (simd) != NULL;
+    }
+}
+
+int
+img_resample_simd_detect (void) {
+    static const int preference[] = { IMG_RESAMPLE_SIMD_AVX2, IMG_RESAMPLE_SIMD_SSE2 };
+    for (int i = 0; i < (int)(sizeof (preference) / sizeof (preference[0])); i++) {
+        if (img_simd_supported (preference[i])) {
+            return preference[i];
+        }
+    }
+    return IMG_RESAMPLE_SIMD_NONE;
+}
+
+const char *
+img_resample_simd_name (int simd) {
+    const img_simd_kernels_t *k = img_simd_kernels (simd);
+    return k ? k->name : NULL;
+}
+
+// selected when the first resampler is created
+static int img_simd = -1;
+
+int
+img_resample_simd_set (int simd) {
+    if (!img_simd_supported (simd)) {
+        return -1;
+    }
+    __atomic_store_n (&img_simd, simd, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static int
+img_get_simd (void) {
+    int simd = __atomic_load_n (&img_simd, __ATOMIC_RELAXED);
+    if (simd < 0) {
+        simd = img_resample_simd_detect ();
+        __atomic_store_n (&img_simd, simd, __ATOMIC_RELAXED);
+    }
+    return simd;
+}
+
+// resampler
+
+img_resampler_t *
+img_resampler_new (int src_width, int src_height, int dst_width, int dst_height, int channels, int has_alpha) {
+    if (src_width < 1 || src_height < 1 || dst_width < 1 || dst_height < 1 || channels < 1 || channels > 4) {
+        return NULL;
+    }
+    img_resampler_t *r = calloc (1, sizeof (img_resampler_t));
+    if (!r) {
+        return NULL;
+    }
+    r->src_width = src_width;
+    r->src_height = src_height;
+    r->dst_width = dst_width;
+    r->dst_height = dst_height;
+    r->channels = channels;
+    r->has_alpha = has_alpha && (channels == 2 || channels == 4);
+    r->stride = channels >= 3 ? 4 : channels;
+
+    const img_simd_kernels_t *k = img_simd_kernels (img_get_simd ());
+    r->hfilter = r->stride == 4 ? k->hfilter : hfilter_scalar;
+    r->vfilter = k->vfilter;
+
+    const size_t lanes = (size_t)dst_width * r->stride;
+    if (contrib_init (&r->h, src_width, dst_width) || contrib_init (&r->v, src_height, dst_height)) {
+        img_resampler_free (r);
+        return NULL;
+    }
+    r->src_row = malloc ((size_t)src_width * channels + ROW_PADDING);
+    r->ring = malloc (r->v.max_count * lanes * sizeof (int16_t));
+    r->rows = malloc (r->v.max_count * sizeof (int16_t *));
+    r->out = malloc (lanes);
+    r->out_row = malloc ((size_t)dst_width * channels);
+    if (!r->src_row || !r->ring || !r->rows || !r->out || !r->out_row) {
+        img_resampler_free (r);
+        return NULL;
+    }
+    memset (r->src_row + (size_t)src_width * channels, 0, ROW_PADDING);
+    return r;
+}
+
+void
+img_resampler_free (img_resampler_t *r) {
+    contrib_free (&r->h);
+    contrib_free (&r->v);
+    free (r->src_row);
+    free (r->ring);
+    free (r->rows);
+    free (r->out);
+    free (r->out_row);
+    free (r);
+}
+
+int
+img_resampler_push_row (img_resampler_t *r, const uint8_t *row) {
+    if (r->pushed >= r->src_height) {
+        return -1;
+    }
+    // the row would replace one which is still needed
+    if (r->pulled < r->dst_height && r->pushed >= r->v.start[r->pulled] + r->v.max_count) {
+        return -1;
+    }
+
+    const int n = r->src_width * r->channels;
+    if (r->has_alpha) {
+        // weight the colors by alpha, to avoid the colors of the transparent pixels bleeding into the visible ones
+        const int c = r->channels;
+        for (int i = 0; i < n; i += c) {
+            const unsigned a = row[i + c - 1];
+            for (int ch = 0; ch < c - 1; ch++) {
+                r->src_row[i + ch] = (uint8_t)((row[i + ch] * a + 127) / 255);
+            }
+            r->src_row[i + c - 1] = (uint8_t)a;
+        }
+    }
+    else {
+        memcpy (r->src_row, row, n);
+    }
+
+    const size_t lanes = (size_t)r->dst_width * r->stride;
+    r->hfilter (r->src_row, r->channels, r->stride, &r->h, r->dst_width, r->ring + (r->pushed % r->v.max_count) * lanes);
+    r->pushed++;
+    return 0;
+}
+
+const uint8_t *
+img_resampler_pull_row (img_resampler_t *r) {
+    if (r->pulled >= r->dst_height) {
+        return NULL;
+    }
+    const int start = r->v.start[r->pulled];
+    const int n = r->v.count[r->pulled];
+    if (r->pushed < start + n) {
+        return NULL;
+    }
+
+    const size_t lanes = (size_t)r->dst_width * r->stride;
+    for (int k = 0; k < n; k++) {
+        r->rows[k] = r->ring + ((start + k) % r->v.max_count) * lanes;
+    }
+    r->vfilter (r->rows, r->v.weights + r->v.offset[r->pulled], n, (int)lanes, r->out);
+    r->pulled++;
+
+    const int c = r->channels;
+    if (!r->has_alpha && c == r->stride) {
+        return r->out;
+    }
+    for (int x = 0; x < r->dst_width; x++) {
+        const uint8_t *in = r->out + x * r->stride;
+        uint8_t *out = r->out_row + x * c;
+        if (r->has_alpha) {
+            const unsigned a = in[c - 1];
+            for (int ch = 0; ch < c - 1; ch++) {
+                const unsigned v = a ? (in[ch] * 255 + a / 2) / a : 0;
+                out[ch] = v > 255 ? 255 : (uint8_t)v;
+            }
+            out[c - 1] = (uint8_t)a;
+        }
+        else {
+            memcpy (out, in, c);
+        }
+    }
+    return r->out_row;
+}
@@ -0,0 +1,82 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2018 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifndef __IMGRESAMPLE_H
+#define __IMGRESAMPLE_H
+
+#include <stdint.h>
+
+// Separable resampler for 8 bit images with 1 to 4 interleaved channels,
+// which takes the source rows one at a time, e.g. straight from the decoder.
+//
+// Downscales use a tent filter widened by the scaling ratio, so every source pixel contributes,
+// upscales use bilinear interpolation.
+// When the last channel is alpha, the colors are weighted by it.
+//
+// Usage:
+//     for (int y = 0; y < src_height; y++) {
+//         img_resampler_push_row (r, src_row[y]);
+//         const uint8_t *out;
+//         while ((out = img_resampler_pull_row (r))) {
+//             write_row (out);
+//         }
+//     }
+
+typedef struct img_resampler_s img_resampler_t;
+
+img_resampler_t *
+img_resampler_new (int src_width, int src_height, int dst_width, int dst_height, int channels, int has_alpha);
+
+void
+img_resampler_free (img_resampler_t *r);
+
+// Returns -1 if all source rows were pushed already,
+// or if the output rows which became available weren't pulled yet.
+int
+img_resampler_push_row (img_resampler_t *r, const uint8_t *row);
+
+// Returns the next output row, when the source rows it needs are pushed, otherwise NULL.
+// The row remains valid until the next call.
+const uint8_t *
+img_resampler_pull_row (img_resampler_t *r);
+
+// Kernel sets, the best one supported by the CPU is used by default.
+enum {
+    IMG_RESAMPLE_SIMD_NONE,
+    IMG_RESAMPLE_SIMD_SSE2,
+    IMG_RESAMPLE_SIMD_AVX2,
+};
+
+int
+img_resample_simd_detect (void);
+
+// returns the name of the kernel set, or NULL if it isn't built
+const char *
+img_resample_simd_name (int simd);
+
+// override the kernel set, e.g. for benchmarking;
+// returns -1 if it's not supported
+int
+img_resample_simd_set (int simd);
+
+#endif
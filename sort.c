@@ -25,9 +25,12 @@
 #include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include "utf8.h"
 #include "sort.h"
 #include "tf.h"
+#include "plindex.h"
+#include "threading.h"
 
 //#define trace(...) { fprintf(stderr, __VA_ARGS__); }
 #define trace(fmt,...)
@@ -55,85 +58,358 @@ static const char *pl_sort_format;
 static char *pl_sort_tf_bytecode;
 static ddb_tf_context_t pl_sort_tf_ctx;
 
+#define SORT_KEY_SIZE 1024
+#define SORT_ARENA_SIZE (256*1024)
+
+// don't bother with threads for small arrays
+#define SORT_MIN_PER_THREAD 8192
+#define SORT_MAX_THREADS 8
+
+typedef struct sort_arena_s {
+    struct sort_arena_s *next;
+    size_t used;
+    char data[SORT_ARENA_SIZE];
+} sort_arena_t;
+
+typedef struct {
+    const char *key; // normalized title, see sort_normalize_key
+    int64_t num; // used instead of the key when sorting by duration or track number
+    playItem_t *it;
+} sort_key_t;
+
+typedef struct {
+    sort_key_t *keys;
+    sort_key_t *tmp;
+    int start;
+    int end;
+    int mid; // for merge jobs
+    sort_arena_t *arena; // normalized keys of this job
+} sort_job_t;
+
+static sort_arena_t *
+sort_arena_alloc (sort_arena_t *next) {
+    sort_arena_t *arena = malloc (sizeof (sort_arena_t));
+    arena->next = next;
+    arena->used = 0;
+    return arena;
+}
+
+static void
+sort_arena_free (sort_arena_t *arena) {
+    while (arena) {
+        sort_arena_t *next = arena->next;
+        free (arena);
+        arena = next;
+    }
+}
+
+// Convert a formatted title into a key, which sorts with strcmp the same way
+// as the titles would with a case-insensitive, numeric-aware comparison:
+// a leading number is compared by value, and the rest of the string is compared
+// case-insensitively, using the same utf8 case mapping as u8_strcasecmp.
+// The leading number is stored as the count of its significant digits, followed by the digits.
+// The count is written as a '9' for every 9 digits, and a '0'..'8' for the rest (e.g. 12 digits are "93"),
+// so that it orders the numbers of any length, and still sorts among digits when compared to a non-numeric title.
 static int
-strcasecmp_numeric (const char *a, const char *b) {
-    if (isdigit (*a) && isdigit (*b)) {
-        int anum = *a-'0';
-        const char *ae = a+1;
-        while (*ae && isdigit (*ae)) {
-            anum *= 10;
-            anum += *ae-'0';
-            ae++;
+sort_normalize_key (const char *s, char *out, int outsize) {
+    char *o = out;
+    char *end = out + outsize - 12; // room for the longest lowercase char and the terminating zero
+    if (isdigit (*s)) {
+        while (*s == '0') {
+            s++;
+        }
+        const char *digits = s;
+        while (isdigit (*s)) {
+            s++;
         }
-        int bnum = *b-'0';
-        const char *be = b+1;
-        while (*be && isdigit (*be)) {
-            bnum *= 10;
-            bnum += *be-'0';
-            be++;
+        int n = (int)(s - digits);
+        int count = n;
+        for (; count >= 9; count -= 9) {
+            *o++ = '9';
         }
-        if (anum == bnum) {
-            return u8_strcasecmp (ae, be);
+        *o++ = '0' + count;
+        memcpy (o, digits, n);
+        o += n;
+    }
+    while (*s && o < end) {
+        if ((uint8_t)*s < 0x80) {
+            *o++ = (*s >= 'A' && *s <= 'Z') ? *s + 0x20 : *s;
+            s++;
+            continue;
         }
-        return anum - bnum;
+        int32_t i = 0;
+        u8_nextchar (s, &i);
+        o += u8_tolower ((const signed char *)s, i, o);
+        s += i;
     }
-    return u8_strcasecmp (a,b);
+    *o = 0;
+    return (int)(o - out);
 }
 
-static int
-pl_sort_compare_str (playItem_t *a, playItem_t *b) {
-    if (pl_sort_is_duration) {
-        float dur_a = a->_duration * 100000;
-        float dur_b = b->_duration * 100000;
-        return !pl_sort_ascending ? dur_b - dur_a : dur_a - dur_b;
+static void
+sort_normalize_keys (sort_job_t *job) {
+    char buf[SORT_KEY_SIZE * 3 + 16];
+    for (int i = job->start; i < job->end; i++) {
+        int l = sort_normalize_key (job->keys[i].key, buf, sizeof (buf));
+        if (!job->arena || job->arena->used + l + 1 > SORT_ARENA_SIZE) {
+            job->arena = sort_arena_alloc (job->arena);
+        }
+        char *key = job->arena->data + job->arena->used;
+        memcpy (key, buf, l + 1);
+        job->arena->used += l + 1;
+        job->keys[i].key = key;
     }
-    else if (pl_sort_is_track) {
-        int t1;
-        int t2;
-        const char *t;
-        t = pl_find_meta_raw (a, "track");
-        if (t && !isdigit (*t)) {
-            t1 = 999999;
+}
+
+static inline int
+sort_key_cmp (const sort_key_t *a, const sort_key_t *b) {
+    int res;
+    if (pl_sort_is_duration || pl_sort_is_track) {
+        res = a->num < b->num ? -1 : (a->num > b->num ? 1 : 0);
+    }
+    else {
+        res = strcmp (a->key, b->key);
+    }
+    return pl_sort_ascending ? res : -res;
+}
+
+// merge the sorted ranges src[start..mid) and src[mid..end) into dst
+static void
+sort_merge (const sort_key_t *src, sort_key_t *dst, int start, int mid, int end) {
+    int i = start;
+    int j = mid;
+    int k = start;
+    while (i < mid && j < end) {
+        if (sort_key_cmp (&src[j], &src[i]) < 0) {
+            dst[k++] = src[j++];
         }
         else {
-            t1 = t ? atoi (t) : -1;
+            dst[k++] = src[i++];
         }
-        t = pl_find_meta_raw (b, "track");
-        if (t && !isdigit (*t)) {
-            t2 = 999999;
+    }
+    while (i < mid) {
+        dst[k++] = src[i++];
+    }
+    while (j < end) {
+        dst[k++] = src[j++];
+    }
+}
+
+// stable sort of keys[start..end), using tmp of the same size as scratch space
+static void
+sort_merge_sort (sort_key_t *keys, sort_key_t *tmp, int start, int end) {
+    if (end - start <= 16) {
+        for (int i = start + 1; i < end; i++) {
+            sort_key_t k = keys[i];
+            int j = i;
+            while (j > start && sort_key_cmp (&k, &keys[j-1]) < 0) {
+                keys[j] = keys[j-1];
+                j--;
+            }
+            keys[j] = k;
         }
-        else {
-            t2 = t ? atoi (t) : -1;
+        return;
+    }
+    int mid = start + (end - start) / 2;
+    sort_merge_sort (keys, tmp, start, mid);
+    sort_merge_sort (keys, tmp, mid, end);
+    if (sort_key_cmp (&keys[mid-1], &keys[mid]) <= 0) {
+        return;
+    }
+    memcpy (tmp + start, keys + start, (end - start) * sizeof (sort_key_t));
+    sort_merge (tmp, keys, start, mid, end);
+}
+
+static void
+sort_job (void *ctx) {
+    sort_job_t *job = ctx;
+    if (!pl_sort_is_duration && !pl_sort_is_track) {
+        sort_normalize_keys (job);
+    }
+    sort_merge_sort (job->keys, job->tmp, job->start, job->end);
+}
+
+static void
+sort_merge_job (void *ctx) {
+    sort_job_t *job = ctx;
+    sort_merge (job->keys, job->tmp, job->start, job->mid, job->end);
+}
+
+static int
+sort_num_threads (int count) {
+    long ncpu = sysconf (_SC_NPROCESSORS_ONLN);
+    int n = count / SORT_MIN_PER_THREAD;
+    if (n > ncpu) {
+        n = (int)ncpu;
+    }
+    if (n > SORT_MAX_THREADS) {
+        n = SORT_MAX_THREADS;
+    }
+    return n < 1 ? 1 : n;
+}
+
+// run the jobs, the first one on the calling thread
+static void
+sort_run_jobs (sort_job_t *jobs, int njobs, void (*fn)(void *ctx)) {
+    intptr_t tids[SORT_MAX_THREADS];
+    for (int i = 1; i < njobs; i++) {
+        tids[i] = thread_start (fn, &jobs[i]);
+        if (!tids[i]) {
+            fn (&jobs[i]);
+        }
+    }
+    fn (&jobs[0]);
+    for (int i = 1; i < njobs; i++) {
+        if (tids[i]) {
+            thread_join (tids[i]);
+        }
+    }
+}
+
+// Normalize the keys (which initially point to the formatted titles) and sort them.
+// The array is split into one chunk per core, the chunks are sorted in parallel,
+// and then merged pairwise, also in parallel.
+// Returns the arenas of the normalized keys, to be freed with sort_arena_free.
+static sort_arena_t *
+sort_keys (sort_key_t *keys, int count) {
+    sort_key_t *tmp = malloc (count * sizeof (sort_key_t));
+    int nthreads = sort_num_threads (count);
+
+    sort_job_t jobs[SORT_MAX_THREADS];
+    int bounds[SORT_MAX_THREADS+1];
+    for (int i = 0; i <= nthreads; i++) {
+        bounds[i] = (int)((int64_t)count * i / nthreads);
+    }
+    for (int i = 0; i < nthreads; i++) {
+        jobs[i].keys = keys;
+        jobs[i].tmp = tmp;
+        jobs[i].start = bounds[i];
+        jobs[i].end = bounds[i+1];
+        jobs[i].arena = NULL;
+    }
+    sort_run_jobs (jobs, nthreads, sort_job);
+
+    sort_arena_t *arena = NULL;
+    for (int i = 0; i < nthreads; i++) {
+        sort_arena_t *a = jobs[i].arena;
+        while (a) {
+            sort_arena_t *next = a->next;
+            a->next = arena;
+            arena = a;
+            a = next;
+        }
+    }
+
+    // merge the sorted chunks, halving their number on each pass
+    sort_key_t *src = keys;
+    sort_key_t *dst = tmp;
+    int nruns = nthreads;
+    while (nruns > 1) {
+        int nmerges = 0;
+        for (int r = 0; r < nruns; r += 2) {
+            sort_job_t *job = &jobs[nmerges];
+            job->keys = src;
+            job->tmp = dst;
+            job->start = bounds[r];
+            job->mid = bounds[r+1];
+            job->end = r + 1 < nruns ? bounds[r+2] : bounds[r+1];
+            bounds[nmerges++] = job->start;
+        }
+        bounds[nmerges] = count;
+        sort_run_jobs (jobs, nmerges, sort_merge_job);
+        nruns = nmerges;
+        sort_key_t *t = src;
+        src = dst;
+        dst = t;
+    }
+    if (src != keys) {
+        memcpy (keys, src, count * sizeof (sort_key_t));
+    }
+
+    free (tmp);
+    return arena;
+}
+
+// Fill in the keys for all tracks, according to the current sort settings.
+// The formatted titles are stored in the returned arenas, to be freed with sort_arena_free.
+// Must be called with pl_lock held.
+static sort_arena_t *
+sort_format_keys (playItem_t **tracks, sort_key_t *keys, int count) {
+    sort_arena_t *arena = NULL;
+
+    for (int i = 0; i < count; i++) {
+        keys[i].it = tracks[i];
+        keys[i].key = "";
+        keys[i].num = 0;
+    }
+
+    if (pl_sort_is_duration) {
+        for (int i = 0; i < count; i++) {
+            keys[i].num = (int64_t)(tracks[i]->_duration * 100000);
+        }
+    }
+    else if (pl_sort_is_track) {
+        for (int i = 0; i < count; i++) {
+            const char *t = pl_find_meta_raw (tracks[i], "track");
+            if (t && !isdigit (*t)) {
+                keys[i].num = 999999;
+            }
+            else {
+                keys[i].num = t ? atoi (t) : -1;
+            }
+        }
+    }
+    else if (pl_sort_version == 0) {
+        for (int i = 0; i < count; i++) {
+            if (!arena || arena->used + SORT_KEY_SIZE > SORT_ARENA_SIZE) {
+                arena = sort_arena_alloc (arena);
+            }
+            char *key = arena->data + arena->used;
+            pl_format_title (tracks[i], -1, key, SORT_KEY_SIZE, pl_sort_id, pl_sort_format);
+            arena->used += strlen (key) + 1;
+            keys[i].key = key;
         }
-        return !pl_sort_ascending ? t2 - t1 : t1 - t2;
     }
     else {
-        char tmp1[1024];
-        char tmp2[1024];
-        if (pl_sort_version == 0) {
-            pl_format_title (a, -1, tmp1, sizeof (tmp1), pl_sort_id, pl_sort_format);
-            pl_format_title (b, -1, tmp2, sizeof (tmp2), pl_sort_id, pl_sort_format);
+        ddb_playItem_t **batch = malloc (count * sizeof (ddb_playItem_t *));
+        const char **results = malloc (count * sizeof (const char *));
+        for (int i = 0; i < count; i++) {
+            batch[i] = (ddb_playItem_t *)tracks[i];
         }
-        else {
-            pl_sort_tf_ctx.id = pl_sort_id;
-            pl_sort_tf_ctx.it = (ddb_playItem_t *)a;
-            tf_eval(&pl_sort_tf_ctx, pl_sort_tf_bytecode, tmp1, sizeof(tmp1));
-            pl_sort_tf_ctx.it = (ddb_playItem_t *)b;
-            tf_eval(&pl_sort_tf_ctx, pl_sort_tf_bytecode, tmp2, sizeof(tmp2));
+
+        pl_sort_tf_ctx.id = pl_sort_id;
+        int n = 0;
+        while (n < count) {
+            arena = sort_arena_alloc (arena);
+            int res = tf_eval_batch (&pl_sort_tf_ctx, pl_sort_tf_bytecode, batch + n, count - n, arena->data, sizeof (arena->data), SORT_KEY_SIZE, results + n);
+            if (res <= 0) {
+                break;
+            }
+            n += res;
         }
-        int res = strcasecmp_numeric (tmp1, tmp2);
-        if (!pl_sort_ascending) {
-            res = -res;
+
+        for (int i = 0; i < n; i++) {
+            keys[i].key = results[i];
         }
-        return res;
+
+        free (results);
+        free (batch);
     }
+    return arena;
 }
 
-static int
-qsort_cmp_func (const void *a, const void *b) {
-    playItem_t *aa = *((playItem_t **)a);
-    playItem_t *bb = *((playItem_t **)b);
-    return pl_sort_compare_str (aa, bb);
+// sort the tracks according to the current sort settings, must be called with pl_lock held
+static void
+sort_tracks (playItem_t **tracks, int count) {
+    sort_key_t *keys = malloc (count * sizeof (sort_key_t));
+    sort_arena_t *titles = sort_format_keys (tracks, keys, count);
+    sort_arena_t *normalized = sort_keys (keys, count);
+    for (int i = 0; i < count; i++) {
+        tracks[i] = keys[i].it;
+    }
+    sort_arena_free (normalized);
+    sort_arena_free (titles);
+    free (keys);
 }
 
 void
@@ -178,6 +454,7 @@ plt_sort_random (playlist_t *playlist, int iter) {
         prev = it;
     }
     playlist->tail[iter] = array[playlist->count[iter]-1];
+    plt_index_rebuild (playlist, iter);
 
     free (array);
 
@@ -251,11 +528,8 @@ plt_sort_internal (playlist_t *playlist, int iter, int id, const char *format, i
         array[idx] = it;
     }
 
-#if HAVE_MERGESORT
-    mergesort (array, playlist->count[iter], sizeof (playItem_t *), qsort_cmp_func);
-#else
-    qsort (array, playlist->count[iter], sizeof (playItem_t *), qsort_cmp_func);
-#endif
+    sort_tracks (array, playlist->count[iter]);
+
     playItem_t *prev = NULL;
     playlist->head[iter] = 0;
     for (idx = 0; idx < playlist->count[iter]; idx++) {
@@ -272,6 +546,7 @@ plt_sort_internal (playlist_t *playlist, int iter, int id, const char *format, i
     }
 
     playlist->tail[iter] = array[playlist->count[iter]-1];
+    plt_index_rebuild (playlist, iter);
 
     free (array);
 
@@ -341,11 +616,7 @@ sort_track_array (playlist_t *playlist, playItem_t **tracks, int num_tracks, con
         pl_sort_is_track = 0;
     }
 
-#if HAVE_MERGESORT
-    mergesort (tracks, num_tracks, sizeof (playItem_t *), qsort_cmp_func);
-#else
-    qsort (tracks, num_tracks, sizeof (playItem_t *), qsort_cmp_func);
-#endif
+    sort_tracks (tracks, num_tracks);
 
     tf_free (pl_sort_tf_bytecode);
     pl_sort_tf_bytecode = NULL;
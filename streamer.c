@@ -50,8 +50,10 @@
 #include "plugins/libparser/parser.h"
 #include "strdupa.h"
 #include "playqueue.h"
+#include "plindex.h"
 #include "streamreader.h"
 #include "dsp.h"
+#include "ringbuf.h"
 
 #ifdef trace
 #undef trace
@@ -110,6 +112,24 @@ static int _format_change_wait;
 static ddb_waveformat_t prev_output_format; // last format that was sent to output via streamer_set_output_format
 static ddb_waveformat_t last_block_fmt; // input file format corresponding to the current output
 
+// The processed output data, ready to be sent to the output plugin.
+// The streamer thread is the only producer (see streamer_fill_output),
+// and the thread calling streamer_read is the only consumer,
+// so the output plugin never has to wait for the streamer lock.
+#define OUTPUT_RING_SIZE (1024*1024)
+// how much audio the streamer thread keeps ready in the ring
+#define OUTPUT_RING_FILL_MS 100
+static ringbuf_t output_ring;
+static char *output_ring_buffer;
+
+// streamer_reset asks the consumer to drop the ring contents by incrementing output_flush_request,
+// the producer doesn't write anything until the consumer has confirmed it via output_flush_done
+static int output_flush_request;
+static int output_flush_done;
+
+// set by the producer, when the ring is drained and there's nothing more to play
+static int output_drained;
+
 static DB_fileinfo_t *fileinfo;
 static DB_FILE *fileinfo_file;
 static DB_fileinfo_t *new_fileinfo;
@@ -187,6 +207,12 @@ stream_track (playItem_t *track, int startpaused);
 static void
 _handle_playback_stopped (void);
 
+static void
+streamer_fill_output (void);
+
+static void
+_outbuffer_release (void);
+
 static void
 streamer_abort_files (void) {
     DB_FILE *file = fileinfo_file;
@@ -327,16 +353,7 @@ str_get_idx_of (playItem_t *it) {
         streamer_set_streamer_playlist (plt);
         plt_unref (plt);
     }
-    playItem_t *c = streamer_playlist->head[PL_MAIN];
-    int idx = 0;
-    while (c && c != it) {
-        c = c->next[PL_MAIN];
-        idx++;
-    }
-    if (!c) {
-        pl_unlock ();
-        return -1;
-    }
+    int idx = plt_index_find (streamer_playlist, PL_MAIN, it);
     pl_unlock ();
     return idx;
 }
@@ -349,14 +366,7 @@ str_get_for_idx (int idx) {
         streamer_set_streamer_playlist (plt);
         plt_unref (plt);
     }
-    playItem_t *it = streamer_playlist->head[PL_MAIN];
-    while (idx--) {
-        if (!it) {
-            pl_unlock ();
-            return NULL;
-        }
-        it = it->next[PL_MAIN];
-    }
+    playItem_t *it = plt_index_get (streamer_playlist, PL_MAIN, idx);
     if (it) {
         pl_item_ref (it);
     }
@@ -1503,6 +1513,10 @@ streamer_thread (void *unused) {
 
         _update_buffering_state ();
 
+        streamer_lock ();
+        streamer_fill_output ();
+        streamer_unlock ();
+
         if (!fileinfo) {
             // HACK: This is to overcome the output plugin API limitation.
             // We count the number of times the output plugin has starved,
@@ -1523,7 +1537,8 @@ streamer_thread (void *unused) {
         streamblock_t *block = streamreader_get_next_block ();
 
         if (!block) {
-            usleep (50000); // all blocks are full
+            // all blocks are full; wake up often enough to keep output_ring filled
+            usleep (20000);
             continue;
         }
 
@@ -1534,6 +1549,7 @@ streamer_thread (void *unused) {
         if (res >= 0) {
             streamreader_enqueue_block (block);
             last = block->last;
+            streamer_fill_output ();
             streamer_unlock ();
         }
 
@@ -1600,6 +1616,8 @@ int
 streamer_init (void) {
     streaming_terminate = 0;
     handler = handler_alloc (100);
+    output_ring_buffer = malloc (OUTPUT_RING_SIZE);
+    ringbuf_init (&output_ring, output_ring_buffer, OUTPUT_RING_SIZE);
 #if WRITE_DUMP
     out = fopen ("out.raw", "w+b");
 #endif
@@ -1629,8 +1647,13 @@ streamer_free (void) {
     streaming_terminate = 1;
     thread_join (streamer_tid);
 
+    _outbuffer_release ();
     streamreader_free ();
 
+    ringbuf_init (&output_ring, NULL, 0);
+    free (output_ring_buffer);
+    output_ring_buffer = NULL;
+
     if (first_failed_track) {
         pl_item_unref (first_failed_track);
         first_failed_track = NULL;
@@ -1679,11 +1702,32 @@ streamer_free (void) {
 // Think converting from 8KHz/8 bit to 192KHz/32 bit, thats 96x size increase,
 // which gives us the need of 1.5MB buffer.
 //
-// It's guaranteed that outbuffer contains only samples from the files with same wave format.
+// Normally the block is processed directly into output_ring,
+// outbuffer is only used when the output doesn't fit into the contiguous free space of the ring.
+// When no DSP or conversion is needed, the block itself is held by a reference instead.
+//
+// It's guaranteed that the pending output contains only samples from the files with same wave format.
+// It holds the output of the last processed block, which didn't fit into output_ring yet.
 //
 // FIXME: this BSS allocation is temporary, needs to be on heap, and allocated on demand.
 static char outbuffer[512*1024];
+static char *outbuffer_data; // points either into outbuffer, or into outbuffer_block
 static int outbuffer_remaining;
+static streamblock_t *outbuffer_block;
+
+static uint64_t stats_underruns;
+static uint64_t stats_direct_blocks;
+static uint64_t stats_staged_blocks;
+
+static void
+_outbuffer_release (void) {
+    if (outbuffer_block) {
+        streamreader_block_unref (outbuffer_block);
+        outbuffer_block = NULL;
+    }
+    outbuffer_data = NULL;
+    outbuffer_remaining = 0;
+}
 
 void
 streamer_reset (int full) { // must be called when current song changes by external reasons
@@ -1693,14 +1737,48 @@ streamer_reset (int full) { // must be called when current song changes by exter
     }
 
     streamer_lock();
+    _outbuffer_release ();
     streamreader_reset ();
     dsp_reset ();
-    outbuffer_remaining = 0;
+    __atomic_store_n (&output_flush_request, output_flush_request + 1, __ATOMIC_RELEASE);
+    __atomic_store_n (&output_drained, 0, __ATOMIC_RELEASE);
     streamer_unlock();
 }
 
+static float (*streamer_volume_modifier) (float delta_time);
+
+void
+streamer_set_volume_modifier (float (*modifier) (float delta_time)) {
+    streamer_volume_modifier = modifier;
+}
+
+// Returns the soft volume scale for the next nframes of output, 0 when muted,
+// or 1 if the output plugin controls the volume itself.
+// Called from streamer_read, after the data was passed to the vis listeners.
+static float
+streamer_get_soft_volume (int nframes) {
+    DB_output_t *output = plug_get_output ();
+
+    float mod = 1.f;
+
+    if (streamer_volume_modifier && output->fmt.samplerate > 0) {
+        mod = streamer_volume_modifier (nframes / (float)output->fmt.samplerate);
+    }
+
+    if (output->has_volume) {
+        return 1.f;
+    }
+    if (audio_is_mute ()) {
+        return 0.f;
+    }
+    return volume_get_amp () * mod;
+}
+
+// Process the current block into output_ring, or into the pending output, if it doesn't fit.
+// Must be called only when there's no pending output.
+// Returns the number of output bytes.
 static int
-process_output_block (streamblock_t *block, char *bytes) {
+process_output_block (streamblock_t *block) {
     DB_output_t *output = plug_get_output ();
 
     // handle change of track
@@ -1722,12 +1800,18 @@ process_output_block (streamblock_t *block, char *bytes) {
     int sz = block->size - block->pos;
     assert (sz);
 
+    // ReplayGain is applied in the source format, before the DSP chain and the conversion
+    // to the output format, so that float and hi-res sources are scaled before they get clipped
+    // or quantized; the soft volume is applied separately, after the vis listeners
+    pcm_apply_gain (&block->fmt, block->buf + block->pos, sz, block->replaygain);
+
     ddb_waveformat_t datafmt; // comes either from dsp, or from input plugin
     memcpy (&datafmt, &block->fmt, sizeof (ddb_waveformat_t));
 
     char *dspbytes = NULL;
     int dspsize = 0;
     float dspratio = 1;
+    int dspbytes_in_block = 0; // dspbytes point to the block data
 
 #if defined(ANDROID) || defined(HAVE_XGUI)
     // android EQ and resampling require 16 bit, so convert here if needed
@@ -1768,15 +1852,52 @@ process_output_block (streamblock_t *block, char *bytes) {
     else {
         memcpy (&datafmt, &block->fmt, sizeof (ddb_waveformat_t));
         dspbytes = block->buf+block->pos;
+        dspbytes_in_block = 1;
         block->pos += sz;
     }
 #endif
 
-    if (memcmp (&output->fmt, &datafmt, sizeof (ddb_waveformat_t))) {
-        sz = pcm_convert (&datafmt, dspbytes, &output->fmt, bytes, sz);
+    int convert = memcmp (&output->fmt, &datafmt, sizeof (ddb_waveformat_t));
+    int in_frame_size = datafmt.channels * datafmt.bps / 8;
+    int out_frame_size = output->fmt.channels * output->fmt.bps / 8;
+    int nframes = in_frame_size > 0 ? sz / in_frame_size : 0;
+    int outsize = convert ? nframes * out_frame_size : sz;
+
+    size_t contiguous;
+    char *ringdata = ringbuf_write_ptr (&output_ring, &contiguous);
+    char *out;
+    if (contiguous >= (size_t)outsize) {
+        out = ringdata;
+        if (convert) {
+            sz = pcm_convert (&datafmt, dspbytes, &output->fmt, out, sz);
+        }
+        else {
+            memcpy (out, dspbytes, sz);
+        }
+    }
+    else if (convert) {
+        out = outbuffer;
+        sz = pcm_convert (&datafmt, dspbytes, &output->fmt, out, sz);
+    }
+    else if (dspbytes_in_block) {
+        // hold the block until the ring has room for it
+        out = dspbytes;
+        streamreader_block_ref (block);
+        outbuffer_block = block;
     }
     else {
-        memcpy (bytes, dspbytes, sz);
+        out = outbuffer;
+        memcpy (out, dspbytes, sz);
+    }
+
+    if (out == ringdata) {
+        ringbuf_write_commit (&output_ring, sz);
+        stats_direct_blocks++;
+    }
+    else {
+        outbuffer_data = out;
+        outbuffer_remaining = sz;
+        stats_staged_blocks++;
     }
 
     playpos += (float)sz/output->fmt.samplerate/((output->fmt.bps>>3)*output->fmt.channels) * dspratio;
@@ -1791,87 +1912,104 @@ process_output_block (streamblock_t *block, char *bytes) {
 }
 
 
-static float (*streamer_volume_modifier) (float delta_time);
-
-void
-streamer_set_volume_modifier (float (*modifier) (float delta_time)) {
-    streamer_volume_modifier = modifier;
+static void
+streamer_update_avg_bitrate (int block_bitrate) {
+    // approximate bitrate
+    if (block_bitrate != -1) {
+        if (avg_bitrate == -1) {
+            avg_bitrate = block_bitrate;
+        }
+        else {
+            if (avg_bitrate < block_bitrate) {
+                avg_bitrate += 5;
+                if (avg_bitrate > block_bitrate) {
+                    avg_bitrate = block_bitrate;
+                }
+            }
+            else if (avg_bitrate > block_bitrate) {
+                avg_bitrate -= 5;
+                if (avg_bitrate < block_bitrate) {
+                    avg_bitrate = block_bitrate;
+                }
+            }
+        }
+//        printf ("apx bitrate: %d (last %d)\n", avg_bitrate, last_bitrate);
+    }
 }
 
+// Process the decoded blocks into output_ring, until it has OUTPUT_RING_FILL_MS worth of audio.
+// Called on the streamer thread, with the streamer lock held.
 static void
-streamer_apply_soft_volume (char *bytes, int sz) {
+streamer_fill_output (void) {
     DB_output_t *output = plug_get_output ();
 
-    float mod = 1.f;
+    if (__atomic_load_n (&output_flush_done, __ATOMIC_ACQUIRE) != output_flush_request) {
+        // the consumer didn't drop the data from before streamer_reset yet
+        return;
+    }
 
-    if (streamer_volume_modifier) {
-        float dt = sz * (output->fmt.bps >> 3) / output->fmt.channels / (float)output->fmt.samplerate;
-        mod = streamer_volume_modifier (dt);
-    }
-
-    float vol = volume_get_amp () * mod;
-
-    if (!output->has_volume) {
-        int mult = 1-audio_is_mute ();
-        char *stream = bytes;
-        int bytesread = sz;
-        if (output->fmt.bps == 16) {
-            mult *= 1000;
-            int16_t ivolume = vol * mult;
-            if (ivolume != 1000) {
-                int half = bytesread/2;
-                for (int i = 0; i < half; i++) {
-                    int16_t sample = *((int16_t*)stream);
-                    *((int16_t*)stream) = (int16_t)(((int32_t)sample) * ivolume / 1000);
-                    stream += 2;
-                }
+    int framesize = output->fmt.channels * output->fmt.bps / 8;
+    if (framesize <= 0) {
+        framesize = 1;
+    }
+    size_t target = (size_t)framesize * output->fmt.samplerate / 1000 * OUTPUT_RING_FILL_MS;
+    // the output format may be not set yet, but the blocks still need to be looked at
+    target = max (target, (size_t)framesize);
+
+    for (;;) {
+        // move the pending output into the ring first, in whole frames
+        if (outbuffer_remaining > 0) {
+            size_t n = min (ringbuf_write_space (&output_ring), outbuffer_remaining);
+            n -= n % framesize;
+            if (n > 0) {
+                ringbuf_write (&output_ring, outbuffer_data, n);
+                outbuffer_data += n;
+                outbuffer_remaining -= n;
             }
-        }
-        else if (output->fmt.bps == 8) {
-            mult *= 255;
-            int16_t ivolume = vol * mult;
-            if (ivolume != 255) {
-                for (int i = 0; i < bytesread; i++) {
-                    *stream = (int8_t)(((int32_t)(*stream)) * ivolume / 1000);
-                    stream++;
-                }
+            if (outbuffer_remaining > 0) {
+                break; // the ring is full
             }
+            _outbuffer_release ();
         }
-        else if (output->fmt.bps == 24) {
-            mult *= 1000;
-            int16_t ivolume = vol * mult;
-            if (ivolume != 1000) {
-                int third = bytesread/3;
-                for (int i = 0; i < third; i++) {
-                    int32_t sample = ((unsigned char)stream[0]) | ((unsigned char)stream[1]<<8) | ((signed char)stream[2]<<16);
-                    int32_t newsample = (int32_t)((int64_t)sample * ivolume / 1000);
-                    stream[0] = (newsample&0x0000ff);
-                    stream[1] = (newsample&0x00ff00)>>8;
-                    stream[2] = (newsample&0xff0000)>>16;
-                    stream += 3;
-                }
-            }
+
+        size_t fill = output_ring.size - ringbuf_write_space (&output_ring);
+        if (fill >= target) {
+            break;
         }
-        else if (output->fmt.bps == 32 && !output->fmt.is_float) {
-            mult *= 1000;
-            int16_t ivolume = vol * mult;
-            if (ivolume != 1000) {
-                for (int i = 0; i < bytesread/4; i++) {
-                    int32_t sample = *((int32_t*)stream);
-                    int32_t newsample = (int32_t)((int64_t)sample * ivolume / 1000);
-                    *((int32_t*)stream) = newsample;
-                    stream += 4;
-                }
+
+        streamblock_t *block = streamreader_get_curr_block();
+        if (!block) {
+            // NULL streaming_track means playback stopped,
+            // otherwise just a buffer starvation (e.g. after seeking)
+            if (!streaming_track && !fill && !output_drained) {
+                update_stop_after_current ();
+                _handle_playback_stopped();
+                playpos = 0;
+                playtime = 0;
+                avg_bitrate = -1;
+                last_seekpos = -1;
+                __atomic_store_n (&output_drained, 1, __ATOMIC_RELEASE);
             }
+            else if (streaming_track) {
+                __atomic_store_n (&output_drained, 0, __ATOMIC_RELEASE);
+            }
+            break;
         }
-        else if (output->fmt.bps == 32 && output->fmt.is_float) {
-            float fvolume = vol * (1-audio_is_mute ());
-            if (fvolume != 1.f) {
-                for (int i = 0; i < bytesread/4; i++) {
-                    *((float*)stream) = (*((float*)stream)) * fvolume;
-                    stream += 4;
-                }
+        __atomic_store_n (&output_drained, 0, __ATOMIC_RELEASE);
+
+        // only decode until the next format change
+        if (memcmp (&block->fmt, &last_block_fmt, sizeof (ddb_waveformat_t))) {
+            // ring is drained, and the next block format differs? request format change!
+            if (!fill) {
+                _format_change_wait = 1;
             }
+            break;
+        }
+
+        int block_bitrate = block->bitrate;
+        int rb = process_output_block (block);
+        if (rb > 0) {
+            streamer_update_avg_bitrate (block_bitrate);
         }
     }
 }
@@ -1884,108 +2022,43 @@ streamer_read (char *bytes, int size) {
 #endif
     DB_output_t *output = plug_get_output ();
 
-    if (_format_change_wait) {
-        memset (bytes, 0, size);
-        return size;
+    // drop the data from before the last streamer_reset
+    int flush_request = __atomic_load_n (&output_flush_request, __ATOMIC_ACQUIRE);
+    if (flush_request != output_flush_done) {
+        ringbuf_flush (&output_ring);
+        __atomic_store_n (&output_flush_done, flush_request, __ATOMIC_RELEASE);
     }
 
-    streamer_lock ();
-    streamblock_t *block = streamreader_get_curr_block();
-    if (!block) {
-        // NULL streaming_track means playback stopped,
-        // otherwise just a buffer starvation (e.g. after seeking)
-        if (!streaming_track) {
-            update_stop_after_current ();
-            _handle_playback_stopped();
-            playpos = 0;
-            playtime = 0;
-            avg_bitrate = -1;
-            last_seekpos = -1;
-        }
-        else {
-            // this message is printed in more cases, than if output is broken, so disable it
-            // but keep for reference -- this is a good place to set breakpoint
-//            fprintf (stderr, "streamer: streamer_read has starved. The current output plugin might be broken\n");
-        }
-        streamer_unlock();
-
-        if (streaming_track) {
-            memset (bytes, 0, size);
-            return size;
-        }
-        _audio_stall_count++;
-        return 0;
-    }
-
-    _audio_stall_count = 0;
-
-    int block_bitrate = -1;
-
-    // only decode until the next format change
-    if (!memcmp (&block->fmt, &last_block_fmt, sizeof (ddb_waveformat_t))) {
-        // decode enough blocks to fill the output buffer
-        while (block && outbuffer_remaining < size && !memcmp (&block->fmt, &last_block_fmt, sizeof (ddb_waveformat_t))) {
-            int rb = process_output_block (block, outbuffer + outbuffer_remaining);
-            if (rb <= 0) {
-                break;
-            }
-            outbuffer_remaining += rb;
-            block_bitrate = block->bitrate;
-            block = streamreader_get_curr_block();
-        }
-    }
-    // empty buffer and the next block format differs? request format change!
-
-    if (!outbuffer_remaining && memcmp (&block->fmt, &last_block_fmt, sizeof (ddb_waveformat_t))) {
-        _format_change_wait = 1;
-        streamer_unlock();
+    if (_format_change_wait) {
         memset (bytes, 0, size);
         return size;
     }
-    streamer_unlock ();
 
     // consume decoded data
-    int sz = min (size, outbuffer_remaining);
-    if (!sz) {
-        // no data available
-        memset (bytes, 0, size);
-        return size;
-    }
+    int sz = (int)min ((size_t)size, ringbuf_read_space (&output_ring));
 
     // clip to frame size
     int ss = output->fmt.channels * output->fmt.bps / 8;
-    if ((sz % ss) != 0) {
+    if (ss && (sz % ss) != 0) {
         sz -= (sz % ss);
     }
 
-    memcpy (bytes, outbuffer, sz);
-    if (sz < outbuffer_remaining) {
-        memmove (outbuffer, outbuffer + sz, outbuffer_remaining - sz);
-    }
-    outbuffer_remaining -= sz;
-
-    // approximate bitrate
-    if (block_bitrate != -1) {
-        if (avg_bitrate == -1) {
-            avg_bitrate = block_bitrate;
-        }
-        else {
-            if (avg_bitrate < block_bitrate) {
-                avg_bitrate += 5;
-                if (avg_bitrate > block_bitrate) {
-                    avg_bitrate = block_bitrate;
-                }
-            }
-            else if (avg_bitrate > block_bitrate) {
-                avg_bitrate -= 5;
-                if (avg_bitrate < block_bitrate) {
-                    avg_bitrate = block_bitrate;
-                }
-            }
+    if (!sz) {
+        if (__atomic_load_n (&output_drained, __ATOMIC_ACQUIRE)) {
+            // playback stopped
+            _audio_stall_count++;
+            return 0;
         }
-//        printf ("apx bitrate: %d (last %d)\n", avg_bitrate, last_bitrate);
+        // no data available
+        __atomic_fetch_add (&stats_underruns, 1, __ATOMIC_RELAXED);
+        memset (bytes, 0, size);
+        return size;
     }
 
+    _audio_stall_count = 0;
+
+    ringbuf_read (&output_ring, bytes, sz);
+
 #if 0
     struct timeval tm2;
     gettimeofday (&tm2, NULL);
@@ -2008,8 +2081,14 @@ streamer_read (char *bytes, int size) {
             .is_bigendian = 0
         };
 
-        float temp_audio_data[in_frames * out_fmt.channels];
-        pcm_convert (&output->fmt, bytes, &out_fmt, (char *)temp_audio_data, sz);
+        // the listeners get the output data as is, if it's already in their format
+        int convert = memcmp (&output->fmt, &out_fmt, sizeof (ddb_waveformat_t));
+        float temp_buffer[convert ? in_frames * out_fmt.channels : 1];
+        float *temp_audio_data = (float *)bytes;
+        if (convert) {
+            pcm_convert (&output->fmt, bytes, &out_fmt, (char *)temp_buffer, sz);
+            temp_audio_data = temp_buffer;
+        }
         ddb_audio_data_t data;
         data.fmt = &out_fmt;
         data.data = temp_audio_data;
@@ -2058,11 +2137,33 @@ streamer_read (char *bytes, int size) {
     }
 #endif
 
-    streamer_apply_soft_volume (bytes, sz);
+    // the listeners get the data before the volume is applied
+    pcm_apply_gain (&output->fmt, bytes, sz, streamer_get_soft_volume (ss ? sz / ss : 0));
 
     return sz;
 }
 
+void
+streamer_get_stats (ddb_streamer_stats_t *stats) {
+    int size = stats->_size;
+    if (size > sizeof (ddb_streamer_stats_t)) {
+        size = sizeof (ddb_streamer_stats_t);
+    }
+    streamer_lock ();
+    ddb_streamer_stats_t s = {
+        ._size = size,
+        .blocks_total = streamreader_num_blocks (),
+        .block_size = streamreader_block_size (),
+        .blocks_in_flight = streamreader_num_blocks_in_flight (),
+        .output_buffered = (int)(output_ring.size - ringbuf_write_space (&output_ring)),
+        .underruns = __atomic_load_n (&stats_underruns, __ATOMIC_RELAXED),
+        .direct_blocks = stats_direct_blocks,
+        .staged_blocks = stats_staged_blocks,
+    };
+    streamer_unlock ();
+    memcpy (stats, &s, size);
+}
+
 int
 streamer_ok_to_read (int len) {
     return !streamer_is_buffering;
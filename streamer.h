@@ -102,6 +102,9 @@ streamer_set_bitrate (int bitrate);
 int
 streamer_get_apx_bitrate (void);
 
+void
+streamer_get_stats (ddb_streamer_stats_t *stats);
+
 // returns -1 if theres no next song, or playlist finished
 // reason 0 means "prev song finished", 1 means "interrupt"
 int
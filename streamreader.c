@@ -26,14 +26,21 @@
 #include <stdlib.h>
 #include "streamreader.h"
 #include "replaygain.h"
+#include "conf.h"
 #include "threading.h"
 
-// read ahead about 5 sec at 44100/16/2
+// read ahead about 5 sec at 44100/16/2 with the default block count
 #define BLOCK_SIZE 16384
-#define BLOCK_COUNT 48
+#define DEFAULT_BLOCK_COUNT 48
+#define MIN_BLOCK_COUNT 8
+#define MAX_BLOCK_COUNT 1024
 
 static streamblock_t *blocks; // list of all blocks
 
+static streamblock_t *block_pool; // all blocks, allocated at once
+static char *block_pool_data; // buffers of all blocks
+static int block_count;
+
 static streamblock_t *block_data; // first available block with data (can be NULL)
 
 static streamblock_t *block_next; // next block available to be read into / queued
@@ -50,13 +57,25 @@ void
 streamreader_init (void) {
     _prev_rg_track = NULL;
     _rg_settingschanged = 1;
-    for (int i = 0; i < BLOCK_COUNT; i++) {
-        streamblock_t *b = calloc (1, sizeof (streamblock_t));
+
+    // the pool is not resized at runtime, the change takes effect after restart
+    block_count = conf_get_int ("streamer.block_count", DEFAULT_BLOCK_COUNT);
+    if (block_count < MIN_BLOCK_COUNT) {
+        block_count = MIN_BLOCK_COUNT;
+    }
+    else if (block_count > MAX_BLOCK_COUNT) {
+        block_count = MAX_BLOCK_COUNT;
+    }
+
+    block_pool = calloc (block_count, sizeof (streamblock_t));
+    block_pool_data = malloc ((size_t)block_count * BLOCK_SIZE);
+    for (int i = 0; i < block_count; i++) {
+        streamblock_t *b = &block_pool[i];
         b->pos = -1;
-        b->buf = malloc (BLOCK_SIZE);
-        b->next = blocks;
-        blocks = b;
+        b->buf = block_pool_data + (size_t)i * BLOCK_SIZE;
+        b->next = i < block_count - 1 ? &block_pool[i+1] : NULL;
     }
+    blocks = block_pool;
     block_next = blocks;
     numblocks_ready = 0;
     _firstblock = 0;
@@ -65,12 +84,12 @@ streamreader_init (void) {
 void
 streamreader_free (void) {
     streamreader_reset ();
-    while (blocks) {
-        streamblock_t *next = blocks->next;
-        free (blocks->buf);
-        free (blocks);
-        blocks = next;
-    }
+    free (block_pool);
+    block_pool = NULL;
+    free (block_pool_data);
+    block_pool_data = NULL;
+    blocks = NULL;
+    block_count = 0;
     block_next = block_data = NULL;
     numblocks_ready = 0;
     _prev_rg_track = NULL;
@@ -80,12 +99,23 @@ streamreader_free (void) {
 
 streamblock_t *
 streamreader_get_next_block (void) {
-    if (block_next->pos >= 0) {
-        return NULL; // all buffers full
+    if (block_next->pos >= 0 || block_next->refc > 0) {
+        return NULL; // all buffers full, or the next one is still referenced
     }
     return block_next;
 }
 
+void
+streamreader_block_ref (streamblock_t *block) {
+    block->refc++;
+}
+
+void
+streamreader_block_unref (streamblock_t *block) {
+    assert (block->refc > 0);
+    block->refc--;
+}
+
 void
 streamreader_configchanged (void) {
     _rg_settingschanged = 1;
@@ -129,10 +159,9 @@ streamreader_read_block (streamblock_t *block, playItem_t *track, DB_fileinfo_t
     pl_item_ref (track);
     block->track = track;
 
+    // the streamer applies the gain later, together with the volume
     int input_does_rg = fileinfo->plugin->plugin.flags & DDB_PLUGIN_FLAG_REPLAYGAIN;
-    if (!input_does_rg) {
-        replaygain_apply (&fileinfo->fmt, block->buf, block->size);
-    }
+    block->replaygain = input_does_rg ? 1.f : replaygain_get_current_scale ();
 
     if (_firstblock) {
         block->first = 1;
@@ -226,3 +255,24 @@ int
 streamreader_num_blocks_ready (void) {
     return numblocks_ready;
 }
+
+int
+streamreader_num_blocks (void) {
+    return block_count;
+}
+
+int
+streamreader_block_size (void) {
+    return BLOCK_SIZE;
+}
+
+int
+streamreader_num_blocks_in_flight (void) {
+    int n = numblocks_ready;
+    for (int i = 0; i < block_count; i++) {
+        if (block_pool[i].refc > 0 && !block_pool[i].queued) {
+            n++;
+        }
+    }
+    return n;
+}
@@ -35,11 +35,16 @@ typedef struct streamblock_s {
     int first; // set to 1 for the first buffer of the stream, following the block with last=1
     int last; // set to 1 for last buffer of the stream
     int bitrate;
+    float replaygain; // ReplayGain scale, which is not applied to the data yet
 
     playItem_t *track;
     ddb_waveformat_t fmt;
 
     int queued;
+
+    // Number of references held by the consumers of the block data.
+    // A block which was released from the queue is not reused until all references are dropped.
+    int refc;
 } streamblock_t;
 
 void
@@ -52,6 +57,14 @@ streamreader_free (void);
 streamblock_t *
 streamreader_get_next_block (void);
 
+// Hold the block data, to consume it without copying.
+// The streamer mutex must be locked when calling ref / unref.
+void
+streamreader_block_ref (streamblock_t *block);
+
+void
+streamreader_block_unref (streamblock_t *block);
+
 // Reads data from stream to the specified block.
 // The mutex must NOT be locked when this function is called.
 // It will get locked if successful.
@@ -81,6 +94,17 @@ streamreader_reset (void);
 int
 streamreader_num_blocks_ready (void);
 
+// Number of blocks in the pool
+int
+streamreader_num_blocks (void);
+
+int
+streamreader_block_size (void);
+
+// Number of blocks in the queue, plus the released blocks which are still referenced
+int
+streamreader_num_blocks_in_flight (void);
+
 // Notify streamreader that some configuration has changed
 void
 streamreader_configchanged (void);
@@ -33,13 +33,18 @@
 //  1: function call
 //   func_idx:byte, num_args:byte, arg1_len:uint16[,arg2_len:byte[,...]]
 //  2: meta field
-//   len:byte, data
+//   field_id:byte, key_id:uint32, len:byte, name
+//   field_id is one of TF_FIELD_*, key_id is the metadata key id of the name
+//   (see pl_meta_key_id), both resolved at compile time
 //  3: if_defined block
 //   len:int32, data
 //  4: pre-interpreted text
 //   len:int32, data
 //  5: text dimming block
 //   dim_amount:int8, len:int32, data
+//  6: unused
+//  7: constant, result of a pure function call with constant arguments, folded at compile time
+//   is_true:byte, len:int32, data
 // !0: plain text
 
 #ifdef HAVE_CONFIG_H
@@ -74,8 +79,15 @@ typedef struct {
     const char *i;
     char *o;
     int eol;
+    int flags; // TF_CODE_FLAG_*
 } tf_compiler_t;
 
+// compiled script layout: int32 code size, code, 4 zero bytes of padding, flags byte
+enum {
+    // the script has fields which need pl_lock, see tf_field_needs_exclusive_lock
+    TF_CODE_FLAG_EXCLUSIVE_LOCK = 1,
+};
+
 typedef int (*tf_func_ptr_t)(ddb_tf_context_t *ctx, int argc, const uint16_t *arglens, const char *args, char *out, int outlen, int fail_on_undef);
 
 #define TF_MAX_FUNCS 0xff
@@ -83,8 +95,116 @@ typedef int (*tf_func_ptr_t)(ddb_tf_context_t *ctx, int argc, const uint16_t *ar
 typedef struct {
     const char *name;
     tf_func_ptr_t func;
+    // the result only depends on the arguments,
+    // so the calls with constant arguments are evaluated at compile time
+    int is_pure;
 } tf_func_def;
 
+// fields with special handling, resolved at compile time
+enum {
+    TF_FIELD_META, // plain metadata lookup
+    TF_FIELD_ALBUM_ARTIST,
+    TF_FIELD_ARTIST,
+    TF_FIELD_ALBUM,
+    TF_FIELD_TRACK_ARTIST,
+    TF_FIELD_TRACKNUMBER,
+    TF_FIELD_TITLE,
+    TF_FIELD_DISCNUMBER,
+    TF_FIELD_TOTALDISCS,
+    TF_FIELD_TRACK_NUMBER,
+    TF_FIELD_DATE,
+    TF_FIELD_SAMPLERATE,
+    TF_FIELD_PLAYBACK_BITRATE,
+    TF_FIELD_BITRATE,
+    TF_FIELD_FILESIZE,
+    TF_FIELD_FILESIZE_NATURAL,
+    TF_FIELD_CHANNELS,
+    TF_FIELD_CODEC,
+    TF_FIELD_REPLAYGAIN_ALBUM_GAIN,
+    TF_FIELD_REPLAYGAIN_ALBUM_PEAK,
+    TF_FIELD_REPLAYGAIN_TRACK_GAIN,
+    TF_FIELD_REPLAYGAIN_TRACK_PEAK,
+    TF_FIELD_PLAYBACK_TIME,
+    TF_FIELD_PLAYBACK_TIME_SECONDS,
+    TF_FIELD_PLAYBACK_TIME_REMAINING,
+    TF_FIELD_PLAYBACK_TIME_REMAINING_SECONDS,
+    TF_FIELD_LENGTH,
+    TF_FIELD_LENGTH_EX,
+    TF_FIELD_LENGTH_SECONDS,
+    TF_FIELD_LENGTH_SECONDS_FP,
+    TF_FIELD_LENGTH_SAMPLES,
+    TF_FIELD_ISPLAYING,
+    TF_FIELD_ISPAUSED,
+    TF_FIELD_FILENAME,
+    TF_FIELD_FILENAME_EXT,
+    TF_FIELD_DIRECTORYNAME,
+    TF_FIELD_PATH_RAW,
+    TF_FIELD_PATH,
+    TF_FIELD_LIST_INDEX,
+    TF_FIELD_LIST_TOTAL,
+    TF_FIELD_QUEUE_INDEX,
+    TF_FIELD_QUEUE_INDEXES,
+    TF_FIELD_QUEUE_TOTAL,
+    TF_FIELD_DEADBEEF_VERSION,
+    TF_FIELD_PLAYLIST_NAME,
+    TF_FIELD_SELECTION_PLAYBACK_TIME,
+    TF_FIELD_COUNT
+};
+
+// names of the special fields, indexed by TF_FIELD_*
+static const char *tf_field_names[TF_FIELD_COUNT] = {
+    [TF_FIELD_ALBUM_ARTIST] = "album artist",
+    [TF_FIELD_ARTIST] = "artist",
+    [TF_FIELD_ALBUM] = "album",
+    [TF_FIELD_TRACK_ARTIST] = "track artist",
+    [TF_FIELD_TRACKNUMBER] = "tracknumber",
+    [TF_FIELD_TITLE] = "title",
+    [TF_FIELD_DISCNUMBER] = "discnumber",
+    [TF_FIELD_TOTALDISCS] = "totaldiscs",
+    [TF_FIELD_TRACK_NUMBER] = "track number",
+    [TF_FIELD_DATE] = "date",
+    [TF_FIELD_SAMPLERATE] = "samplerate",
+    [TF_FIELD_PLAYBACK_BITRATE] = "playback_bitrate",
+    [TF_FIELD_BITRATE] = "bitrate",
+    [TF_FIELD_FILESIZE] = "filesize",
+    [TF_FIELD_FILESIZE_NATURAL] = "filesize_natural",
+    [TF_FIELD_CHANNELS] = "channels",
+    [TF_FIELD_CODEC] = "codec",
+    [TF_FIELD_REPLAYGAIN_ALBUM_GAIN] = "replaygain_album_gain",
+    [TF_FIELD_REPLAYGAIN_ALBUM_PEAK] = "replaygain_album_peak",
+    [TF_FIELD_REPLAYGAIN_TRACK_GAIN] = "replaygain_track_gain",
+    [TF_FIELD_REPLAYGAIN_TRACK_PEAK] = "replaygain_track_peak",
+    [TF_FIELD_PLAYBACK_TIME] = "playback_time",
+    [TF_FIELD_PLAYBACK_TIME_SECONDS] = "playback_time_seconds",
+    [TF_FIELD_PLAYBACK_TIME_REMAINING] = "playback_time_remaining",
+    [TF_FIELD_PLAYBACK_TIME_REMAINING_SECONDS] = "playback_time_remaining_seconds",
+    [TF_FIELD_LENGTH] = "length",
+    [TF_FIELD_LENGTH_EX] = "length_ex",
+    [TF_FIELD_LENGTH_SECONDS] = "length_seconds",
+    [TF_FIELD_LENGTH_SECONDS_FP] = "length_seconds_fp",
+    [TF_FIELD_LENGTH_SAMPLES] = "length_samples",
+    [TF_FIELD_ISPLAYING] = "isplaying",
+    [TF_FIELD_ISPAUSED] = "ispaused",
+    [TF_FIELD_FILENAME] = "filename",
+    [TF_FIELD_FILENAME_EXT] = "filename_ext",
+    [TF_FIELD_DIRECTORYNAME] = "directoryname",
+    [TF_FIELD_PATH_RAW] = "_path_raw",
+    [TF_FIELD_PATH] = "path",
+    [TF_FIELD_LIST_INDEX] = "list_index",
+    [TF_FIELD_LIST_TOTAL] = "list_total",
+    [TF_FIELD_QUEUE_INDEX] = "queue_index",
+    [TF_FIELD_QUEUE_INDEXES] = "queue_indexes",
+    [TF_FIELD_QUEUE_TOTAL] = "queue_total",
+    [TF_FIELD_DEADBEEF_VERSION] = "_deadbeef_version",
+    [TF_FIELD_PLAYLIST_NAME] = "_playlist_name",
+    [TF_FIELD_SELECTION_PLAYBACK_TIME] = "selection_playback_time",
+};
+
+// key ids of the fields with fallbacks, zero-terminated, resolved by the first tf_compile
+static uint32_t tf_aa_keys[7];
+static uint32_t tf_a_keys[6];
+static uint32_t tf_alb_keys[3];
+
 static int
 tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int outlen, int *bool_out, int fail_on_undef);
 
@@ -101,7 +221,26 @@ static playItem_t empty_track;
 // empty playlist is used when ctx.plt is null
 static playlist_t empty_playlist;
 // empty code is used when "code" argumen is null
-static char empty_code[4] = {0};
+static char empty_code[9] = {0};
+
+// these fields may release the last reference to the playing track,
+// or update the cached playlist state, so they can't be evaluated under pl_lock_shared
+static int
+tf_field_needs_exclusive_lock (uint8_t field) {
+    switch (field) {
+    case TF_FIELD_PLAYBACK_BITRATE:
+    case TF_FIELD_BITRATE:
+    case TF_FIELD_PLAYBACK_TIME:
+    case TF_FIELD_PLAYBACK_TIME_SECONDS:
+    case TF_FIELD_PLAYBACK_TIME_REMAINING:
+    case TF_FIELD_PLAYBACK_TIME_REMAINING_SECONDS:
+    case TF_FIELD_ISPLAYING:
+    case TF_FIELD_ISPAUSED:
+    case TF_FIELD_SELECTION_PLAYBACK_TIME:
+        return 1;
+    }
+    return 0;
+}
 
 static int
 snprintf_clip (char *buf, size_t len, const char *fmt, ...) {
@@ -116,37 +255,20 @@ snprintf_clip (char *buf, size_t len, const char *fmt, ...) {
     return (int)min (n, len-1);
 }
 
-int
-tf_eval (ddb_tf_context_t *ctx, const char *code, char *out, int outlen) {
-    if (
+static int
+tf_context_is_valid (ddb_tf_context_t *ctx) {
+    return
         // 0.7.2
-        ctx->_size != (char *)&ctx->dimmed - (char *)ctx
+        ctx->_size == (char *)&ctx->dimmed - (char *)ctx
         // 0.8
-        && ctx->_size != sizeof (ddb_tf_context_t)
-        ) {
-        *out = 0;
-        return -1;
-    }
-
-    if (!code) {
-        code = empty_code;
-    }
-
-    int null_it = 0;
-    if (!ctx->it) {
-        null_it = 1;
-        ctx->it = (ddb_playItem_t *)&empty_track;
-    }
-
-    int null_plt = 0;
-    if (!ctx->plt) {
-        null_plt = 1;
-        ctx->plt = (ddb_playlist_t *)&empty_playlist;
-    }
+        || ctx->_size == sizeof (ddb_tf_context_t);
+}
 
-    int32_t codelen = *((int32_t *)code);
-    code += 4;
-    memset (out, 0, outlen);
+// evaluate the script for ctx->it, which must be non-null;
+// code points past the length prefix
+static int
+tf_eval_track (ddb_tf_context_t *ctx, const char *code, int32_t codelen, char *out, int outlen) {
+    *out = 0;
     int l = 0;
 
     int bool_out = 0;
@@ -175,6 +297,9 @@ tf_eval (ddb_tf_context_t *ctx, const char *code, char *out, int outlen) {
     default:
         // tf_eval_int expects outlen to not include the terminating zero
         l = tf_eval_int (ctx, code, codelen, out, outlen-1, &bool_out, 0);
+        if (l < 0) {
+            *out = 0;
+        }
         break;
     }
 
@@ -190,6 +315,35 @@ tf_eval (ddb_tf_context_t *ctx, const char *code, char *out, int outlen) {
         }
     }
 
+    return l;
+}
+
+int
+tf_eval (ddb_tf_context_t *ctx, const char *code, char *out, int outlen) {
+    if (!tf_context_is_valid (ctx)) {
+        *out = 0;
+        return -1;
+    }
+
+    if (!code) {
+        code = empty_code;
+    }
+
+    int null_it = 0;
+    if (!ctx->it) {
+        null_it = 1;
+        ctx->it = (ddb_playItem_t *)&empty_track;
+    }
+
+    int null_plt = 0;
+    if (!ctx->plt) {
+        null_plt = 1;
+        ctx->plt = (ddb_playlist_t *)&empty_playlist;
+    }
+
+    int32_t codelen = *((int32_t *)code);
+    int l = tf_eval_track (ctx, code + 4, codelen, out, outlen);
+
     if (null_it) {
         ctx->it = NULL;
     }
@@ -199,6 +353,65 @@ tf_eval (ddb_tf_context_t *ctx, const char *code, char *out, int outlen) {
     return l;
 }
 
+int
+tf_eval_batch (ddb_tf_context_t *ctx, const char *code, ddb_playItem_t **tracks, int count, char *arena, size_t arena_size, int outlen, const char **results) {
+    if (!tf_context_is_valid (ctx) || outlen <= 0) {
+        return -1;
+    }
+
+    if (!code) {
+        code = empty_code;
+    }
+
+    int null_plt = 0;
+    if (!ctx->plt) {
+        null_plt = 1;
+        ctx->plt = (ddb_playlist_t *)&empty_playlist;
+    }
+
+    ddb_playItem_t *it = ctx->it;
+    int idx = ctx->idx;
+
+    int32_t codelen = *((int32_t *)code);
+    int exclusive = code[4 + codelen + 4] & TF_CODE_FLAG_EXCLUSIVE_LOCK;
+    code += 4;
+
+    // every field access would take the lock otherwise
+    if (exclusive) {
+        pl_lock ();
+    }
+    else {
+        pl_lock_shared ();
+    }
+
+    int n;
+    for (n = 0; n < count && arena_size >= (size_t)outlen; n++) {
+        ctx->it = tracks[n] ? tracks[n] : (ddb_playItem_t *)&empty_track;
+        if (ctx->flags & DDB_TF_CONTEXT_HAS_INDEX) {
+            ctx->idx = idx + n;
+        }
+        tf_eval_track (ctx, code, codelen, arena, outlen);
+        size_t l = strlen (arena);
+        results[n] = arena;
+        arena += l + 1;
+        arena_size -= l + 1;
+    }
+
+    if (exclusive) {
+        pl_unlock ();
+    }
+    else {
+        pl_unlock_shared ();
+    }
+
+    ctx->it = it;
+    ctx->idx = idx;
+    if (null_plt) {
+        ctx->plt = NULL;
+    }
+    return n;
+}
+
 // $greater(a,b) returns true if a is greater than b, otherwise false
 int
 tf_func_greater (ddb_tf_context_t *ctx, int argc, const uint16_t *arglens, const char *args, char *out, int outlen, int fail_on_undef) {
@@ -1714,56 +1927,56 @@ tf_func_hex (ddb_tf_context_t *ctx, int argc, const uint16_t *arglens, const cha
 
 tf_func_def tf_funcs[TF_MAX_FUNCS] = {
     // Control flow
-    { "if", tf_func_if },
-    { "if2", tf_func_if2 },
-    { "if3", tf_func_if3 },
-    { "ifequal", tf_func_ifequal },
-    { "ifgreater", tf_func_ifgreater },
-    { "iflonger", tf_func_iflonger },
-    { "select", tf_func_select },
+    { "if", tf_func_if, 1 },
+    { "if2", tf_func_if2, 1 },
+    { "if3", tf_func_if3, 1 },
+    { "ifequal", tf_func_ifequal, 1 },
+    { "ifgreater", tf_func_ifgreater, 1 },
+    { "iflonger", tf_func_iflonger, 1 },
+    { "select", tf_func_select, 1 },
     // Arithmetic
-    { "add", tf_func_add },
-    { "div", tf_func_div },
-    { "greater", tf_func_greater },
-    { "max", tf_func_max },
-    { "min", tf_func_min },
-    { "mod", tf_func_mod },
-    { "mul", tf_func_mul },
-    { "muldiv", tf_func_muldiv },
+    { "add", tf_func_add, 1 },
+    { "div", tf_func_div, 1 },
+    { "greater", tf_func_greater, 1 },
+    { "max", tf_func_max, 1 },
+    { "min", tf_func_min, 1 },
+    { "mod", tf_func_mod, 1 },
+    { "mul", tf_func_mul, 1 },
+    { "muldiv", tf_func_muldiv, 1 },
     { "rand", tf_func_rand },
-    { "sub", tf_func_sub },
+    { "sub", tf_func_sub, 1 },
     // Boolean
-    { "and", tf_func_and },
-    { "or", tf_func_or },
-    { "not", tf_func_not },
-    { "xor", tf_func_xor },
+    { "and", tf_func_and, 1 },
+    { "or", tf_func_or, 1 },
+    { "not", tf_func_not, 1 },
+    { "xor", tf_func_xor, 1 },
     // String
-    { "abbr", tf_func_abbr },
-    { "ansi", tf_func_ansi },
-    { "ascii", tf_func_ascii },
-    { "caps", tf_func_caps },
-    { "caps2", tf_func_caps2 },
-    { "char", tf_func_char },
-    { "crc32", tf_func_crc32 },
-    { "crlf", tf_func_crlf },
-    { "cut", tf_func_left },
-    { "left", tf_func_left }, // alias of 'cut'
-    { "directory", tf_func_directory },
-    { "directory_path", tf_func_directory_path },
-    { "ext", tf_func_ext },
-    { "filename", tf_func_filename },
-    { "fix_eol", tf_func_fix_eol },
-    { "hex", tf_func_hex },
-    { "strcmp", tf_func_strcmp },
-    { "upper", tf_func_upper },
-    { "lower", tf_func_lower },
-    { "num", tf_func_num },
-    { "replace", tf_func_replace },
-    { "repeat", tf_func_repeat },
-    { "insert", tf_func_insert },
-    { "len", tf_func_len },
-    { "pad", tf_func_pad },
-    { "pad_right", tf_func_pad_right },
+    { "abbr", tf_func_abbr, 1 },
+    { "ansi", tf_func_ansi, 1 },
+    { "ascii", tf_func_ascii, 1 },
+    { "caps", tf_func_caps, 1 },
+    { "caps2", tf_func_caps2, 1 },
+    { "char", tf_func_char, 1 },
+    { "crc32", tf_func_crc32, 1 },
+    { "crlf", tf_func_crlf, 1 },
+    { "cut", tf_func_left, 1 },
+    { "left", tf_func_left, 1 }, // alias of 'cut'
+    { "directory", tf_func_directory, 1 },
+    { "directory_path", tf_func_directory_path, 1 },
+    { "ext", tf_func_ext, 1 },
+    { "filename", tf_func_filename, 1 },
+    { "fix_eol", tf_func_fix_eol, 1 },
+    { "hex", tf_func_hex, 1 },
+    { "strcmp", tf_func_strcmp, 1 },
+    { "upper", tf_func_upper, 1 },
+    { "lower", tf_func_lower, 1 },
+    { "num", tf_func_num, 1 },
+    { "replace", tf_func_replace, 1 },
+    { "repeat", tf_func_repeat, 1 },
+    { "insert", tf_func_insert, 1 },
+    { "len", tf_func_len, 1 },
+    { "pad", tf_func_pad, 1 },
+    { "pad_right", tf_func_pad_right, 1 },
     // Track info
     { "meta", tf_func_meta },
     { "channels", tf_func_channels },
@@ -1771,9 +1984,7 @@ tf_func_def tf_funcs[TF_MAX_FUNCS] = {
 };
 
 static const char *
-_tf_get_combined_value (playItem_t *it, const char *key, int *needs_free) {
-    DB_metaInfo_t *meta = pl_meta_for_key (it, key);
-
+_tf_combine_values (DB_metaInfo_t *meta, int *needs_free) {
     if (!meta) {
         *needs_free = 0;
         return NULL;
@@ -1818,6 +2029,27 @@ _tf_get_combined_value (playItem_t *it, const char *key, int *needs_free) {
     return out;
 }
 
+static const char *
+_tf_get_combined_value (playItem_t *it, const char *key, int *needs_free) {
+    return _tf_combine_values (pl_meta_for_key (it, key), needs_free);
+}
+
+static const char *
+_tf_get_combined_value_for_id (playItem_t *it, uint32_t key_id, int *needs_free) {
+    return _tf_combine_values (pl_meta_for_key_id (it, key_id), needs_free);
+}
+
+// returns the value of the first existing key from zero-terminated list of key ids
+static const char *
+_tf_get_first_combined_value (playItem_t *it, const uint32_t *key_ids, int *needs_free) {
+    const char *val = NULL;
+    *needs_free = 0;
+    for (int i = 0; !val && key_ids[i]; i++) {
+        val = _tf_get_combined_value_for_id (it, key_ids[i], needs_free);
+    }
+    return val;
+}
+
 static int
 format_playback_time (char *out, int outlen, float t) {
     int daystotal = (int)t / (3600*24);
@@ -1850,10 +2082,16 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
 
     while (size) {
         if (*code) {
-            int len = u8_charcpy (out, code, outlen);
-            if (len == 0) {
+            // copy the whole run of plain text at once
+            int len = 0;
+            while (len < size && code[len]) {
+                len++;
+            }
+            if (len > outlen) {
+                out += u8_strnbcpy (out, code, outlen);
                 break;
             }
+            memcpy (out, code, len);
             code += len;
             size -= len;
             out += len;
@@ -1899,60 +2137,61 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
             else if (*code == 2) {
                 code++;
                 size--;
+                uint8_t field = (uint8_t)*code;
+                code++;
+                size--;
+                uint32_t key_id;
+                memcpy (&key_id, code, 4);
+                code += 4;
+                size -= 4;
                 uint8_t len = *code;
                 code++;
                 size--;
 
-                char name[len+1];
-                memcpy (name, code, len);
-                name[len] = 0;
-
                 // special cases
                 // most if not all of this stuff is to make tf scripts
                 // compatible with fb2k syntax
-                pl_lock ();
+                int exclusive = tf_field_needs_exclusive_lock (field);
+                if (exclusive) {
+                    pl_lock ();
+                }
+                else {
+                    pl_lock_shared ();
+                }
                 const char *val = NULL;
                 int needs_free = 0;
-                const char *aa_fields[] = { "album artist", "albumartist", "band", "artist", "composer", "performer", NULL };
-                const char *a_fields[] = { "artist", "album artist", "albumartist", "composer", "performer", NULL };
-                const char *alb_fields[] = { "album", "venue", NULL };
 
                 // set to 1 if special case handler successfully wrote the output
                 int skip_out = 0;
 
-                // temp vars used for strcmp optimizations
-                int tmp_a = 0, tmp_b = 0, tmp_c = 0, tmp_d = 0;
-
-                if (!strcmp (name, aa_fields[0])) {
-                    for (int i = 0; !val && aa_fields[i]; i++) {
-                        val = _tf_get_combined_value(it, aa_fields[i], &needs_free);
-                    }
-                }
-                else if (!strcmp (name, a_fields[0])) {
-                    for (int i = 0; !val && a_fields[i]; i++) {
-                        val = _tf_get_combined_value(it, a_fields[i], &needs_free);
-                    }
-                }
-                else if (!strcmp (name, "album")) {
-                    for (int i = 0; !val && alb_fields[i]; i++) {
-                        val = _tf_get_combined_value (it, alb_fields[i], &needs_free);
-                    }
-                }
-                else if (!strcmp (name, "track artist")) {
-                    const char *aa = NULL;
-                    for (int i = 0; !val && aa_fields[i]; i++) {
-                        val = _tf_get_combined_value (it, aa_fields[i], &needs_free);
-                    }
-                    aa = val;
-                    val = NULL;
-                    for (int i = 0; !val && a_fields[i]; i++) {
-                        val = _tf_get_combined_value (it, a_fields[i], &needs_free);
-                    }
+                switch (field) {
+                case TF_FIELD_ALBUM_ARTIST:
+                    val = _tf_get_first_combined_value (it, tf_aa_keys, &needs_free);
+                    break;
+                case TF_FIELD_ARTIST:
+                    val = _tf_get_first_combined_value (it, tf_a_keys, &needs_free);
+                    break;
+                case TF_FIELD_ALBUM:
+                    val = _tf_get_first_combined_value (it, tf_alb_keys, &needs_free);
+                    break;
+                case TF_FIELD_TRACK_ARTIST: {
+                    const char *aa = _tf_get_first_combined_value (it, tf_aa_keys, &needs_free);
+                    int aa_needs_free = needs_free;
+                    val = _tf_get_first_combined_value (it, tf_a_keys, &needs_free);
                     if (val && aa && !strcmp (val, aa)) {
+                        if (needs_free) {
+                            free ((char *)val);
+                            needs_free = 0;
+                        }
                         val = NULL;
                     }
+                    if (aa && aa_needs_free) {
+                        free ((char *)aa);
+                    }
+                    break;
                 }
-                else if (!strcmp (name, "tracknumber")) {
+                case TF_FIELD_TRACKNUMBER:
+                case TF_FIELD_TRACK_NUMBER: {
                     const char *v = pl_find_meta_raw (it, "track");
                     if (v) {
                         const char *p = v;
@@ -1963,15 +2202,16 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                             p++;
                         }
                         if (p > v) {
-                            int len = snprintf_clip (out, outlen, "%02d", atoi(v));
+                            int len = snprintf_clip (out, outlen, field == TF_FIELD_TRACKNUMBER ? "%02d" : "%d", atoi(v));
                             out += len;
                             outlen -= len;
                             skip_out = 1;
                         }
                     }
+                    break;
                 }
-                else if (!strcmp (name, "title")) {
-                    val = _tf_get_combined_value (it, "title", &needs_free);
+                case TF_FIELD_TITLE:
+                    val = _tf_get_combined_value_for_id (it, key_id, &needs_free);
                     if (!val) {
                         const char *v = pl_find_meta_raw (it, ":URI");
                         if (v) {
@@ -1996,40 +2236,22 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                             }
                         }
                     }
-                }
-                else if (!strcmp (name, "discnumber")) {
+                    break;
+                case TF_FIELD_DISCNUMBER:
                     val = pl_find_meta_raw (it, "disc");
-                }
-                else if (!strcmp (name, "totaldiscs")) {
+                    break;
+                case TF_FIELD_TOTALDISCS:
                     val = pl_find_meta_raw (it, "numdiscs");
-                }
-                else if (!strcmp (name, "track number")) {
-                    const char *v = pl_find_meta_raw (it, "track");
-                    if (v) {
-                        const char *p = v;
-                        while (*p) {
-                            if (!isdigit (*p)) {
-                                break;
-                            }
-                            p++;
-                        }
-                        if (p > v) {
-                            int len = snprintf_clip (out, outlen, "%d", atoi(v));
-                            out += len;
-                            outlen -= len;
-                            skip_out = 1;
-                        }
-                    }
-                }
-                else if (!strcmp (name, "date")) {
+                    break;
+                case TF_FIELD_DATE:
                     // NOTE: foobar2000 uses "date" instead of "year"
                     // so for %date% we simply return the content of "year"
                     val = pl_find_meta_raw (it, "year");
-                }
-                else if (!strcmp (name, "samplerate")) {
+                    break;
+                case TF_FIELD_SAMPLERATE:
                     val = pl_find_meta_raw (it, ":SAMPLERATE");
-                }
-                else if (!strcmp (name, "playback_bitrate")) {
+                    break;
+                case TF_FIELD_PLAYBACK_BITRATE: {
                     playItem_t *playing_track = streamer_get_playing_track();
                     if (playing_track) {
                         int br = streamer_get_apx_bitrate();
@@ -2041,14 +2263,15 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         }
                         pl_item_unref (playing_track);
                     }
+                    break;
                 }
-                else if (!strcmp (name, "bitrate")) {
+                case TF_FIELD_BITRATE:
                     val = pl_find_meta_raw (it, ":BITRATE");
-                }
-                else if (!strcmp (name, "filesize")) {
+                    break;
+                case TF_FIELD_FILESIZE:
                     val = pl_find_meta_raw (it, ":FILE_SIZE");
-                }
-                else if (!strcmp (name, "filesize_natural")) {
+                    break;
+                case TF_FIELD_FILESIZE_NATURAL: {
                     const char *v = pl_find_meta_raw (it, ":FILE_SIZE");
                     if (v) {
                         int64_t bs = atoll (v);
@@ -2072,36 +2295,40 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         outlen -= len;
                         skip_out = 1;
                     }
+                    break;
                 }
-                else if (!strcmp (name, "channels")) {
+                case TF_FIELD_CHANNELS:
                     val = tf_get_channels_string_for_track (it);
-                }
-                else if (!strcmp (name, "codec")) {
+                    break;
+                case TF_FIELD_CODEC:
                     val = pl_find_meta (it, ":FILETYPE");
-                }
-                else if (!strcmp (name, "replaygain_album_gain")) {
+                    break;
+                case TF_FIELD_REPLAYGAIN_ALBUM_GAIN:
                     val = pl_find_meta_raw (it, ":REPLAYGAIN_ALBUMGAIN");
-                }
-                else if (!strcmp (name, "replaygain_album_peak")) {
+                    break;
+                case TF_FIELD_REPLAYGAIN_ALBUM_PEAK:
                     val = pl_find_meta_raw (it, ":REPLAYGAIN_ALBUMPEAK");
-                }
-                else if (!strcmp (name, "replaygain_track_gain")) {
+                    break;
+                case TF_FIELD_REPLAYGAIN_TRACK_GAIN:
                     val = pl_find_meta_raw (it, ":REPLAYGAIN_TRACKGAIN");
-                }
-                else if (!strcmp (name, "replaygain_track_peak")) {
+                    break;
+                case TF_FIELD_REPLAYGAIN_TRACK_PEAK:
                     val = pl_find_meta_raw (it, ":REPLAYGAIN_TRACKPEAK");
-                }
-                else if ((tmp_a = !strcmp (name, "playback_time")) || (tmp_b = !strcmp (name, "playback_time_seconds")) || (tmp_c = !strcmp (name, "playback_time_remaining")) || (tmp_d = !strcmp (name, "playback_time_remaining_seconds"))) {
+                    break;
+                case TF_FIELD_PLAYBACK_TIME:
+                case TF_FIELD_PLAYBACK_TIME_SECONDS:
+                case TF_FIELD_PLAYBACK_TIME_REMAINING:
+                case TF_FIELD_PLAYBACK_TIME_REMAINING_SECONDS: {
                     playItem_t *playing = streamer_get_playing_track ();
                     if (it && playing == it && !(ctx->flags & DDB_TF_CONTEXT_NO_DYNAMIC)) {
                         float t = streamer_get_playpos ();
-                        if (tmp_c || tmp_d) {
+                        if (field == TF_FIELD_PLAYBACK_TIME_REMAINING || field == TF_FIELD_PLAYBACK_TIME_REMAINING_SECONDS) {
                             float dur = pl_get_item_duration (it);
                             t = dur - t;
                         }
                         if (t >= 0) {
                             int len = 0;
-                            if (tmp_a || tmp_c) {
+                            if (field == TF_FIELD_PLAYBACK_TIME || field == TF_FIELD_PLAYBACK_TIME_REMAINING) {
                                 int hr = t/3600;
                                 int mn = (t-hr*3600)/60;
                                 int sc = t-hr*3600-mn*60;
@@ -2112,7 +2339,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                                     len = snprintf_clip (out, outlen, "%d:%02d", mn, sc);
                                 }
                             }
-                            else if (tmp_b || tmp_d) {
+                            else {
                                 len = snprintf_clip (out, outlen, "%0.2f", t);
                             }
                             out += len;
@@ -2127,22 +2354,25 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                     if (playing) {
                         pl_item_unref (playing);
                     }
+                    break;
                 }
-                else if ((tmp_a = !strcmp (name, "length")) || (tmp_b = !strcmp (name, "length_ex"))) {
+                case TF_FIELD_LENGTH:
+                case TF_FIELD_LENGTH_EX: {
+                    int ex = field == TF_FIELD_LENGTH_EX;
                     float t = pl_get_item_duration (it);
-                    if (tmp_a) {
+                    if (!ex) {
                         t = roundf (t);
                     }
-                    else if (tmp_b) {
+                    else {
                         t = roundf(t * 1000) / 1000.f;
                     }
                     if (t >= 0) {
                         int hr = t/3600;
                         int mn = (t-hr*3600)/60;
-                        int sc = tmp_a ? t-hr*3600-mn*60 : t-hr*3600-mn*60;
-                        int ms = tmp_b ? (t-hr*3600-mn*60-sc) * 1000.f : 0;
+                        int sc = t-hr*3600-mn*60;
+                        int ms = ex ? (t-hr*3600-mn*60-sc) * 1000.f : 0;
                         int len = 0;
-                        if (tmp_a) {
+                        if (!ex) {
                             if (hr) {
                                 len = snprintf_clip (out, outlen, "%d:%02d:%02d", hr, mn, sc);
                             }
@@ -2150,7 +2380,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                                 len = snprintf_clip (out, outlen, "%d:%02d", mn, sc);
                             }
                         }
-                        else if (tmp_b) {
+                        else {
                             if (hr) {
                                 len = snprintf_clip (out, outlen, "%d:%02d:%02d.%03d", hr, mn, sc, ms);
                             }
@@ -2162,12 +2392,14 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         outlen -= len;
                         skip_out = 1;
                     }
+                    break;
                 }
-                else if ((tmp_a = !strcmp (name, "length_seconds") || (tmp_b = !strcmp (name, "length_seconds_fp")))) {
+                case TF_FIELD_LENGTH_SECONDS:
+                case TF_FIELD_LENGTH_SECONDS_FP: {
                     float t = pl_get_item_duration (it);
                     if (t >= 0) {
                         int len;
-                        if (tmp_a) {
+                        if (field == TF_FIELD_LENGTH_SECONDS) {
                             len = snprintf_clip (out, outlen, "%d", (int)roundf(t));
                         }
                         else {
@@ -2177,20 +2409,23 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         outlen -= len;
                         skip_out = 1;
                     }
+                    break;
                 }
-                else if (!strcmp (name, "length_samples")) {
+                case TF_FIELD_LENGTH_SAMPLES: {
                     int len = snprintf_clip (out, outlen, "%lld", pl_item_get_endsample ((playItem_t *)ctx->it) - pl_item_get_startsample ((playItem_t *)ctx->it));
                     out += len;
                     outlen -= len;
                     skip_out = 1;
+                    break;
                 }
-                else if ((tmp_a = !strcmp (name, "isplaying")) || (tmp_b = !strcmp (name, "ispaused"))) {
+                case TF_FIELD_ISPLAYING:
+                case TF_FIELD_ISPAUSED: {
                     playItem_t *playing = streamer_get_playing_track ();
-                    
-                    if (playing && 
+
+                    if (playing &&
                             (
-                            (tmp_a && plug_get_output ()->state () == OUTPUT_STATE_PLAYING)
-                            || (tmp_b && plug_get_output ()->state () == OUTPUT_STATE_PAUSED)
+                            (field == TF_FIELD_ISPLAYING && plug_get_output ()->state () == OUTPUT_STATE_PLAYING)
+                            || (field == TF_FIELD_ISPAUSED && plug_get_output ()->state () == OUTPUT_STATE_PAUSED)
                             )) {
                         *out++ = '1';
                         outlen--;
@@ -2199,8 +2434,9 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                     if (playing) {
                         pl_item_unref (playing);
                     }
+                    break;
                 }
-                else if (!strcmp (name, "filename")) {
+                case TF_FIELD_FILENAME: {
                     const char *v = pl_find_meta_raw (it, ":URI");
                     if (v) {
                         const char *start = strrchr (v, '/');
@@ -2216,8 +2452,9 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                             skip_out = 1;
                         }
                     }
+                    break;
                 }
-                else if (!strcmp (name, "filename_ext")) {
+                case TF_FIELD_FILENAME_EXT: {
                     const char *v = pl_find_meta_raw (it, ":URI");
                     if (v) {
                         const char *start = strrchr (v, '/');
@@ -2230,8 +2467,9 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         tf_append_out (&out, &outlen, start, (int)strlen (start));
                         skip_out = 1;
                     }
+                    break;
                 }
-                else if (!strcmp (name, "directoryname")) {
+                case TF_FIELD_DIRECTORYNAME: {
                     const char *v = pl_find_meta_raw (it, ":URI");
                     if (v) {
                         const char *end = strrchr (v, '/');
@@ -2247,39 +2485,21 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                             }
                         }
                     }
+                    break;
                 }
-                else if (!strcmp (name, "_path_raw")) {
+                case TF_FIELD_PATH_RAW:
                     val = pl_find_meta_raw (it, ":URI");
-                }
-                else if (!strcmp (name, "path")) {
+                    break;
+                case TF_FIELD_PATH:
                     val = pl_find_meta_raw (it, ":URI");
 
                     // strip file://
                     if (val && !strncmp (val, "file://", 7)) {
                         val += 7;
                     }
-#if 0
-                    // strip any URI scheme
-                    if (isalpha (*val)) {
-                        const char *slash = strchr (val, ':');
-                        if (slash && strlen (slash) > 3 && slash[1] == '/' && slash[2] == '/') {
-                            const char *p = val;
-                            while (p < slash) {
-                                if (!isalpha (*p) && !isdigit (*p) && !strchr ("+.-", *p)) {
-                                    p = NULL;
-                                    break;
-                                }
-                                p++;
-                            }
-                            if (p) {
-                                val = slash + 3;
-                            }
-                        }
-                    }
-#endif
-                }
+                    break;
                 // index of track in playlist (zero-padded)
-                else if (!strcmp (name, "list_index")) {
+                case TF_FIELD_LIST_INDEX:
                     if (it) {
                         int total_tracks = plt_get_item_count ((playlist_t *)ctx->plt, ctx->iter);
                         int digits = 0;
@@ -2300,19 +2520,15 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         outlen -= len;
                         skip_out = 1;
                     }
-                }
+                    break;
                 // total number of tracks in playlist
-                else if (!strcmp (name, "list_total")) {
+                case TF_FIELD_LIST_TOTAL: {
                     int total_tracks = -1;
                     if (ctx->plt) {
                         total_tracks = plt_get_item_count ((playlist_t *)ctx->plt, ctx->iter);
                     }
                     else {
-                        playlist_t *plt = plt_get_curr ();
-                        if (plt) {
-                            total_tracks = plt_get_item_count (plt, ctx->iter);
-                            plt_unref (plt);
-                        }
+                        total_tracks = pl_getcount (ctx->iter);
                     }
                     if (total_tracks >= 0) {
                         int len = snprintf_clip (out, outlen, "%d", total_tracks);
@@ -2320,9 +2536,10 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         outlen -= len;
                         skip_out = 1;
                     }
+                    break;
                 }
                 // index of track in queue
-                else if (!strcmp (name, "queue_index")) {
+                case TF_FIELD_QUEUE_INDEX:
                     if (it) {
                         int idx = playqueue_test (it) + 1;
                         if (idx >= 1) {
@@ -2332,9 +2549,9 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                             skip_out = 1;
                         }
                     }
-                }
+                    break;
                 // indexes of track in queue
-                else if (!strcmp (name, "queue_indexes")) {
+                case TF_FIELD_QUEUE_INDEXES:
                     if (it) {
                         int idx = playqueue_test (it) + 1;
                         if (idx >= 1) {
@@ -2356,9 +2573,9 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                             skip_out = 1;
                         }
                     }
-                }
+                    break;
                 // total amount of tracks in queue
-                else if (!strcmp (name, "queue_total")) {
+                case TF_FIELD_QUEUE_TOTAL: {
                     int count = playqueue_getcount ();
                     if (count >= 0) {
                         int len = snprintf_clip (out, outlen, "%d", count);
@@ -2366,14 +2583,15 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         outlen -= len;
                         skip_out = 1;
                     }
+                    break;
                 }
-                else if (!strcmp (name, "_deadbeef_version")) {
+                case TF_FIELD_DEADBEEF_VERSION:
                     val = VERSION;
-                }
-                else if (!strcmp (name, "_playlist_name")) {
+                    break;
+                case TF_FIELD_PLAYLIST_NAME:
                     val = ((playlist_t *)ctx->plt)->title;
-                }
-                else if (!strcmp (name, "selection_playback_time")) {
+                    break;
+                case TF_FIELD_SELECTION_PLAYBACK_TIME: {
                     float seltime = plt_get_selection_playback_time((playlist_t *)ctx->plt);
 
                     int len = format_playback_time (out, outlen, seltime);
@@ -2381,9 +2599,11 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                     out += len;
                     outlen -= len;
                     skip_out = 1;
+                    break;
                 }
-                else {
-                    val = _tf_get_combined_value (it, name, &needs_free);
+                default:
+                    val = _tf_get_combined_value_for_id (it, key_id, &needs_free);
+                    break;
                 }
 
                 if (val || (!val && out > init_out)) {
@@ -2396,7 +2616,12 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                     out += l;
                     outlen -= l;
                 }
-                pl_unlock ();
+                if (exclusive) {
+                    pl_unlock ();
+                }
+                else {
+                    pl_unlock_shared ();
+                }
                 if (!skip_out && !val && fail_on_undef) {
                     return -1;
                 }
@@ -2501,6 +2726,25 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                     outlen -= undimlen;
                 }
             }
+            else if (*code == 7) { // constant
+                code++;
+                size--;
+                int is_true = *code;
+                code++;
+                size--;
+                int32_t len;
+                memcpy (&len, code, 4);
+                code += 4;
+                size -= 4;
+                int32_t l = u8_strnbcpy (out, code, min (len, outlen));
+                out += l;
+                outlen -= l;
+                if (is_true) {
+                    *bool_out = 1;
+                }
+                code += len;
+                size -= len;
+            }
             else {
                 return -1;
             }
@@ -2518,10 +2762,62 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
 int
 tf_compile_plain (tf_compiler_t *c);
 
+// returns 1 if the code only consists of plain text and constants
+static int
+tf_is_constant (const char *code, int size) {
+    while (size > 0) {
+        if (*code) {
+            code++;
+            size--;
+            continue;
+        }
+        if (size < 7 || code[1] != 7) {
+            return 0;
+        }
+        int32_t len;
+        memcpy (&len, code + 3, 4);
+        code += 7 + len;
+        size -= 7 + len;
+    }
+    return 1;
+}
+
+// evaluate the function call which starts at `start`, and ends at the current output position,
+// and replace it with a constant, if the result is not bigger than the call
+static void
+tf_fold_constant (tf_compiler_t *c, char *start) {
+    int size = (int)(c->o - start);
+    char out[1000];
+    ddb_tf_context_t ctx;
+    memset (&ctx, 0, sizeof (ctx));
+    ctx._size = sizeof (ddb_tf_context_t);
+    ctx.flags = DDB_TF_CONTEXT_NO_DYNAMIC;
+    ctx.it = (ddb_playItem_t *)&empty_track;
+    ctx.plt = (ddb_playlist_t *)&empty_playlist;
+
+    int bool_out = 0;
+    int res = tf_eval_int (&ctx, start, size, out, sizeof (out) - 1, &bool_out, 0);
+    if (res < 0 || res >= (int)sizeof (out) - 1 || 7 + res > size) {
+        return;
+    }
+
+    char *o = start;
+    *o++ = 0;
+    *o++ = 7;
+    *o++ = bool_out ? 1 : 0;
+    int32_t len = res;
+    memcpy (o, &len, 4);
+    o += 4;
+    memcpy (o, out, res);
+    c->o = o + res;
+}
+
 int
 tf_compile_func (tf_compiler_t *c) {
     c->i++;
 
+    char *call_start = c->o;
+
     // function marker
     *(c->o++) = 0;
     *(c->o++) = 1;
@@ -2598,6 +2894,14 @@ tf_compile_func (tf_compiler_t *c) {
     }
     c->i++;
 
+    if (tf_funcs[i].is_pure) {
+        int argc = (uint8_t)*start;
+        const char *args = start + 1 + argc * sizeof (uint16_t);
+        if (tf_is_constant (args, (int)(c->o - args))) {
+            tf_fold_constant (c, call_start);
+        }
+    }
+
     return 0;
 }
 
@@ -2607,6 +2911,10 @@ tf_compile_field (tf_compiler_t *c) {
     *(c->o++) = 0;
     *(c->o++) = 2;
 
+    // field id and key id, filled in after the name is known
+    char *pfield = c->o;
+    c->o += 5;
+
     const char *fstart = c->i;
     char *plen = c->o;
     c->o += 1;
@@ -2632,6 +2940,20 @@ tf_compile_field (tf_compiler_t *c) {
     char field[len+1];
     memcpy (field, fstart, len);
     field[len] = 0;
+
+    uint8_t field_id = TF_FIELD_META;
+    for (int i = 1; i < TF_FIELD_COUNT; i++) {
+        if (!strcmp (field, tf_field_names[i])) {
+            field_id = i;
+            break;
+        }
+    }
+    *pfield = field_id;
+    if (tf_field_needs_exclusive_lock (field_id)) {
+        c->flags |= TF_CODE_FLAG_EXCLUSIVE_LOCK;
+    }
+    uint32_t key_id = pl_meta_key_id (field);
+    memcpy (pfield + 1, &key_id, 4);
     return 0;
 }
 
@@ -2810,6 +3132,27 @@ tf_compile_plain (tf_compiler_t *c) {
     return 0;
 }
 
+static void
+tf_resolve_keys (void) {
+    static const char *aa_fields[] = { "album artist", "albumartist", "band", "artist", "composer", "performer", NULL };
+    static const char *a_fields[] = { "artist", "album artist", "albumartist", "composer", "performer", NULL };
+    static const char *alb_fields[] = { "album", "venue", NULL };
+
+    pl_lock ();
+    if (!tf_aa_keys[0]) {
+        for (int i = 0; aa_fields[i]; i++) {
+            tf_aa_keys[i] = pl_meta_key_id (aa_fields[i]);
+        }
+        for (int i = 0; a_fields[i]; i++) {
+            tf_a_keys[i] = pl_meta_key_id (a_fields[i]);
+        }
+        for (int i = 0; alb_fields[i]; i++) {
+            tf_alb_keys[i] = pl_meta_key_id (alb_fields[i]);
+        }
+    }
+    pl_unlock ();
+}
+
 char *
 tf_compile (const char *script) {
     tf_compiler_t c;
@@ -2817,25 +3160,30 @@ tf_compile (const char *script) {
 
     c.i = script;
 
-    char code[strlen(script) * 3];
-    memset (code, 0, sizeof (code));
+    // the longest expansions are fields and dimming blocks, e.g. 5 chars of "<%a%>" produce 16 bytes
+    char *code = calloc (1, strlen (script) * 4 + 16);
 
     c.o = code;
 
     c.eol = 1;
 
+    tf_resolve_keys ();
+
     while (*(c.i)) {
         if (tf_compile_plain (&c)) {
             trace ("tf: compilation failed <%s>\n", c.i);
+            free (code);
             return NULL;
         }
     }
 
     size_t size = c.o - code;
-    char *out = malloc (size + 8);
+    char *out = malloc (size + 9);
     memcpy (out + 4, code, size);
     memset (out + 4 + size, 0, 4); // FIXME: this is the padding for possible buffer overflow bug fix
+    out[size + 8] = (char)c.flags;
     *((int32_t *)out) = (int32_t)(size);
+    free (code);
     return out;
 }
 
@@ -42,6 +42,18 @@ tf_free (char *code);
 int
 tf_eval (ddb_tf_context_t *ctx, const char *code, char *out, int outlen);
 
+// evaluate the titleformatting script for each of the tracks, holding the playlist lock once
+// ctx: same as in tf_eval, ctx->it is ignored; with DDB_TF_CONTEXT_HAS_INDEX, ctx->idx is the index of tracks[0],
+//      and is incremented for each following track
+// tracks: the tracks to evaluate the script for, null entries are treated the same way as in tf_eval
+// arena: buffer allocated by the caller, the output strings are written into it one after another
+// outlen: the max size of each output string, including the terminating zero
+// results: receives a pointer into the arena for each evaluated track
+// returns the number of evaluated tracks, which is less than count if the arena got full,
+// or -1 on fail
+int
+tf_eval_batch (ddb_tf_context_t *ctx, const char *code, ddb_playItem_t **tracks, int count, char *arena, size_t arena_size, int outlen, const char **results);
+
 // convert legacy title formatting to the new format, usable with tf_compile
 void
 tf_import_legacy (const char *fmt, char *out, int outsize);
@@ -68,11 +68,39 @@ cond_free (uintptr_t cond);
 int
 cond_wait (uintptr_t cond, uintptr_t mutex);
 
+// unlike cond_wait, expects the mutex to be locked (once) by the caller,
+// so that the predicate can be checked under the same lock; the mutex is locked on return
+int
+cond_wait_locked (uintptr_t cond, uintptr_t mutex);
+
 int
 cond_signal (uintptr_t cond);
 
 int
 cond_broadcast (uintptr_t cond);
 
+// non-recursive reader-writer lock, preferring writers
+uintptr_t
+rwlock_create (void);
+
+void
+rwlock_free (uintptr_t rwlock);
+
+int
+rwlock_rdlock (uintptr_t rwlock);
+
+int
+rwlock_wrlock (uintptr_t rwlock);
+
+// returns 0 on success, EBUSY if the lock is held
+int
+rwlock_tryrdlock (uintptr_t rwlock);
+
+int
+rwlock_trywrlock (uintptr_t rwlock);
+
+int
+rwlock_unlock (uintptr_t rwlock);
+
 #endif
 
@@ -222,6 +222,17 @@ cond_wait (uintptr_t c, uintptr_t m) {
     return err;
 }
 
+int
+cond_wait_locked (uintptr_t c, uintptr_t m) {
+    pthread_cond_t *cond = (pthread_cond_t *)c;
+    pthread_mutex_t *mutex = (pthread_mutex_t *)m;
+    int err = pthread_cond_wait (cond, mutex);
+    if (err != 0) {
+        fprintf (stderr, "pthread_cond_wait failed: %s\n", strerror (err));
+    }
+    return err;
+}
+
 int
 cond_signal (uintptr_t c) {
     pthread_cond_t *cond = (pthread_cond_t *)c;
@@ -241,3 +252,68 @@ cond_broadcast (uintptr_t c) {
     }
     return err;
 }
+
+uintptr_t
+rwlock_create (void) {
+    pthread_rwlock_t *rwlock = malloc (sizeof (pthread_rwlock_t));
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init (&attr);
+#if defined(__GLIBC__)
+    // glibc prefers readers by default, which lets a steady stream of readers starve the writers
+    pthread_rwlockattr_setkind_np (&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    int err = pthread_rwlock_init (rwlock, &attr);
+    pthread_rwlockattr_destroy (&attr);
+    if (err != 0) {
+        fprintf (stderr, "pthread_rwlock_init failed: %s\n", strerror (err));
+        free (rwlock);
+        return 0;
+    }
+    return (uintptr_t)rwlock;
+}
+
+void
+rwlock_free (uintptr_t l) {
+    if (l) {
+        pthread_rwlock_t *rwlock = (pthread_rwlock_t *)l;
+        pthread_rwlock_destroy (rwlock);
+        free (rwlock);
+    }
+}
+
+int
+rwlock_rdlock (uintptr_t l) {
+    int err = pthread_rwlock_rdlock ((pthread_rwlock_t *)l);
+    if (err != 0) {
+        fprintf (stderr, "pthread_rwlock_rdlock failed: %s\n", strerror (err));
+    }
+    return err;
+}
+
+int
+rwlock_wrlock (uintptr_t l) {
+    int err = pthread_rwlock_wrlock ((pthread_rwlock_t *)l);
+    if (err != 0) {
+        fprintf (stderr, "pthread_rwlock_wrlock failed: %s\n", strerror (err));
+    }
+    return err;
+}
+
+int
+rwlock_tryrdlock (uintptr_t l) {
+    return pthread_rwlock_tryrdlock ((pthread_rwlock_t *)l);
+}
+
+int
+rwlock_trywrlock (uintptr_t l) {
+    return pthread_rwlock_trywrlock ((pthread_rwlock_t *)l);
+}
+
+int
+rwlock_unlock (uintptr_t l) {
+    int err = pthread_rwlock_unlock ((pthread_rwlock_t *)l);
+    if (err != 0) {
+        fprintf (stderr, "pthread_rwlock_unlock failed: %s\n", strerror (err));
+    }
+    return err;
+}
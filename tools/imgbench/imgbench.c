@@ -0,0 +1,188 @@
+/*
+  This file is part of Deadbeef Player source code
+  http://deadbeef.sourceforge.net
+
+  artwork scaling micro-benchmark
+
+  Copyright (C) 2009-2018 Alexey Yakovenko
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+
+  Alexey Yakovenko waker@users.sourceforge.net
+*/
+
+// Measures decoding and scaling a jpeg cover to the thumbnail sizes, in ms per image:
+// full decode with the scalar resampler, full decode with the SIMD resampler,
+// and DCT-domain prescaling in the decoder followed by the SIMD resampler.
+//   make imgbench && ./imgbench [cover_size] [number_of_passes]
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <jpeglib.h>
+#include "../../shared/imgresample.h"
+
+static const int thumbnail_sizes[] = { 32, 64, 128, 256 };
+
+static double
+now (void) {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// a photo-like cover: smooth gradients with some detail and noise
+static FILE *
+make_cover (int size) {
+    FILE *fp = tmpfile ();
+    if (!fp) {
+        return NULL;
+    }
+
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error (&jerr);
+    jpeg_create_compress (&cinfo);
+    jpeg_stdio_dest (&cinfo, fp);
+    cinfo.image_width = size;
+    cinfo.image_height = size;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults (&cinfo);
+    jpeg_set_quality (&cinfo, 90, TRUE);
+    jpeg_start_compress (&cinfo, TRUE);
+
+    JSAMPLE *row = malloc (size * 3);
+    srand (1);
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            int stripe = ((x / 24) ^ (y / 24)) & 1 ? 40 : 0;
+            row[x*3+0] = (x * 255 / size + stripe + rand () % 16) & 255;
+            row[x*3+1] = (y * 255 / size + rand () % 16) & 255;
+            row[x*3+2] = ((x + y) * 127 / size + stripe + rand () % 16) & 255;
+        }
+        jpeg_write_scanlines (&cinfo, &row, 1);
+    }
+    free (row);
+
+    jpeg_finish_compress (&cinfo);
+    jpeg_destroy_compress (&cinfo);
+    return fp;
+}
+
+static unsigned int
+prescale_denom (unsigned int size, unsigned int scaled_size) {
+    unsigned int denom = 8;
+    while (denom > 1 && (size + denom - 1) / denom < scaled_size) {
+        denom /= 2;
+    }
+    return denom;
+}
+
+// returns a checksum of the scaled image, so that the work can't be skipped
+static unsigned int
+scale_cover (FILE *fp, int scaled_size, int simd, int prescale) {
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error (&jerr);
+    jpeg_create_decompress (&cinfo);
+    rewind (fp);
+    jpeg_stdio_src (&cinfo, fp);
+    jpeg_read_header (&cinfo, TRUE);
+    if (prescale) {
+        cinfo.scale_num = 1;
+        cinfo.scale_denom = prescale_denom (cinfo.image_width, scaled_size);
+    }
+    jpeg_start_decompress (&cinfo);
+
+    img_resample_simd_set (simd);
+    img_resampler_t *r = img_resampler_new (cinfo.output_width, cinfo.output_height, scaled_size, scaled_size, cinfo.output_components, 0);
+    JSAMPLE *row = malloc (cinfo.output_width * cinfo.output_components);
+    unsigned int sum = 0;
+    while (cinfo.output_scanline < cinfo.output_height) {
+        jpeg_read_scanlines (&cinfo, &row, 1);
+        img_resampler_push_row (r, row);
+        const uint8_t *out;
+        while ((out = img_resampler_pull_row (r))) {
+            sum += out[0] + out[scaled_size * cinfo.output_components - 1];
+        }
+    }
+    free (row);
+    img_resampler_free (r);
+
+    jpeg_finish_decompress (&cinfo);
+    jpeg_destroy_decompress (&cinfo);
+    return sum;
+}
+
+int
+main (int argc, char *argv[]) {
+    int cover_size = argc > 1 ? atoi (argv[1]) : 1500;
+    int passes = argc > 2 ? atoi (argv[2]) : 10;
+    if (cover_size < 256 || passes <= 0) {
+        fprintf (stderr, "usage: imgbench [cover_size] [number_of_passes]\n");
+        return 1;
+    }
+
+    FILE *fp = make_cover (cover_size);
+    if (!fp) {
+        fprintf (stderr, "failed to create the test image\n");
+        return 1;
+    }
+
+    const int simd = img_resample_simd_detect ();
+    printf ("%dx%d jpeg cover, %s kernels\n", cover_size, cover_size, img_resample_simd_name (simd));
+    printf ("%-6s %12s %12s %12s   (ms/image)\n", "size", "full+scalar", "full+simd", "dct+simd");
+
+    unsigned int checksum = 0;
+    for (int s = 0; s < sizeof (thumbnail_sizes) / sizeof (thumbnail_sizes[0]); s++) {
+        const int size = thumbnail_sizes[s];
+        const struct {
+            int simd;
+            int prescale;
+        } paths[] = {
+            { IMG_RESAMPLE_SIMD_NONE, 0 },
+            { simd, 0 },
+            { simd, 1 },
+        };
+
+        printf ("%-6d", size);
+        for (int p = 0; p < sizeof (paths) / sizeof (paths[0]); p++) {
+            // best of 5 runs
+            double best = 0;
+            for (int run = 0; run < 5; run++) {
+                double t = now ();
+                for (int i = 0; i < passes; i++) {
+                    checksum += scale_cover (fp, size, paths[p].simd, paths[p].prescale);
+                }
+                t = now () - t;
+                if (!run || t < best) {
+                    best = t;
+                }
+            }
+            printf (" %12.2f", best * 1000 / passes);
+        }
+        printf ("\n");
+    }
+
+    fclose (fp);
+    return checksum == 0xdeadbeef;
+}
@@ -0,0 +1,168 @@
+/*
+  This file is part of Deadbeef Player source code
+  http://deadbeef.sourceforge.net
+
+  pcm_convert micro-benchmark
+
+  Copyright (C) 2009-2018 Alexey Yakovenko
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+
+  Alexey Yakovenko waker@users.sourceforge.net
+*/
+
+// Measures pcm_convert throughput for the common sample format conversions,
+// with each kernel set supported by the CPU, in ns per frame.
+//   make pcmbench && ./pcmbench [number_of_frames] [number_of_passes]
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../../deadbeef.h"
+#include "../../premix.h"
+
+typedef struct {
+    int bps;
+    int is_float;
+} sampleformat_t;
+
+static const struct {
+    sampleformat_t in;
+    sampleformat_t out;
+} conversions[] = {
+    { { 16, 0 }, { 32, 1 } },
+    { { 32, 1 }, { 16, 0 } },
+    { { 24, 0 }, { 32, 1 } },
+    { { 32, 1 }, { 24, 0 } },
+    { { 32, 0 }, { 32, 1 } },
+    { { 32, 1 }, { 32, 0 } },
+    { { 16, 0 }, { 32, 0 } },
+    { { 32, 0 }, { 16, 0 } },
+    { { 24, 0 }, { 16, 0 } },
+};
+
+static const struct {
+    const char *name;
+    int channels;
+    uint32_t channelmask;
+} layouts[] = {
+    { "stereo", 2, DDB_SPEAKER_FRONT_LEFT | DDB_SPEAKER_FRONT_RIGHT },
+    { "5.1", 6, DDB_SPEAKER_FRONT_LEFT | DDB_SPEAKER_FRONT_RIGHT | DDB_SPEAKER_FRONT_CENTER | DDB_SPEAKER_LOW_FREQUENCY | DDB_SPEAKER_BACK_LEFT | DDB_SPEAKER_BACK_RIGHT },
+};
+
+static double
+now (void) {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char *
+format_name (sampleformat_t f) {
+    switch (f.bps) {
+    case 16:
+        return "s16";
+    case 24:
+        return "s24";
+    default:
+        return f.is_float ? "f32" : "s32";
+    }
+}
+
+int
+main (int argc, char *argv[]) {
+    int frames = argc > 1 ? atoi (argv[1]) : 4096;
+    int passes = argc > 2 ? atoi (argv[2]) : 2000;
+    if (frames <= 0 || passes <= 0) {
+        fprintf (stderr, "usage: pcmbench [number_of_frames] [number_of_passes]\n");
+        return 1;
+    }
+
+    size_t bufsize = (size_t)frames * 6 * 4;
+    char *input = malloc (bufsize);
+    char *output = malloc (bufsize);
+
+    int kernels[] = { PCM_SIMD_NONE, PCM_SIMD_SSE2, PCM_SIMD_AVX2, PCM_SIMD_NEON };
+    int nkernels = sizeof (kernels) / sizeof (kernels[0]);
+
+    printf ("%-8s %-12s", "layout", "conversion");
+    for (int k = 0; k < nkernels; k++) {
+        if (pcm_simd_name (kernels[k]) && !pcm_simd_set (kernels[k])) {
+            printf (" %8s", pcm_simd_name (kernels[k]));
+        }
+    }
+    printf ("   (ns/frame)\n");
+
+    for (int l = 0; l < sizeof (layouts) / sizeof (layouts[0]); l++) {
+        for (int c = 0; c < sizeof (conversions) / sizeof (conversions[0]); c++) {
+            ddb_waveformat_t infmt = {
+                .bps = conversions[c].in.bps,
+                .is_float = conversions[c].in.is_float,
+                .channels = layouts[l].channels,
+                .channelmask = layouts[l].channelmask,
+                .samplerate = 44100,
+            };
+            ddb_waveformat_t outfmt = infmt;
+            outfmt.bps = conversions[c].out.bps;
+            outfmt.is_float = conversions[c].out.is_float;
+
+            int insize = frames * infmt.channels * infmt.bps / 8;
+            if (infmt.is_float) {
+                float *f = (float *)input;
+                for (int i = 0; i < insize / 4; i++) {
+                    f[i] = (rand () / (float)RAND_MAX) * 2.f - 1.f;
+                }
+            }
+            else {
+                for (int i = 0; i < insize; i++) {
+                    input[i] = rand ();
+                }
+            }
+
+            char name[20];
+            snprintf (name, sizeof (name), "%s->%s", format_name (conversions[c].in), format_name (conversions[c].out));
+            printf ("%-8s %-12s", layouts[l].name, name);
+
+            for (int k = 0; k < nkernels; k++) {
+                if (!pcm_simd_name (kernels[k]) || pcm_simd_set (kernels[k])) {
+                    continue;
+                }
+                double best = 0;
+                for (int r = 0; r < 5; r++) {
+                    double start = now ();
+                    for (int p = 0; p < passes; p++) {
+                        pcm_convert (&infmt, input, &outfmt, output, insize);
+                    }
+                    double t = now () - start;
+                    if (r == 0 || t < best) {
+                        best = t;
+                    }
+                }
+                printf (" %8.2f", best * 1e9 / passes / frames);
+            }
+            printf ("\n");
+        }
+    }
+
+    free (input);
+    free (output);
+    return 0;
+}
@@ -0,0 +1,157 @@
+/*
+  This file is part of Deadbeef Player source code
+  http://deadbeef.sourceforge.net
+
+  title formatting micro-benchmark
+
+  Copyright (C) 2009-2018 Alexey Yakovenko
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+
+  Alexey Yakovenko waker@users.sourceforge.net
+*/
+
+// Measures the time it takes to evaluate typical title formatting scripts
+// against a synthetic playlist, in ns per track.
+// Built from the core sources, with the player's main() renamed:
+//   make tfbench && ./tfbench [number_of_tracks] [number_of_passes]
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../../playlist.h"
+#include "../../conf.h"
+#include "../../messagepump.h"
+#include "../../tf.h"
+
+#undef main
+
+static const char *corpus[] = {
+    "%artist% - %title%",
+    "%tracknumber%",
+    "%album artist% - %album%",
+    "%length%",
+    "%codec% %bitrate%kbps %samplerate%Hz",
+    "%directoryname%/%filename_ext%",
+    "$if2(%title%,%filename%)",
+    "$if(%album artist%,%album artist%,%artist%)",
+    "$upper($left(%artist%,1))",
+    "$select(%tracknumber%,one,two,three,four,five)",
+    "%artist% - $if(%album%,['['%year%']' ]%album% - )[%discnumber%.]%tracknumber%. %title%",
+    "[%album artist% - ]['['%year%']' ]%album%",
+    "$pad(%tracknumber%,3) $repeat(-,3)$char(9)%title%",
+    "$if($strcmp(%genre%,Rock),rock,other) $num(%track number%,3)",
+    NULL
+};
+
+static double
+now (void) {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static playlist_t *
+make_playlist (int count) {
+    static const char *genres[] = { "Rock", "Jazz", "Electronic", "Classical" };
+    playlist_t *plt = plt_alloc ("tfbench");
+    for (int i = 0; i < count; i++) {
+        char s[200];
+        playItem_t *it = pl_item_alloc ();
+        snprintf (s, sizeof (s), "/home/user/Music/Artist %d/Album %d/%02d Track %d.flac", i / 100, i / 10, i % 10 + 1, i);
+        pl_add_meta (it, ":URI", s);
+        pl_add_meta (it, ":DECODER", "stdflac");
+        pl_add_meta (it, ":FILETYPE", "FLAC");
+        pl_add_meta (it, ":BITRATE", "1024");
+        pl_add_meta (it, ":SAMPLERATE", "44100");
+        snprintf (s, sizeof (s), "Artist %d", i / 100);
+        pl_add_meta (it, "artist", s);
+        if (i % 3) {
+            pl_add_meta (it, "album artist", s);
+        }
+        snprintf (s, sizeof (s), "Album %d", i / 10);
+        pl_add_meta (it, "album", s);
+        snprintf (s, sizeof (s), "Track title number %d", i);
+        pl_add_meta (it, "title", s);
+        snprintf (s, sizeof (s), "%d", i % 10 + 1);
+        pl_add_meta (it, "track", s);
+        snprintf (s, sizeof (s), "%d", 1970 + i % 50);
+        pl_add_meta (it, "year", s);
+        pl_add_meta (it, "genre", genres[i % 4]);
+        plt_insert_item (plt, plt->tail[PL_MAIN], it);
+        plt_set_item_duration (plt, it, 180 + i % 300);
+        pl_item_unref (it);
+    }
+    return plt;
+}
+
+int
+main (int argc, char *argv[]) {
+    int count = argc > 1 ? atoi (argv[1]) : 10000;
+    int passes = argc > 2 ? atoi (argv[2]) : 10;
+    if (count <= 0 || passes <= 0) {
+        fprintf (stderr, "usage: tfbench [number_of_tracks] [number_of_passes]\n");
+        return 1;
+    }
+
+    pl_init ();
+    conf_init ();
+    messagepump_init ();
+
+    playlist_t *plt = make_playlist (count);
+
+    double total = 0;
+    for (int f = 0; corpus[f]; f++) {
+        char *code = tf_compile (corpus[f]);
+        if (!code) {
+            fprintf (stderr, "failed to compile %s\n", corpus[f]);
+            continue;
+        }
+        ddb_tf_context_t ctx = {
+            ._size = sizeof (ddb_tf_context_t),
+            .flags = DDB_TF_CONTEXT_NO_DYNAMIC,
+            .plt = (ddb_playlist_t *)plt,
+            .iter = PL_MAIN,
+        };
+        char buf[1024];
+        double best = 0;
+        for (int p = 0; p < passes; p++) {
+            double start = now ();
+            for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
+                ctx.it = (ddb_playItem_t *)it;
+                tf_eval (&ctx, code, buf, sizeof (buf));
+            }
+            double t = now () - start;
+            if (p == 0 || t < best) {
+                best = t;
+            }
+        }
+        tf_free (code);
+        double ns = best * 1e9 / count;
+        total += ns;
+        printf ("%8.1f ns/track  %s\n", ns, corpus[f]);
+    }
+    printf ("%8.1f ns/track  total\n", total);
+
+    plt_clear (plt);
+    plt_free (plt);
+    return 0;
+}